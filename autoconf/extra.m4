@@ -242,7 +242,7 @@ dnl	])
 	AC_CHECK_FUNCS([gethostbyname inet_ntoa mkdir]) 
 	AC_HEADER_STDC    
 	AC_HEADER_STDBOOL 
-	AC_CHECK_HEADERS([netinet/in.h fcntl.h sys/signal.h stdio.h errno.h ctype.h assert.h sys/sysinfo.h])
+	AC_CHECK_HEADERS([netinet/in.h fcntl.h sys/signal.h stdio.h errno.h ctype.h assert.h sys/sysinfo.h sys/epoll.h])
 	AC_STRUCT_TM
 	AC_STRUCT_TIMEZONE
 ])
@@ -366,6 +366,18 @@ AC_DEFUN([AST_SET_PBX_AMCONDITIONALS],[
 	AC_SUBST([PBXVER_COND_LIBADD])
 	AC_SUBST([PBXVER_COND_ANNOUNCE_SUBDIR])
 	AC_SUBST([PBXVER_COND_ANNOUNCE_LIBADD])
+	PBX_COND_MOCK_SUBDIR=
+	if test "_${ac_cv_enable_mock_pbx}" == "_yes"; then
+		if test "$PBX_TYPE" == "Asterisk" && test ${ASTERISK_VER_GROUP} -gt 111; then
+			PBX_COND_MOCK_SUBDIR=pbx_impl/mock
+		else
+			AC_MSG_WARN([--enable-mock-pbx needs the asterisk-12+ (stasis) headers, mock pbx backend disabled])
+			ac_cv_enable_mock_pbx=no
+		fi
+	fi
+	AC_SUBST([PBX_COND_MOCK_SUBDIR])
+	AM_CONDITIONAL([BUILD_MOCK_PBX], [test "_${ac_cv_enable_mock_pbx}" == "_yes"])
+	AM_COND_IF([BUILD_MOCK_PBX],[AC_CONFIG_FILES([src/pbx_impl/mock/Makefile])])
 	AM_CONDITIONAL([ASTERISK_VER_GROUP_106], [test x${ASTTERISK_VER_GROUP} = x106])
 	AM_CONDITIONAL([ASTERISK_VER_GROUP_108], [test x${ASTTERISK_VER_GROUP} = x108])
 	AM_CONDITIONAL([ASTERISK_VER_GROUP_110], [test x${ASTTERISK_VER_GROUP} = x110])
@@ -982,6 +994,15 @@ AC_DEFUN([CS_ENABLE_DISTRIBUTED_DEVSTATE], [
 	AC_MSG_RESULT([--enable-distributed-devicestate: ${ac_cv_use_distributed_devicestate}])
 ])
 
+AC_DEFUN([CS_ENABLE_MOCK_PBX], [
+	AC_ARG_ENABLE(mock_pbx, 
+		[AC_HELP_STRING([--enable-mock-pbx], [build the in-memory mock pbx backend and the sccp_mock_bench runner (developer only)])], 
+		[ac_cv_enable_mock_pbx=$enableval], 
+		[ac_cv_enable_mock_pbx=no]
+	)
+	AC_MSG_RESULT([--enable-mock-pbx: ${ac_cv_enable_mock_pbx}])
+])
+
 AC_DEFUN([CS_WITH_HASH_SIZE], [
 	AC_ARG_WITH(hash_size, 
 		[AC_HELP_STRING([--with-hash-size], [to provide room for higher number of phones (>100), specify a prime number, bigger then number of phones times 4 (default=536)])], 
@@ -1024,6 +1045,7 @@ AC_DEFUN([CS_PARSE_WITH_AND_ENABLE], [
 	CS_ENABLE_VIDEO
 	CS_ENABLE_DISTRIBUTED_DEVSTATE
 	CS_ENABLE_EXPERIMENTAL_MODE
+	CS_ENABLE_MOCK_PBX
 	AC_MSG_RESULT([--enable-experimental-xml: ${ac_cv_experimental_xml}])
 	CS_WITH_HASH_SIZE
 ])
@@ -22,8 +22,10 @@
 #include "sccp_device.h"
 #include "sccp_globals.h"
 #include "sccp_line.h"
+#include "sccp_msgstats.h"
 #include "sccp_mwi.h"		// use __constructor__ to remove this entry
 #include "sccp_netsock.h"
+#include "sccp_packet.h"
 #include "sccp_session.h"	// use __constructor__ to remove this entry
 #include "sccp_utils.h"
 #include "sccp_hint.h"		// use __constructor__ to remove this entry
@@ -105,10 +107,17 @@ boolean_t sccp_prePBXLoad(void)
 
 	/* init refcount */
 	sccp_refcount_init();
+	sccp_packet_pool_init();
+	sccp_trace_init();
+	sccp_msgstats_init();
 
 	SCCP_RWLIST_HEAD_INIT(&GLOB(sessions));
 	SCCP_RWLIST_HEAD_INIT(&GLOB(devices));
 	SCCP_RWLIST_HEAD_INIT(&GLOB(lines));
+	GLOB(session_index) = sccp_hashtable_create(SCCP_HASHTABLE_KEY_POINTER, 0);
+	GLOB(device_index) = sccp_hashtable_create(SCCP_HASHTABLE_KEY_STRING_NOCASE, 0);
+	GLOB(line_index) = sccp_hashtable_create(SCCP_HASHTABLE_KEY_STRING_NOCASE, 0);
+	sccp_channel_index_init();
 
 	GLOB(general_threadpool) = sccp_threadpool_init(THREADPOOL_MIN_SIZE);
 
@@ -244,6 +253,7 @@ int sccp_preUnload(void)
 	}
 	SCCP_RWLIST_TRAVERSE_SAFE_END;
 	if (SCCP_RWLIST_EMPTY(&GLOB(devices))) {
+		sccp_hashtable_destroy(&GLOB(device_index));
 		SCCP_RWLIST_HEAD_DESTROY(&GLOB(devices));
 	}
 
@@ -267,6 +277,8 @@ int sccp_preUnload(void)
 	}
 	SCCP_RWLIST_TRAVERSE_SAFE_END;
 	if (SCCP_RWLIST_EMPTY(&GLOB(lines))) {
+		sccp_hashtable_destroy(&GLOB(line_index));
+		sccp_channel_index_destroy();
 		SCCP_RWLIST_HEAD_DESTROY(&GLOB(lines));
 	}
 	usleep(100);												// wait for events to finalize
@@ -281,10 +293,14 @@ int sccp_preUnload(void)
 	sccp_conference_module_stop();
 #endif
 	sccp_softkey_clear();
+	sccp_config_resetReloadChecksums();
 	sccp_hint_module_stop();
 	sccp_event_module_stop();
 	sccp_threadpool_destroy(GLOB(general_threadpool));
 	sccp_refcount_destroy();
+	sccp_packet_pool_destroy();
+	sccp_trace_destroy();
+	sccp_msgstats_destroy();
 
 	/* free resources */
 	if (GLOB(config_file_name)) {
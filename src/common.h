@@ -44,9 +44,11 @@
 #include "forward_declarations.h"
 #include "sccp_enum.h"
 #include "sccp_dllists.h"
+#include "sccp_hashtable.h"
 #include "sccp_threadpool.h"
 #include "sccp_debug.h"
 #include "sccp_globals.h"
+#include "sccp_trace.h"
 #include "sccp_rtp.h"
 #include "sccp_refcount.h"
 #include "sccp_event.h"
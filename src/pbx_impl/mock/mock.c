@@ -0,0 +1,1139 @@
+/*!
+ * \file        mock.c
+ * \brief       SCCP PBX Mock Backend
+ * \note        In-memory implementation of the PbxInterface (iPbx). Channels are plain records (never handed to asterisk),
+ *              the scheduler runs against a virtual clock (see sccp_mock_sched_advance) and the astdb is a hash index next
+ *              to a list. The devicestate / mwi bus lives in mock_runtime.c.
+ * \note        This program is free software and may be modified and distributed under the terms of the GNU Public License.
+ *              See the LICENSE file at the top of the source tree.
+ */
+#include "config.h"
+#include "common.h"
+#include "sccp_channel.h"
+#include "sccp_line.h"
+#include "sccp_utils.h"
+#include "sccp_hashtable.h"
+#include "pbx_impl/mock/mock.h"
+
+SCCP_FILE_VERSION(__FILE__, "");
+
+#define MOCK_SCHED_INITIAL_SIZE 256
+#define MOCK_MAX_LANGUAGE 40
+
+/* ========================================================================================================= channels */
+/*!
+ * \brief Mock PBX Channel
+ * \note Handed to libsccp as (PBX_CHANNEL_TYPE *). Only the mock iPbx callbacks look inside.
+ */
+typedef struct sccp_mock_channel {
+	SCCP_LIST_ENTRY (struct sccp_mock_channel) list;
+	sccp_channel_t *channel;										/*!< weak back reference to the sccp channel */
+	enum ast_channel_state state;
+	boolean_t hangup;
+	char name[StationMaxNameSize + 16];
+	char uniqueid[32];
+	char linkedid[32];
+	char exten[SCCP_MAX_EXTENSION];
+	char context[SCCP_MAX_CONTEXT];
+	char macroexten[SCCP_MAX_EXTENSION];
+	char macrocontext[SCCP_MAX_CONTEXT];
+	char call_forward[SCCP_MAX_EXTENSION];
+	char language[MOCK_MAX_LANGUAGE];
+	char cid_name[StationMaxNameSize];
+	char cid_number[StationMaxDirnumSize];
+	char cid_ani[StationMaxDirnumSize];
+	char cid_dnid[StationMaxDirnumSize];
+	char cid_rdnis[StationMaxDirnumSize];
+	int cid_presentation;
+} sccp_mock_channel_t;
+
+static SCCP_LIST_HEAD (, sccp_mock_channel_t) mock_channels;
+static uint32_t mock_channels_allocated = 0;
+static uint64_t mock_callstates = 0;
+static uint64_t mock_controls = 0;
+
+#define MOCK_CHANNEL(_x) ((sccp_mock_channel_t *) (_x))
+#define MOCK_OWNER(_c) ((_c) ? MOCK_CHANNEL((_c)->owner) : NULL)
+
+static boolean_t sccp_mock_allocPBXChannel(sccp_channel_t * channel, const void *ids, const PBX_CHANNEL_TYPE * pbxSrcChannel, PBX_CHANNEL_TYPE ** pbxDstChannel)
+{
+	sccp_mock_channel_t *mc = NULL;
+
+	if (!channel || !channel->line || !pbxDstChannel) {
+		return FALSE;
+	}
+	if (!(mc = sccp_calloc(sizeof *mc, 1))) {
+		pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
+		return FALSE;
+	}
+	mc->channel = channel;
+	mc->state = AST_STATE_DOWN;
+	mc->cid_presentation = CALLERID_PRESENTATION_ALLOWED;
+	snprintf(mc->name, sizeof(mc->name), "SCCP/%s-%08x", channel->line->name, channel->callid);
+	sccp_copy_string(mc->context, channel->line->context ? channel->line->context : "default", sizeof(mc->context));
+	sccp_copy_string(mc->language, channel->line->language ? channel->line->language : "", sizeof(mc->language));
+
+	SCCP_LIST_LOCK(&mock_channels);
+	snprintf(mc->uniqueid, sizeof(mc->uniqueid), "mock-%u", ++mock_channels_allocated);
+	sccp_copy_string(mc->linkedid, (pbxSrcChannel ? MOCK_CHANNEL(pbxSrcChannel)->linkedid : mc->uniqueid), sizeof(mc->linkedid));
+	SCCP_LIST_INSERT_TAIL(&mock_channels, mc, list);
+	SCCP_LIST_UNLOCK(&mock_channels);
+
+	*pbxDstChannel = (PBX_CHANNEL_TYPE *) mc;
+	return TRUE;
+}
+
+static int sccp_mock_hangup(PBX_CHANNEL_TYPE * pbx_channel)
+{
+	sccp_mock_channel_t *mc = MOCK_CHANNEL(pbx_channel);
+
+	if (!mc) {
+		return -1;
+	}
+	SCCP_LIST_LOCK(&mock_channels);
+	mc = SCCP_LIST_REMOVE(&mock_channels, mc, list);
+	SCCP_LIST_UNLOCK(&mock_channels);
+	if (!mc) {
+		return -1;
+	}
+	if (mc->channel && mc->channel->owner == pbx_channel) {
+		mc->channel->owner = NULL;
+	}
+	sccp_free(mc);
+	return 0;
+}
+
+static void sccp_mock_setOwner(sccp_channel_t * channel, PBX_CHANNEL_TYPE * pbx_channel)
+{
+	channel->owner = pbx_channel;
+	if (pbx_channel) {
+		MOCK_CHANNEL(pbx_channel)->channel = channel;
+	}
+}
+
+static boolean_t sccp_mock_checkHangup(constChannelPtr channel)
+{
+	sccp_mock_channel_t *mc = MOCK_OWNER(channel);
+
+	return (!mc || mc->hangup) ? TRUE : FALSE;
+}
+
+static int sccp_mock_setCallState(constChannelPtr channel, int state)
+{
+	sccp_mock_channel_t *mc = MOCK_OWNER(channel);
+
+	mock_callstates++;
+	if (mc) {
+		mc->state = (enum ast_channel_state) state;
+	}
+	return 0;
+}
+
+static int sccp_mock_queue_control(const PBX_CHANNEL_TYPE * pbx_channel, enum ast_control_frame_type control)
+{
+	mock_controls++;
+	if (pbx_channel && control == AST_CONTROL_HANGUP) {
+		MOCK_CHANNEL(pbx_channel)->hangup = TRUE;
+	}
+	return 0;
+}
+
+static int sccp_mock_queue_control_data(const PBX_CHANNEL_TYPE * pbx_channel, enum ast_control_frame_type control, const void *data, size_t datalen)
+{
+	return sccp_mock_queue_control(pbx_channel, control);
+}
+
+#define MOCK_CHANNEL_STRING(_field, _get, _set)									\
+static const char *sccp_mock_get_channel_##_get(constChannelPtr channel)					\
+{														\
+	sccp_mock_channel_t *mc = MOCK_OWNER(channel);								\
+	return mc ? mc->_field : "";										\
+}														\
+static void sccp_mock_set_channel_##_set(const sccp_channel_t *channel, const char *value)			\
+{														\
+	sccp_mock_channel_t *mc = MOCK_OWNER(channel);								\
+	if (mc) {												\
+		sccp_copy_string(mc->_field, value ? value : "", sizeof(mc->_field));				\
+	}													\
+}
+MOCK_CHANNEL_STRING(name, name, name)
+MOCK_CHANNEL_STRING(exten, exten, exten)
+MOCK_CHANNEL_STRING(context, context, context)
+MOCK_CHANNEL_STRING(macroexten, macroexten, macroexten)
+MOCK_CHANNEL_STRING(macrocontext, macrocontext, macrocontext)
+MOCK_CHANNEL_STRING(call_forward, call_forward, call_forward)
+MOCK_CHANNEL_STRING(linkedid, linkedid, linkedid)
+#undef MOCK_CHANNEL_STRING
+
+static const char *sccp_mock_get_channel_uniqueid(const sccp_channel_t * channel)
+{
+	sccp_mock_channel_t *mc = MOCK_OWNER(channel);
+
+	return mc ? mc->uniqueid : "";
+}
+
+static const char *sccp_mock_get_channel_appl(const sccp_channel_t * channel)
+{
+	return "";
+}
+
+static enum ast_channel_state sccp_mock_get_channel_state(const sccp_channel_t * channel)
+{
+	sccp_mock_channel_t *mc = MOCK_OWNER(channel);
+
+	return mc ? mc->state : AST_STATE_DOWN;
+}
+
+static const struct ast_pbx *sccp_mock_get_channel_pbx(const sccp_channel_t * channel)
+{
+	return NULL;												/* no dialplan is ever started */
+}
+
+static void sccp_mock_set_pbxchannel_linkedid(PBX_CHANNEL_TYPE * pbx_channel, const char *linkedid)
+{
+	if (pbx_channel && linkedid) {
+		sccp_copy_string(MOCK_CHANNEL(pbx_channel)->linkedid, linkedid, sizeof(MOCK_CHANNEL(pbx_channel)->linkedid));
+	}
+}
+
+static boolean_t sccp_mock_getChannelByName(const char *name, PBX_CHANNEL_TYPE ** pbx_channel)
+{
+	sccp_mock_channel_t *mc = NULL;
+
+	if (sccp_strlen_zero(name)) {
+		return FALSE;
+	}
+	SCCP_LIST_LOCK(&mock_channels);
+	SCCP_LIST_TRAVERSE(&mock_channels, mc, list) {
+		if (sccp_strcaseequals(mc->name, name)) {
+			break;
+		}
+	}
+	SCCP_LIST_UNLOCK(&mock_channels);
+	*pbx_channel = (PBX_CHANNEL_TYPE *) mc;
+	return mc ? TRUE : FALSE;
+}
+
+static PBX_CHANNEL_TYPE *sccp_mock_findChannelWithCallback(int (*const found_cb) (PBX_CHANNEL_TYPE * c, void *data), void *data, boolean_t lock)
+{
+	sccp_mock_channel_t *mc = NULL;
+
+	SCCP_LIST_LOCK(&mock_channels);
+	SCCP_LIST_TRAVERSE(&mock_channels, mc, list) {
+		if (found_cb((PBX_CHANNEL_TYPE *) mc, data)) {
+			break;
+		}
+	}
+	SCCP_LIST_UNLOCK(&mock_channels);
+	return (PBX_CHANNEL_TYPE *) mc;
+}
+
+static void *sccp_mock_getChannelByCallback(int (*is_match) (PBX_CHANNEL_TYPE *, void *), void *data)
+{
+	return sccp_mock_findChannelWithCallback(is_match, data, FALSE);
+}
+
+/* the mock never bridges, the remote side of a call does not exist */
+static boolean_t sccp_mock_getRemoteChannel(const sccp_channel_t * channel, PBX_CHANNEL_TYPE ** pbx_channel)
+{
+	*pbx_channel = NULL;
+	return FALSE;
+}
+
+static PBX_CHANNEL_TYPE *sccp_mock_getBridgeChannel(PBX_CHANNEL_TYPE * pbx_channel)
+{
+	return NULL;
+}
+
+static boolean_t sccp_mock_channelIsBridged(sccp_channel_t * channel)
+{
+	return FALSE;
+}
+
+static boolean_t sccp_mock_attended_transfer(sccp_channel_t * destination_channel, sccp_channel_t * source_channel)
+{
+	return FALSE;
+}
+
+/* ================================================================================================= dialplan / hints */
+/*!
+ * \brief Extension known to the mock dialplan, with its hint state
+ */
+typedef struct sccp_mock_extension {
+	SCCP_LIST_ENTRY (struct sccp_mock_extension) list;
+	skinny_busylampfield_state_t state;
+	char exten[SCCP_MAX_EXTENSION];
+	char context[SCCP_MAX_CONTEXT];
+} sccp_mock_extension_t;
+
+static SCCP_LIST_HEAD (, sccp_mock_extension_t) mock_extensions;
+
+void sccp_mock_setExtensionState(const char *extension, const char *context, skinny_busylampfield_state_t state)
+{
+	sccp_mock_extension_t *me = NULL;
+
+	if (sccp_strlen_zero(extension) || sccp_strlen_zero(context)) {
+		return;
+	}
+	SCCP_LIST_LOCK(&mock_extensions);
+	SCCP_LIST_TRAVERSE(&mock_extensions, me, list) {
+		if (sccp_strequals(me->exten, extension) && sccp_strcaseequals(me->context, context)) {
+			break;
+		}
+	}
+	if (!me && (me = sccp_calloc(sizeof *me, 1))) {
+		sccp_copy_string(me->exten, extension, sizeof(me->exten));
+		sccp_copy_string(me->context, context, sizeof(me->context));
+		SCCP_LIST_INSERT_TAIL(&mock_extensions, me, list);
+	}
+	if (me) {
+		me->state = state;
+	}
+	SCCP_LIST_UNLOCK(&mock_extensions);
+}
+
+static skinny_busylampfield_state_t sccp_mock_getExtensionState(const char *extension, const char *context)
+{
+	skinny_busylampfield_state_t result = SKINNY_BLF_STATUS_UNKNOWN;
+	sccp_mock_extension_t *me = NULL;
+
+	if (sccp_strlen_zero(extension) || sccp_strlen_zero(context)) {
+		return result;
+	}
+	SCCP_LIST_LOCK(&mock_extensions);
+	SCCP_LIST_TRAVERSE(&mock_extensions, me, list) {
+		if (sccp_strequals(me->exten, extension) && sccp_strcaseequals(me->context, context)) {
+			result = me->state;
+			break;
+		}
+	}
+	SCCP_LIST_UNLOCK(&mock_extensions);
+	return result;
+}
+
+/* every extension given to sccp_mock_setExtensionState is dialable, prefixes of it match more */
+static sccp_extension_status_t sccp_mock_extensionStatus(constChannelPtr channel)
+{
+	sccp_extension_status_t result = SCCP_EXTENSION_NOTEXISTS;
+	sccp_mock_extension_t *me = NULL;
+	const char *context = sccp_mock_get_channel_context(channel);
+	size_t len = strlen(channel->dialedNumber);
+
+	SCCP_LIST_LOCK(&mock_extensions);
+	SCCP_LIST_TRAVERSE(&mock_extensions, me, list) {
+		if (!sccp_strcaseequals(me->context, context) || strncmp(me->exten, channel->dialedNumber, len)) {
+			continue;
+		}
+		if (me->exten[len] == '\0') {
+			result = SCCP_EXTENSION_EXACTMATCH;
+			break;
+		}
+		result = SCCP_EXTENSION_MATCHMORE;
+	}
+	SCCP_LIST_UNLOCK(&mock_extensions);
+	return result;
+}
+
+/* ======================================================================================================= scheduler */
+/*!
+ * \brief Scheduled callback, kept in a binary min-heap ordered by (when, seq)
+ */
+typedef struct sccp_mock_sched_entry {
+	uint64_t when;
+	uint64_t seq;												/*!< keeps entries due at the same time in fifo order */
+	uint32_t id;
+	int interval;
+	sccp_sched_cb callback;
+	const void *data;
+	boolean_t deleted;
+} sccp_mock_sched_entry_t;
+
+AST_MUTEX_DEFINE_STATIC(mock_sched_lock);									/* protects everything below */
+static sccp_mock_sched_entry_t **mock_sched_heap = NULL;
+static uint32_t mock_sched_size = 0;
+static uint32_t mock_sched_used = 0;
+static sccp_hashtable_t *mock_sched_index = NULL;								/* id -> entry */
+static uint64_t mock_now = 0;
+static uint64_t mock_sched_seq = 0;
+static uint32_t mock_sched_lastid = 0;
+static uint64_t mock_sched_added = 0;
+static uint64_t mock_sched_fired = 0;
+static uint64_t mock_sched_deleted = 0;
+
+static inline boolean_t mock_sched_before(const sccp_mock_sched_entry_t * a, const sccp_mock_sched_entry_t * b)
+{
+	return (a->when < b->when || (a->when == b->when && a->seq < b->seq)) ? TRUE : FALSE;
+}
+
+static void mock_sched_push(sccp_mock_sched_entry_t * entry)
+{
+	uint32_t pos = mock_sched_used++;
+
+	while (pos > 0) {
+		uint32_t parent = (pos - 1) / 2;
+
+		if (!mock_sched_before(entry, mock_sched_heap[parent])) {
+			break;
+		}
+		mock_sched_heap[pos] = mock_sched_heap[parent];
+		pos = parent;
+	}
+	mock_sched_heap[pos] = entry;
+}
+
+static sccp_mock_sched_entry_t *mock_sched_pop(void)
+{
+	sccp_mock_sched_entry_t *top = mock_sched_heap[0];
+	sccp_mock_sched_entry_t *last = mock_sched_heap[--mock_sched_used];
+	uint32_t pos = 0;
+
+	while (pos * 2 + 1 < mock_sched_used) {
+		uint32_t child = pos * 2 + 1;
+
+		if (child + 1 < mock_sched_used && mock_sched_before(mock_sched_heap[child + 1], mock_sched_heap[child])) {
+			child++;
+		}
+		if (!mock_sched_before(mock_sched_heap[child], last)) {
+			break;
+		}
+		mock_sched_heap[pos] = mock_sched_heap[child];
+		pos = child;
+	}
+	if (mock_sched_used) {
+		mock_sched_heap[pos] = last;
+	}
+	return top;
+}
+
+/* drop deleted entries sitting at the top of the heap, returns the first live one */
+static sccp_mock_sched_entry_t *mock_sched_peek(void)
+{
+	sccp_mock_sched_entry_t *entry = NULL;
+
+	while (mock_sched_used && mock_sched_heap[0]->deleted) {
+		entry = mock_sched_pop();
+		sccp_free(entry);
+	}
+	return mock_sched_used ? mock_sched_heap[0] : NULL;
+}
+
+static int mock_sched_add_locked(sccp_mock_sched_entry_t * entry)
+{
+	if (mock_sched_used == mock_sched_size) {
+		uint32_t newsize = mock_sched_size ? mock_sched_size * 2 : MOCK_SCHED_INITIAL_SIZE;
+		sccp_mock_sched_entry_t **newheap = (sccp_mock_sched_entry_t **) sccp_realloc(mock_sched_heap, newsize * sizeof(*newheap));
+
+		if (!newheap) {
+			return -1;
+		}
+		mock_sched_heap = newheap;
+		mock_sched_size = newsize;
+	}
+	entry->when = mock_now + (entry->interval > 0 ? entry->interval : 0);
+	entry->seq = ++mock_sched_seq;
+	mock_sched_push(entry);
+	return 0;
+}
+
+static int sccp_mock_sched_add(int when, sccp_sched_cb callback, const void *data)
+{
+	sccp_mock_sched_entry_t *entry = NULL;
+	int id = -1;
+
+	if (!callback || !(entry = sccp_calloc(sizeof *entry, 1))) {
+		return -1;
+	}
+	entry->interval = when;
+	entry->callback = callback;
+	entry->data = data;
+
+	pbx_mutex_lock(&mock_sched_lock);
+	if (++mock_sched_lastid > INT_MAX) {
+		mock_sched_lastid = 1;
+	}
+	entry->id = mock_sched_lastid;
+	if (mock_sched_add_locked(entry)) {
+		pbx_mutex_unlock(&mock_sched_lock);
+		sccp_free(entry);
+		return -1;
+	}
+	if (sccp_hashtable_insert(mock_sched_index, (const void *) (uintptr_t) entry->id, entry)) {
+		id = (int) entry->id;
+		mock_sched_added++;
+	} else {
+		entry->deleted = TRUE;										/* already on the heap, freed when popped */
+	}
+	pbx_mutex_unlock(&mock_sched_lock);
+	return id;
+}
+
+static int sccp_mock_sched_del(int id)
+{
+	sccp_mock_sched_entry_t *entry = NULL;
+
+	if (id < 0) {
+		return -1;
+	}
+	pbx_mutex_lock(&mock_sched_lock);
+	if ((entry = (sccp_mock_sched_entry_t *) sccp_hashtable_find(mock_sched_index, (const void *) (uintptr_t) id))) {
+		sccp_hashtable_remove(mock_sched_index, (const void *) (uintptr_t) id, entry);
+		entry->deleted = TRUE;
+		mock_sched_deleted++;
+	}
+	pbx_mutex_unlock(&mock_sched_lock);
+	return entry ? 0 : -1;
+}
+
+static int sccp_mock_sched_add_ref(int *id, int when, sccp_sched_cb callback, sccp_channel_t * channel)
+{
+	if (channel) {
+		sccp_channel_t *c = sccp_channel_retain(channel);
+
+		if (c) {
+			if ((*id = sccp_mock_sched_add(when, callback, c)) < 0) {
+				sccp_channel_release(&c);							/* explicit release during failure */
+			}
+			return *id;
+		}
+	}
+	return -2;
+}
+
+static int sccp_mock_sched_del_ref(int *id, sccp_channel_t * channel)
+{
+	if (*id > -1 && sccp_mock_sched_del(*id) == 0) {
+		sccp_channel_release(&channel);									/* explicit release of the ref taken by sched_add_ref */
+	}
+	*id = -1;
+	return *id;
+}
+
+static int sccp_mock_sched_replace_ref(int *id, int when, ast_sched_cb callback, sccp_channel_t * channel)
+{
+	sccp_mock_sched_del_ref(id, channel);
+	return sccp_mock_sched_add_ref(id, when, (sccp_sched_cb) callback, channel);
+}
+
+/* like ast_sched_when: seconds until the entry fires */
+static long sccp_mock_sched_when(int id)
+{
+	sccp_mock_sched_entry_t *entry = NULL;
+	long secs = 0;
+
+	pbx_mutex_lock(&mock_sched_lock);
+	if ((entry = (sccp_mock_sched_entry_t *) sccp_hashtable_find(mock_sched_index, (const void *) (uintptr_t) id))) {
+		secs = (long) ((entry->when - mock_now) / 1000);
+	}
+	pbx_mutex_unlock(&mock_sched_lock);
+	return secs;
+}
+
+/* like ast_sched_wait: ms until the next entry fires, -1 when there is nothing scheduled */
+static int sccp_mock_sched_wait(int id)
+{
+	sccp_mock_sched_entry_t *entry = NULL;
+	int ms = -1;
+
+	pbx_mutex_lock(&mock_sched_lock);
+	if ((entry = mock_sched_peek())) {
+		ms = (int) (entry->when - mock_now);
+	}
+	pbx_mutex_unlock(&mock_sched_lock);
+	return ms;
+}
+
+uint64_t sccp_mock_now(void)
+{
+	return mock_now;
+}
+
+int sccp_mock_sched_runq(void)
+{
+	sccp_mock_sched_entry_t *entry = NULL;
+	int count = 0;
+
+	pbx_mutex_lock(&mock_sched_lock);
+	while ((entry = mock_sched_peek()) && entry->when <= mock_now) {
+		mock_sched_pop();
+		/* like ast_sched, a running entry can not be deleted anymore (sched_del returns -1) */
+		sccp_hashtable_remove(mock_sched_index, (const void *) (uintptr_t) entry->id, entry);
+
+		/* the callback may add/delete other entries, run it unlocked */
+		pbx_mutex_unlock(&mock_sched_lock);
+		int res = entry->callback(entry->data);
+		pbx_mutex_lock(&mock_sched_lock);
+		mock_sched_fired++;
+		count++;
+
+		/* same contract as ast_sched: a non-zero return reschedules with the same interval and id */
+		if (res && !mock_sched_add_locked(entry)) {
+			if (sccp_hashtable_insert(mock_sched_index, (const void *) (uintptr_t) entry->id, entry)) {
+				continue;
+			}
+			entry->deleted = TRUE;									/* already back on the heap, freed when popped */
+			continue;
+		}
+		sccp_free(entry);
+	}
+	pbx_mutex_unlock(&mock_sched_lock);
+	return count;
+}
+
+int sccp_mock_sched_advance(uint32_t ms)
+{
+	uint64_t target = mock_now + ms;
+	sccp_mock_sched_entry_t *entry = NULL;
+	int count = 0;
+
+	/* step through every due time so callbacks observe the clock they were scheduled for */
+	for (;;) {
+		pbx_mutex_lock(&mock_sched_lock);
+		entry = mock_sched_peek();
+		if (!entry || entry->when > target) {
+			mock_now = target;
+			pbx_mutex_unlock(&mock_sched_lock);
+			break;
+		}
+		if (entry->when > mock_now) {
+			mock_now = entry->when;
+		}
+		pbx_mutex_unlock(&mock_sched_lock);
+		count += sccp_mock_sched_runq();
+	}
+	return count;
+}
+
+/* ============================================================================================================ astdb */
+/*!
+ * \brief AstDB entry, indexed by "family/key"
+ */
+typedef struct sccp_mock_db_entry {
+	SCCP_LIST_ENTRY (struct sccp_mock_db_entry) list;
+	char *value;
+	size_t familylen;
+	char fullkey[1];											/* "family/key", allocated to size */
+} sccp_mock_db_entry_t;
+
+static SCCP_LIST_HEAD (, sccp_mock_db_entry_t) mock_db;
+static sccp_hashtable_t *mock_db_index = NULL;
+static uint64_t mock_db_puts = 0;
+static uint64_t mock_db_gets = 0;
+static uint64_t mock_db_dels = 0;
+
+static void mock_db_free(sccp_mock_db_entry_t * entry)
+{
+	sccp_hashtable_remove(mock_db_index, entry->fullkey, entry);
+	SCCP_LIST_REMOVE(&mock_db, entry, list);
+	sccp_free(entry->value);
+	sccp_free(entry);
+}
+
+static boolean_t sccp_mock_addToDatabase(const char *family, const char *key, const char *value)
+{
+	sccp_mock_db_entry_t *entry = NULL;
+	char fullkey[256];
+	char *newvalue = NULL;
+
+	if (sccp_strlen_zero(family) || sccp_strlen_zero(key) || sccp_strlen_zero(value)) {
+		return FALSE;
+	}
+	if ((size_t) snprintf(fullkey, sizeof(fullkey), "%s/%s", family, key) >= sizeof(fullkey) || !(newvalue = pbx_strdup(value))) {
+		return FALSE;
+	}
+	SCCP_LIST_LOCK(&mock_db);
+	mock_db_puts++;
+	if (!(entry = (sccp_mock_db_entry_t *) sccp_hashtable_find(mock_db_index, fullkey))) {
+		if ((entry = sccp_calloc(sizeof *entry + strlen(fullkey), 1))) {
+			strcpy(entry->fullkey, fullkey);
+			entry->familylen = strlen(family);
+			SCCP_LIST_INSERT_TAIL(&mock_db, entry, list);
+			sccp_hashtable_insert(mock_db_index, entry->fullkey, entry);
+		}
+	}
+	if (entry) {
+		sccp_free(entry->value);
+		entry->value = newvalue;
+	}
+	SCCP_LIST_UNLOCK(&mock_db);
+	if (!entry) {
+		sccp_free(newvalue);
+	}
+	return entry ? TRUE : FALSE;
+}
+
+static boolean_t sccp_mock_getFromDatabase(const char *family, const char *key, char *out, int outlen)
+{
+	sccp_mock_db_entry_t *entry = NULL;
+	char fullkey[256];
+
+	if (sccp_strlen_zero(family) || sccp_strlen_zero(key)) {
+		return FALSE;
+	}
+	snprintf(fullkey, sizeof(fullkey), "%s/%s", family, key);
+	SCCP_LIST_LOCK(&mock_db);
+	mock_db_gets++;
+	if ((entry = (sccp_mock_db_entry_t *) sccp_hashtable_find(mock_db_index, fullkey))) {
+		sccp_copy_string(out, entry->value, outlen);
+	}
+	SCCP_LIST_UNLOCK(&mock_db);
+	return entry ? TRUE : FALSE;
+}
+
+static boolean_t sccp_mock_removeFromDatabase(const char *family, const char *key)
+{
+	sccp_mock_db_entry_t *entry = NULL;
+	char fullkey[256];
+
+	if (sccp_strlen_zero(family) || sccp_strlen_zero(key)) {
+		return FALSE;
+	}
+	snprintf(fullkey, sizeof(fullkey), "%s/%s", family, key);
+	SCCP_LIST_LOCK(&mock_db);
+	mock_db_dels++;
+	if ((entry = (sccp_mock_db_entry_t *) sccp_hashtable_find(mock_db_index, fullkey))) {
+		mock_db_free(entry);
+	}
+	SCCP_LIST_UNLOCK(&mock_db);
+	return entry ? TRUE : FALSE;
+}
+
+/* like ast_db_deltree: remove everything in family whose key starts with key */
+static boolean_t sccp_mock_removeTreeFromDatabase(const char *family, const char *key)
+{
+	sccp_mock_db_entry_t *entry = NULL;
+	size_t familylen = 0;
+	int removed = 0;
+
+	if (sccp_strlen_zero(family) || sccp_strlen_zero(key)) {
+		return FALSE;
+	}
+	familylen = strlen(family);
+	SCCP_LIST_LOCK(&mock_db);
+	mock_db_dels++;
+	SCCP_LIST_TRAVERSE_SAFE_BEGIN(&mock_db, entry, list) {
+		if (entry->familylen == familylen && !strncmp(entry->fullkey, family, familylen) && !strncmp(entry->fullkey + familylen + 1, key, strlen(key))) {
+			SCCP_LIST_REMOVE_CURRENT(list);
+			sccp_hashtable_remove(mock_db_index, entry->fullkey, entry);
+			sccp_free(entry->value);
+			sccp_free(entry);
+			removed++;
+		}
+	}
+	SCCP_LIST_TRAVERSE_SAFE_END;
+	SCCP_LIST_UNLOCK(&mock_db);
+	return removed ? TRUE : FALSE;
+}
+
+void sccp_mock_db_dump(int fd)
+{
+	sccp_mock_db_entry_t *entry = NULL;
+
+	SCCP_LIST_LOCK(&mock_db);
+	SCCP_LIST_TRAVERSE(&mock_db, entry, list) {
+		dprintf(fd, "/%-50s : %s\n", entry->fullkey, entry->value);
+	}
+	dprintf(fd, "%d results found.\n", SCCP_LIST_GETSIZE(&mock_db));
+	SCCP_LIST_UNLOCK(&mock_db);
+}
+
+/* ============================================================================================================= misc */
+static int sccp_mock_send_digits(constChannelPtr channel, const char *digits)
+{
+	return 0;
+}
+
+static int sccp_mock_send_digit(constChannelPtr channel, const char digit)
+{
+	return 0;
+}
+
+static int sccp_mock_set_nativeAudioFormats(constChannelPtr channel, skinny_codec_t codec[], int length)
+{
+	return 1;
+}
+
+static int sccp_mock_set_nativeVideoFormats(constChannelPtr channel, uint32_t formats)
+{
+	return 1;
+}
+
+static void sccp_mock_setCalleridName(PBX_CHANNEL_TYPE * pbx_channel, const char *name)
+{
+	if (pbx_channel && name) {
+		sccp_copy_string(MOCK_CHANNEL(pbx_channel)->cid_name, name, sizeof(MOCK_CHANNEL(pbx_channel)->cid_name));
+	}
+}
+
+static void sccp_mock_setCalleridNumber(PBX_CHANNEL_TYPE * pbx_channel, const char *number)
+{
+	if (pbx_channel && number) {
+		sccp_copy_string(MOCK_CHANNEL(pbx_channel)->cid_number, number, sizeof(MOCK_CHANNEL(pbx_channel)->cid_number));
+	}
+}
+
+static void sccp_mock_setCalleridAni(PBX_CHANNEL_TYPE * pbx_channel, const char *ani)
+{
+	if (pbx_channel && ani) {
+		sccp_copy_string(MOCK_CHANNEL(pbx_channel)->cid_ani, ani, sizeof(MOCK_CHANNEL(pbx_channel)->cid_ani));
+	}
+}
+
+static void sccp_mock_setCalleridDnid(PBX_CHANNEL_TYPE * pbx_channel, const char *dnid)
+{
+	if (pbx_channel && dnid) {
+		sccp_copy_string(MOCK_CHANNEL(pbx_channel)->cid_dnid, dnid, sizeof(MOCK_CHANNEL(pbx_channel)->cid_dnid));
+	}
+}
+
+static void sccp_mock_setCalleridPresentation(PBX_CHANNEL_TYPE * pbx_channel, sccp_callerid_presentation_t presentation)
+{
+	if (pbx_channel) {
+		MOCK_CHANNEL(pbx_channel)->cid_presentation = (presentation == CALLERID_PRESENTATION_FORBIDDEN) ? CALLERID_PRESENTATION_FORBIDDEN : CALLERID_PRESENTATION_ALLOWED;
+	}
+}
+
+static void sccp_mock_setRedirectingParty(PBX_CHANNEL_TYPE * pbx_channel, const char *number, const char *name)
+{
+	if (pbx_channel && number) {
+		sccp_copy_string(MOCK_CHANNEL(pbx_channel)->cid_rdnis, number, sizeof(MOCK_CHANNEL(pbx_channel)->cid_rdnis));
+	}
+}
+
+static void sccp_mock_setRedirectedParty(PBX_CHANNEL_TYPE * pbx_channel, const char *number, const char *name)
+{
+}
+
+static int mock_callerid_string(const char *value, char **out)
+{
+	if (sccp_strlen_zero(value)) {
+		return 0;
+	}
+	*out = pbx_strdup(value);
+	return 1;
+}
+
+static int sccp_mock_callerid_name(PBX_CHANNEL_TYPE * pbx_channel, char **cid_name)
+{
+	return pbx_channel ? mock_callerid_string(MOCK_CHANNEL(pbx_channel)->cid_name, cid_name) : 0;
+}
+
+static int sccp_mock_callerid_number(PBX_CHANNEL_TYPE * pbx_channel, char **cid_number)
+{
+	return pbx_channel ? mock_callerid_string(MOCK_CHANNEL(pbx_channel)->cid_number, cid_number) : 0;
+}
+
+static int sccp_mock_callerid_ani(PBX_CHANNEL_TYPE * pbx_channel, char **ani)
+{
+	return pbx_channel ? mock_callerid_string(MOCK_CHANNEL(pbx_channel)->cid_ani, ani) : 0;
+}
+
+static int sccp_mock_callerid_dnid(PBX_CHANNEL_TYPE * pbx_channel, char **dnid)
+{
+	return pbx_channel ? mock_callerid_string(MOCK_CHANNEL(pbx_channel)->cid_dnid, dnid) : 0;
+}
+
+static int sccp_mock_callerid_rdnis(PBX_CHANNEL_TYPE * pbx_channel, char **rdnis)
+{
+	return pbx_channel ? mock_callerid_string(MOCK_CHANNEL(pbx_channel)->cid_rdnis, rdnis) : 0;
+}
+
+static int sccp_mock_callerid_presentation(PBX_CHANNEL_TYPE * pbx_channel)
+{
+	return pbx_channel ? MOCK_CHANNEL(pbx_channel)->cid_presentation : CALLERID_PRESENTATION_ALLOWED;
+}
+
+static void sccp_mock_setDialedNumber(const sccp_channel_t * channel, const char *number)
+{
+	sccp_mock_channel_t *mc = MOCK_OWNER(channel);
+
+	if (mc && number) {
+		sccp_copy_string(mc->exten, number, sizeof(mc->exten));
+		sccp_copy_string(mc->cid_dnid, number, sizeof(mc->cid_dnid));
+	}
+}
+
+static void sccp_mock_updateConnectedLine(constChannelPtr channel, const char *number, const char *name, uint8_t reason)
+{
+}
+
+static boolean_t sccp_mock_setLanguage(PBX_CHANNEL_TYPE * pbx_channel, const char *language)
+{
+	if (!pbx_channel || !language) {
+		return FALSE;
+	}
+	sccp_copy_string(MOCK_CHANNEL(pbx_channel)->language, language, sizeof(MOCK_CHANNEL(pbx_channel)->language));
+	return TRUE;
+}
+
+static int sccp_mock_moh_start(PBX_CHANNEL_TYPE * pbx_channel, const char *mclass, const char *interpclass)
+{
+	return 0;
+}
+
+static void sccp_mock_moh_stop(PBX_CHANNEL_TYPE * pbx_channel)
+{
+}
+
+static boolean_t sccp_mock_rtp_setFormat(constChannelPtr channel, skinny_codec_t codec)
+{
+	return TRUE;
+}
+
+static boolean_t sccp_mock_rtp_create_instance(constDevicePtr d, constChannelPtr c, sccp_rtp_t * rtp)
+{
+	return FALSE;												/* no media in the mock, callers treat this as "no rtp" */
+}
+
+static uint8_t sccp_mock_rtp_get_payloadType(const struct sccp_rtp *rtp, skinny_codec_t codec)
+{
+	return 0;
+}
+
+static int sccp_mock_rtp_get_sampleRate(skinny_codec_t codec)
+{
+	return 8000;
+}
+
+static uint sccp_mock_get_codec_framing(constChannelPtr c)
+{
+	return 20;
+}
+
+static uint sccp_mock_get_dtmf_payload_code(constChannelPtr c)
+{
+	return 101;
+}
+
+static void sccp_mock_set_group(sccp_channel_t * channel, ast_group_t value)
+{
+}
+
+static PBX_ENDPOINT_TYPE *sccp_mock_endpoint_create(const char *tech, const char *resource)
+{
+	return NULL;
+}
+
+static void sccp_mock_endpoint_online(PBX_ENDPOINT_TYPE * endpoint, const char *address)
+{
+}
+
+static void sccp_mock_endpoint_offline(PBX_ENDPOINT_TYPE * endpoint, const char *cause)
+{
+}
+
+static void sccp_mock_endpoint_shutdown(PBX_ENDPOINT_TYPE ** endpoint)
+{
+}
+
+static int sccp_mock_dumpchan(PBX_CHANNEL_TYPE * pbx_channel, char *buf, size_t size)
+{
+	sccp_mock_channel_t *mc = MOCK_CHANNEL(pbx_channel);
+
+	if (!mc) {
+		return -1;
+	}
+	return snprintf(buf, size, "Name=%s\nUniqueID=%s\nLinkedID=%s\nState=%d\nContext=%s\nExten=%s\nCallerIDNum=%s\nCallerIDName=%s\n", mc->name, mc->uniqueid, mc->linkedid, mc->state, mc->context, mc->exten, mc->cid_number, mc->cid_name);
+}
+
+/* ======================================================================================================= lifecycle */
+void sccp_mock_init(void)
+{
+	SCCP_LIST_HEAD_INIT(&mock_channels);
+	SCCP_LIST_HEAD_INIT(&mock_extensions);
+	SCCP_LIST_HEAD_INIT(&mock_db);
+	mock_sched_index = sccp_hashtable_create(SCCP_HASHTABLE_KEY_UINT32, 0);
+	mock_db_index = sccp_hashtable_create(SCCP_HASHTABLE_KEY_STRING_NOCASE, 0);
+	mock_now = 0;
+	sccp_mock_runtime_init();
+}
+
+void sccp_mock_destroy(void)
+{
+	sccp_mock_channel_t *mc = NULL;
+	sccp_mock_extension_t *me = NULL;
+	sccp_mock_db_entry_t *entry = NULL;
+
+	sccp_mock_runtime_destroy();
+
+	pbx_mutex_lock(&mock_sched_lock);
+	while (mock_sched_used) {
+		sccp_mock_sched_entry_t *sched_entry = mock_sched_pop();
+
+		sccp_free(sched_entry);
+	}
+	sccp_free(mock_sched_heap);
+	mock_sched_heap = NULL;
+	mock_sched_size = 0;
+	sccp_hashtable_destroy(&mock_sched_index);
+	pbx_mutex_unlock(&mock_sched_lock);
+
+	SCCP_LIST_LOCK(&mock_channels);
+	while ((mc = SCCP_LIST_REMOVE_HEAD(&mock_channels, list))) {
+		sccp_free(mc);
+	}
+	SCCP_LIST_UNLOCK(&mock_channels);
+	SCCP_LIST_HEAD_DESTROY(&mock_channels);
+
+	SCCP_LIST_LOCK(&mock_extensions);
+	while ((me = SCCP_LIST_REMOVE_HEAD(&mock_extensions, list))) {
+		sccp_free(me);
+	}
+	SCCP_LIST_UNLOCK(&mock_extensions);
+	SCCP_LIST_HEAD_DESTROY(&mock_extensions);
+
+	SCCP_LIST_LOCK(&mock_db);
+	while ((entry = SCCP_LIST_FIRST(&mock_db))) {
+		mock_db_free(entry);
+	}
+	sccp_hashtable_destroy(&mock_db_index);
+	SCCP_LIST_UNLOCK(&mock_db);
+	SCCP_LIST_HEAD_DESTROY(&mock_db);
+}
+
+void sccp_mock_getStats(sccp_mock_stats_t * stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	SCCP_LIST_LOCK(&mock_channels);
+	stats->channels = SCCP_LIST_GETSIZE(&mock_channels);
+	stats->channels_allocated = mock_channels_allocated;
+	SCCP_LIST_UNLOCK(&mock_channels);
+
+	pbx_mutex_lock(&mock_sched_lock);
+	stats->sched_pending = sccp_hashtable_size(mock_sched_index);
+	stats->sched_added = mock_sched_added;
+	stats->sched_fired = mock_sched_fired;
+	stats->sched_deleted = mock_sched_deleted;
+	pbx_mutex_unlock(&mock_sched_lock);
+
+	SCCP_LIST_LOCK(&mock_db);
+	stats->db_entries = SCCP_LIST_GETSIZE(&mock_db);
+	stats->db_puts = mock_db_puts;
+	stats->db_gets = mock_db_gets;
+	stats->db_dels = mock_db_dels;
+	SCCP_LIST_UNLOCK(&mock_db);
+
+	stats->callstates = mock_callstates;
+	stats->controls = mock_controls;
+	sccp_mock_runtime_getStats(stats);
+}
+
+/*!
+ * \brief SCCP - PBX Callback Functions (Mock)
+ * \note Entries left out are NULL on purpose: libsccp checks those before use.
+ */
+const PbxInterface iPbx = {
+	/* *INDENT-OFF* */
+
+	/* channel */
+	.alloc_pbxChannel 		= sccp_mock_allocPBXChannel,
+	.extension_status 		= sccp_mock_extensionStatus,
+	.setPBXChannelLinkedId		= sccp_mock_set_pbxchannel_linkedid,
+	.hangup				= sccp_mock_hangup,
+
+	.getChannelByName 		= sccp_mock_getChannelByName,
+	.getChannelByCallback		= sccp_mock_getChannelByCallback,
+	.getChannelLinkedId		= sccp_mock_get_channel_linkedid,
+	.setChannelLinkedId		= sccp_mock_set_channel_linkedid,
+	.getChannelName			= sccp_mock_get_channel_name,
+	.setChannelName			= sccp_mock_set_channel_name,
+	.getChannelUniqueID		= sccp_mock_get_channel_uniqueid,
+	.getChannelExten		= sccp_mock_get_channel_exten,
+	.setChannelExten		= sccp_mock_set_channel_exten,
+	.getChannelContext		= sccp_mock_get_channel_context,
+	.setChannelContext		= sccp_mock_set_channel_context,
+	.getChannelMacroExten		= sccp_mock_get_channel_macroexten,
+	.setChannelMacroExten		= sccp_mock_set_channel_macroexten,
+	.getChannelMacroContext		= sccp_mock_get_channel_macrocontext,
+	.setChannelMacroContext		= sccp_mock_set_channel_macrocontext,
+	.getChannelCallForward		= sccp_mock_get_channel_call_forward,
+	.setChannelCallForward		= sccp_mock_set_channel_call_forward,
+
+	.getChannelAppl			= sccp_mock_get_channel_appl,
+	.getChannelState		= sccp_mock_get_channel_state,
+	.getChannelPbx			= sccp_mock_get_channel_pbx,
+
+	.getRemoteChannel		= sccp_mock_getRemoteChannel,
+	.checkhangup			= sccp_mock_checkHangup,
+
+	/* digits */
+	.send_digits 			= sccp_mock_send_digits,
+	.send_digit 			= sccp_mock_send_digit,
+
+	/* schedulers */
+	.sched_add			= sccp_mock_sched_add,
+	.sched_del			= sccp_mock_sched_del,
+	.sched_add_ref			= sccp_mock_sched_add_ref,
+	.sched_del_ref			= sccp_mock_sched_del_ref,
+	.sched_replace_ref		= sccp_mock_sched_replace_ref,
+	.sched_when 			= sccp_mock_sched_when,
+	.sched_wait 			= sccp_mock_sched_wait,
+
+	/* callstate / indicate */
+	.set_callstate 			= sccp_mock_setCallState,
+
+	/* codecs */
+	.set_nativeAudioFormats 	= sccp_mock_set_nativeAudioFormats,
+	.set_nativeVideoFormats 	= sccp_mock_set_nativeVideoFormats,
+
+	/* rtp */
+	.rtp_create_instance		= sccp_mock_rtp_create_instance,
+	.rtp_get_payloadType 		= sccp_mock_rtp_get_payloadType,
+	.rtp_get_sampleRate 		= sccp_mock_rtp_get_sampleRate,
+	.rtp_setWriteFormat 		= sccp_mock_rtp_setFormat,
+	.rtp_setReadFormat 		= sccp_mock_rtp_setFormat,
+
+	/* callerid */
+	.get_callerid_name 		= sccp_mock_callerid_name,
+	.get_callerid_number 		= sccp_mock_callerid_number,
+	.get_callerid_ani 		= sccp_mock_callerid_ani,
+	.get_callerid_dnid 		= sccp_mock_callerid_dnid,
+	.get_callerid_rdnis 		= sccp_mock_callerid_rdnis,
+	.get_callerid_presentation 	= sccp_mock_callerid_presentation,
+
+	.set_callerid_name 		= sccp_mock_setCalleridName,
+	.set_callerid_number 		= sccp_mock_setCalleridNumber,
+	.set_callerid_ani 		= sccp_mock_setCalleridAni,
+	.set_callerid_dnid 		= sccp_mock_setCalleridDnid,
+	.set_callerid_redirectingParty 	= sccp_mock_setRedirectingParty,
+	.set_callerid_redirectedParty 	= sccp_mock_setRedirectedParty,
+	.set_callerid_presentation 	= sccp_mock_setCalleridPresentation,
+	.set_dialed_number		= sccp_mock_setDialedNumber,
+	.set_connected_line		= sccp_mock_updateConnectedLine,
+
+	/* database */
+	.feature_addToDatabase 		= sccp_mock_addToDatabase,
+	.feature_getFromDatabase 	= sccp_mock_getFromDatabase,
+	.feature_removeFromDatabase     = sccp_mock_removeFromDatabase,
+	.feature_removeTreeFromDatabase = sccp_mock_removeTreeFromDatabase,
+
+	.findChannelByCallback		= sccp_mock_findChannelWithCallback,
+
+	.moh_start			= sccp_mock_moh_start,
+	.moh_stop			= sccp_mock_moh_stop,
+	.queue_control			= sccp_mock_queue_control,
+	.queue_control_data		= sccp_mock_queue_control_data,
+
+	.set_language			= sccp_mock_setLanguage,
+
+	.getExtensionState		= sccp_mock_getExtensionState,
+
+	.endpoint_create		= sccp_mock_endpoint_create,
+	.endpoint_online		= sccp_mock_endpoint_online,
+	.endpoint_offline		= sccp_mock_endpoint_offline,
+	.endpoint_shutdown		= sccp_mock_endpoint_shutdown,
+
+	.set_owner			= sccp_mock_setOwner,
+	.dumpchan			= sccp_mock_dumpchan,
+	.channel_is_bridged		= sccp_mock_channelIsBridged,
+	.get_bridged_channel		= sccp_mock_getBridgeChannel,
+	.get_underlying_channel		= sccp_mock_getBridgeChannel,
+	.attended_transfer		= sccp_mock_attended_transfer,
+
+	.set_callgroup			= sccp_mock_set_group,
+	.set_pickupgroup		= sccp_mock_set_group,
+
+	.get_codec_framing		= sccp_mock_get_codec_framing,
+	.get_dtmf_payload_code		= sccp_mock_get_dtmf_payload_code,
+	/* *INDENT-ON* */
+};
+// kate: indent-width 8; replace-tabs off; indent-mode cstyle; auto-insert-doxygen on; line-numbers on; tab-indents on; keep-extra-spaces off; auto-brackets off;
@@ -0,0 +1,59 @@
+/*!
+ * \file        mock.h
+ * \brief       SCCP PBX Mock Backend Header
+ * \note        In-memory implementation of the PbxInterface (iPbx), used to drive libsccp outside of a running asterisk
+ *              (benchmarks / tests). Everything runs against a virtual clock, nothing is scheduled by itself: the runner
+ *              decides when time moves on and when events are delivered.
+ * \note        This program is free software and may be modified and distributed under the terms of the GNU Public License.
+ *              See the LICENSE file at the top of the source tree.
+ */
+#pragma once
+
+__BEGIN_C_EXTERN__
+/*!
+ * \brief Counters kept by the mock backend (see sccp_mock_getStats)
+ */
+typedef struct sccp_mock_stats {
+	uint32_t channels;											/*!< pbx channels currently allocated */
+	uint32_t channels_allocated;										/*!< pbx channels allocated in total */
+	uint32_t sched_pending;											/*!< scheduled callbacks waiting for the virtual clock */
+	uint64_t sched_added;
+	uint64_t sched_fired;
+	uint64_t sched_deleted;
+	uint32_t db_entries;
+	uint64_t db_puts;
+	uint64_t db_gets;
+	uint64_t db_dels;
+	uint64_t callstates;											/*!< iPbx.set_callstate invocations */
+	uint64_t controls;											/*!< iPbx.queue_control(_data) invocations */
+	uint32_t subscriptions;											/*!< devstate/mwi bus subscriptions */
+	uint64_t published;											/*!< devstate/mwi messages published */
+	uint64_t delivered;											/*!< devstate/mwi messages delivered to subscribers */
+} sccp_mock_stats_t;
+
+/* lifecycle */
+SCCP_API void SCCP_CALL sccp_mock_init(void);
+SCCP_API void SCCP_CALL sccp_mock_destroy(void);
+SCCP_API void SCCP_CALL sccp_mock_getStats(sccp_mock_stats_t * stats);
+
+/* virtual clock / scheduler */
+SCCP_API uint64_t SCCP_CALL sccp_mock_now(void);							/*!< virtual time in ms since sccp_mock_init */
+SCCP_API int SCCP_CALL sccp_mock_sched_advance(uint32_t ms);						/*!< move the clock forward, running everything that became due; returns number of callbacks run */
+SCCP_API int SCCP_CALL sccp_mock_sched_runq(void);							/*!< run everything due at the current virtual time */
+
+/* extension state (used by iPbx.getExtensionState) */
+SCCP_API void SCCP_CALL sccp_mock_setExtensionState(const char *extension, const char *context, skinny_busylampfield_state_t state);
+
+/* devicestate / mwi bus */
+SCCP_API int SCCP_CALL sccp_mock_devstate_publish(const char *device, enum ast_device_state state);	/*!< returns number of subscribers notified */
+SCCP_API int SCCP_CALL sccp_mock_mwi_publish(const char *uniqueid, int newmsgs, int oldmsgs);		/*!< uniqueid is "mailbox@context" */
+
+/* astdb */
+SCCP_API void SCCP_CALL sccp_mock_db_dump(int fd);
+
+/* used between mock.c and mock_runtime.c */
+SCCP_API void SCCP_CALL sccp_mock_runtime_init(void);
+SCCP_API void SCCP_CALL sccp_mock_runtime_destroy(void);
+SCCP_API void SCCP_CALL sccp_mock_runtime_getStats(sccp_mock_stats_t * stats);
+__END_C_EXTERN__
+// kate: indent-width 8; replace-tabs off; indent-mode cstyle; auto-insert-doxygen on; line-numbers on; tab-indents on; keep-extra-spaces off; auto-brackets off;
@@ -0,0 +1,501 @@
+/*!
+ * \file        mock_runtime.c
+ * \brief       SCCP PBX Mock Runtime
+ * \note        Stand-ins for the asterisk core functions libsccp calls directly (not through iPbx), so that the mock
+ *              backend can be linked into a plain executable:
+ *              - a synchronous stasis bus for devicestate and mwi (topics, subscriptions, messages)
+ *              - logging and verbose output (to stderr, filtered by sccp_mock_loglevel)
+ *              - the lock wrappers behind pbx_mutex_* / pbx_rwlock_* / pbx_cond_* (plain pthread, no lock tracking)
+ *              - thread creation behind pbx_pthread_create* (accept thread, device threads and reactor workers, used by the
+ *                stub pbx listener)
+ *              - the asterisk core variables libsccp reads (config/log/data paths, entity id)
+ *              - test registration (CS_TEST_FRAMEWORK builds register their tests from constructors, before main)
+ *              Every other asterisk function referenced at link time gets a generated stub which aborts when it is
+ *              reached (see tools/gen_mock_stubs.awk).
+ *              Only built into the mock runner, never into chan_sccp.so.
+ * \note        This program is free software and may be modified and distributed under the terms of the GNU Public License.
+ *              See the LICENSE file at the top of the source tree.
+ */
+#include "config.h"
+#include "common.h"
+#include "sccp_atomic.h"
+#include "pbx_impl/mock/mock.h"
+
+SCCP_FILE_VERSION(__FILE__, "");
+
+#include <asterisk/stasis.h>
+#include <asterisk/devicestate.h>
+#include <asterisk/app.h>
+#include <asterisk/paths.h>
+#include <limits.h>
+#if CS_TEST_FRAMEWORK
+#include <asterisk/test.h>
+#endif
+
+int sccp_mock_loglevel = __LOG_WARNING;										/* messages at or below this level are printed */
+
+/* ========================================================================================================= globals */
+/* variables can not be replaced by the generated function stubs, so every one libsccp reads is defined here */
+const char *ast_config_AST_CONFIG_DIR = ".";
+const char *ast_config_AST_DATA_DIR = ".";
+const char *ast_config_AST_LOG_DIR = ".";
+struct ast_eid ast_eid_default = { {0x02, 0x00, 0x00, 0x00, 0x00, 0x01} };
+
+/* ============================================================================================================== bus */
+struct stasis_message_type {
+	const char *name;
+};
+
+struct stasis_message {
+	struct stasis_message_type *type;
+	void *data;
+};
+
+struct stasis_subscription {
+	SCCP_LIST_ENTRY (struct stasis_subscription) list;
+	struct stasis_topic *topic;
+	stasis_subscription_cb callback;
+	void *data;
+};
+
+struct stasis_topic {
+	SCCP_LIST_ENTRY (struct stasis_topic) list;
+	SCCP_LIST_HEAD (, struct stasis_subscription) subscriptions;
+	enum ast_device_state devstate;										/* last published state (devicestate topics) */
+	char name[1];												/* allocated to size */
+};
+
+static struct stasis_message_type mock_devstate_type = { "ast_device_state_message_type" };
+static struct stasis_message_type mock_mwi_type = { "ast_mwi_state_type" };
+static struct stasis_message_type mock_change_type = { "stasis_subscription_change_type" };
+
+static SCCP_LIST_HEAD (, struct stasis_topic) mock_topics;
+static struct stasis_topic *mock_mwi_all = NULL;
+static volatile uint32_t mock_subscriptions = 0;							/* counters are updated from every publishing / subscribing thread */
+static volatile uint64_t mock_published = 0;
+static volatile uint64_t mock_delivered = 0;
+
+static struct stasis_topic *mock_topic_find_or_create(const char *prefix, const char *name)
+{
+	struct stasis_topic *topic = NULL;
+	char fullname[256];
+
+	snprintf(fullname, sizeof(fullname), "%s%s", prefix, name ? name : "");
+	SCCP_LIST_LOCK(&mock_topics);
+	SCCP_LIST_TRAVERSE(&mock_topics, topic, list) {
+		if (sccp_strcaseequals(topic->name, fullname)) {
+			break;
+		}
+	}
+	if (!topic && (topic = (struct stasis_topic *) sccp_calloc(sizeof *topic + strlen(fullname), 1))) {
+		strcpy(topic->name, fullname);
+		topic->devstate = AST_DEVICE_UNKNOWN;
+		SCCP_LIST_HEAD_INIT(&topic->subscriptions);
+		SCCP_LIST_INSERT_TAIL(&mock_topics, topic, list);
+	}
+	SCCP_LIST_UNLOCK(&mock_topics);
+	return topic;
+}
+
+/* delivery is synchronous, on the publishing thread, like a stasis pool subscription under no load */
+static int mock_topic_publish(struct stasis_topic *topic, struct stasis_message *msg)
+{
+	struct stasis_subscription *sub = NULL;
+	int delivered = 0;
+
+	ATOMIC_INCR(&mock_published, 1, &mock_topics.lock);
+	if (!topic) {
+		return 0;
+	}
+	SCCP_LIST_LOCK(&topic->subscriptions);
+	SCCP_LIST_TRAVERSE(&topic->subscriptions, sub, list) {
+		sub->callback(sub->data, sub, msg);
+		delivered++;
+	}
+	SCCP_LIST_UNLOCK(&topic->subscriptions);
+	ATOMIC_INCR(&mock_delivered, delivered, &mock_topics.lock);
+	return delivered;
+}
+
+int sccp_mock_devstate_publish(const char *device, enum ast_device_state state)
+{
+	struct stasis_topic *topic = mock_topic_find_or_create("devicestate:", device);
+	struct ast_device_state_message *dev_state = NULL;
+	struct stasis_message msg = { &mock_devstate_type, NULL };
+	int delivered = 0;
+
+	if (!topic || !(dev_state = (struct ast_device_state_message *) sccp_calloc(sizeof *dev_state, 1))) {
+		return -1;
+	}
+	dev_state->eid = NULL;											/* aggregate state */
+	dev_state->state = state;
+	topic->devstate = state;
+	msg.data = dev_state;
+	delivered = mock_topic_publish(topic, &msg);
+	sccp_free(dev_state);
+	return delivered;
+}
+
+int sccp_mock_mwi_publish(const char *uniqueid, int newmsgs, int oldmsgs)
+{
+	struct ast_mwi_state *mwi_state = NULL;
+	struct stasis_message msg = { &mock_mwi_type, NULL };
+	int delivered = 0;
+
+	if (!(mwi_state = (struct ast_mwi_state *) sccp_calloc(sizeof *mwi_state, 1))) {
+		return -1;
+	}
+	mwi_state->new_msgs = newmsgs;
+	mwi_state->old_msgs = oldmsgs;
+	msg.data = mwi_state;
+	delivered = mock_topic_publish(mock_topic_find_or_create("mwi:", uniqueid), &msg);
+	mock_topic_publish(mock_mwi_all, &msg);
+	sccp_free(mwi_state);
+	return delivered;
+}
+
+struct stasis_topic *ast_device_state_topic(const char *device)
+{
+	return mock_topic_find_or_create("devicestate:", device);
+}
+
+struct stasis_message_type *ast_device_state_message_type(void)
+{
+	return &mock_devstate_type;
+}
+
+enum ast_device_state ast_device_state(const char *device)
+{
+	struct stasis_topic *topic = mock_topic_find_or_create("devicestate:", device);
+
+	return topic ? topic->devstate : AST_DEVICE_UNKNOWN;
+}
+
+const char *ast_devstate_str(enum ast_device_state devstate)
+{
+	return pbxsccp_devicestate2str(devstate);
+}
+
+struct stasis_topic *ast_mwi_topic(const char *uniqueid)
+{
+	return mock_topic_find_or_create("mwi:", uniqueid);
+}
+
+struct stasis_topic *ast_mwi_topic_all(void)
+{
+	return mock_mwi_all;
+}
+
+struct stasis_message_type *ast_mwi_state_type(void)
+{
+	return &mock_mwi_type;
+}
+
+struct stasis_cache *ast_mwi_state_cache(void)
+{
+	return NULL;
+}
+
+/* nothing is cached: libsccp falls back to pbx_app_inboxcount */
+struct stasis_message *stasis_cache_get(struct stasis_cache *cache, struct stasis_message_type *type, const char *id)
+{
+	return NULL;
+}
+
+int ast_app_inboxcount(const char *mailboxes, int *newmsgs, int *oldmsgs)
+{
+	*newmsgs = 0;
+	*oldmsgs = 0;
+	return 0;
+}
+
+struct stasis_message_type *stasis_subscription_change_type(void)
+{
+	return &mock_change_type;
+}
+
+struct stasis_message_type *stasis_message_type(const struct stasis_message *msg)
+{
+	return msg ? msg->type : NULL;
+}
+
+void *stasis_message_data(const struct stasis_message *msg)
+{
+	return msg ? msg->data : NULL;
+}
+
+static struct stasis_subscription *mock_subscribe(struct stasis_topic *topic, stasis_subscription_cb callback, void *data)
+{
+	struct stasis_subscription *sub = NULL;
+
+	if (!topic || !callback || !(sub = (struct stasis_subscription *) sccp_calloc(sizeof *sub, 1))) {
+		return NULL;
+	}
+	sub->topic = topic;
+	sub->callback = callback;
+	sub->data = data;
+	SCCP_LIST_LOCK(&topic->subscriptions);
+	SCCP_LIST_INSERT_TAIL(&topic->subscriptions, sub, list);
+	ATOMIC_INCR(&mock_subscriptions, 1, &mock_topics.lock);
+	SCCP_LIST_UNLOCK(&topic->subscriptions);
+	return sub;
+}
+
+#ifdef stasis_subscribe
+/* asterisk >= 13.28 / 16.5: stasis_subscribe is a macro adding file/line/func */
+struct stasis_subscription *__stasis_subscribe(struct stasis_topic *topic, stasis_subscription_cb callback, void *data, const char *file, int lineno, const char *func)
+{
+	return mock_subscribe(topic, callback, data);
+}
+
+struct stasis_subscription *__stasis_subscribe_pool(struct stasis_topic *topic, stasis_subscription_cb callback, void *data, const char *file, int lineno, const char *func)
+{
+	return mock_subscribe(topic, callback, data);
+}
+#else
+struct stasis_subscription *stasis_subscribe(struct stasis_topic *topic, stasis_subscription_cb callback, void *data)
+{
+	return mock_subscribe(topic, callback, data);
+}
+
+struct stasis_subscription *stasis_subscribe_pool(struct stasis_topic *topic, stasis_subscription_cb callback, void *data)
+{
+	return mock_subscribe(topic, callback, data);
+}
+#endif
+
+struct stasis_subscription *stasis_unsubscribe(struct stasis_subscription *sub)
+{
+	struct stasis_topic *topic = NULL;
+
+	if (!sub) {
+		return NULL;
+	}
+	topic = sub->topic;
+	SCCP_LIST_LOCK(&topic->subscriptions);
+	if (SCCP_LIST_REMOVE(&topic->subscriptions, sub, list)) {
+		ATOMIC_DECR(&mock_subscriptions, 1, &mock_topics.lock);
+	}
+	SCCP_LIST_UNLOCK(&topic->subscriptions);
+	sccp_free(sub);
+	return NULL;
+}
+
+struct stasis_subscription *stasis_unsubscribe_and_join(struct stasis_subscription *sub)
+{
+	return stasis_unsubscribe(sub);
+}
+
+#if ASTERISK_VERSION_GROUP >= 116
+int stasis_subscription_accept_message_type(struct stasis_subscription *subscription, const struct stasis_message_type *type)
+{
+	return 0;
+}
+
+int stasis_subscription_set_filter(struct stasis_subscription *subscription, enum stasis_subscription_message_filter filter)
+{
+	return 0;
+}
+#endif
+
+/* ========================================================================================================== logging */
+void ast_log(int level, const char *file, int line, const char *function, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (level > sccp_mock_loglevel) {
+		return;
+	}
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+}
+
+void __ast_verbose(const char *file, int line, const char *func, int level, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (sccp_mock_loglevel < __LOG_VERBOSE) {
+		return;
+	}
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+}
+
+/* ============================================================================================================ locks */
+int __ast_pthread_mutex_init(int tracking, const char *filename, int lineno, const char *func, const char *mutex_name, ast_mutex_t * t)
+{
+	return pthread_mutex_init(&t->mutex, NULL);
+}
+
+int __ast_pthread_mutex_destroy(const char *filename, int lineno, const char *func, const char *mutex_name, ast_mutex_t * t)
+{
+	return pthread_mutex_destroy(&t->mutex);
+}
+
+int __ast_pthread_mutex_lock(const char *filename, int lineno, const char *func, const char *mutex_name, ast_mutex_t * t)
+{
+	return pthread_mutex_lock(&t->mutex);
+}
+
+int __ast_pthread_mutex_trylock(const char *filename, int lineno, const char *func, const char *mutex_name, ast_mutex_t * t)
+{
+	return pthread_mutex_trylock(&t->mutex);
+}
+
+int __ast_pthread_mutex_unlock(const char *filename, int lineno, const char *func, const char *mutex_name, ast_mutex_t * t)
+{
+	return pthread_mutex_unlock(&t->mutex);
+}
+
+int __ast_rwlock_init(int tracking, const char *filename, int lineno, const char *func, const char *rwlock_name, ast_rwlock_t * t)
+{
+	return pthread_rwlock_init(&t->lock, NULL);
+}
+
+int __ast_rwlock_destroy(const char *filename, int lineno, const char *func, const char *rwlock_name, ast_rwlock_t * t)
+{
+	return pthread_rwlock_destroy(&t->lock);
+}
+
+int __ast_rwlock_unlock(const char *filename, int lineno, const char *func, ast_rwlock_t * t, const char *name)
+{
+	return pthread_rwlock_unlock(&t->lock);
+}
+
+int __ast_rwlock_rdlock(const char *filename, int lineno, const char *func, ast_rwlock_t * t, const char *name)
+{
+	return pthread_rwlock_rdlock(&t->lock);
+}
+
+int __ast_rwlock_wrlock(const char *filename, int lineno, const char *func, ast_rwlock_t * t, const char *name)
+{
+	return pthread_rwlock_wrlock(&t->lock);
+}
+
+int __ast_rwlock_tryrdlock(const char *filename, int lineno, const char *func, ast_rwlock_t * t, const char *name)
+{
+	return pthread_rwlock_tryrdlock(&t->lock);
+}
+
+int __ast_rwlock_trywrlock(const char *filename, int lineno, const char *func, ast_rwlock_t * t, const char *name)
+{
+	return pthread_rwlock_trywrlock(&t->lock);
+}
+
+int __ast_cond_init(const char *filename, int lineno, const char *func, const char *cond_name, ast_cond_t * cond, pthread_condattr_t * cond_attr)
+{
+	return pthread_cond_init(cond, cond_attr);
+}
+
+int __ast_cond_destroy(const char *filename, int lineno, const char *func, const char *cond_name, ast_cond_t * cond)
+{
+	return pthread_cond_destroy(cond);
+}
+
+int __ast_cond_signal(const char *filename, int lineno, const char *func, const char *cond_name, ast_cond_t * cond)
+{
+	return pthread_cond_signal(cond);
+}
+
+int __ast_cond_broadcast(const char *filename, int lineno, const char *func, const char *cond_name, ast_cond_t * cond)
+{
+	return pthread_cond_broadcast(cond);
+}
+
+int __ast_cond_wait(const char *filename, int lineno, const char *func, const char *cond_name, const char *mutex_name, ast_cond_t * cond, ast_mutex_t * t)
+{
+	return pthread_cond_wait(cond, &t->mutex);
+}
+
+int __ast_cond_timedwait(const char *filename, int lineno, const char *func, const char *cond_name, const char *mutex_name, ast_cond_t * cond, ast_mutex_t * t, const struct timespec *abstime)
+{
+	return pthread_cond_timedwait(cond, &t->mutex, abstime);
+}
+
+/* ========================================================================================================= threads */
+int ast_pthread_create_stack(pthread_t * thread, pthread_attr_t * attr, void *(*start_routine) (void *), void *data, size_t stacksize, const char *file, const char *caller, int line, const char *start_fn)
+{
+	pthread_attr_t local;
+	int res = 0;
+
+	if (!attr) {
+		pthread_attr_init(&local);
+		attr = &local;
+	}
+	if (stacksize) {
+		pthread_attr_setstacksize(attr, stacksize + PTHREAD_STACK_MIN);
+	}
+	res = pthread_create(thread, attr, start_routine, data);
+	if (attr == &local) {
+		pthread_attr_destroy(&local);
+	}
+	return res;
+}
+
+int ast_pthread_create_detached_stack(pthread_t * thread, pthread_attr_t * attr, void *(*start_routine) (void *), void *data, size_t stacksize, const char *file, const char *caller, int line, const char *start_fn)
+{
+	pthread_attr_t local;
+	int res = 0;
+
+	if (!attr) {
+		pthread_attr_init(&local);
+		attr = &local;
+	}
+	pthread_attr_setdetachstate(attr, PTHREAD_CREATE_DETACHED);
+	res = ast_pthread_create_stack(thread, attr, start_routine, data, stacksize, file, caller, line, start_fn);
+	if (attr == &local) {
+		pthread_attr_destroy(&local);
+	}
+	return res;
+}
+
+#if CS_TEST_FRAMEWORK
+/* ================================================================================================== test framework */
+/* the runner has no test framework, registered tests are simply not available */
+int ast_test_register(ast_test_cb_t * cb)
+{
+	return 0;
+}
+
+int ast_test_unregister(ast_test_cb_t * cb)
+{
+	return 0;
+}
+#endif
+
+/* ======================================================================================================= lifecycle */
+void sccp_mock_runtime_init(void)
+{
+	SCCP_LIST_HEAD_INIT(&mock_topics);
+	mock_mwi_all = mock_topic_find_or_create("mwi:", "all");
+}
+
+void sccp_mock_runtime_destroy(void)
+{
+	struct stasis_topic *topic = NULL;
+	struct stasis_subscription *sub = NULL;
+
+	SCCP_LIST_LOCK(&mock_topics);
+	while ((topic = SCCP_LIST_REMOVE_HEAD(&mock_topics, list))) {
+		SCCP_LIST_LOCK(&topic->subscriptions);
+		while ((sub = SCCP_LIST_REMOVE_HEAD(&topic->subscriptions, list))) {
+			sccp_free(sub);
+		}
+		SCCP_LIST_UNLOCK(&topic->subscriptions);
+		SCCP_LIST_HEAD_DESTROY(&topic->subscriptions);
+		sccp_free(topic);
+	}
+	SCCP_LIST_UNLOCK(&mock_topics);
+	mock_mwi_all = NULL;
+	mock_subscriptions = 0;
+}
+
+void sccp_mock_runtime_getStats(sccp_mock_stats_t * stats)
+{
+	stats->subscriptions = ATOMIC_FETCH(&mock_subscriptions, &mock_topics.lock);
+	stats->published = ATOMIC_FETCH(&mock_published, &mock_topics.lock);
+	stats->delivered = ATOMIC_FETCH(&mock_delivered, &mock_topics.lock);
+}
+// kate: indent-width 8; replace-tabs off; indent-mode cstyle; auto-insert-doxygen on; line-numbers on; tab-indents on; keep-extra-spaces off; auto-brackets off;
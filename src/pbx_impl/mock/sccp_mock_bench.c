@@ -0,0 +1,358 @@
+/*!
+ * \file        sccp_mock_bench.c
+ * \brief       SCCP Mock Benchmark Runner
+ * \note        Runs libsccp against the mock pbx backend, without asterisk:
+ *              - scheduler: timer churn through iPbx.sched_* on the virtual clock
+ *              - astdb: put/get/del through iPbx.feature_*Database
+ *              - replay: per device a synthetic registration / call / keepalive capture, replayed through sccp_handle_message
+ *              - bus: devicestate and mwi publishes fanned out to the libsccp subscribers
+ *              With -L it runs as a stub pbx instead: it listens on -b address / -p port (default 127.0.0.1:2000) for
+ *              -L seconds (0: until interrupted), so real or simulated phones (tools/sccp_phone_simulator.py) can
+ *              register over tcp. The virtual scheduler clock follows the wall clock while listening.
+ *              Usage: sccp_mock_bench [-n devices] [-l loops] [-k keepalives] [-e events] [-t tmpdir] [-v]
+ *                     sccp_mock_bench -L seconds [-b address] [-p port] [-v]
+ * \note        This program is free software and may be modified and distributed under the terms of the GNU Public License.
+ *              See the LICENSE file at the top of the source tree.
+ */
+#include "config.h"
+#include "common.h"
+#include "chan_sccp.h"
+#include "sccp_device.h"
+#include "sccp_netsock.h"
+#include "sccp_packet.h"
+#include "sccp_pcap.h"
+#include "sccp_session.h"
+#include "sccp_utils.h"
+#include "pbx_impl/mock/mock.h"
+
+#include <getopt.h>
+#include <signal.h>
+
+extern int sccp_mock_loglevel;
+
+typedef struct bench_options {
+	int devices;
+	int loops;
+	int keepalives;
+	int events;
+	const char *tmpdir;
+	int listen;												/* seconds to run as stub pbx (-1: benchmarks) */
+	const char *address;
+	int port;
+} bench_options_t;
+
+static volatile sig_atomic_t bench_interrupted = 0;
+
+static int bench_sched_cb(const void *data)
+{
+	int *counter = (int *) data;
+
+	(*counter)++;
+	return 0;
+}
+
+static int bench_sched_periodic_cb(const void *data)
+{
+	int *counter = (int *) data;
+
+	return ++(*counter) < 1000 ? 1 : 0;
+}
+
+static int64_t bench_elapsed_us(struct timeval start)
+{
+	return ast_tvdiff_us(ast_tvnow(), start);
+}
+
+static void bench_report(const char *name, uint64_t ops, int64_t usecs)
+{
+	printf("%-10s %10" PRIu64 " ops %10.3f ms %12.0f ops/sec\n", name, ops, (double) usecs / 1000, usecs ? (double) ops * 1000000 / usecs : 0.0);
+}
+
+static void bench_sched(const bench_options_t * options)
+{
+	int nr = options->devices * options->loops * 10;
+	int *ids = (int *) sccp_calloc(nr, sizeof(int));
+	int fired = 0, periodic = 0, idx = 0;
+	struct timeval start = ast_tvnow();
+
+	if (!ids) {
+		return;
+	}
+	/* keepalive like churn: add, delete half again, let the rest fire */
+	for (idx = 0; idx < nr; idx++) {
+		ids[idx] = iPbx.sched_add(1 + (idx * 7919) % 60000, bench_sched_cb, &fired);
+	}
+	for (idx = 0; idx < nr; idx += 2) {
+		iPbx.sched_del(ids[idx]);
+	}
+	iPbx.sched_add(10, bench_sched_periodic_cb, &periodic);
+	while (iPbx.sched_wait(-1) >= 0) {
+		sccp_mock_sched_advance(iPbx.sched_wait(-1));
+	}
+	bench_report("sched", (uint64_t) nr + nr / 2 + fired + periodic, bench_elapsed_us(start));
+	if (fired != nr / 2 || periodic != 1000) {
+		printf("sched: unexpected callback count fired:%d (expected %d), periodic:%d\n", fired, nr / 2, periodic);
+	}
+	sccp_free(ids);
+}
+
+static void bench_astdb(const bench_options_t * options)
+{
+	int nr = options->devices * options->loops * 10;
+	char key[32], value[32], out[32];
+	int idx = 0, found = 0;
+	struct timeval start = ast_tvnow();
+
+	for (idx = 0; idx < nr; idx++) {
+		snprintf(key, sizeof(key), "SEP%012X", idx % (options->devices * 10));
+		snprintf(value, sizeof(value), "%d", idx);
+		iPbx.feature_addToDatabase("SCCP/dnd", key, value);
+	}
+	for (idx = 0; idx < nr; idx++) {
+		snprintf(key, sizeof(key), "SEP%012X", idx % (options->devices * 10));
+		found += iPbx.feature_getFromDatabase("SCCP/dnd", key, out, sizeof(out)) ? 1 : 0;
+	}
+	iPbx.feature_removeTreeFromDatabase("SCCP", "dnd");
+	bench_report("astdb", (uint64_t) nr * 2, bench_elapsed_us(start));
+	if (found != nr) {
+		printf("astdb: only found %d out of %d keys\n", found, nr);
+	}
+}
+
+/* registration, a short call and some keepalives, as a phone would send them */
+static int bench_write_capture(const char *filename, int device, const bench_options_t * options)
+{
+	static const sccp_mid_t session[] = {
+		RegisterMessage, IpPortMessage, CapabilitiesResMessage, ButtonTemplateReqMessage, SoftKeyTemplateReqMessage,
+		SoftKeySetReqMessage, ConfigStatReqMessage, LineStatReqMessage, ForwardStatReqMessage, TimeDateReqMessage,
+		OffHookMessage, KeypadButtonMessage, KeypadButtonMessage, KeypadButtonMessage, OnHookMessage,
+	};
+	struct sockaddr_storage phone = { 0 }, server = { 0 };
+	sccp_pcap_t *pcap = NULL;
+	sccp_msg_t *msg = NULL;
+	uint32_t idx = 0;
+	int res = 0;
+
+	phone.ss_family = AF_INET;
+	((struct sockaddr_in *) &phone)->sin_addr.s_addr = htonl(0x0A000000 + device + 1);
+	sccp_netsock_setPort(&phone, 10000 + device % 50000);
+	server.ss_family = AF_INET;
+	((struct sockaddr_in *) &server)->sin_addr.s_addr = htonl(0x0A00FFFE);
+	sccp_netsock_setPort(&server, sccp_netsock_getPort(&GLOB(bindaddr)));
+
+	if (!(pcap = sccp_pcap_open(filename, &phone, &server))) {
+		return -1;
+	}
+	for (idx = 0; idx < ARRAY_LEN(session) + options->keepalives && !res; idx++) {
+		sccp_mid_t mid = idx < ARRAY_LEN(session) ? session[idx] : KeepAliveMessage;
+
+		if (!(msg = sccp_build_packet(mid, sccp_messagetypes[mid].size))) {
+			res = -1;
+			break;
+		}
+		switch (mid) {
+			case RegisterMessage:
+				snprintf(msg->data.RegisterMessage.sId.deviceName, sizeof(msg->data.RegisterMessage.sId.deviceName), "SEP%012X", device);
+				msg->data.RegisterMessage.lel_deviceType = htolel(SKINNY_DEVICETYPE_CISCO7960);
+				msg->data.RegisterMessage.lel_maxStreams = htolel(5);
+				msg->data.RegisterMessage.protocolFeatures.protocolVersion = 11;
+				break;
+			case KeypadButtonMessage:
+				msg->data.KeypadButtonMessage.lel_kpButton = htolel(1 + idx % 9);
+				msg->data.KeypadButtonMessage.lel_lineInstance = htolel(1);
+				break;
+			default:
+				break;
+		}
+		if (sccp_pcap_write(pcap, SCCP_PCAP_INBOUND, msg, letohl(msg->header.length) + 8) < 0) {
+			res = -1;
+		}
+		sccp_packet_release(msg);
+	}
+	sccp_pcap_close(pcap);
+	return res;
+}
+
+static void bench_replay(const bench_options_t * options)
+{
+	char filename[SCCP_PATH_MAX];
+	sccp_session_replay_stats_t stats;
+	uint64_t frames = 0, replies = 0, usecs = 0;
+	int device = 0, loop = 0, failed = 0;
+
+	for (device = 0; device < options->devices; device++) {
+		snprintf(filename, sizeof(filename), "%s/sccp_mock_bench_%d.pcap", options->tmpdir, device);
+		if (bench_write_capture(filename, device, options)) {
+			printf("replay: could not write %s\n", filename);
+			return;
+		}
+	}
+	for (loop = 0; loop < options->loops; loop++) {
+		for (device = 0; device < options->devices; device++) {
+			snprintf(filename, sizeof(filename), "%s/sccp_mock_bench_%d.pcap", options->tmpdir, device);
+			memset(&stats, 0, sizeof(stats));
+			if (sccp_session_replay(filename, FALSE, &stats)) {
+				failed++;
+			}
+			frames += stats.frames;
+			replies += stats.replies;
+			usecs += stats.duration_us;
+			/* let timers started by the registration (keepalive, digit timeouts) run */
+			sccp_mock_sched_advance(1000);
+		}
+	}
+	for (device = 0; device < options->devices; device++) {
+		snprintf(filename, sizeof(filename), "%s/sccp_mock_bench_%d.pcap", options->tmpdir, device);
+		unlink(filename);
+	}
+	bench_report("replay", frames, (int64_t) usecs);
+	printf("replay: %" PRIu64 " replies, %d failed replays, %d devices registered\n", replies, failed, SCCP_RWLIST_GETSIZE(&GLOB(devices)));
+}
+
+static void bench_bus(const bench_options_t * options)
+{
+	char name[64];
+	uint64_t delivered = 0;
+	int idx = 0, res = 0;
+	struct timeval start = ast_tvnow();
+
+	for (idx = 0; idx < options->events; idx++) {
+		snprintf(name, sizeof(name), "Custom:bench%d", idx % 16);
+		if ((res = sccp_mock_devstate_publish(name, (idx & 1) ? AST_DEVICE_INUSE : AST_DEVICE_NOT_INUSE)) > 0) {
+			delivered += res;
+		}
+		snprintf(name, sizeof(name), "%d@default", 100 + idx % options->devices);
+		if ((res = sccp_mock_mwi_publish(name, idx % 5, idx % 3)) > 0) {
+			delivered += res;
+		}
+	}
+	bench_report("bus", (uint64_t) options->events * 2, bench_elapsed_us(start));
+	printf("bus: %" PRIu64 " deliveries to libsccp subscribers\n", delivered);
+}
+
+static void bench_interrupt(int sig)
+{
+	bench_interrupted = 1;
+}
+
+static boolean_t bench_listen_address(const bench_options_t * options, struct sockaddr_storage *addr)
+{
+	struct sockaddr_in *in = (struct sockaddr_in *) addr;
+	struct sockaddr_in6 *in6 = (struct sockaddr_in6 *) addr;
+
+	memset(addr, 0, sizeof(*addr));
+	if (inet_pton(AF_INET, options->address, &in->sin_addr) == 1) {
+		addr->ss_family = AF_INET;
+	} else if (inet_pton(AF_INET6, options->address, &in6->sin6_addr) == 1) {
+		addr->ss_family = AF_INET6;
+	} else {
+		return FALSE;
+	}
+	sccp_netsock_setPort(addr, options->port);
+	return TRUE;
+}
+
+/* stub pbx: accept phones on the listening socket, while moving the virtual scheduler clock along with the wall clock */
+static int bench_listen(const bench_options_t * options)
+{
+	struct timeval start = ast_tvnow(), last = start;
+	int64_t elapsed = 0;
+
+	if (!bench_listen_address(options, &GLOB(bindaddr))) {
+		fprintf(stderr, "listen: invalid address '%s'\n", options->address);
+		return -1;
+	}
+	if (!sccp_session_bind_and_listen(&GLOB(bindaddr))) {
+		fprintf(stderr, "listen: could not listen on %s:%d\n", options->address, options->port);
+		return -1;
+	}
+	signal(SIGINT, bench_interrupt);
+	signal(SIGTERM, bench_interrupt);
+	printf("listening on %s:%d for %d seconds (0: until interrupted)\n", options->address, options->port, options->listen);
+	fflush(stdout);
+	while (!bench_interrupted && (!options->listen || ast_tvdiff_ms(ast_tvnow(), start) < (int64_t) options->listen * 1000)) {
+		usleep(10000);
+		elapsed = ast_tvdiff_ms(ast_tvnow(), last);
+		if (elapsed > 0) {
+			last = ast_tvadd(last, ast_samp2tv(elapsed, 1000));
+			sccp_mock_sched_advance((int) elapsed);
+		}
+	}
+	printf("listen: %d devices registered, %d sessions\n", SCCP_RWLIST_GETSIZE(&GLOB(devices)), SCCP_RWLIST_GETSIZE(&GLOB(sessions)));
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	bench_options_t options = { 10, 10, 5, 10000, "/tmp", -1, "127.0.0.1", DEFAULT_SCCP_PORT };
+	sccp_mock_stats_t stats;
+	int opt, res = 0;
+
+	while ((opt = getopt(argc, argv, "n:l:k:e:t:L:b:p:vh")) != -1) {
+		switch (opt) {
+			case 'n':
+				options.devices = atoi(optarg) > 0 ? atoi(optarg) : 1;
+				break;
+			case 'l':
+				options.loops = atoi(optarg) > 0 ? atoi(optarg) : 1;
+				break;
+			case 'k':
+				options.keepalives = atoi(optarg) >= 0 ? atoi(optarg) : 0;
+				break;
+			case 'e':
+				options.events = atoi(optarg) >= 0 ? atoi(optarg) : 0;
+				break;
+			case 't':
+				options.tmpdir = optarg;
+				break;
+			case 'L':
+				options.listen = atoi(optarg) >= 0 ? atoi(optarg) : 0;
+				break;
+			case 'b':
+				options.address = optarg;
+				break;
+			case 'p':
+				options.port = atoi(optarg) > 0 ? atoi(optarg) : DEFAULT_SCCP_PORT;
+				break;
+			case 'v':
+				sccp_mock_loglevel = __LOG_VERBOSE;
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-n devices] [-l loops] [-k keepalives] [-e events] [-t tmpdir] [-v]\n", argv[0]);
+				fprintf(stderr, "       %s -L seconds [-b address] [-p port] [-v]\n", argv[0]);
+				return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	sccp_mock_init();
+	if (!sccp_prePBXLoad()) {
+		fprintf(stderr, "sccp_prePBXLoad failed\n");
+		return 1;
+	}
+	GLOB(debug) = sccp_mock_loglevel >= __LOG_VERBOSE ? DEBUGCAT_CORE : DEBUGCAT_NONE;
+	GLOB(allowAnonymous) = TRUE;										/* register the synthetic devices on the hotline */
+	sccp_netsock_setPort(&GLOB(bindaddr), DEFAULT_SCCP_PORT);
+	GLOB(module_running) = TRUE;
+
+	if (options.listen >= 0) {										/* stub pbx, sessions come from the network */
+		res = bench_listen(&options) ? 1 : 0;
+	} else {												/* no listener, sessions only come from replays */
+		printf("%d devices, %d loops, %d keepalives, %d events\n", options.devices, options.loops, options.keepalives, options.events);
+		bench_sched(&options);
+		bench_astdb(&options);
+		bench_replay(&options);
+		bench_bus(&options);
+	}
+
+	sccp_mock_getStats(&stats);
+	printf("mock: channels:%u (allocated:%u) sched pending:%u added:%" PRIu64 " fired:%" PRIu64 " deleted:%" PRIu64 " callstates:%" PRIu64 " controls:%" PRIu64 "\n",
+		stats.channels, stats.channels_allocated, stats.sched_pending, stats.sched_added, stats.sched_fired, stats.sched_deleted, stats.callstates, stats.controls);
+	printf("mock: astdb entries:%u puts:%" PRIu64 " gets:%" PRIu64 " dels:%" PRIu64 ", bus subscriptions:%u published:%" PRIu64 " delivered:%" PRIu64 "\n",
+		stats.db_entries, stats.db_puts, stats.db_gets, stats.db_dels, stats.subscriptions, stats.published, stats.delivered);
+
+	sccp_preUnload();
+	while (sccp_mock_sched_advance(1000) > 0);
+	sccp_mock_destroy();
+	return res;
+}
+// kate: indent-width 8; replace-tabs off; indent-mode cstyle; auto-insert-doxygen on; line-numbers on; tab-indents on; keep-extra-spaces off; auto-brackets off;
@@ -29,6 +29,7 @@ SCCP_FILE_VERSION(__FILE__, "");
 #include "sccp_line.h"
 #include "sccp_labels.h"
 #include "sccp_featureParkingLot.h"
+#include "sccp_msgstats.h"
 
 /*!
  * \remarks
@@ -225,6 +226,7 @@ int sccp_handle_message(constMessagePtr msg, constSessionPtr s)
 	}
 
 	mid = letohl(msg->header.lel_messageId);
+	sccp_trace(DEBUGCAT_MESSAGE, SCCP_TRACE_MSG_RX, s, mid, letohl(msg->header.length), 0);
 
 	/* search for message handler */
 	//if ((mid >= SCCP_MESSAGE_LOW_BOUNDARY && mid <= SCCP_MESSAGE_HIGH_BOUNDARY)) {
@@ -234,7 +236,9 @@ int sccp_handle_message(constMessagePtr msg, constSessionPtr s)
 		messageMap_cb = &spcpMessagesCbMap[mid - SPCP_MESSAGE_OFFSET]; 
 	} else {
 		pbx_log(LOG_WARNING, "SCCP: Unknown Message %x. Don't know how to handle it. Skipping.\n", mid);
+		uint64_t start = sccp_msgstats_now();
 		handle_unknown_message(s, device, msg);
+		sccp_msgstats_record(mid, start);
 		return 0;
 	}
 	sccp_log((DEBUGCAT_MESSAGE)) (VERBOSE_PREFIX_3 "%s: >> Got message %s (0x%X)\n", sccp_session_getDesignator(s), msgtype2str(mid), mid);
@@ -246,7 +250,9 @@ int sccp_handle_message(constMessagePtr msg, constSessionPtr s)
 		return -3;
 	}
 	if (messageMap_cb->messageHandler_cb) {
+		uint64_t start = sccp_msgstats_now();
 		messageMap_cb->messageHandler_cb(s, device, msg);
+		sccp_msgstats_record(mid, start);
 	}
 
 	if (device && sccp_device_getRegistrationState(device) == SKINNY_DEVICE_RS_PROGRESS && mid == device->protocol->registrationFinishedMessageId) {
@@ -636,6 +642,14 @@ void handle_token_request(constSessionPtr s, devicePtr no_d, constMessagePtr msg
 	//sccp_log((DEBUGCAT_ACTION)) (VERBOSE_PREFIX_3 "%s: serverPriority: %d, unknown: %d, active call? %s\n", deviceName, serverPriority, letohl(msg_in->data.RegisterTokenRequest.unknown), (letohl(msg_in->data.RegisterTokenRequest.unknown) & 0x6) ? "yes" : "no");
 	device->keepalive = device->keepaliveinterval = device->keepalive ? device->keepalive : GLOB(keepalive);
 
+	/* registration storm: ask the phone to come back later */
+	if (sendAck && !sccp_device_admitRegistration(device, TRUE)) {
+		token_backoff_time = sccp_device_admissionBackoff();
+		sccp_log_and((DEBUGCAT_ACTION + DEBUGCAT_CORE)) (VERBOSE_PREFIX_2 "%s: Too many registrations, sending phone a token rejection, ask again in '%d' seconds\n", deviceName, token_backoff_time);
+		sccp_session_tokenReject(s, token_backoff_time);
+		goto EXIT;
+	}
+
 	sccp_device_setRegistrationState(device, SKINNY_DEVICE_RS_TOKEN);
 	if (sendAck) {
 		sccp_log_and((DEBUGCAT_ACTION + DEBUGCAT_CORE)) (VERBOSE_PREFIX_2 "%s: Acknowledging phone token request\n", deviceName);
@@ -767,6 +781,12 @@ void handle_SPCPTokenReq(constSessionPtr s, devicePtr no_d, constMessagePtr msg_
 		goto EXIT;
 	}
 
+	/* registration storm: ask the phone to come back later */
+	if (!sccp_device_admitRegistration(device, TRUE)) {
+		sccp_session_tokenRejectSPCP(s, sccp_device_admissionBackoff());
+		goto EXIT;
+	}
+
 	/* all checks passed, assign session to device */
 	// device->session = s;
 	device->keepalive = device->keepaliveinterval = device->keepalive ? device->keepalive : GLOB(keepalive);
@@ -879,6 +899,13 @@ void handle_register(constSessionPtr s, devicePtr maybe_d, constMessagePtr msg_i
 			goto FUNC_EXIT;
 		}
 
+		/* registration storm: phones which asked for a token were admitted when it was acknowledged */
+		if (!sccp_device_admitRegistration(device, FALSE)) {
+			pbx_log(LOG_NOTICE, "%s: Rejecting device: too many registrations in progress, come back later\n", deviceName);
+			sccp_session_reject(s, "Registration deferred");
+			goto FUNC_EXIT;
+		}
+
 	} else {
 		pbx_log(LOG_NOTICE, "%s: Rejecting device: Device Unknown \n", deviceName);
 		sccp_session_reject(s, "Device Unknown");
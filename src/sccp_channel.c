@@ -40,6 +40,11 @@ void __sccp_channel_destroy(sccp_channel_t * channel);
 
 AST_MUTEX_DEFINE_STATIC(callCountLock);
 
+/* global channel index by callid and passthrupartyid, mirrors the line channel lists (see sccp_line_addChannel/removeChannel) */
+static ast_rwlock_t channel_index_lock;
+static sccp_hashtable_t *channel_callid_index = NULL;
+static sccp_hashtable_t *channel_passthrupartyid_index = NULL;
+
 /*!
  * \brief Private Channel Data Structure
  */
@@ -432,6 +437,7 @@ void sccp_channel_send_callinfo2(sccp_channel_t * channel)
  */
 void sccp_channel_setChannelstate(channelPtr channel, sccp_channelstate_t state)
 {
+	sccp_trace(DEBUGCAT_CHANNEL, SCCP_TRACE_CHANNEL_STATE, channel->callid, state, channel->state, 0);
 	channel->previousChannelState = channel->state;
 	channel->state = state;
 }
@@ -2753,6 +2759,55 @@ sccp_channel_t *sccp_find_channel_by_lineInstance_and_callid(const sccp_device_t
 	return c;
 }
 
+/*!
+ * \brief Initialize the global channel index (callid / passthrupartyid)
+ */
+void sccp_channel_index_init(void)
+{
+	pbx_rwlock_init_notracking(&channel_index_lock);
+	ast_rwlock_wrlock(&channel_index_lock);
+	channel_callid_index = sccp_hashtable_create(SCCP_HASHTABLE_KEY_UINT32, 0);
+	channel_passthrupartyid_index = sccp_hashtable_create(SCCP_HASHTABLE_KEY_UINT32, 0);
+	ast_rwlock_unlock(&channel_index_lock);
+}
+
+/*!
+ * \brief Destroy the global channel index
+ */
+void sccp_channel_index_destroy(void)
+{
+	ast_rwlock_wrlock(&channel_index_lock);
+	sccp_hashtable_destroy(&channel_callid_index);
+	sccp_hashtable_destroy(&channel_passthrupartyid_index);
+	ast_rwlock_unlock(&channel_index_lock);
+	pbx_rwlock_destroy(&channel_index_lock);
+}
+
+/*!
+ * \brief Add channel to the global channel index
+ * \note called by sccp_line_addChannel, the index does not hold a reference of its own: the entry lives exactly as long as
+ *       the channel is on the line channel list, which holds the reference
+ */
+void sccp_channel_index_add(constChannelPtr channel)
+{
+	ast_rwlock_wrlock(&channel_index_lock);
+	sccp_hashtable_insert(channel_callid_index, (const void *) (uintptr_t) channel->callid, (void *) channel);
+	sccp_hashtable_insert(channel_passthrupartyid_index, (const void *) (uintptr_t) channel->passthrupartyid, (void *) channel);
+	ast_rwlock_unlock(&channel_index_lock);
+}
+
+/*!
+ * \brief Remove channel from the global channel index
+ * \note called by sccp_line_removeChannel, before the line channel list releases its reference
+ */
+void sccp_channel_index_remove(constChannelPtr channel)
+{
+	ast_rwlock_wrlock(&channel_index_lock);
+	sccp_hashtable_remove(channel_callid_index, (const void *) (uintptr_t) channel->callid, channel);
+	sccp_hashtable_remove(channel_passthrupartyid_index, (const void *) (uintptr_t) channel->passthrupartyid, channel);
+	ast_rwlock_unlock(&channel_index_lock);
+}
+
 /*!
  * \brief Find Line by ID
  *
@@ -2767,18 +2822,14 @@ sccp_channel_t *sccp_find_channel_by_lineInstance_and_callid(const sccp_device_t
 sccp_channel_t *sccp_channel_find_byid(uint32_t callid)
 {
 	sccp_channel_t *channel = NULL;
-	sccp_line_t *l = NULL;
 
 	sccp_log((DEBUGCAT_CHANNEL)) (VERBOSE_PREFIX_3 "SCCP: Looking for channel by id %u\n", callid);
 
-	SCCP_RWLIST_RDLOCK(&GLOB(lines));
-	SCCP_RWLIST_TRAVERSE(&GLOB(lines), l, list) {
-		channel = sccp_find_channel_on_line_byid(l, callid);
-		if (channel) {
-			break;
-		}
+	ast_rwlock_rdlock(&channel_index_lock);
+	if ((channel = (sccp_channel_t *) sccp_hashtable_find(channel_callid_index, (const void *) (uintptr_t) callid))) {
+		channel = channel->state != SCCP_CHANNELSTATE_DOWN ? sccp_channel_retain(channel) : NULL;
 	}
-	SCCP_RWLIST_UNLOCK(&GLOB(lines));
+	ast_rwlock_unlock(&channel_index_lock);
 	if (!channel) {
 		sccp_log((DEBUGCAT_CHANNEL)) (VERBOSE_PREFIX_3 "SCCP: Could not find channel for callid:%d on device\n", callid);
 	}
@@ -2800,20 +2851,14 @@ sccp_channel_t *sccp_channel_find_byid(uint32_t callid)
 sccp_channel_t *sccp_channel_find_bypassthrupartyid(uint32_t passthrupartyid)
 {
 	sccp_channel_t *c = NULL;
-	sccp_line_t *l = NULL;
 
 	sccp_log((DEBUGCAT_CHANNEL)) (VERBOSE_PREFIX_3 "SCCP: Looking for channel by PassThruId %u\n", passthrupartyid);
 
-	SCCP_RWLIST_RDLOCK(&GLOB(lines));
-	SCCP_RWLIST_TRAVERSE(&GLOB(lines), l, list) {
-		SCCP_LIST_LOCK(&l->channels);
-		c = SCCP_LIST_FIND(&l->channels, sccp_channel_t, tmpc, list, (tmpc->passthrupartyid == passthrupartyid && tmpc->state != SCCP_CHANNELSTATE_DOWN), TRUE, __FILE__, __LINE__, __PRETTY_FUNCTION__);
-		SCCP_LIST_UNLOCK(&l->channels);
-		if (c) {
-			break;
-		}
+	ast_rwlock_rdlock(&channel_index_lock);
+	if ((c = (sccp_channel_t *) sccp_hashtable_find(channel_passthrupartyid_index, (const void *) (uintptr_t) passthrupartyid))) {
+		c = c->state != SCCP_CHANNELSTATE_DOWN ? sccp_channel_retain(c) : NULL;
 	}
-	SCCP_RWLIST_UNLOCK(&GLOB(lines));
+	ast_rwlock_unlock(&channel_index_lock);
 
 	if (!c) {
 		sccp_log((DEBUGCAT_CHANNEL)) (VERBOSE_PREFIX_3 "SCCP: Could not find active channel with Passthrupartyid %u\n", passthrupartyid);
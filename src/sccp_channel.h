@@ -193,6 +193,12 @@ SCCP_API int SCCP_CALL sccp_channel_callwaiting_tone_interval(sccp_device_t * de
 SCCP_API const char *sccp_channel_getLinkedId(const sccp_channel_t * channel);
 #endif
 
+// channel index
+SCCP_API void SCCP_CALL sccp_channel_index_init(void);
+SCCP_API void SCCP_CALL sccp_channel_index_destroy(void);
+SCCP_API void SCCP_CALL sccp_channel_index_add(constChannelPtr channel);
+SCCP_API void SCCP_CALL sccp_channel_index_remove(constChannelPtr channel);
+
 // find channel
 SCCP_API sccp_channel_t * SCCP_CALL sccp_channel_find_byid(uint32_t callid);
 SCCP_API sccp_channel_t * SCCP_CALL sccp_find_channel_on_line_byid(constLinePtr l, uint32_t id);
@@ -58,7 +58,9 @@ SCCP_FILE_VERSION(__FILE__, "");
 #include "sccp_utils.h"
 #include "sccp_config.h"
 #include "sccp_features.h"
+#include "sccp_msgstats.h"
 #include "sccp_mwi.h"
+#include "sccp_packet.h"
 #include "sccp_hint.h"
 #include "sccp_labels.h"
 #include "sys/stat.h"
@@ -479,7 +481,9 @@ static int sccp_show_globals(int fd, sccp_cli_totals_t *totals, struct mansessio
 	char *debugcategories;
 	int local_line_total = 0;
 	const char *actionid = "";
+	sccp_device_admission_stats_t admission_stats;
 
+	sccp_device_getAdmissionStats(&admission_stats);
 	pbx_rwlock_rdlock(&GLOB(lock));
 
 	sccp_codec_multiple2str(apref_buf, sizeof(apref_buf) - 1, GLOB(global_preferences).audio, ARRAY_LEN(GLOB(global_preferences).audio));
@@ -587,6 +591,14 @@ static int sccp_show_globals(int fd, sccp_cli_totals_t *totals, struct mansessio
 #endif
 	CLI_AMI_OUTPUT_PARAM("Token FallBack", CLI_AMI_LIST_WIDTH, "%s", GLOB(token_fallback));
 	CLI_AMI_OUTPUT_PARAM("Token Backoff-Time", CLI_AMI_LIST_WIDTH, "%d", GLOB(token_backoff_time));
+	CLI_AMI_OUTPUT_BOOL("Session Reactor", CLI_AMI_LIST_WIDTH, GLOB(session_reactor));
+	CLI_AMI_OUTPUT_PARAM("Session Workers", CLI_AMI_LIST_WIDTH, "%d", GLOB(session_workers));
+	CLI_AMI_OUTPUT_PARAM("Registration Rate", CLI_AMI_LIST_WIDTH, "%u/s", GLOB(registration_rate));
+	CLI_AMI_OUTPUT_PARAM("Registration Max InProgress", CLI_AMI_LIST_WIDTH, "%u", GLOB(registration_max_inprogress));
+	CLI_AMI_OUTPUT_PARAM("Registrations InProgress", CLI_AMI_LIST_WIDTH, "%u", admission_stats.inprogress);
+	CLI_AMI_OUTPUT_PARAM("Registrations Admitted", CLI_AMI_LIST_WIDTH, "%lu", (unsigned long) admission_stats.admitted);
+	CLI_AMI_OUTPUT_PARAM("Registrations Deferred", CLI_AMI_LIST_WIDTH, "%lu", (unsigned long) admission_stats.deferred);
+	CLI_AMI_OUTPUT_PARAM("Registrations Rejected", CLI_AMI_LIST_WIDTH, "%lu", (unsigned long) admission_stats.rejected);
 	CLI_AMI_OUTPUT_BOOL("Hotline_Enabled", CLI_AMI_LIST_WIDTH, GLOB(allowAnonymous));
 	CLI_AMI_OUTPUT_PARAM("Hotline_Exten", CLI_AMI_LIST_WIDTH, "%s", GLOB(hotline->exten));
 	CLI_AMI_OUTPUT_PARAM("Hotline_Context", CLI_AMI_LIST_WIDTH, "%s", GLOB(hotline)->line->context ? GLOB(hotline)->line->context : "<not set>");
@@ -1533,6 +1545,21 @@ CLI_AMI_ENTRY(show_sessions, sccp_cli_show_sessions, "Show all SCCP sessions", c
 #undef CLI_COMPLETE
 #undef AMI_COMMAND
 #undef CLI_COMMAND
+#endif														/* DOXYGEN_SHOULD_SKIP_THIS */
+/* -------------------------------------------------------------------------------------------------------SHOW CAPTURES- */
+static char cli_captures_usage[] = "Usage: sccp show captures\n" "	Show the SCCP sessions being captured and the active capture pattern.\n";
+static char ami_captures_usage[] = "Usage: SCCPShowCaptures\n" "Show the SCCP sessions being captured.\n\n" "PARAMS: None\n";
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+#define CLI_COMMAND "sccp", "show", "captures"
+#define AMI_COMMAND "SCCPShowCaptures"
+#define CLI_COMPLETE SCCP_CLI_NULL_COMPLETER
+#define CLI_AMI_PARAMS ""
+CLI_AMI_ENTRY(show_captures, sccp_cli_show_captures, "Show SCCP session captures", cli_captures_usage, FALSE, TRUE)
+#undef CLI_AMI_PARAMS
+#undef CLI_COMPLETE
+#undef AMI_COMMAND
+#undef CLI_COMMAND
 #endif														/* DOXYGEN_SHOULD_SKIP_THIS */
     /* ---------------------------------------------------------------------------------------------SHOW_MWI_SUBSCRIPTIONS- */
     // sccp_show_mwi_subscriptions implementation moved to sccp_mwi.c, because of access to private struct
@@ -1950,6 +1977,70 @@ CLI_AMI_ENTRY(show_refcount, sccp_show_refcount, "Show all Refcount Entries", cl
 #undef CLI_COMPLETE
 #undef AMI_COMMAND
 #undef CLI_COMMAND
+#endif														/* DOXYGEN_SHOULD_SKIP_THIS */
+
+    /* ------------------------------------------------------------------------------------------------------SHOW_MEMORY - */
+static char cli_show_memory_usage[] = "Usage: sccp show memory\n" "	Show SCCP Packet Pool usage (allocations, cache hit rate and outstanding buffers).\n";
+static char ami_show_memory_usage[] = "Usage: SCCPShowMemory\n" "Show SCCP Packet Pool usage.\n\n" "PARAMS: None\n";
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+#define CLI_COMMAND "sccp", "show", "memory"
+#define AMI_COMMAND "SCCPShowMemory"
+#define CLI_COMPLETE SCCP_CLI_NULL_COMPLETER
+#define CLI_AMI_PARAMS ""
+CLI_AMI_ENTRY(show_memory, sccp_show_memory, "Show SCCP Packet Pool usage", cli_show_memory_usage, FALSE, TRUE)
+#undef CLI_AMI_PARAMS
+#undef CLI_COMPLETE
+#undef AMI_COMMAND
+#undef CLI_COMMAND
+#endif														/* DOXYGEN_SHOULD_SKIP_THIS */
+
+    /* --------------------------------------------------------------------------------------------------SHOW_THREADPOOL - */
+static char cli_show_threadpool_usage[] = "Usage: sccp show threadpool\n" "	Show SCCP Threadpool usage (queue depth, work stealing and job latency).\n";
+static char ami_show_threadpool_usage[] = "Usage: SCCPShowThreadpool\n" "Show SCCP Threadpool usage.\n\n" "PARAMS: None\n";
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+#define CLI_COMMAND "sccp", "show", "threadpool"
+#define AMI_COMMAND "SCCPShowThreadpool"
+#define CLI_COMPLETE SCCP_CLI_NULL_COMPLETER
+#define CLI_AMI_PARAMS ""
+CLI_AMI_ENTRY(show_threadpool, sccp_show_threadpool, "Show SCCP Threadpool usage", cli_show_threadpool_usage, FALSE, TRUE)
+#undef CLI_AMI_PARAMS
+#undef CLI_COMPLETE
+#undef AMI_COMMAND
+#undef CLI_COMMAND
+#endif														/* DOXYGEN_SHOULD_SKIP_THIS */
+
+    /* -------------------------------------------------------------------------------------------------------SHOW_TRACE - */
+static char cli_show_trace_usage[] = "Usage: sccp show trace [count]\n" "	Show the most recent records in the SCCP trace rings (default 100), see 'sccp trace'.\n";
+static char ami_show_trace_usage[] = "Usage: SCCPShowTrace\n" "Show the most recent records in the SCCP trace rings.\n\n" "Optional PARAMS: Count\n";
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+#define CLI_COMMAND "sccp", "show", "trace"
+#define AMI_COMMAND "SCCPShowTrace"
+#define CLI_COMPLETE SCCP_CLI_NULL_COMPLETER
+#define CLI_AMI_PARAMS "Count"
+CLI_AMI_ENTRY(show_trace, sccp_show_trace, "Show SCCP Trace Records", cli_show_trace_usage, FALSE, TRUE)
+#undef CLI_AMI_PARAMS
+#undef CLI_COMPLETE
+#undef AMI_COMMAND
+#undef CLI_COMMAND
+#endif														/* DOXYGEN_SHOULD_SKIP_THIS */
+
+    /* -----------------------------------------------------------------------------------------------SHOW_STATS_MESSAGES - */
+static char cli_show_stats_messages_usage[] = "Usage: sccp show stats messages [reset]\n" "	Show the number of messages handled per message type, with handler latency percentiles in usec.\n" "	Queue latency is the time between the session reactor seeing the data and the handler being called.\n" "	reset clears the statistics after showing them.\n";
+static char ami_show_stats_messages_usage[] = "Usage: SCCPShowStatsMessages\n" "Show the number of messages handled and handler latency per message type.\n\n" "Optional PARAMS: Reset (yes to clear the statistics after showing them)\n";
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+#define CLI_COMMAND "sccp", "show", "stats", "messages"
+#define AMI_COMMAND "SCCPShowStatsMessages"
+#define CLI_COMPLETE SCCP_CLI_NULL_COMPLETER
+#define CLI_AMI_PARAMS "Reset"
+CLI_AMI_ENTRY(show_stats_messages, sccp_show_stats_messages, "Show SCCP Message Statistics", cli_show_stats_messages_usage, FALSE, TRUE)
+#undef CLI_AMI_PARAMS
+#undef CLI_COMPLETE
+#undef AMI_COMMAND
+#undef CLI_COMMAND
 #endif														/* DOXYGEN_SHOULD_SKIP_THIS */
 
     /* --------------------------------------------------------------------------------------------------SHOW_SOKFTKEYSETS- */
@@ -2483,6 +2574,138 @@ static char no_debug_usage[] = "Usage: SCCP no debug\n" "       Disables dumping
 CLI_ENTRY(cli_no_debug, sccp_no_debug, "Set SCCP Debugging Types", no_debug_usage, FALSE)
 #undef CLI_COMMAND
 #undef CLI_COMPLETE
+#endif														/* DOXYGEN_SHOULD_SKIP_THIS */
+    /* ---------------------------------------------------------------------------------------------------------------TRACE- */
+    /*!
+     * \brief Trace
+     * \param fd Fd as int
+     * \param argc Argc as int
+     * \param argv[] Argv[] as char
+     * \return Result as int
+     * 
+     * \called_from_asterisk
+     */
+static int sccp_cli_trace(int fd, int argc, char *argv[])
+{
+	int32_t new_trace = GLOB(trace);
+
+	if (argc == 4 && sccp_strcaseequals(argv[2], "dump")) {
+		int records = sccp_trace_dump(argv[3]);
+
+		if (records < 0) {
+			pbx_cli(fd, "SCCP trace dump to '%s' failed\n", argv[3]);
+			return RESULT_FAILURE;
+		}
+		pbx_cli(fd, "SCCP trace: %d records written to '%s'\n", records, argv[3]);
+		return RESULT_SUCCESS;
+	}
+	if (argc == 3 && sccp_strcaseequals(argv[2], "clear")) {
+		sccp_trace_clear();
+		pbx_cli(fd, "SCCP trace cleared\n");
+		return RESULT_SUCCESS;
+	}
+	if (argc > 2) {
+		new_trace = sccp_parse_debugline(argv, 2, argc, new_trace);
+	}
+
+	char *tracecategories = sccp_get_debugcategories(new_trace);
+
+	if (argc > 2) {
+		pbx_cli(fd, "SCCP new trace status: (%d -> %d) %s\n", GLOB(trace), new_trace, tracecategories);
+	} else {
+		pbx_cli(fd, "SCCP trace status: (%d) %s\n", GLOB(trace), tracecategories);
+	}
+	sccp_free(tracecategories);
+
+	GLOB(trace) = new_trace;
+	return RESULT_SUCCESS;
+}
+
+static char cli_trace_usage[] = "Usage: SCCP trace [no] <categories> | dump <filename> | clear\n" "       Record the events of one or more categories (separated by commas, see 'sccp debug') in the binary trace rings.\n" "       dump writes all records to <filename> (decode using tools/sccp_trace_decode.py), clear forgets the records up to now.\n";
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+#define CLI_COMMAND "sccp", "trace"
+#define CLI_COMPLETE SCCP_CLI_DEBUG_COMPLETER
+CLI_ENTRY(cli_trace, sccp_cli_trace, "Set SCCP Trace Categories", cli_trace_usage, TRUE)
+#undef CLI_COMPLETE
+#undef CLI_COMMAND
+#endif														/* DOXYGEN_SHOULD_SKIP_THIS */
+    /* -------------------------------------------------------------------------------------------------------------CAPTURE- */
+    /*!
+     * \brief Start / Stop Session Capture
+     * \param fd Fd as int
+     * \param argc Argc as int
+     * \param argv[] Argv[] as char
+     * \return Result as int
+     * 
+     * \called_from_asterisk
+     */
+static int sccp_cli_capture(int fd, int argc, char *argv[])
+{
+	if (argc >= 4 && argc <= 5 && sccp_strcaseequals(argv[2], "start")) {
+		int started = sccp_session_startCapture(argv[3], argc == 5 ? argv[4] : NULL);
+
+		pbx_cli(fd, "SCCP capture of '%s' started, %d session(s) being captured, devices matching the pattern will be captured when they register\n", argv[3], started);
+		return RESULT_SUCCESS;
+	}
+	if (argc >= 3 && argc <= 4 && sccp_strcaseequals(argv[2], "stop")) {
+		int stopped = sccp_session_stopCapture(argc == 4 ? argv[3] : NULL);
+
+		pbx_cli(fd, "SCCP capture stopped, %d capture file(s) closed\n", stopped);
+		return RESULT_SUCCESS;
+	}
+	return RESULT_SHOWUSAGE;
+}
+
+static char cli_capture_usage[] = "Usage: sccp capture start <deviceId or pattern> [directory] | stop [<deviceId or pattern>]\n" "       Write the messages of matching sessions to a pcap file per session (default: the asterisk log directory).\n" "       The pattern (shell wildcards, '*' for all) is matched against the device name, or the ip-address of the phone before it registered.\n";
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+#define CLI_COMMAND "sccp", "capture"
+#define CLI_COMPLETE SCCP_CLI_NULL_COMPLETER
+CLI_ENTRY(cli_capture, sccp_cli_capture, "Start/Stop SCCP session capture", cli_capture_usage, FALSE)
+#undef CLI_COMPLETE
+#undef CLI_COMMAND
+#endif														/* DOXYGEN_SHOULD_SKIP_THIS */
+    /* --------------------------------------------------------------------------------------------------------------REPLAY- */
+    /*!
+     * \brief Replay a Session Capture
+     * \param fd Fd as int
+     * \param argc Argc as int
+     * \param argv[] Argv[] as char
+     * \return Result as int
+     * 
+     * \called_from_asterisk
+     */
+static int sccp_cli_replay(int fd, int argc, char *argv[])
+{
+	sccp_session_replay_stats_t stats;
+	boolean_t realtime = FALSE;
+
+	if (argc < 3 || argc > 4) {
+		return RESULT_SHOWUSAGE;
+	}
+	if (argc == 4) {
+		if (!sccp_strcaseequals(argv[3], "realtime")) {
+			return RESULT_SHOWUSAGE;
+		}
+		realtime = TRUE;
+	}
+	if (sccp_session_replay(argv[2], realtime, &stats) != 0) {
+		pbx_cli(fd, "SCCP replay of '%s' failed after %u frames\n", argv[2], stats.frames);
+		return RESULT_FAILURE;
+	}
+	pbx_cli(fd, "SCCP replayed %u frames from '%s' in %.3f ms (%.0f frames/sec), %lu replies sent (%u in the capture)\n", stats.frames, argv[2], (double) stats.duration_us / 1000, stats.duration_us ? (double) stats.frames * 1000000 / stats.duration_us : 0.0, stats.replies, stats.captured_replies);
+	return RESULT_SUCCESS;
+}
+
+static char cli_replay_usage[] = "Usage: sccp replay <filename> [realtime]\n" "       Feed the messages a phone sent in a capture file (sccp capture or tcpdump of the sccp port) through the message handlers.\n" "       Replies are counted and dropped. Replaying a registration registers that device (test systems only).\n" "       'realtime' keeps the captured time between the messages, otherwise they are replayed as fast as possible.\n";
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+#define CLI_COMMAND "sccp", "replay"
+#define CLI_COMPLETE SCCP_CLI_NULL_COMPLETER
+CLI_ENTRY(cli_replay, sccp_cli_replay, "Replay an SCCP session capture", cli_replay_usage, FALSE)
+#undef CLI_COMPLETE
+#undef CLI_COMMAND
 #endif														/* DOXYGEN_SHOULD_SKIP_THIS */
 /* --------------------------------------------------------------------------------------------------------------RELOAD- */
 /*!
@@ -2708,6 +2931,9 @@ static int sccp_cli_reload(int fd, int argc, char *argv[])
 			goto EXIT;
 		}
 	}
+	if (force_reload) {
+		sccp_config_resetReloadChecksums();								/* re-apply every section */
+	}
 	sccp_config_file_status_t cfg = sccp_config_getConfig(force_reload);
 
 	switch (cfg) {
@@ -2726,6 +2952,11 @@ static int sccp_cli_reload(int fd, int argc, char *argv[])
 					pbx_cli(fd, "Unable to reload configuration.\n");
 					goto EXIT;
 				}
+				sccp_config_reload_stats_t stats;
+				sccp_config_getReloadStats(&stats);
+				pbx_cli(fd, "SCCP %s reload took %.3f ms, %u sections (%u unchanged)\n", stats.incremental ? "incremental" : "full", stats.duration_us / 1000.0, stats.sections, stats.unchanged);
+				pbx_cli(fd, " - devices: %u added, %u updated, %u removed\n", stats.devices_added, stats.devices_updated, stats.devices_removed);
+				pbx_cli(fd, " - lines  : %u added, %u updated, %u removed\n", stats.lines_added, stats.lines_updated, stats.lines_removed);
 				returnval = sccp_session_bind_and_listen( &GLOB(bindaddr) ) ? RESULT_SUCCESS : RESULT_FAILURE;
 			}
 			break;
@@ -3459,9 +3690,13 @@ static struct pbx_cli_entry cli_entries[] = {
 	AST_CLI_DEFINE(cli_remove_line_from_device, "Remove a line from a device."),
 	AST_CLI_DEFINE(cli_add_line_to_device, "Add a line to a device."),
 	AST_CLI_DEFINE(cli_show_sessions, "Show All SCCP Sessions."),
+	AST_CLI_DEFINE(cli_show_captures, "Show SCCP session captures."),
+	AST_CLI_DEFINE(cli_capture, "Start/Stop SCCP session capture."),
+	AST_CLI_DEFINE(cli_replay, "Replay an SCCP session capture."),
 	AST_CLI_DEFINE(cli_dnd_device, "Set DND on a device"),
 	AST_CLI_DEFINE(cli_do_debug, "Enable SCCP debugging."),
 	AST_CLI_DEFINE(cli_no_debug, "Disable SCCP debugging."),
+	AST_CLI_DEFINE(cli_trace, "Set SCCP trace categories."),
 	AST_CLI_DEFINE(cli_config_generate, "SCCP generate config file."),
 	AST_CLI_DEFINE(cli_reload, "SCCP module reload."),
 	AST_CLI_DEFINE(cli_reload_file, "SCCP module reload file."),
@@ -3479,6 +3714,10 @@ static struct pbx_cli_entry cli_entries[] = {
 	AST_CLI_DEFINE(cli_test, "Test message."),
 #endif
 	AST_CLI_DEFINE(cli_show_refcount, "Test message."),
+	AST_CLI_DEFINE(cli_show_memory, "Show SCCP Packet Pool usage."),
+	AST_CLI_DEFINE(cli_show_threadpool, "Show SCCP Threadpool usage."),
+	AST_CLI_DEFINE(cli_show_trace, "Show SCCP Trace Records."),
+	AST_CLI_DEFINE(cli_show_stats_messages, "Show SCCP Message Statistics."),
 	AST_CLI_DEFINE(cli_tokenack, "Send Token Acknowledgement."),
 #ifdef CS_SCCP_CONFERENCE
 	AST_CLI_DEFINE(cli_show_conferences, "Show running SCCP Conferences."),
@@ -3515,6 +3754,7 @@ int sccp_register_cli(void)
 	res |= pbx_manager_register("SCCPShowLine", _MAN_REP_FLAGS, manager_show_line, "show line", ami_line_usage);
 	res |= pbx_manager_register("SCCPShowChannels", _MAN_REP_FLAGS, manager_show_channels, "show channels", ami_channels_usage);
 	res |= pbx_manager_register("SCCPShowSessions", _MAN_REP_FLAGS, manager_show_sessions, "show sessions", ami_sessions_usage);
+	res |= pbx_manager_register("SCCPShowCaptures", _MAN_REP_FLAGS, manager_show_captures, "show session captures", ami_captures_usage);
 	res |= pbx_manager_register("SCCPShowMWISubscriptions", _MAN_REP_FLAGS, manager_show_mwi_subscriptions, "show mwi subscriptions", ami_mwi_subscriptions_usage);
 	res |= pbx_manager_register("SCCPShowSoftkeySets", _MAN_REP_FLAGS, manager_show_softkeysets, "show softkey sets", ami_show_softkeysets_usage);
 	res |= pbx_manager_register("SCCPMessageDevices", _MAN_REP_FLAGS, manager_message_devices, "message devices", ami_message_devices_usage);
@@ -3531,6 +3771,10 @@ int sccp_register_cli(void)
 	res |= pbx_manager_register("SCCPShowHintLineStates", _MAN_REP_FLAGS, manager_show_hint_lineStates, "show hint lineStates", ami_show_hint_lineStates_usage);
 	res |= pbx_manager_register("SCCPShowHintSubscriptions", _MAN_REP_FLAGS, manager_show_hint_subscriptions, "show hint subscriptions", ami_show_hint_subscriptions_usage);
 	res |= pbx_manager_register("SCCPShowRefcount", _MAN_REP_FLAGS, manager_show_refcount, "show refcount", ami_show_refcount_usage);
+	res |= pbx_manager_register("SCCPShowMemory", _MAN_REP_FLAGS, manager_show_memory, "show packet pool usage", ami_show_memory_usage);
+	res |= pbx_manager_register("SCCPShowThreadpool", _MAN_REP_FLAGS, manager_show_threadpool, "show threadpool usage", ami_show_threadpool_usage);
+	res |= pbx_manager_register("SCCPShowTrace", _MAN_REP_FLAGS, manager_show_trace, "show trace records", ami_show_trace_usage);
+	res |= pbx_manager_register("SCCPShowStatsMessages", _MAN_REP_FLAGS, manager_show_stats_messages, "show message statistics", ami_show_stats_messages_usage);
 
 	return res;
 }
@@ -3554,6 +3798,7 @@ int sccp_unregister_cli(void)
 	res |= pbx_manager_unregister("SCCPShowLine");
 	res |= pbx_manager_unregister("SCCPShowChannels");
 	res |= pbx_manager_unregister("SCCPShowSessions");
+	res |= pbx_manager_unregister("SCCPShowCaptures");
 	res |= pbx_manager_unregister("SCCPShowMWISubscriptions");
 	res |= pbx_manager_unregister("SCCPShowSoftkeySets");
 	res |= pbx_manager_unregister("SCCPMessageDevices");
@@ -3570,6 +3815,10 @@ int sccp_unregister_cli(void)
 	res |= pbx_manager_unregister("SCCPShowHintLineStates");
 	res |= pbx_manager_unregister("SCCPShowHintSubscriptions");
 	res |= pbx_manager_unregister("SCCPShowRefcount");
+	res |= pbx_manager_unregister("SCCPShowMemory");
+	res |= pbx_manager_unregister("SCCPShowThreadpool");
+	res |= pbx_manager_unregister("SCCPShowTrace");
+	res |= pbx_manager_unregister("SCCPShowStatsMessages");
 
 	return res;
 }
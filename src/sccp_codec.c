@@ -95,51 +95,145 @@ uint8_t __CONST__ sccp_codec_getArrayLen()
 {
 	return ARRAY_LEN(skinny_codecs);
 }
-#define _ARR2STR(arrayname, lookup_var, lookup_val, return_var) \
-        ({ \
-        uint32_t i; \
-        for (i = 0; i < ARRAY_LEN(arrayname); i++) { \
-                if (arrayname[i].lookup_var == lookup_val) { \
-                        return arrayname[i].return_var; \
-                } \
-        } \
-        pbx_log(LOG_ERROR, "_ARR2STR Lookup Failed for " #arrayname "." #lookup_var "=%i\n", lookup_val); \
-        return ""; \
-        })
+
+/*
+ * Direct-indexed view on skinny_codecs[], built once at load time. skinny_codec_index[codec] holds the position of the
+ * first table entry for that codec plus one (0 = unknown codec), so codec2xxx() no longer has to walk the table. The
+ * same position doubles as the bit number of the codec in a sccp_codec_set_t, used by the set operations below.
+ */
+#define SKINNY_CODEC_INDEX_SIZE (SKINNY_CODEC_V150_LC_SSE + 1)
+#define SKINNY_CODEC_SET_WORDS 2
+#define SKINNY_CODEC_SET_BITS (SKINNY_CODEC_SET_WORDS * 64)
+
+static uint8_t skinny_codec_index[SKINNY_CODEC_INDEX_SIZE];
+
+typedef struct {
+	uint64_t bits[SKINNY_CODEC_SET_WORDS];
+} sccp_codec_set_t;
+
+static void __attribute__((constructor)) sccp_codec_index_build(void)
+{
+	uint i;
+
+	if (ARRAY_LEN(skinny_codecs) > SKINNY_CODEC_SET_BITS) {						/* leave the index empty, everything falls back to a linear scan */
+		return;
+	}
+	for (i = 0; i < ARRAY_LEN(skinny_codecs); i++) {
+		uint32_t codec = skinny_codecs[i].codec;
+		if (codec < SKINNY_CODEC_INDEX_SIZE && !skinny_codec_index[codec]) {			/* duplicate codecs (h224): the first entry wins, like the linear scan did */
+			skinny_codec_index[codec] = i + 1;
+		}
+	}
+}
+
+/* position of codec in skinny_codecs[] or -1 */
+static inline int codec_position(skinny_codec_t value)
+{
+	uint i;
+
+	if ((uint32_t) value < SKINNY_CODEC_INDEX_SIZE && skinny_codec_index[value]) {
+		return skinny_codec_index[value] - 1;
+	}
+	for (i = 0; i < ARRAY_LEN(skinny_codecs); i++) {							/* index not built, or codec unknown */
+		if (skinny_codecs[i].codec == value) {
+			return i;
+		}
+	}
+	return -1;
+}
 
 gcc_inline const char *codec2str(skinny_codec_t value)
 {
-	_ARR2STR(skinny_codecs, codec, value, text);
+	int pos = codec_position(value);
+
+	if (pos < 0) {
+		pbx_log(LOG_ERROR, "codec2str lookup failed for skinny_codecs[%i]\n", value);
+		return "";
+	}
+	return skinny_codecs[pos].text;
 }
 
 gcc_inline const char *codec2name(skinny_codec_t value)
 {
-	_ARR2STR(skinny_codecs, codec, value, name);
+	int pos = codec_position(value);
+
+	if (pos < 0) {
+		pbx_log(LOG_ERROR, "codec2name lookup failed for skinny_codecs[%i]\n", value);
+		return "";
+	}
+	return skinny_codecs[pos].name;
 }
 
 /*! \todo should be called skinny_codec_type_t instead of skinny_payload_type_t */
 gcc_inline const skinny_payload_type_t codec2type(skinny_codec_t value)
 {
-        uint32_t i;
-        for (i = 0; i < ARRAY_LEN(skinny_codecs); i++) {
-                if (skinny_codecs[i].codec == value) {
-                        return skinny_codecs[i].codec_type;
-                } \
-        } \
-        pbx_log(LOG_ERROR, "codec2type lookup failed for skinny_codecs[%i]\n", value);
-        return SKINNY_CODEC_TYPE_UNKNOWN;
+	int pos = codec_position(value);
+
+	if (pos < 0) {
+		pbx_log(LOG_ERROR, "codec2type lookup failed for skinny_codecs[%i]\n", value);
+		return SKINNY_CODEC_TYPE_UNKNOWN;
+	}
+	return skinny_codecs[pos].codec_type;
 }
 
 gcc_inline const int32_t codec2rtp_payload_type(skinny_codec_t value)
 {
-        uint32_t i;
-        for (i = 0; i < ARRAY_LEN(skinny_codecs); i++) {
-                if (skinny_codecs[i].codec == value) {
-                        return skinny_codecs[i].rtp_payload_type;
-                } \
-        } \
-        pbx_log(LOG_ERROR, "codec2rtp_payload_type lookup failed for skinny_codecs[%i]\n", value);
-        return SKINNY_CODEC_TYPE_UNKNOWN;
+	int pos = codec_position(value);
+
+	if (pos < 0) {
+		pbx_log(LOG_ERROR, "codec2rtp_payload_type lookup failed for skinny_codecs[%i]\n", value);
+		return SKINNY_CODEC_TYPE_UNKNOWN;
+	}
+	return skinny_codecs[pos].rtp_payload_type;
+}
+
+/* bit of codec in a sccp_codec_set_t, or -1 when the codec is not indexed (not in skinny_codecs[]) */
+static inline int codec_set_bit(skinny_codec_t codec)
+{
+	if ((uint32_t) codec < SKINNY_CODEC_INDEX_SIZE && skinny_codec_index[codec]) {
+		return skinny_codec_index[codec] - 1;
+	}
+	return -1;
+}
+
+static inline void codec_set_add(sccp_codec_set_t * set, skinny_codec_t codec)
+{
+	int bit = codec_set_bit(codec);
+
+	if (bit >= 0) {
+		set->bits[bit >> 6] |= (uint64_t) 1 << (bit & 63);
+	}
+}
+
+/* build the set from a preference/capability array, up to the first SKINNY_CODEC_NONE */
+static void codec_set_fromArray(sccp_codec_set_t * set, const skinny_codec_t codecs[], uint8_t length)
+{
+	uint8_t x;
+
+	memset(set, 0, sizeof(sccp_codec_set_t));
+	for (x = 0; x < length && codecs[x] != SKINNY_CODEC_NONE; x++) {
+		codec_set_add(set, codecs[x]);
+	}
+}
+
+/*
+ * set was built from codecs[]: indexed codecs are a single bit test, codecs that are not in skinny_codecs[] (or an
+ * index that was not built) cannot be represented in the set and are looked up in the array itself
+ */
+static inline boolean_t codec_set_contains(const sccp_codec_set_t * set, skinny_codec_t codec, const skinny_codec_t codecs[], uint8_t length)
+{
+	int bit = codec_set_bit(codec);
+	uint8_t x;
+
+	if (bit >= 0) {
+		return (set->bits[bit >> 6] >> (bit & 63)) & 1 ? TRUE : FALSE;
+	}
+	for (x = 0; x < length && codecs[x] != SKINNY_CODEC_NONE; x++) {
+		if (codecs[x] == codec) {
+			return TRUE;
+		}
+	}
+	return FALSE;
 }
 
 /*!
@@ -278,6 +372,7 @@ int sccp_get_codecs_bytype(skinny_codec_t * in_codecs, skinny_codec_t *out_codec
 
 /*!
  * \brief Check if Skinny Codec is compatible with Skinny Capabilities Array
+ * \note single membership test, scanning the (max SKINNY_MAX_CAPABILITIES) array is cheaper than building a codec set first
  */
 boolean_t __PURE__ sccp_codec_isCompatible(skinny_codec_t codec, const skinny_codec_t capabilities[], uint8_t length)
 {
@@ -296,18 +391,18 @@ boolean_t __PURE__ sccp_codec_isCompatible(skinny_codec_t codec, const skinny_co
 
 /*!
  * \brief get smallest common denominator codecset
- * intersection of two sets
+ * intersection of two sets, keeping the preference order of base
  */
 void sccp_codec_reduceSet(skinny_codec_t base[SKINNY_MAX_CAPABILITIES], const skinny_codec_t reduceByCodecs[SKINNY_MAX_CAPABILITIES])
 {
 	skinny_codec_t temp[SKINNY_MAX_CAPABILITIES] = {0};
-	uint8_t x = 0, y = 0, z = 0;
+	sccp_codec_set_t reduceBy;
+	uint8_t x = 0, z = 0;
+
+	codec_set_fromArray(&reduceBy, reduceByCodecs, SKINNY_MAX_CAPABILITIES);
 	for (x = 0; x < SKINNY_MAX_CAPABILITIES && (z+1) < SKINNY_MAX_CAPABILITIES && base[x] != SKINNY_CODEC_NONE; x++) {
-		for (y = 0; y < SKINNY_MAX_CAPABILITIES && (z+1) < SKINNY_MAX_CAPABILITIES && reduceByCodecs[y] != SKINNY_CODEC_NONE; y++) {
-			if (base[x] == reduceByCodecs[y]) {
-				temp[z++] = base[x];
-				break;
-			}
+		if (codec_set_contains(&reduceBy, base[x], reduceByCodecs, SKINNY_MAX_CAPABILITIES)) {
+			temp[z++] = base[x];
 		}
 	}
 	memcpy(base, temp, sizeof(skinny_codec_t) * SKINNY_MAX_CAPABILITIES);
@@ -315,29 +410,26 @@ void sccp_codec_reduceSet(skinny_codec_t base[SKINNY_MAX_CAPABILITIES], const sk
 
 /*!
  * \brief combine two codecs sets skipping duplicates
- * union of two sets
+ * union of two sets, the codecs of addCodecs that are not in base yet are appended in their preference order
  */
 void sccp_codec_combineSets(skinny_codec_t base[SKINNY_MAX_CAPABILITIES], const skinny_codec_t addCodecs[SKINNY_MAX_CAPABILITIES])
 {
-	uint8_t x = 0, y = 0, z = 0, demarquation = SKINNY_MAX_CAPABILITIES;
+	sccp_codec_set_t present;
+	uint8_t y = 0, z = 0;
+
+	codec_set_fromArray(&present, base, SKINNY_MAX_CAPABILITIES);
 	for (y = 0; y < SKINNY_MAX_CAPABILITIES && addCodecs[y] != SKINNY_CODEC_NONE; y++) {
-		boolean_t found = FALSE;
-		for (x = 0; x < demarquation && base[x] != SKINNY_CODEC_NONE; x++) {
-			if (base[x] == addCodecs[y]) {
-				found = TRUE;
-				break;
-			}
+		if (codec_set_contains(&present, addCodecs[y], base, SKINNY_MAX_CAPABILITIES)) {
+			continue;
 		}
-		while (!found && z < SKINNY_MAX_CAPABILITIES) {
-			if (base[z] == SKINNY_CODEC_NONE) {
-				if (demarquation) {		// don't check against newly added codecs
-					demarquation = z;
-				}
-				base[z] = addCodecs[y];
-				break;
-			}
+		while (z < SKINNY_MAX_CAPABILITIES && base[z] != SKINNY_CODEC_NONE) {
 			z++;
 		}
+		if (z >= SKINNY_MAX_CAPABILITIES) {
+			break;
+		}
+		base[z] = addCodecs[y];
+		codec_set_add(&present, addCodecs[y]);
 	}
 }
 
@@ -379,5 +471,167 @@ EXIT:
 	return res;
 }
 
+#if CS_TEST_FRAMEWORK
+#include <asterisk/test.h>
+
+/* the set operations as they were before the codec sets, used as reference by the benchmark */
+static void codec_reduceSet_linear(skinny_codec_t base[SKINNY_MAX_CAPABILITIES], const skinny_codec_t reduceByCodecs[SKINNY_MAX_CAPABILITIES])
+{
+	skinny_codec_t temp[SKINNY_MAX_CAPABILITIES] = {0};
+	uint8_t x = 0, y = 0, z = 0;
+	for (x = 0; x < SKINNY_MAX_CAPABILITIES && (z+1) < SKINNY_MAX_CAPABILITIES && base[x] != SKINNY_CODEC_NONE; x++) {
+		for (y = 0; y < SKINNY_MAX_CAPABILITIES && (z+1) < SKINNY_MAX_CAPABILITIES && reduceByCodecs[y] != SKINNY_CODEC_NONE; y++) {
+			if (base[x] == reduceByCodecs[y]) {
+				temp[z++] = base[x];
+				break;
+			}
+		}
+	}
+	memcpy(base, temp, sizeof(skinny_codec_t) * SKINNY_MAX_CAPABILITIES);
+}
+
+static void codec_combineSets_linear(skinny_codec_t base[SKINNY_MAX_CAPABILITIES], const skinny_codec_t addCodecs[SKINNY_MAX_CAPABILITIES])
+{
+	uint8_t x = 0, y = 0, z = 0, demarquation = SKINNY_MAX_CAPABILITIES;
+	for (y = 0; y < SKINNY_MAX_CAPABILITIES && addCodecs[y] != SKINNY_CODEC_NONE; y++) {
+		boolean_t found = FALSE;
+		for (x = 0; x < demarquation && base[x] != SKINNY_CODEC_NONE; x++) {
+			if (base[x] == addCodecs[y]) {
+				found = TRUE;
+				break;
+			}
+		}
+		while (!found && z < SKINNY_MAX_CAPABILITIES) {
+			if (base[z] == SKINNY_CODEC_NONE) {
+				if (demarquation) {
+					demarquation = z;
+				}
+				base[z] = addCodecs[y];
+				break;
+			}
+			z++;
+		}
+	}
+}
+
+#define CODEC_BENCH_SETS 64
+#define CODEC_BENCH_ROUNDS 100000
+AST_TEST_DEFINE(sccp_codec_negotiation_bench)
+{
+	skinny_codec_t audio[ARRAY_LEN(skinny_codecs)];
+	skinny_codec_t sets[CODEC_BENCH_SETS][SKINNY_MAX_CAPABILITIES];
+	skinny_codec_t caps[SKINNY_MAX_CAPABILITIES], prefs[SKINNY_MAX_CAPABILITIES];
+	skinny_codec_t caps_linear[SKINNY_MAX_CAPABILITIES], prefs_linear[SKINNY_MAX_CAPABILITIES];
+	uint32_t seed = 0x5cc9;
+	struct timeval start;
+	int64_t set_us, linear_us;
+	uint naudio = 0, errors = 0, compatible = 0;
+	uint i, k;
+
+	switch(cmd) {
+		case TEST_INIT:
+			info->name = "negotiationBench";
+			info->category = "/channels/chan_sccp/codec/";
+			info->summary = "chan-sccp-b codec negotiation benchmark";
+			info->description = "Combines and reduces full audio capability sets, using the codec sets and the linear scan";
+			return AST_TEST_NOT_RUN;
+		case TEST_EXECUTE:
+			break;
+	}
+
+	pbx_test_status_update(test, "Checking the direct-indexed codec table...\n");
+	for (i = 0; i < SKINNY_CODEC_INDEX_SIZE + 16; i++) {
+		int pos = -1;
+		for (k = 0; k < ARRAY_LEN(skinny_codecs); k++) {
+			if ((uint) skinny_codecs[k].codec == i) {
+				pos = k;
+				break;
+			}
+		}
+		if (codec_position((skinny_codec_t) i) != pos) {
+			pbx_test_status_update(test, "index mismatch for codec %d\n", i);
+			errors++;
+		}
+		if (pos >= 0 && (codec2name((skinny_codec_t) i) != skinny_codecs[pos].name || codec2type((skinny_codec_t) i) != skinny_codecs[pos].codec_type)) {
+			errors++;
+		}
+	}
+
+	/* full capability sets: SKINNY_MAX_CAPABILITIES distinct audio codecs each, in a different (preference) order */
+	for (i = 0; i < ARRAY_LEN(skinny_codecs); i++) {
+		if (skinny_codecs[i].codec_type == SKINNY_CODEC_TYPE_AUDIO && codec_position(skinny_codecs[i].codec) == (int) i) {
+			audio[naudio++] = skinny_codecs[i].codec;
+		}
+	}
+	pbx_test_validate(test, naudio >= SKINNY_MAX_CAPABILITIES);
+	for (i = 0; i < CODEC_BENCH_SETS; i++) {
+		for (k = naudio - 1; k > 0; k--) {
+			uint j;
+			skinny_codec_t tmp;
+			seed = seed * 1103515245 + 12345;
+			j = (seed >> 8) % (k + 1);
+			tmp = audio[k];
+			audio[k] = audio[j];
+			audio[j] = tmp;
+		}
+		memcpy(sets[i], audio, sizeof(skinny_codec_t) * SKINNY_MAX_CAPABILITIES);
+	}
+
+	pbx_test_status_update(test, "Negotiating %d rounds of full capability sets...\n", CODEC_BENCH_ROUNDS);
+	start = pbx_tvnow();
+	for (i = 0; i < CODEC_BENCH_ROUNDS; i++) {
+		memcpy(caps, sets[i % CODEC_BENCH_SETS], sizeof(caps));
+		caps[SKINNY_MAX_CAPABILITIES / 2] = SKINNY_CODEC_NONE;
+		sccp_codec_combineSets(caps, sets[(i + 1) % CODEC_BENCH_SETS]);
+		memcpy(prefs, sets[(i + 7) % CODEC_BENCH_SETS], sizeof(prefs));
+		sccp_codec_reduceSet(prefs, caps);
+		if (sccp_codec_isCompatible(prefs[0], caps, SKINNY_MAX_CAPABILITIES)) {
+			compatible++;
+		}
+	}
+	set_us = ast_tvdiff_us(pbx_tvnow(), start);
+
+	start = pbx_tvnow();
+	for (i = 0; i < CODEC_BENCH_ROUNDS; i++) {
+		memcpy(caps_linear, sets[i % CODEC_BENCH_SETS], sizeof(caps_linear));
+		caps_linear[SKINNY_MAX_CAPABILITIES / 2] = SKINNY_CODEC_NONE;
+		codec_combineSets_linear(caps_linear, sets[(i + 1) % CODEC_BENCH_SETS]);
+		memcpy(prefs_linear, sets[(i + 7) % CODEC_BENCH_SETS], sizeof(prefs_linear));
+		codec_reduceSet_linear(prefs_linear, caps_linear);
+	}
+	linear_us = ast_tvdiff_us(pbx_tvnow(), start);
+
+	/* the sets do not contain duplicates, so both implementations have to produce the same arrays */
+	for (i = 0; i < CODEC_BENCH_SETS * CODEC_BENCH_SETS; i++) {
+		memcpy(caps, sets[i % CODEC_BENCH_SETS], sizeof(caps));
+		caps[i % SKINNY_MAX_CAPABILITIES] = SKINNY_CODEC_NONE;
+		memcpy(caps_linear, caps, sizeof(caps));
+		sccp_codec_combineSets(caps, sets[i / CODEC_BENCH_SETS]);
+		codec_combineSets_linear(caps_linear, sets[i / CODEC_BENCH_SETS]);
+		memcpy(prefs, sets[(i + 3) % CODEC_BENCH_SETS], sizeof(prefs));
+		memcpy(prefs_linear, prefs, sizeof(prefs));
+		sccp_codec_reduceSet(prefs, caps);
+		codec_reduceSet_linear(prefs_linear, caps_linear);
+		if (memcmp(caps, caps_linear, sizeof(caps)) || memcmp(prefs, prefs_linear, sizeof(prefs))) {
+			errors++;
+		}
+	}
+
+	pbx_test_status_update(test, "codec set: %.3f ms, %.3f usec per negotiation (%u compatible)\n", (double) set_us / 1000, (double) set_us / CODEC_BENCH_ROUNDS, compatible);
+	pbx_test_status_update(test, "linear   : %.3f ms, %.3f usec per negotiation\n", (double) linear_us / 1000, (double) linear_us / CODEC_BENCH_ROUNDS);
+	pbx_test_validate(test, errors == 0);
+	return AST_TEST_PASS;
+}
+
+static void __attribute__((constructor)) sccp_register_tests(void)
+{
+	AST_TEST_REGISTER(sccp_codec_negotiation_bench);
+}
+
+static void __attribute__((destructor)) sccp_unregister_tests(void)
+{
+	AST_TEST_UNREGISTER(sccp_codec_negotiation_bench);
+}
+#endif
 
 // kate: indent-width 8; replace-tabs off; indent-mode cstyle; auto-insert-doxygen on; line-numbers on; tab-indents on; keep-extra-spaces off; auto-brackets off;
@@ -29,6 +29,11 @@
  * - modified sccp_config_general
  *
  * - modified sccp_config_readDevicesLines
+ *  - calculates a content checksum per section and compares it to the previous (re)load
+ *    - if [general] and all softkeysets are unchanged, the reload is incremental: unchanged sections are skipped, and only
+ *      added, changed and removed devices/lines go through pre_reload/build/post_reload (sccp_device_pre_reload_device / sccp_line_pre_reload_line)
+ *    - otherwise all sections are re-applied as described below ('sccp reload force' always does)
+ *    .
  *  - sets pendingDelete for
  *    - devices (via sccp_device_pre_reload),
  *    - lines (via sccp_line_pre_reload)
@@ -227,6 +232,111 @@ static const SCCPConfigSegment sccpConfigSegments[] = {
 	{"softkey", sccpSoftKeyConfigOptions, ARRAY_LEN(sccpSoftKeyConfigOptions), SCCP_CONFIG_SOFTKEY_SEGMENT},
 };
 
+/*!
+ * \brief SCCP Config Option Name Index Entry
+ */
+typedef struct SCCPConfigOptionName {
+	const char *name;											/*!< option name, or one of its "|" separated aliases */
+	uint16_t option;											/*!< index into the segment config */
+} SCCPConfigOptionName;
+
+/*!
+ * \brief SCCP Config Segment Index
+ *
+ * Built once when the module is loaded, so that looking up a parameter while parsing sccp.conf is a binary search over
+ * the (alias expanded) option names, instead of a linear scan which splits every aliased name again for each lookup.
+ */
+static struct SCCPConfigSegmentIndex {
+	SCCPConfigOptionName *names;										/*!< sorted case-insensitive */
+	uint16_t num_names;
+	uint16_t *sameOffset;											/*!< next option storing to the same member (ring, itself when unique) */
+	char *namebuf;
+} sccpConfigSegmentIndex[ARRAY_LEN(sccpConfigSegments)];
+
+/* duplicate names keep their table order, the first one wins (like the linear scan did) */
+static int sccp_config_optionname_cmp(const void *a, const void *b)
+{
+	const SCCPConfigOptionName *name_a = (const SCCPConfigOptionName *) a;
+	const SCCPConfigOptionName *name_b = (const SCCPConfigOptionName *) b;
+	int cmp = strcasecmp(name_a->name, name_b->name);
+
+	return cmp ? cmp : (int) name_a->option - (int) name_b->option;
+}
+
+static void __attribute__((constructor)) sccp_config_index_build(void)
+{
+	uint8_t segidx = 0;
+
+	for (segidx = 0; segidx < ARRAY_LEN(sccpConfigSegments); segidx++) {
+		const SCCPConfigSegment *sccpConfigSegment = &sccpConfigSegments[segidx];
+		struct SCCPConfigSegmentIndex *segindex = &sccpConfigSegmentIndex[segidx];
+		uint16_t num_names = 0;
+		size_t buflen = 0;
+		uint16_t i, j;
+		char *ptr = NULL;
+
+		for (i = 0; i < sccpConfigSegment->config_size; i++) {
+			const char *c = sccpConfigSegment->config[i].name;
+			num_names++;
+			while ((c = strchr(c, '|'))) {
+				num_names++;
+				c++;
+			}
+			buflen += strlen(sccpConfigSegment->config[i].name) + 1;
+		}
+		segindex->names = (SCCPConfigOptionName *) sccp_calloc(num_names, sizeof(SCCPConfigOptionName));
+		segindex->sameOffset = (uint16_t *) sccp_calloc(sccpConfigSegment->config_size, sizeof(uint16_t));
+		segindex->namebuf = (char *) sccp_calloc(1, buflen);
+		if (!segindex->names || !segindex->sameOffset || !segindex->namebuf) {
+			pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
+			sccp_free(segindex->names);
+			sccp_free(segindex->sameOffset);
+			sccp_free(segindex->namebuf);
+			memset(segindex, 0, sizeof(*segindex));							/* sccp_find_config falls back to a linear scan */
+			continue;
+		}
+
+		/* expand the aliases */
+		ptr = segindex->namebuf;
+		for (i = 0; i < sccpConfigSegment->config_size; i++) {
+			char *token = NULL, *tokenptr = NULL;
+
+			strcpy(ptr, sccpConfigSegment->config[i].name);
+			for (token = strtok_r(ptr, "|", &tokenptr); token; token = strtok_r(NULL, "|", &tokenptr)) {
+				segindex->names[segindex->num_names].name = token;
+				segindex->names[segindex->num_names].option = i;
+				segindex->num_names++;
+			}
+			ptr += strlen(sccpConfigSegment->config[i].name) + 1;
+		}
+		qsort(segindex->names, segindex->num_names, sizeof(SCCPConfigOptionName), sccp_config_optionname_cmp);
+
+		/* options which share a struct member (deprecated names, aliases) */
+		for (i = 0; i < sccpConfigSegment->config_size; i++) {
+			segindex->sameOffset[i] = i;
+			for (j = 1; j < sccpConfigSegment->config_size; j++) {
+				uint16_t next = (i + j) % sccpConfigSegment->config_size;
+				if (sccpConfigSegment->config[next].offset == sccpConfigSegment->config[i].offset) {
+					segindex->sameOffset[i] = next;
+					break;
+				}
+			}
+		}
+	}
+}
+
+static void __attribute__((destructor)) sccp_config_index_destroy(void)
+{
+	uint8_t segidx = 0;
+
+	for (segidx = 0; segidx < ARRAY_LEN(sccpConfigSegments); segidx++) {
+		sccp_free(sccpConfigSegmentIndex[segidx].names);
+		sccp_free(sccpConfigSegmentIndex[segidx].sameOffset);
+		sccp_free(sccpConfigSegmentIndex[segidx].namebuf);
+		sccpConfigSegmentIndex[segidx].num_names = 0;
+	}
+}
+
 /*!
  * \brief Find of SCCP Config Options
  */
@@ -235,6 +345,9 @@ static const SCCPConfigSegment *sccp_find_segment(const sccp_config_segment_t se
 {
 	uint8_t i = 0;
 
+	if ((uint) segment < ARRAY_LEN(sccpConfigSegments) && sccpConfigSegments[segment].segment == segment) {
+		return &sccpConfigSegments[segment];
+	}
 	for (i = 0; i < ARRAY_LEN(sccpConfigSegments); i++) {
 		if (sccpConfigSegments[i].segment == segment) {
 			return &sccpConfigSegments[i];
@@ -243,10 +356,15 @@ static const SCCPConfigSegment *sccp_find_segment(const sccp_config_segment_t se
 	return NULL;
 }
 
+static inline const struct SCCPConfigSegmentIndex *sccp_find_segment_index(const SCCPConfigSegment * sccpConfigSegment)
+{
+	return &sccpConfigSegmentIndex[sccpConfigSegment - sccpConfigSegments];
+}
+
 /*!
- * \brief Find of SCCP Config Options
+ * \brief Find of SCCP Config Options (linear scan)
  */
-static const SCCPConfigOption *sccp_find_config(const sccp_config_segment_t segment, const char *name)
+static const SCCPConfigOption *sccp_find_config_linear(const sccp_config_segment_t segment, const char *name)
 {
 	long unsigned int i = 0;
 	const SCCPConfigSegment *sccpConfigSegment = sccp_find_segment(segment);
@@ -275,6 +393,61 @@ static const SCCPConfigOption *sccp_find_config(const sccp_config_segment_t segm
 	return NULL;
 }
 
+/*!
+ * \brief Find of SCCP Config Options
+ */
+static const SCCPConfigOption *sccp_find_config(const sccp_config_segment_t segment, const char *name)
+{
+	const SCCPConfigSegment *sccpConfigSegment = sccp_find_segment(segment);
+	const struct SCCPConfigSegmentIndex *segindex = NULL;
+	int low = 0, high = 0;
+
+	if (!sccpConfigSegment) {
+		return NULL;
+	}
+	segindex = sccp_find_segment_index(sccpConfigSegment);
+	high = segindex->num_names - 1;
+	if (!segindex->names) {
+		return sccp_find_config_linear(segment, name);
+	}
+	while (low <= high) {
+		int mid = (low + high) / 2;
+		int cmp = strcasecmp(name, segindex->names[mid].name);
+
+		if (cmp == 0) {
+			while (mid > 0 && !strcasecmp(name, segindex->names[mid - 1].name)) {
+				mid--;
+			}
+			return &sccpConfigSegment->config[segindex->names[mid].option];
+		} else if (cmp < 0) {
+			high = mid - 1;
+		} else {
+			low = mid + 1;
+		}
+	}
+	return NULL;
+}
+
+/*!
+ * \brief Next option in the segment storing to the same struct member as option (option itself when unique)
+ */
+static inline uint16_t sccp_config_sameOffset(const SCCPConfigSegment * sccpConfigSegment, uint16_t option)
+{
+	const struct SCCPConfigSegmentIndex *segindex = sccp_find_segment_index(sccpConfigSegment);
+	uint16_t j;
+
+	if (segindex->sameOffset) {
+		return segindex->sameOffset[option];
+	}
+	for (j = 1; j < sccpConfigSegment->config_size; j++) {
+		uint16_t next = (option + j) % sccpConfigSegment->config_size;
+		if (sccpConfigSegment->config[next].offset == sccpConfigSegment->config[option].offset) {
+			return next;
+		}
+	}
+	return option;
+}
+
 /* Create new variable structure for Multi Entry Parameters */
 static PBX_VARIABLE_TYPE *createVariableSetForMultiEntryParameters(PBX_VARIABLE_TYPE * cat_root, const char *configOptionName, PBX_VARIABLE_TYPE * out)
 {
@@ -382,6 +555,7 @@ static sccp_configurationchange_t sccp_config_object_setValue(void *obj, PBX_VAR
 	char *str;
 	char oldChar;
 	char *tmp_value;
+	uint16_t option;
 
 	if (!sccpConfigOption) {
 		if (strlen(name) == 0 || name[0] != '_') {							/* skip generating error, when column name starts with '_' */
@@ -393,18 +567,14 @@ static sccp_configurationchange_t sccp_config_object_setValue(void *obj, PBX_VAR
 	dst = ((uint8_t *) obj) + sccpConfigOption->offset;
 	type = sccpConfigOption->type;
 	flags = sccpConfigOption->flags;
+	option = sccpConfigOption - sccpConfigSegment->config;
 	
 	// check if already set during first pass (multi_entry)
 	if (SetEntries != NULL && ((flags & SCCP_CONFIG_FLAG_MULTI_ENTRY) == SCCP_CONFIG_FLAG_MULTI_ENTRY)) {
-		uint y;
-
-		for (y = 0; y < sccpConfigSegment->config_size; y++) {
-			if (sccpConfigOption->offset == sccpConfigSegment->config[y].offset) {
-				if (SetEntries[y] == TRUE) {
-					sccp_log((DEBUGCAT_CONFIG + DEBUGCAT_HIGH)) (VERBOSE_PREFIX_3 "SCCP: (sccp_config_object_setValue) Set Entry[%d] = TRUE for MultiEntry %s -> SKIPPING\n", y, sccpConfigSegment->config[y].name);
-					return SCCP_CONFIG_NOUPDATENEEDED;
-				}
-			}
+		/* all options storing to the same member are marked together, see below */
+		if (SetEntries[option] == TRUE) {
+			sccp_log((DEBUGCAT_CONFIG + DEBUGCAT_HIGH)) (VERBOSE_PREFIX_3 "SCCP: (sccp_config_object_setValue) Set Entry[%d] = TRUE for MultiEntry %s -> SKIPPING\n", option, sccpConfigOption->name);
+			return SCCP_CONFIG_NOUPDATENEEDED;
 		}
 	}
 
@@ -692,14 +862,13 @@ static sccp_configurationchange_t sccp_config_object_setValue(void *obj, PBX_VAR
 	) {
 		/* if SetEntries is provided lookup the first offset of the struct variable we have set and note the index in SetEntries by changing the boolean_t to TRUE */
 		if (SetEntries != NULL) {
-			uint x;
+			uint16_t x = option;
 
-			for (x = 0; x < sccpConfigSegment->config_size; x++) {
-				if (sccpConfigOption->offset == sccpConfigSegment->config[x].offset) {
-					sccp_log_and((DEBUGCAT_CONFIG + DEBUGCAT_HIGH)) (VERBOSE_PREFIX_3 "SCCP: (sccp_config_object_setValue) Set Entry[%d] = TRUE for %s\n", x, sccpConfigSegment->config[x].name);
-					SetEntries[x] = TRUE;
-				}
-			}
+			do {
+				sccp_log_and((DEBUGCAT_CONFIG + DEBUGCAT_HIGH)) (VERBOSE_PREFIX_3 "SCCP: (sccp_config_object_setValue) Set Entry[%d] = TRUE for %s\n", x, sccpConfigSegment->config[x].name);
+				SetEntries[x] = TRUE;
+				x = sccp_config_sameOffset(sccpConfigSegment, x);
+			} while (x != option);
 		}
 	}
 	if (SCCP_CONFIG_CHANGE_INVALIDVALUE == changed) {
@@ -741,18 +910,20 @@ static void sccp_config_set_defaults(void *obj, const sccp_config_segment_t segm
 	boolean_t skip = FALSE;
 
 	/* find the defaultValue, first check the reference, if no reference is specified, us the local defaultValue */
-	uint8_t cur_elem = 0;
+	uint cur_elem = 0;
 
 	for (cur_elem = 0; cur_elem < sccpConfigSegment->config_size; cur_elem++) {
 		/* Lookup the first offset of the struct variable we want to set default for, find the corresponding entry in the SetEntries array and check the boolean flag, skip if true */
 		skip = FALSE;
-		for (skip_elem = 0; skip_elem < sccpConfigSegment->config_size; skip_elem++) {
-			if (sccpDstConfig[cur_elem].offset == sccpConfigSegment->config[skip_elem].offset && (SetEntries[skip_elem] || sccpConfigSegment->config[cur_elem].flags & (SCCP_CONFIG_FLAG_DEPRECATED | SCCP_CONFIG_FLAG_OBSOLETE))) {
+		skip_elem = cur_elem;
+		do {
+			if (SetEntries[skip_elem] || sccpConfigSegment->config[cur_elem].flags & (SCCP_CONFIG_FLAG_DEPRECATED | SCCP_CONFIG_FLAG_OBSOLETE)) {
 				sccp_log_and((DEBUGCAT_CONFIG + DEBUGCAT_HIGH)) (VERBOSE_PREFIX_2 "SCCP: (sccp_config_set_defaults) skip setting default (SetEntry[%d] = TRUE for %s)\n", skip_elem, sccpConfigSegment->config[skip_elem].name);
 				skip = TRUE;
 				break;
 			}
-		}
+			skip_elem = sccp_config_sameOffset(sccpConfigSegment, skip_elem);
+		} while (skip_elem != cur_elem);
 		if (skip) {											// skip default value if already set
 			continue;
 		}
@@ -841,7 +1012,7 @@ void sccp_config_cleanup_dynamically_allocated_memory(void *obj, const sccp_conf
 	void *dst;
 	char *str;
 
-	uint8_t i = 0;
+	uint i = 0;
 
 	for (i = 0; i < sccpConfigSegment->config_size; i++) {
 		if (sccpConfigOption[i].type == SCCP_CONFIG_DATATYPE_STRINGPTR) {
@@ -1502,6 +1673,7 @@ sccp_value_changed_t sccp_config_parse_deny_permit(void *dest, const size_t size
 				if (prev_ha) {
 					sccp_free_ha(prev_ha);
 				}
+				sccp_compile_ha(ha);
 				*(struct sccp_ha **) dest = ha;
 				changed = SCCP_CONFIG_CHANGE_CHANGED;
 				ha = NULL;					// passed on to dest, will not be freed at exit
@@ -2392,6 +2564,155 @@ void cleanup_stale_contexts(char *new, char *old)
 	}
 }
 
+/*!
+ * \brief Content checksum of a single sccp.conf section, as read during the previous (re)load
+ */
+typedef struct sccp_config_checksum sccp_config_checksum_t;
+struct sccp_config_checksum {
+	sccp_config_checksum_t *next;
+	uint64_t checksum;
+	sccp_config_segment_t segment;										/*!< device, line or softkey segment */
+	char name[];
+};
+
+typedef struct sccp_config_checksums {
+	sccp_hashtable_t *index;										/*!< sections by name */
+	sccp_config_checksum_t *first;
+	uint32_t count;
+	uint64_t general;
+	uint64_t softkeysets;											/*!< combined checksum of all softkeyset sections */
+} sccp_config_checksums_t;
+
+/* only touched by sccp_config_readDevicesLines, which is serialized by GLOB(reload_in_progress) */
+static sccp_config_checksums_t sccp_config_previous_checksums = { 0 };
+static sccp_config_reload_stats_t sccp_config_reload_stats = { 0 };
+
+/* 64bit FNV-1a, the terminating null is included to separate the strings */
+static inline uint64_t sccp_config_checksum_add(uint64_t checksum, const char *str)
+{
+	do {
+		checksum ^= (unsigned char) *str;
+		checksum *= 1099511628211ULL;
+	} while (*str++);
+	return checksum;
+}
+
+/*!
+ * \brief Calculate the content checksum of the variables of a section (in order, including inherited template variables)
+ */
+static uint64_t sccp_config_section_checksum(PBX_VARIABLE_TYPE * v)
+{
+	uint64_t checksum = 14695981039346656037ULL;
+
+	for (; v; v = v->next) {
+		checksum = sccp_config_checksum_add(checksum, v->name);
+		checksum = sccp_config_checksum_add(checksum, v->value);
+	}
+	return checksum;
+}
+
+static void sccp_config_checksums_free(sccp_config_checksums_t * checksums)
+{
+	sccp_config_checksum_t *checksum = NULL;
+
+	while ((checksum = checksums->first)) {
+		checksums->first = checksum->next;
+		sccp_free(checksum);
+	}
+	sccp_hashtable_destroy(&checksums->index);
+	memset(checksums, 0, sizeof(sccp_config_checksums_t));
+}
+
+static const sccp_config_checksum_t *sccp_config_checksums_find(const sccp_config_checksums_t * checksums, const char *name, const sccp_config_segment_t segment)
+{
+	const sccp_config_checksum_t *checksum = (const sccp_config_checksum_t *) sccp_hashtable_find(checksums->index, name);
+
+	return (checksum && checksum->segment == segment) ? checksum : NULL;
+}
+
+/*!
+ * \brief Check if a section has the same type and content as during the previous (re)load
+ */
+static boolean_t sccp_config_checksums_unchanged(const sccp_config_checksums_t * current, const sccp_config_checksums_t * previous, const char *name, const sccp_config_segment_t segment)
+{
+	const sccp_config_checksum_t *checksum = sccp_config_checksums_find(current, name, segment);
+	const sccp_config_checksum_t *previous_checksum = sccp_config_checksums_find(previous, name, segment);
+
+	return (checksum && previous_checksum && checksum->checksum == previous_checksum->checksum) ? TRUE : FALSE;
+}
+
+/*!
+ * \brief Calculate the checksums of all sections in GLOB(cfg)
+ * \return FALSE on allocation failure, checksums is empty in that case
+ */
+static boolean_t sccp_config_checksums_build(sccp_config_checksums_t * checksums)
+{
+	sccp_config_checksum_t *checksum = NULL;
+	sccp_config_segment_t segment;
+	const char *utype = NULL;
+	char *cat = NULL;
+	size_t len = 0;
+
+	if (!(checksums->index = sccp_hashtable_create(SCCP_HASHTABLE_KEY_STRING_NOCASE, sccp_config_previous_checksums.count))) {
+		return FALSE;
+	}
+	checksums->softkeysets = 14695981039346656037ULL;
+	while ((cat = pbx_category_browse(GLOB(cfg), cat))) {
+		if (!strcasecmp(cat, "general")) {
+			checksums->general = sccp_config_section_checksum(ast_variable_browse(GLOB(cfg), cat));
+			continue;
+		}
+		if (!(utype = pbx_variable_retrieve(GLOB(cfg), cat, "type"))) {
+			continue;
+		} else if (!strcasecmp(utype, "device")) {
+			segment = SCCP_CONFIG_DEVICE_SEGMENT;
+		} else if (!strcasecmp(utype, "line")) {
+			segment = SCCP_CONFIG_LINE_SEGMENT;
+		} else if (!strcasecmp(utype, "softkeyset")) {
+			segment = SCCP_CONFIG_SOFTKEY_SEGMENT;
+		} else {
+			continue;
+		}
+		len = strlen(cat) + 1;
+		if (!(checksum = (sccp_config_checksum_t *) sccp_calloc(1, sizeof(sccp_config_checksum_t) + len))) {
+			pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
+			sccp_config_checksums_free(checksums);
+			return FALSE;
+		}
+		memcpy(checksum->name, cat, len);
+		checksum->segment = segment;
+		checksum->checksum = sccp_config_section_checksum(ast_variable_browse(GLOB(cfg), cat));
+		checksum->next = checksums->first;
+		checksums->first = checksum;
+		checksums->count++;
+		sccp_hashtable_insert(checksums->index, checksum->name, checksum);
+		if (segment == SCCP_CONFIG_SOFTKEY_SEGMENT) {
+			/* softkeysets are always rebuilt as a whole, any change (or removal) forces a full reload */
+			checksums->softkeysets = sccp_config_checksum_add(checksums->softkeysets, checksum->name);
+			checksums->softkeysets ^= checksum->checksum;
+			checksums->softkeysets *= 1099511628211ULL;
+		}
+	}
+	return TRUE;
+}
+
+/*!
+ * \brief Forget the section checksums of the previous load, the next reload will re-apply every section
+ * \note used by 'sccp reload force' / 'sccp reload file' and during module unload
+ */
+void sccp_config_resetReloadChecksums(void)
+{
+	sccp_config_checksums_free(&sccp_config_previous_checksums);
+}
+
+/*!
+ * \brief Get the statistics of the last device/line (re)load
+ */
+void sccp_config_getReloadStats(sccp_config_reload_stats_t * stats)
+{
+	memcpy(stats, &sccp_config_reload_stats, sizeof(sccp_config_reload_stats_t));
+}
+
 /*!
  * \brief Read Lines from the Config File
  *
@@ -2409,14 +2730,33 @@ boolean_t sccp_config_readDevicesLines(sccp_readingtype_t readingtype)
 
 	char *cat = NULL;
 	PBX_VARIABLE_TYPE *v = NULL;
-	uint8_t device_count = 0;
-	uint8_t line_count = 0;
+	uint32_t device_count = 0;
+	uint32_t line_count = 0;
 	sccp_device_t *d = NULL;
+	sccp_config_checksums_t checksums = { 0 };
+	sccp_config_checksums_t *previous = &sccp_config_previous_checksums;
+	const sccp_config_checksum_t *checksum = NULL;
+	sccp_config_reload_stats_t stats = { 0 };
+	struct timeval start = pbx_tvnow();
 
 	sccp_log((DEBUGCAT_CONFIG)) (VERBOSE_PREFIX_1 "Loading Devices and Lines from config\n");
 
-	sccp_log((DEBUGCAT_CONFIG)) (VERBOSE_PREFIX_1 "Checking Reading Type:%s (%d)\n", readingtype == 0 ? "Module load" : "Reload", readingtype);
-	if (readingtype == SCCP_CONFIG_READRELOAD) {
+	if (!GLOB(cfg)) {
+		pbx_log(LOG_NOTICE, "SCCP: (sccp_config_readDevicesLines) Unable to load config file sccp.conf, SCCP disabled\n");
+		return FALSE;
+	}
+
+	/*
+	 * compare the section checksums against the previous load. As long as [general] and the softkeysets did not change, only
+	 * sections that were added, changed or removed need to go through pre_reload/apply/post_reload, all others are skipped.
+	 */
+	if (sccp_config_checksums_build(&checksums) && readingtype == SCCP_CONFIG_READRELOAD && previous->index && !GLOB(pendingUpdate)) {
+		stats.incremental = (checksums.general == previous->general && checksums.softkeysets == previous->softkeysets) ? TRUE : FALSE;
+	}
+	stats.sections = checksums.count;
+
+	sccp_log((DEBUGCAT_CONFIG)) (VERBOSE_PREFIX_1 "Checking Reading Type:%s (%d)\n", readingtype == 0 ? "Module load" : (stats.incremental ? "Incremental Reload" : "Reload"), readingtype);
+	if (readingtype == SCCP_CONFIG_READRELOAD && !stats.incremental) {
 		sccp_log((DEBUGCAT_CONFIG)) (VERBOSE_PREFIX_2 "Device Pre Reload\n");
 		sccp_device_pre_reload();
 		sccp_log((DEBUGCAT_CONFIG)) (VERBOSE_PREFIX_2 "Line Pre Reload\n");
@@ -2425,11 +2765,6 @@ boolean_t sccp_config_readDevicesLines(sccp_readingtype_t readingtype)
 		sccp_softkey_pre_reload();
 	}
 
-	if (!GLOB(cfg)) {
-		pbx_log(LOG_NOTICE, "SCCP: (sccp_config_readDevicesLines) Unable to load config file sccp.conf, SCCP disabled\n");
-		return FALSE;
-	}
-
 	while ((cat = pbx_category_browse(GLOB(cfg), cat))) {
 
 		const char *utype;
@@ -2444,6 +2779,10 @@ boolean_t sccp_config_readDevicesLines(sccp_readingtype_t readingtype)
 			pbx_log(LOG_WARNING, "Section '%s' is missing a type parameter\n", cat);
 			continue;
 		} else if (!strcasecmp(utype, "device")) {
+			if (stats.incremental && sccp_config_checksums_unchanged(&checksums, previous, cat, SCCP_CONFIG_DEVICE_SEGMENT)) {
+				stats.unchanged++;
+				continue;
+			}
 			// check minimum requirements for a device
 			sccp_log((DEBUGCAT_CONFIG)) (VERBOSE_PREFIX_2 "Parsing device [%s]\n", cat);
 			v = ast_variable_browse(GLOB(cfg), cat);
@@ -2462,13 +2801,17 @@ boolean_t sccp_config_readDevicesLines(sccp_readingtype_t readingtype)
 				sccp_device_addToGlobals(device);
 				device_count++;
 			} else {
+				if (stats.incremental) {
+					sccp_device_pre_reload_device(device);
+				}
+				stats.devices_updated++;
 				if (device->pendingDelete) {
 					nat = device->nat;
 					device->pendingDelete = 0;
 				}
 			}
 			sccp_config_buildDevice(device, v, cat, FALSE);
-			sccp_log((DEBUGCAT_CONFIG)) (VERBOSE_PREFIX_3 "found device %d: %s\n", device_count, cat);
+			sccp_log((DEBUGCAT_CONFIG)) (VERBOSE_PREFIX_3 "found device %u: %s\n", device_count, cat);
 			/* load saved settings from ast db */
 			sccp_config_restoreDeviceFeatureStatus(device);
 			
@@ -2479,6 +2822,10 @@ boolean_t sccp_config_readDevicesLines(sccp_readingtype_t readingtype)
 				}
 			}
 		} else if (!strcasecmp(utype, "line")) {
+			if (stats.incremental && sccp_config_checksums_unchanged(&checksums, previous, cat, SCCP_CONFIG_LINE_SEGMENT)) {
+				stats.unchanged++;
+				continue;
+			}
 			/* check minimum requirements for a line */
 			sccp_log((DEBUGCAT_CONFIG)) (VERBOSE_PREFIX_2 "Parsing line [%s]\n", cat);
 
@@ -2494,15 +2841,24 @@ boolean_t sccp_config_readDevicesLines(sccp_readingtype_t readingtype)
 			/* check if we have this line already */
 			//    SCCP_RWLIST_WRLOCK(&GLOB(lines));
 			if (l) {
-				sccp_log((DEBUGCAT_CONFIG)) (VERBOSE_PREFIX_3 "found line %d: %s, do update\n", line_count, cat);
+				sccp_log((DEBUGCAT_CONFIG)) (VERBOSE_PREFIX_3 "found line %u: %s, do update\n", line_count, cat);
+				if (stats.incremental) {
+					sccp_line_pre_reload_line(l);
+				}
+				stats.lines_updated++;
 				sccp_config_buildLine(l, v, cat, FALSE);
 			} else if ((l = sccp_line_create(cat))) {
+				stats.lines_added++;
 				sccp_config_buildLine(l, v, cat, FALSE);
 				sccp_line_addToGlobals(l);						/* may find another line instance create by another thread, in that case the newly created line is going to be dropped when l is released */
 			}
 			//    SCCP_RWLIST_UNLOCK(&GLOB(lines));
 
 		} else if (!strcasecmp(utype, "softkeyset")) {
+			if (stats.incremental) {							/* softkeysets did not change, otherwise we would not be incremental */
+				stats.unchanged++;
+				continue;
+			}
 			sccp_log((DEBUGCAT_CONFIG)) (VERBOSE_PREFIX_2 "parsing softkey [%s]\n", cat);
 			if (sccp_strcaseequals(cat, "default")) {
 				pbx_log(LOG_WARNING, "SCCP: (sccp_config_readDevicesLines) The 'default' softkeyset cannot be overriden, please use another name\n");
@@ -2514,7 +2870,36 @@ boolean_t sccp_config_readDevicesLines(sccp_readingtype_t readingtype)
 			pbx_log(LOG_WARNING, "SCCP: (sccp_config_readDevicesLines) UNKNOWN SECTION / UTYPE, type: %s\n", utype);
 		}
 	}
-	sccp_config_add_default_softkeyset();
+	if (!stats.incremental) {
+		sccp_config_add_default_softkeyset();
+	}
+	stats.devices_added = device_count;
+
+	/* sections that were present during the previous load, but are gone now */
+	if (previous->index && checksums.index) {
+		for (checksum = previous->first; checksum; checksum = checksum->next) {
+			if (sccp_config_checksums_find(&checksums, checksum->name, checksum->segment)) {
+				continue;
+			}
+			if (checksum->segment == SCCP_CONFIG_DEVICE_SEGMENT) {
+				stats.devices_removed++;
+				if (stats.incremental) {
+					AUTO_RELEASE(sccp_device_t, device, sccp_device_find_byid(checksum->name, FALSE));
+					if (device) {
+						sccp_device_pre_reload_device(device);
+					}
+				}
+			} else if (checksum->segment == SCCP_CONFIG_LINE_SEGMENT) {
+				stats.lines_removed++;
+				if (stats.incremental) {
+					AUTO_RELEASE(sccp_line_t, line, sccp_line_find_byname(checksum->name, FALSE));
+					if (line) {
+						sccp_line_pre_reload_line(line);
+					}
+				}
+			}
+		}
+	}
 
 #ifdef CS_SCCP_REALTIME
 	/* reload realtime lines */
@@ -2610,9 +2995,21 @@ boolean_t sccp_config_readDevicesLines(sccp_readingtype_t readingtype)
 		sccp_line_post_reload();
 		sccp_log((DEBUGCAT_CONFIG)) (VERBOSE_PREFIX_2 "Device Post Reload\n");
 		sccp_device_post_reload();
-		sccp_log((DEBUGCAT_CONFIG)) (VERBOSE_PREFIX_2 "Softkey Post Reload\n");
-		sccp_softkey_post_reload();
+		if (!stats.incremental || stats.devices_added || stats.devices_updated) {		/* (re-)attach softkeysets */
+			sccp_log((DEBUGCAT_CONFIG)) (VERBOSE_PREFIX_2 "Softkey Post Reload\n");
+			sccp_softkey_post_reload();
+		}
 	}
+
+	/* keep the checksums for the next reload */
+	sccp_config_checksums_free(previous);
+	memcpy(previous, &checksums, sizeof(sccp_config_checksums_t));
+
+	stats.duration_us = ast_tvdiff_us(pbx_tvnow(), start);
+	memcpy(&sccp_config_reload_stats, &stats, sizeof(sccp_config_reload_stats_t));
+	sccp_log((DEBUGCAT_CONFIG)) (VERBOSE_PREFIX_1 "SCCP: %s devices and lines in %.3f ms: %u sections, %u unchanged, devices %u added/%u updated/%u removed, lines %u added/%u updated/%u removed\n",
+		readingtype == SCCP_CONFIG_READRELOAD ? (stats.incremental ? "Incrementally reloaded" : "Reloaded") : "Loaded", stats.duration_us / 1000.0, stats.sections, stats.unchanged,
+		stats.devices_added, stats.devices_updated, stats.devices_removed, stats.lines_added, stats.lines_updated, stats.lines_removed);
 	return TRUE;
 }
 
@@ -3203,7 +3600,7 @@ int sccp_manager_config_metadata(struct mansession *s, const struct message *m)
 				astman_append(s, "JSON: {");
 				astman_append(s, "\"Segment\":\"%s\",", sccpConfigSegment->name);
 				astman_append(s, "\"Options\":[");
-				uint8_t cur_elem = 0;
+				uint cur_elem = 0;
 				comma = 0;
 
 				for (cur_elem = 0; cur_elem < sccpConfigSegment->config_size; cur_elem++) {
@@ -3590,6 +3987,155 @@ AST_TEST_DEFINE(sccp_config_tokenized_default)
 	return AST_TEST_PASS;
 }
 
+#define CONFIG_BENCH_DEVICES 10000
+#define CONFIG_BENCH_LINEAR_DEVICES 1000
+AST_TEST_DEFINE(sccp_config_parse_bench)
+{
+	static const char *const device_keys[][2] = {
+		{"type", "device"}, {"description", "Phone"}, {"devicetype", "7962"}, {"keepalive", "60"}, {"tzoffset", "0"},
+		{"transfer", "on"}, {"park", "on"}, {"cfwdall", "off"}, {"cfwdbusy", "off"}, {"dndFeature", "on"},
+		{"mwilamp", "on"}, {"earlyrtp", "progress"}, {"deny", "0.0.0.0/0.0.0.0"}, {"permit", "10.0.0.0/255.0.0.0"},
+		{"disallow", "all"}, {"allow", "alaw"}, {"button", "line, 1000"}, {"button", "speeddial,Help,9999"},
+		{"button", "empty"}, {"_customfield", "skip"},
+	};
+	PBX_VARIABLE_TYPE **sections = NULL;
+	PBX_VARIABLE_TYPE *v = NULL, *tail = NULL;
+	struct timeval start;
+	int64_t index_us, linear_us;
+	uint lookups = 0, found = 0, errors = 0;
+	uint i, k;
+
+	switch(cmd) {
+		case TEST_INIT:
+			info->name = "parseBench";
+			info->category = "/channels/chan_sccp/config/";
+			info->summary = "chan-sccp-b config parse benchmark";
+			info->description = "Looks up all parameters of a synthetic 10k device sccp.conf, using the option index and the linear scan";
+			return AST_TEST_NOT_RUN;
+		case TEST_EXECUTE:
+			break;
+	}
+
+	if (!(sections = (PBX_VARIABLE_TYPE **) sccp_calloc(CONFIG_BENCH_DEVICES, sizeof(PBX_VARIABLE_TYPE *)))) {
+		return AST_TEST_FAIL;
+	}
+	pbx_test_status_update(test, "Building %d device sections...\n", CONFIG_BENCH_DEVICES);
+	for (i = 0; i < CONFIG_BENCH_DEVICES; i++) {
+		tail = NULL;
+		for (k = 0; k < ARRAY_LEN(device_keys); k++) {
+			if (!(v = ast_variable_new(device_keys[k][0], device_keys[k][1], ""))) {
+				errors++;
+				break;
+			}
+			v->lineno = i * ARRAY_LEN(device_keys) + k;
+			if (tail) {
+				tail->next = v;
+			} else {
+				sections[i] = v;
+			}
+			tail = v;
+		}
+	}
+
+	start = pbx_tvnow();
+	for (i = 0; i < CONFIG_BENCH_DEVICES; i++) {
+		for (v = sections[i]; v; v = v->next) {
+			if (sccp_find_config(SCCP_CONFIG_DEVICE_SEGMENT, v->name)) {
+				found++;
+			}
+			lookups++;
+		}
+	}
+	index_us = ast_tvdiff_us(pbx_tvnow(), start);
+
+	start = pbx_tvnow();
+	for (i = 0; i < CONFIG_BENCH_LINEAR_DEVICES; i++) {
+		for (v = sections[i]; v; v = v->next) {
+			if (sccp_find_config_linear(SCCP_CONFIG_DEVICE_SEGMENT, v->name) != sccp_find_config(SCCP_CONFIG_DEVICE_SEGMENT, v->name)) {
+				errors++;
+			}
+		}
+	}
+	linear_us = ast_tvdiff_us(pbx_tvnow(), start);
+
+	pbx_test_status_update(test, "index : %u lookups (%u found) in %.3f ms, %.3f usec per lookup\n", lookups, found, (double) index_us / 1000, (double) index_us / (lookups ? lookups : 1));
+	pbx_test_status_update(test, "linear: %.3f ms per 1k devices (incl. index lookup), extrapolated %.3f ms for %d devices\n", (double) linear_us / 1000, (double) linear_us * CONFIG_BENCH_DEVICES / CONFIG_BENCH_LINEAR_DEVICES / 1000, CONFIG_BENCH_DEVICES);
+
+	/* every option name and alias of every segment has to resolve to the same entry as the linear scan */
+	for (i = 0; i < ARRAY_LEN(sccpConfigSegments); i++) {
+		const struct SCCPConfigSegmentIndex *segindex = sccp_find_segment_index(&sccpConfigSegments[i]);
+		for (k = 0; k < segindex->num_names; k++) {
+			if (sccp_find_config(sccpConfigSegments[i].segment, segindex->names[k].name) != sccp_find_config_linear(sccpConfigSegments[i].segment, segindex->names[k].name)) {
+				pbx_test_status_update(test, "mismatch for %s->%s\n", sccpConfigSegments[i].name, segindex->names[k].name);
+				errors++;
+			}
+		}
+	}
+
+	for (i = 0; i < CONFIG_BENCH_DEVICES; i++) {
+		if (sections[i]) {
+			pbx_variables_destroy(sections[i]);
+		}
+	}
+	sccp_free(sections);
+
+	pbx_test_validate(test, errors == 0);
+	pbx_test_validate(test, found == CONFIG_BENCH_DEVICES * (ARRAY_LEN(device_keys) - 1));
+	return AST_TEST_PASS;
+}
+
+AST_TEST_DEFINE(sccp_config_section_checksums)
+{
+	switch(cmd) {
+		case TEST_INIT:
+			info->name = "SectionChecksum";
+			info->category = "/channels/chan_sccp/config/";
+			info->summary = "chan-sccp-b incremental reload checksum test";
+			info->description = "section checksums used to skip unchanged sections during reload";
+			return AST_TEST_NOT_RUN;
+		case TEST_EXECUTE:
+			break;
+	}
+
+	PBX_VARIABLE_TYPE *a = NULL, *b = NULL;
+	a = ast_variable_new("type", "device", "");
+	a->next = ast_variable_new("button", "line,98011", "");
+	a->next->next = ast_variable_new("button", "line,98012", "");
+	b = ast_variable_new("type", "device", "");
+	b->next = ast_variable_new("button", "line,98011", "");
+	b->next->next = ast_variable_new("button", "line,98012", "");
+
+	pbx_test_status_update(test, "same content -> same checksum\n");
+	pbx_test_validate(test, sccp_config_section_checksum(a) == sccp_config_section_checksum(b));
+
+	pbx_test_status_update(test, "changed value -> different checksum\n");
+	pbx_variables_destroy(b->next->next);
+	b->next->next = ast_variable_new("button", "line,98013", "");
+	pbx_test_validate(test, sccp_config_section_checksum(a) != sccp_config_section_checksum(b));
+
+	pbx_test_status_update(test, "changed order -> different checksum (button order matters)\n");
+	pbx_variables_destroy(b->next);
+	b->next = ast_variable_new("button", "line,98012", "");
+	b->next->next = ast_variable_new("button", "line,98011", "");
+	pbx_test_validate(test, sccp_config_section_checksum(a) != sccp_config_section_checksum(b));
+
+	pbx_test_status_update(test, "name/value boundary is part of the checksum\n");
+	pbx_variables_destroy(b);
+	b = ast_variable_new("type", "device", "");
+	b->next = ast_variable_new("buttonline", ",98011", "");
+	b->next->next = ast_variable_new("button", "line,98012", "");
+	pbx_test_validate(test, sccp_config_section_checksum(a) != sccp_config_section_checksum(b));
+
+	pbx_test_status_update(test, "removed variable -> different checksum\n");
+	pbx_variables_destroy(b->next);
+	b->next = NULL;
+	pbx_test_validate(test, sccp_config_section_checksum(a) != sccp_config_section_checksum(b));
+
+	pbx_variables_destroy(a);
+	pbx_variables_destroy(b);
+	return AST_TEST_PASS;
+}
+
 /*
 AST_TEST_DEFINE(sccp_config_setValue)
 {
@@ -3635,6 +4181,8 @@ static void __attribute__((constructor)) sccp_register_tests(void)
 	AST_TEST_REGISTER(sccp_config_base_functions);
 	AST_TEST_REGISTER(sccp_config_multientry);
 	AST_TEST_REGISTER(sccp_config_tokenized_default);
+	AST_TEST_REGISTER(sccp_config_parse_bench);
+	AST_TEST_REGISTER(sccp_config_section_checksums);
 	//AST_TEST_REGISTER(sccp_config_setValue);
 	//AST_TEST_REGISTER(sccp_config_setDefault);
 }
@@ -3644,6 +4192,8 @@ static void __attribute__((destructor)) sccp_unregister_tests(void)
 	AST_TEST_UNREGISTER(sccp_config_base_functions);
 	AST_TEST_UNREGISTER(sccp_config_multientry);
 	AST_TEST_UNREGISTER(sccp_config_tokenized_default);
+	AST_TEST_UNREGISTER(sccp_config_parse_bench);
+	AST_TEST_UNREGISTER(sccp_config_section_checksums);
 	//AST_TEST_UNREGISTER(sccp_config_setValue);
 	//AST_TEST_UNREGISTER(sccp_config_setDefault);
 }
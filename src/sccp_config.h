@@ -58,6 +58,26 @@ typedef enum {
 } sccp_config_file_status_t;
 
 SCCP_API sccp_config_file_status_t SCCP_CALL sccp_config_getConfig(boolean_t force);
+
+/*!
+ * \brief Statistics of the last sccp_config_readDevicesLines run
+ */
+typedef struct sccp_config_reload_stats {
+	boolean_t incremental;											/*!< only added/changed/removed sections were applied */
+	uint32_t sections;											/*!< device, line and softkeyset sections in sccp.conf */
+	uint32_t unchanged;											/*!< sections skipped because their content checksum did not change */
+	uint32_t devices_added;
+	uint32_t devices_updated;
+	uint32_t devices_removed;
+	uint32_t lines_added;
+	uint32_t lines_updated;
+	uint32_t lines_removed;
+	int64_t duration_us;											/*!< time spent reading devices and lines */
+} sccp_config_reload_stats_t;
+
+SCCP_API void SCCP_CALL sccp_config_getReloadStats(sccp_config_reload_stats_t * stats);
+SCCP_API void SCCP_CALL sccp_config_resetReloadChecksums(void);
+
 SCCP_API sccp_configurationchange_t SCCP_CALL sccp_config_applyGlobalConfiguration(PBX_VARIABLE_TYPE * v);
 SCCP_API sccp_configurationchange_t SCCP_CALL sccp_config_applyLineConfiguration(sccp_line_t * l, PBX_VARIABLE_TYPE * v);
 SCCP_API sccp_configurationchange_t SCCP_CALL sccp_config_applyDeviceConfiguration(sccp_device_t * d, PBX_VARIABLE_TYPE * v);
@@ -162,6 +162,16 @@ static const SCCPConfigOption sccpGlobalConfigOptions[]={
 	{"backoff_time", 		G_OBJ_REF(token_backoff_time),		TYPE_INT,									SCCP_CONFIG_FLAG_NONE,						SCCP_CONFIG_NOUPDATENEEDED,		"60",				"Time to wait before re-asking to fallback to primairy server (Token Reject Backoff Time)\n"},
 	{"server_priority", 		G_OBJ_REF(server_priority),		TYPE_INT,									SCCP_CONFIG_FLAG_NONE,						SCCP_CONFIG_NOUPDATENEEDED,		"1",				"Server Priority for fallback: 1=Primairy, 2=Secundary, 3=Tertiary etc\n"
 																																					"For active-active (fallback=odd/even) use 1 for both\n"},
+	{"session_reactor", 		G_OBJ_REF(session_reactor),		TYPE_BOOLEAN,									SCCP_CONFIG_FLAG_NONE,						SCCP_CONFIG_NOUPDATENEEDED,		"no",				"Handle device connections using a small pool of epoll based worker threads, instead of starting a new thread per device.\n"
+																																					"Recommended for installations with a large number of devices. Only applies to new connections (Linux only).\n"},
+	{"session_workers", 		G_OBJ_REF(session_workers),		TYPE_UINT,									SCCP_CONFIG_FLAG_NONE,						SCCP_CONFIG_NOUPDATENEEDED,		"0",				"Number of session reactor worker threads. 0 means one worker per cpu core. Takes effect when the reactor is (re)started.\n"},
+	{"hint_coalesce_window", 	G_OBJ_REF(hint_coalesce_window),	TYPE_UINT,									SCCP_CONFIG_FLAG_NONE,						SCCP_CONFIG_NOUPDATENEEDED,		"0",				"Coalescing window for hint state changes in ms (0-250, 0 = off). Changes arriving within the window are collapsed into the final state\n"
+																																					"before being sent to the BLF subscribers and the pbx devicestate. Ringing is always sent immediately.\n"},
+	{"registration_rate", 		G_OBJ_REF(registration_rate),		TYPE_UINT,									SCCP_CONFIG_FLAG_NONE,						SCCP_CONFIG_NOUPDATENEEDED,		"0",				"Maximum number of device registrations started per second (0 = unlimited). Limits the load when all phones reconnect at once.\n"
+																																					"Phones asking for a token are deferred using a token reject (backoff_time plus a random part of it), other phones are rejected.\n"},
+	{"registration_max_inprogress",	G_OBJ_REF(registration_max_inprogress),	TYPE_UINT,									SCCP_CONFIG_FLAG_NONE,						SCCP_CONFIG_NOUPDATENEEDED,		"0",				"Maximum number of device registrations in progress at the same time (0 = unlimited), see registration_rate.\n"},
+	{"trace", 			G_OBJ_REF(trace), 			TYPE_PARSER(sccp_config_parse_debug),						SCCP_CONFIG_FLAG_NONE | SCCP_CONFIG_FLAG_MULTI_ENTRY,		SCCP_CONFIG_NOUPDATENEEDED,		"none",				"categories recorded in the binary trace ring (same categories as debug, see 'sccp show trace' and 'sccp trace dump')\n"
+																																					"tracing is much cheaper than debug output, currently traced: message (received/sent messages), device (registration state), channel (channel state), refcount\n"},
 //#if defined(CS_EXPERIMENTAL_XML)
 //	{"webdir",			G_OBJ_REF(webdir),			TYPE_PARSER(sccp_config_parse_webdir),						SCCP_CONFIG_FLAG_NONE,						SCCP_CONFIG_NOUPDATENEEDED,		"",				"Directory where xslt stylesheets can be found.\n"},
 //#endif
@@ -26,6 +26,7 @@
 #include "sccp_session.h"
 #include "sccp_indicate.h"
 #include "sccp_mwi.h"
+#include "sccp_packet.h"
 #include "sccp_utils.h"
 #include "sccp_atomic.h"
 #include "sccp_devstate.h"
@@ -44,6 +45,7 @@ SCCP_FILE_VERSION(__FILE__, "");
 int __sccp_device_destroy(const void *ptr);
 void sccp_device_removeFromGlobals(devicePtr device);
 int sccp_device_destroy(const void *ptr);
+static void sccp_device_admission_release(void);
 
 /*!
  * \brief Private Device Data Structure
@@ -55,6 +57,7 @@ struct sccp_private_device_data {
 	sccp_devicestate_t deviceState;											/*!< Device State */
 
 	skinny_registrationstate_t registrationState;
+	boolean_t registrationAdmitted;										/*!< holds a registration admission slot (see sccp_device_admitRegistration) */
 };
 
 #define sccp_private_lock(x) sccp_mutex_lock(&((struct sccp_private_device_data * const)(x))->lock)			/* discard const */
@@ -326,38 +329,46 @@ static boolean_t sccp_device_checkACL(constDevicePtr device)
 void sccp_device_pre_reload(void)
 {
 	sccp_device_t *d = NULL;
-	sccp_buttonconfig_t *config = NULL;
 
 	SCCP_RWLIST_WRLOCK(&GLOB(devices));
 	SCCP_RWLIST_TRAVERSE(&GLOB(devices), d, list) {
-		sccp_log((DEBUGCAT_CONFIG + DEBUGCAT_DEVICE)) (VERBOSE_PREFIX_3 "%s: Setting Device to Pending Delete=1\n", d->id);
-#ifdef CS_SCCP_REALTIME
-		if (!d->realtime) {										/* don't want to reset realtime devices, if they have not changed */
-			d->pendingDelete = 1;
-		}
-#endif
-		d->pendingUpdate = 0;
-		
-		/* clear softkeyset */
-		d->softkeyset = NULL;
-		d->softKeyConfiguration.modes = NULL;
-		d->softKeyConfiguration.size = 0;
-		d->isAnonymous=FALSE;
+		sccp_device_pre_reload_device(d);
 
-		SCCP_LIST_LOCK(&d->buttonconfig);
-		SCCP_LIST_TRAVERSE(&d->buttonconfig, config, list) {
-			sccp_log((DEBUGCAT_CONFIG + DEBUGCAT_DEVICE)) (VERBOSE_PREFIX_4 "%s: Setting Button at Index:%d to pendingDelete\n", d->id, config->index);
-			config->pendingDelete = 1;
-			config->pendingUpdate = 0;
-		}
-		SCCP_LIST_UNLOCK(&d->buttonconfig);
+		/* clear softkeyset, softkeysets are rebuilt and re-attached during sccp_softkey_post_reload */
 		d->softkeyset = NULL;
-		d->softKeyConfiguration.modes = 0;
+		d->softKeyConfiguration.modes = NULL;
 		d->softKeyConfiguration.size = 0;
 	}
 	SCCP_RWLIST_UNLOCK(&GLOB(devices));
 }
 
+/*!
+ * \brief prepare a single device for being re-read from sccp.conf
+ * \note used by sccp_device_pre_reload and by the incremental reload, for devices whose section has changed or was removed.
+ *       The softkeyset is left untouched, as softkeysets are only rebuilt during a full reload.
+ */
+void sccp_device_pre_reload_device(sccp_device_t * d)
+{
+	sccp_buttonconfig_t *config = NULL;
+
+	sccp_log((DEBUGCAT_CONFIG + DEBUGCAT_DEVICE)) (VERBOSE_PREFIX_3 "%s: Setting Device to Pending Delete=1\n", d->id);
+#ifdef CS_SCCP_REALTIME
+	if (!d->realtime) {											/* don't want to reset realtime devices, if they have not changed */
+		d->pendingDelete = 1;
+	}
+#endif
+	d->pendingUpdate = 0;
+	d->isAnonymous=FALSE;
+
+	SCCP_LIST_LOCK(&d->buttonconfig);
+	SCCP_LIST_TRAVERSE(&d->buttonconfig, config, list) {
+		sccp_log((DEBUGCAT_CONFIG + DEBUGCAT_DEVICE)) (VERBOSE_PREFIX_4 "%s: Setting Button at Index:%d to pendingDelete\n", d->id, config->index);
+		config->pendingDelete = 1;
+		config->pendingUpdate = 0;
+	}
+	SCCP_LIST_UNLOCK(&d->buttonconfig);
+}
+
 /*!
  * \brief Check Device Update Status
  * \note See \ref sccp_config_reload
@@ -519,15 +530,24 @@ int sccp_device_setRegistrationState(constDevicePtr d, const skinny_registration
 	}
 
 	int changed = 0;
+	boolean_t released = FALSE;
 	
 	if (!isPointerDead(d->privateData)) {
 		sccp_private_lock(d->privateData);
 		if (state != d->privateData->registrationState) {
+			sccp_trace(DEBUGCAT_DEVICE, SCCP_TRACE_DEVICE_REGSTATE, d, state, d->privateData->registrationState, 0);
 			d->privateData->registrationState = state;
 			changed=1;
 		}
+		if (d->privateData->registrationAdmitted && state != SKINNY_DEVICE_RS_TOKEN && state != SKINNY_DEVICE_RS_PROGRESS) {
+			d->privateData->registrationAdmitted = FALSE;
+			released = TRUE;
+		}
 		sccp_private_unlock(d->privateData);
 	}
+	if (released) {
+		sccp_device_admission_release();
+	}
 	
 #ifdef CS_AST_HAS_STASIS_ENDPOINT
 	if (iPbx.endpoint_online && iPbx.endpoint_offline) {
@@ -549,6 +569,115 @@ int sccp_device_setRegistrationState(constDevicePtr d, const skinny_registration
 
 /* ======================================================================================================== end getters / setters for privateData */
 
+/* ==================================================================================================== start registration admission control */
+/*!
+ * \brief Registration Admission Control
+ *
+ * After a network outage all phones reconnect at once, and handling the complete registration (button template, softkeys, lines)
+ * for all of them at the same time starves everything else, until keepalives start timing out and the phones re-register again.
+ *
+ * A token bucket refilled at 'registration_rate' registrations per second (bucket size one second worth) limits how fast new
+ * registrations are started, 'registration_max_inprogress' limits how many can be between token/register and registered at the
+ * same time. A device holds its slot from being admitted until it leaves the token/progress registration states. Phones that ask
+ * for a token are deferred using a token reject (they come back after the backoff time), phones registering directly are rejected.
+ */
+AST_MUTEX_DEFINE_STATIC(admission_lock);										/* protects admission */
+static struct {
+	double tokens;
+	struct timeval refilled;
+	uint32_t inprogress;
+	uint64_t admitted;
+	uint64_t deferred;
+	uint64_t rejected;
+} admission;
+
+/* called without the device private lock held */
+static void sccp_device_admission_release(void)
+{
+	pbx_mutex_lock(&admission_lock);
+	if (admission.inprogress) {
+		admission.inprogress--;
+	}
+	pbx_mutex_unlock(&admission_lock);
+}
+
+/*!
+ * \brief Try to admit the registration of device d (token request or register)
+ * \param d SCCP Device
+ * \param canDefer TRUE when the device can be deferred with a token reject (counted as deferred instead of rejected)
+ * \return TRUE when the registration can go ahead (including when d was admitted before and is still registering)
+ */
+boolean_t sccp_device_admitRegistration(constDevicePtr d, boolean_t canDefer)
+{
+	pbx_assert(d != NULL && d->privateData != NULL);
+	uint32_t rate = GLOB(registration_rate);
+	uint32_t max_inprogress = GLOB(registration_max_inprogress);
+	uint32_t inprogress = 0;
+	boolean_t res = FALSE;
+
+	sccp_private_lock(d->privateData);
+	if (d->privateData->registrationAdmitted) {
+		sccp_private_unlock(d->privateData);
+		return TRUE;
+	}
+	pbx_mutex_lock(&admission_lock);
+	if (rate) {
+		struct timeval now = pbx_tvnow();
+		if (ast_tvzero(admission.refilled)) {
+			admission.tokens = rate;
+		} else {
+			admission.tokens += (double) ast_tvdiff_us(now, admission.refilled) * rate / 1000000;
+			if (admission.tokens > rate) {
+				admission.tokens = rate;
+			}
+		}
+		admission.refilled = now;
+	}
+	if ((!max_inprogress || admission.inprogress < max_inprogress) && (!rate || admission.tokens >= 1.0)) {
+		if (rate) {
+			admission.tokens -= 1.0;
+		}
+		admission.inprogress++;
+		admission.admitted++;
+		res = TRUE;
+	} else if (canDefer) {
+		admission.deferred++;
+	} else {
+		admission.rejected++;
+	}
+	inprogress = admission.inprogress;
+	pbx_mutex_unlock(&admission_lock);
+	d->privateData->registrationAdmitted = res;
+	sccp_private_unlock(d->privateData);
+
+	if (!res) {
+		sccp_log((DEBUGCAT_DEVICE)) (VERBOSE_PREFIX_3 "%s: Registration not admitted (rate:%u/s, in progress:%u/%u), %s\n", d->id, rate, inprogress, max_inprogress, canDefer ? "deferring" : "rejecting");
+	}
+	return res;
+}
+
+/*!
+ * \brief Time a deferred device should wait before asking for a token again
+ * \note backoff_time plus a random part of it, to spread the returning phones out
+ */
+int sccp_device_admissionBackoff(void)
+{
+	int backoff = GLOB(token_backoff_time) >= 30 ? GLOB(token_backoff_time) : 60;
+
+	return backoff + (int) (sccp_random() % backoff);
+}
+
+void sccp_device_getAdmissionStats(sccp_device_admission_stats_t * stats)
+{
+	pbx_mutex_lock(&admission_lock);
+	stats->admitted = admission.admitted;
+	stats->deferred = admission.deferred;
+	stats->rejected = admission.rejected;
+	stats->inprogress = admission.inprogress;
+	pbx_mutex_unlock(&admission_lock);
+}
+/* ====================================================================================================== end registration admission control */
+
 /*!
  * \brief create a device and adding default values.
  * \return retained device with default/global values
@@ -797,6 +926,7 @@ void sccp_device_addToGlobals(constDevicePtr device)
 	if (d) {
 		SCCP_RWLIST_WRLOCK(&GLOB(devices));
 		SCCP_RWLIST_INSERT_SORTALPHA(&GLOB(devices), d, list, id);
+		sccp_hashtable_insert(GLOB(device_index), d->id, d);
 		SCCP_RWLIST_UNLOCK(&GLOB(devices));
 		sccp_log((DEBUGCAT_DEVICE)) (VERBOSE_PREFIX_3 "Added device '%s' to Glob(devices)\n", d->id);
 	}
@@ -820,6 +950,7 @@ void sccp_device_removeFromGlobals(devicePtr device)
 
 	SCCP_RWLIST_WRLOCK(&GLOB(devices));
 	if ((d = SCCP_RWLIST_REMOVE(&GLOB(devices), device, list))) {
+		sccp_hashtable_remove(GLOB(device_index), d->id, d);
 		sccp_log((DEBUGCAT_CORE + DEBUGCAT_DEVICE)) (VERBOSE_PREFIX_3 "Removed device '%s' from Glob(devices)\n", DEV_ID_LOG(device));
 		sccp_device_release(&d);					/* explicit release of device after removing from list */
 	}
@@ -1220,7 +1351,7 @@ sccp_msg_t __attribute__ ((malloc)) * sccp_build_packet(sccp_mid_t t, size_t pkt
 	int padding = ((pkt_len + 8) % 4);
 	padding = (padding > 0) ? 4 - padding : 0;
 	
-	sccp_msg_t *msg = sccp_calloc(1, pkt_len + SCCP_PACKET_HEADER + padding);
+	sccp_msg_t *msg = (sccp_msg_t *) sccp_packet_alloc(pkt_len + SCCP_PACKET_HEADER + padding);
 
 	if (!msg) {
 		pbx_log(LOG_WARNING, "SCCP: Packet memory allocation error\n");
@@ -1249,7 +1380,7 @@ int sccp_dev_send(constDevicePtr d, sccp_msg_t * msg)
 		sccp_log((DEBUGCAT_MESSAGE)) (VERBOSE_PREFIX_3 "%s: >> Send message %s\n", d->id, msgtype2str(letohl(msg->header.lel_messageId)));
 		result = sccp_session_send(d, msg);
 	} else {
-		sccp_free(msg);
+		sccp_packet_free(msg);
 	}
 	return result;
 }
@@ -2594,6 +2725,9 @@ int __sccp_device_destroy(const void *ptr)
 	
 	// cleanup privateData
 	if (d->privateData) {
+		if (d->privateData->registrationAdmitted) {
+			sccp_device_admission_release();
+		}
 		sccp_mutex_destroy(&d->privateData->lock);
 		sccp_free(d->privateData);
 	}
@@ -3271,7 +3405,9 @@ sccp_device_t *sccp_device_find_byid(const char *id, boolean_t useRealtime)
 	}
 
 	SCCP_RWLIST_RDLOCK(&GLOB(devices));
-	d = SCCP_RWLIST_FIND(&GLOB(devices), sccp_device_t, tmpd, list, (sccp_strcaseequals(tmpd->id, id)), TRUE, __FILE__, __LINE__, __PRETTY_FUNCTION__);
+	if ((d = (sccp_device_t *) sccp_hashtable_find(GLOB(device_index), id))) {
+		d = sccp_device_retain(d);
+	}
 	SCCP_RWLIST_UNLOCK(&GLOB(devices));
 
 #ifdef CS_SCCP_REALTIME
@@ -3355,4 +3491,186 @@ void sccp_device_setLamp(constDevicePtr device, skinny_stimulus_t stimulus, uint
 	}
 }
 
+#if CS_TEST_FRAMEWORK
+#include <asterisk/test.h>
+#define DEVICE_TEST_NUM_DEVICES 10000
+#define DEVICE_TEST_INDEX_LOOKUPS 200000
+#define DEVICE_TEST_LINEAR_LOOKUPS 2000
+AST_TEST_DEFINE(sccp_device_lookup_bench)
+{
+	sccp_device_t **devices = NULL;
+	char (*query)[StationMaxDeviceNameSize] = NULL;
+	char id[StationMaxDeviceNameSize];
+	struct timeval start;
+	int64_t index_us, linear_us;
+	enum ast_test_result_state res = AST_TEST_PASS;
+	int idx, n;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "lookupBench";
+		info->category = "/channels/chan_sccp/device/";
+		info->summary = "chan-sccp-b device lookup benchmark";
+		info->description = "Registers 10k synthetic devices and compares sccp_device_find_byid against a linear list scan";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	devices = (sccp_device_t **) sccp_calloc(DEVICE_TEST_NUM_DEVICES, sizeof(sccp_device_t *));
+	query = sccp_calloc(DEVICE_TEST_NUM_DEVICES, sizeof(*query));
+	if (!devices || !query) {
+		sccp_free(devices);
+		sccp_free(query);
+		return AST_TEST_FAIL;
+	}
+
+	pbx_test_status_update(test, "Adding %d devices to the global device list...\n", DEVICE_TEST_NUM_DEVICES);
+	for (idx = 0; idx < DEVICE_TEST_NUM_DEVICES; idx++) {
+		snprintf(id, sizeof(id), "SEPBENCH%05d", idx);
+		snprintf(query[idx], sizeof(query[idx]), "sepbench%05d", idx);					/* lookups are case-insensitive */
+		if (!(devices[idx] = sccp_device_create(id))) {
+			res = AST_TEST_FAIL;
+			break;
+		}
+		sccp_device_addToGlobals(devices[idx]);
+	}
+
+	if (res == AST_TEST_PASS) {
+		start = pbx_tvnow();
+		for (n = 0; n < DEVICE_TEST_INDEX_LOOKUPS && res == AST_TEST_PASS; n++) {
+			idx = (n * 7919) % DEVICE_TEST_NUM_DEVICES;
+			sccp_device_t *d = sccp_device_find_byid(query[idx], FALSE);
+			if (d != devices[idx]) {
+				res = AST_TEST_FAIL;
+			}
+			if (d) {
+				sccp_device_release(&d);
+			}
+		}
+		index_us = ast_tvdiff_us(pbx_tvnow(), start);
+
+		start = pbx_tvnow();
+		for (n = 0; n < DEVICE_TEST_LINEAR_LOOKUPS && res == AST_TEST_PASS; n++) {
+			idx = (n * 7919) % DEVICE_TEST_NUM_DEVICES;
+			SCCP_RWLIST_RDLOCK(&GLOB(devices));
+			sccp_device_t *d = SCCP_RWLIST_FIND(&GLOB(devices), sccp_device_t, tmpd, list, (sccp_strcaseequals(tmpd->id, query[idx])), FALSE, __FILE__, __LINE__, __PRETTY_FUNCTION__);
+			SCCP_RWLIST_UNLOCK(&GLOB(devices));
+			if (d != devices[idx]) {
+				res = AST_TEST_FAIL;
+			}
+		}
+		linear_us = ast_tvdiff_us(pbx_tvnow(), start);
+
+		pbx_test_status_update(test, "hash index : %.3f usec per lookup\n", (double) index_us / DEVICE_TEST_INDEX_LOOKUPS);
+		pbx_test_status_update(test, "linear scan: %.3f usec per lookup\n", (double) linear_us / DEVICE_TEST_LINEAR_LOOKUPS);
+		pbx_test_status_update(test, "index: %d entries in %d buckets\n", sccp_hashtable_size(GLOB(device_index)), sccp_hashtable_buckets(GLOB(device_index)));
+
+		sccp_device_t *missing = sccp_device_find_byid("SEPBENCHMISSING", FALSE);
+		if (missing) {
+			sccp_device_release(&missing);
+			res = AST_TEST_FAIL;
+		}
+	}
+
+	for (idx = 0; idx < DEVICE_TEST_NUM_DEVICES; idx++) {
+		if (devices[idx]) {
+			sccp_device_removeFromGlobals(devices[idx]);
+			sccp_device_release(&devices[idx]);
+		}
+	}
+	sccp_free(devices);
+	sccp_free(query);
+	return res;
+}
+
+#define DEVICE_TEST_ADMISSION_DEVICES 6
+AST_TEST_DEFINE(sccp_device_admission_test)
+{
+	sccp_device_t *devices[DEVICE_TEST_ADMISSION_DEVICES] = { NULL };
+	sccp_device_admission_stats_t before, after;
+	uint32_t rate = GLOB(registration_rate);
+	uint32_t max_inprogress = GLOB(registration_max_inprogress);
+	char id[StationMaxDeviceNameSize];
+	enum ast_test_result_state res = AST_TEST_PASS;
+	int idx;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "admission";
+		info->category = "/channels/chan_sccp/device/";
+		info->summary = "chan-sccp-b registration admission control";
+		info->description = "Registration token bucket and max in progress limit, slots being released on registration state changes";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	for (idx = 0; idx < DEVICE_TEST_ADMISSION_DEVICES; idx++) {
+		snprintf(id, sizeof(id), "SEPADMIT%05d", idx);
+		if (!(devices[idx] = sccp_device_create(id))) {
+			res = AST_TEST_FAIL;
+			goto EXIT;
+		}
+	}
+
+	/* full bucket of 5 tokens, at most 3 in progress */
+	pbx_mutex_lock(&admission_lock);
+	GLOB(registration_rate) = 5;
+	GLOB(registration_max_inprogress) = 3;
+	admission.tokens = 5;
+	admission.refilled = pbx_tvnow();
+	pbx_mutex_unlock(&admission_lock);
+	sccp_device_getAdmissionStats(&before);
+
+	pbx_test_status_update(test, "Max in progress...\n");
+	for (idx = 0; idx < 3; idx++) {
+		pbx_test_validate_cleanup(test, sccp_device_admitRegistration(devices[idx], TRUE), res, EXIT);
+	}
+	pbx_test_validate_cleanup(test, !sccp_device_admitRegistration(devices[3], TRUE), res, EXIT);
+	pbx_test_validate_cleanup(test, sccp_device_admitRegistration(devices[0], FALSE), res, EXIT);		/* still holds its slot */
+	sccp_device_setRegistrationState(devices[0], SKINNY_DEVICE_RS_PROGRESS);
+	pbx_test_validate_cleanup(test, !sccp_device_admitRegistration(devices[3], TRUE), res, EXIT);
+	sccp_device_setRegistrationState(devices[0], SKINNY_DEVICE_RS_FAILED);				/* releases the slot */
+	pbx_test_validate_cleanup(test, sccp_device_admitRegistration(devices[3], TRUE), res, EXIT);
+
+	pbx_test_status_update(test, "Rate...\n");
+	sccp_device_setRegistrationState(devices[1], SKINNY_DEVICE_RS_FAILED);
+	pbx_test_validate_cleanup(test, sccp_device_admitRegistration(devices[4], FALSE), res, EXIT);	/* last token */
+	sccp_device_setRegistrationState(devices[2], SKINNY_DEVICE_RS_FAILED);
+	sccp_device_setRegistrationState(devices[3], SKINNY_DEVICE_RS_FAILED);
+	pbx_test_validate_cleanup(test, !sccp_device_admitRegistration(devices[5], FALSE), res, EXIT);	/* bucket empty */
+
+	sccp_device_getAdmissionStats(&after);
+	pbx_test_status_update(test, "admitted:%lu, deferred:%lu, rejected:%lu, in progress:%u\n", (unsigned long) (after.admitted - before.admitted), (unsigned long) (after.deferred - before.deferred), (unsigned long) (after.rejected - before.rejected), after.inprogress);
+	pbx_test_validate_cleanup(test, after.admitted - before.admitted == 5, res, EXIT);
+	pbx_test_validate_cleanup(test, after.deferred - before.deferred == 2, res, EXIT);
+	pbx_test_validate_cleanup(test, after.rejected - before.rejected == 1, res, EXIT);
+	pbx_test_validate_cleanup(test, after.inprogress == before.inprogress + 1, res, EXIT);
+
+EXIT:
+	for (idx = 0; idx < DEVICE_TEST_ADMISSION_DEVICES; idx++) {
+		if (devices[idx]) {
+			sccp_device_setRegistrationState(devices[idx], SKINNY_DEVICE_RS_NONE);
+			sccp_device_release(&devices[idx]);
+		}
+	}
+	GLOB(registration_rate) = rate;
+	GLOB(registration_max_inprogress) = max_inprogress;
+	return res;
+}
+
+static void __attribute__((constructor)) sccp_register_tests(void)
+{
+	AST_TEST_REGISTER(sccp_device_lookup_bench);
+	AST_TEST_REGISTER(sccp_device_admission_test);
+}
+
+static void __attribute__((destructor)) sccp_unregister_tests(void)
+{
+	AST_TEST_UNREGISTER(sccp_device_lookup_bench);
+	AST_TEST_UNREGISTER(sccp_device_admission_test);
+}
+#endif
+
 // kate: indent-width 4; replace-tabs off; indent-mode cstyle; auto-insert-doxygen on; line-numbers on; tab-indents on; keep-extra-spaces off; auto-brackets on;
@@ -382,6 +382,7 @@ struct sccp_device_indication_cb {
 #define sccp_dev_displayprinotify(p,q,r,s) sccp_dev_displayprinotify_debug(p,q,r,s,__FILE__, __LINE__, __PRETTY_FUNCTION__)
 
 SCCP_API void SCCP_CALL sccp_device_pre_reload(void);
+SCCP_API void SCCP_CALL sccp_device_pre_reload_device(sccp_device_t * d);
 SCCP_API void SCCP_CALL sccp_device_post_reload(void);
 
 /* ====================================================================================================== start getters / setters for privateData */
@@ -394,6 +395,18 @@ SCCP_API const SCCP_CALL skinny_registrationstate_t sccp_device_getRegistrationS
 SCCP_API int SCCP_CALL sccp_device_setRegistrationState(constDevicePtr d, const skinny_registrationstate_t state);
 /* ======================================================================================================== end getters / setters for privateData */
 
+/* registration admission control */
+typedef struct sccp_device_admission_stats {
+	uint64_t admitted;											/*!< registrations allowed to go ahead */
+	uint64_t deferred;											/*!< token requests answered with a token reject */
+	uint64_t rejected;											/*!< direct registrations refused */
+	uint32_t inprogress;											/*!< admitted devices which have not finished registering yet */
+} sccp_device_admission_stats_t;
+
+SCCP_API boolean_t SCCP_CALL sccp_device_admitRegistration(constDevicePtr d, boolean_t canDefer);
+SCCP_API int SCCP_CALL sccp_device_admissionBackoff(void);
+SCCP_API void SCCP_CALL sccp_device_getAdmissionStats(sccp_device_admission_stats_t * stats);
+
 /* live cycle */
 SCCP_API sccp_device_t * SCCP_CALL sccp_device_create(const char *id);
 SCCP_API sccp_device_t * SCCP_CALL sccp_device_createAnonymous(const char *name);
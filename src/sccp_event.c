@@ -19,7 +19,7 @@
 #include "sccp_device.h"
 #include "sccp_event.h"
 #include "sccp_line.h"
-#include "sccp_vector.h"
+#include "sccp_atomic.h"
 
 SCCP_FILE_VERSION(__FILE__, "");
 
@@ -32,14 +32,11 @@ void sccp_event_destroy(sccp_event_t * event);
 #else
 #define NUMBER_OF_EVENT_TYPES 10				/* grep SCCP_EVENT sccp_enum.in */
 #endif
+#define SCCP_EVENT_ASYNC_SLOTS 256				/* preallocated async event arguments, beyond that fall back to malloc */
+
 /* type declarations */
 typedef struct sccp_event_subscriber sccp_event_subscriber_t;
-typedef struct sccp_event_subscriptions sccp_event_subscriptions_t;
-typedef SCCP_VECTOR_RW(, sccp_event_subscriber_t) sccp_event_vector_t;
-
-/* vector compare functions */
-#define SUBSCRIBER_CB_CMP(elem, value) ((elem).callback_function == (value))
-#define SUBSCRIBER_EXEC_CMP(elem, value) ((elem).execution == (value))
+typedef struct sccp_event_snapshot sccp_event_snapshot_t;
 
 /*!
  * \brief Execution Mode Enum
@@ -58,15 +55,29 @@ struct sccp_event_subscriber {
 	sccp_event_callback_t callback_function;
 };
 
+/*!
+ * \brief SCCP Event Subscribers Snapshot
+ *
+ * Immutable array of subscribers for one event type, synchronous subscribers first, followed by the asynchronous ones.
+ * (Un)subscribe builds a new snapshot and swaps it in. The previous one is retired and only freed when the event system is
+ * stopped, so that sccp_event_fire and the async processor can walk a snapshot without taking any lock.
+ */
+struct sccp_event_snapshot {
+	sccp_event_snapshot_t *retired;										/*!< next on the retired list */
+	uint32_t num_sync;
+	uint32_t num_async;
+	sccp_event_subscriber_t subscriber[];
+};
+
 /*!
  * \brief SCCP Event Subscriptions Structure
  */
 static struct sccp_event_subscriptions {
-	sccp_event_vector_t subscribers;
-							// same as: SCCP_VECTOR_RW(sccp_event_vector, sccp_event_subscriber_t) subscribers;
-							// typedef struct sccp_event_vector sccp_event_vector_t;
-							// but using predeclared type instead
-} event_subscriptions[NUMBER_OF_EVENT_TYPES] = {{{0}}};
+	sccp_event_snapshot_t *volatile snapshot;
+} event_subscriptions[NUMBER_OF_EVENT_TYPES] = {{0}};
+
+AST_MUTEX_DEFINE_STATIC(event_subscriptions_lock);								/* serializes (un)subscribe, never taken by fire */
+static sccp_event_snapshot_t *retired_snapshots = NULL;
 
 /*
  * \brief release held references when we are finished processing this event
@@ -123,6 +134,59 @@ void sccp_event_destroy(sccp_event_t * event)
 }
 
 static volatile boolean_t sccp_event_running = FALSE;
+static volatile int sccp_event_inflight = 0;									/*!< fires and queued async events that may still walk a snapshot */
+#define SCCP_EVENT_STOP_WAIT 500										/* times 10ms, after that the snapshots are leaked instead of freed */
+
+/*!
+ * async thread arguments
+ */
+typedef struct __aSyncEventProcessorThreadArg
+{
+	sccp_event_t event;
+	const sccp_event_snapshot_t *snapshot;
+	uint32_t next;												/*!< free list link (slot + 1, 0 = end) */
+	boolean_t pooled;
+} AsyncArgs_t;
+
+static AsyncArgs_t async_slots[SCCP_EVENT_ASYNC_SLOTS];
+static volatile uint64_t async_free = 0;									/*!< free list head: generation << 32 | (slot + 1) */
+
+/*!
+ * take async arguments from the lock free slot list (the generation count protects against ABA), malloc when exhausted
+ */
+static AsyncArgs_t *__async_args_get(void)
+{
+	AsyncArgs_t *arg = NULL;
+	uint64_t head, next;
+
+	do {
+		head = async_free;
+		if (!(uint32_t) head) {
+			if ((arg = (AsyncArgs_t *) sccp_malloc(sizeof(AsyncArgs_t)))) {
+				arg->pooled = FALSE;
+			}
+			return arg;
+		}
+		arg = &async_slots[(uint32_t) head - 1];
+		next = (((head >> 32) + 1) << 32) | arg->next;
+	} while (__sync_val_compare_and_swap(&async_free, head, next) != head);
+	return arg;
+}
+
+static void __async_args_put(AsyncArgs_t *arg)
+{
+	uint64_t head, next;
+
+	if (!arg->pooled) {
+		sccp_free(arg);
+		return;
+	}
+	do {
+		head = async_free;
+		arg->next = (uint32_t) head;
+		next = (((head >> 32) + 1) << 32) | (uint32_t) (arg - async_slots + 1);
+	} while (__sync_val_compare_and_swap(&async_free, head, next) != head);
+}
 
 //static void __attribute__((constructor)) sccp_event_module_init(void)
 void sccp_event_module_start(void)
@@ -130,12 +194,11 @@ void sccp_event_module_start(void)
 	uint _idx = 0;
 	if (!sccp_event_running) {
 		sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_2 "Starting event system\n");
-		for (_idx = 0; _idx < NUMBER_OF_EVENT_TYPES; _idx++) {
-			if (SCCP_VECTOR_RW_INIT(&event_subscriptions[_idx].subscribers, SCCP_EVENT_EXPECTED_SUBSCRIPTIONS) != 0) {
-				pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
-				return;
-			}
+		for (_idx = 0; _idx < SCCP_EVENT_ASYNC_SLOTS; _idx++) {
+			async_slots[_idx].pooled = TRUE;
+			async_slots[_idx].next = (_idx + 1 < SCCP_EVENT_ASYNC_SLOTS) ? _idx + 2 : 0;
 		}
+		async_free = 1;
 		sccp_event_running = TRUE;
 	}
 }
@@ -144,13 +207,88 @@ void sccp_event_module_start(void)
 void sccp_event_module_stop(void)
 {
 	uint _idx = 0;
+	int loopcount = 0;
+	int inflight = 0;
+	sccp_event_snapshot_t *snapshot = NULL;
 	if (sccp_event_running) {
 		sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_2 "Stopping event system\n");
 		sccp_event_running = FALSE;
+		__sync_synchronize();										/* fire increments sccp_event_inflight before checking sccp_event_running */
+		while ((inflight = ATOMIC_FETCH(&sccp_event_inflight, &event_subscriptions_lock)) && SCCP_EVENT_STOP_WAIT > loopcount++) {	/* fires and queued async events still walk a snapshot */
+			usleep(10000);
+		}
+		pbx_mutex_lock(&event_subscriptions_lock);
+		if (inflight) {
+			pbx_log(LOG_WARNING, "SCCP: (sccp_event_module_stop) %d events still being processed, leaking the subscriber snapshots\n", inflight);
+		}
 		for (_idx = 0; _idx < NUMBER_OF_EVENT_TYPES; _idx++) {
-			SCCP_VECTOR_RW_FREE(&event_subscriptions[_idx].subscribers);
+			if (!inflight && event_subscriptions[_idx].snapshot) {
+				sccp_free(event_subscriptions[_idx].snapshot);
+			}
+			event_subscriptions[_idx].snapshot = NULL;
+		}
+		while ((snapshot = retired_snapshots)) {
+			retired_snapshots = snapshot->retired;
+			if (!inflight) {
+				sccp_free(snapshot);
+			}
+		}
+		pbx_mutex_unlock(&event_subscriptions_lock);
+	}
+}
+
+/*!
+ * \brief Replace the snapshot at _idx by a copy with subscriber added (or the first subscriber with the same callback removed)
+ * \note needs to be called with event_subscriptions_lock held
+ */
+static boolean_t __replace_snapshot(uint32_t _idx, const sccp_event_subscriber_t *subscriber, boolean_t add)
+{
+	sccp_event_snapshot_t *current = event_subscriptions[_idx].snapshot;
+	sccp_event_snapshot_t *snapshot = NULL;
+	uint32_t num_sync = current ? current->num_sync : 0;
+	uint32_t total = current ? current->num_sync + current->num_async : 0;
+	uint32_t insert = total, n = 0, pos = 0;
+
+	if (add) {
+		if (subscriber->execution == SCCP_EVENT_SYNC) {
+			insert = num_sync++;									/* append to the sync group */
+		}
+	} else {
+		for (insert = 0; insert < total && current->subscriber[insert].callback_function != subscriber->callback_function; insert++);
+		if (insert == total) {
+			return FALSE;
+		}
+		if (insert < num_sync) {
+			num_sync--;
+		}
+	}
+	if (!(snapshot = (sccp_event_snapshot_t *) sccp_calloc(1, sizeof(sccp_event_snapshot_t) + (total + 1) * sizeof(sccp_event_subscriber_t)))) {
+		pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
+		return FALSE;
+	}
+	for (n = 0; n < total; n++) {
+		if (n == insert) {
+			if (add) {
+				snapshot->subscriber[pos++] = *subscriber;
+			} else {
+				continue;
+			}
 		}
+		snapshot->subscriber[pos++] = current->subscriber[n];
 	}
+	if (add && insert == total) {
+		snapshot->subscriber[pos++] = *subscriber;
+	}
+	snapshot->num_sync = num_sync;
+	snapshot->num_async = pos - num_sync;
+
+	__sync_synchronize();											/* publish the contents before the pointer */
+	event_subscriptions[_idx].snapshot = snapshot;
+	if (current) {
+		current->retired = retired_snapshots;								/* a running fire might still be walking it */
+		retired_snapshots = current;
+	}
+	return TRUE;
 }
 
 /*!
@@ -162,27 +300,22 @@ void sccp_event_module_stop(void)
 boolean_t sccp_event_subscribe(sccp_event_type_t eventType, sccp_event_callback_t cb, boolean_t allowAsyncExecution)
 {
 	boolean_t res = FALSE;
-	uint8_t _idx; 
-	sccp_event_type_t _mask;
-	for (_idx = 0, _mask = 1 << _idx; sccp_event_running && _idx < NUMBER_OF_EVENT_TYPES; _mask = 1 << ++_idx) {
-		if(eventType & _mask) {
-			//sccp_log(DEBUGCAT_EVENT)(VERBOSE_PREFIX_3 "SCCP: (sccp_event_subscribe) Adding %s with callback:%p to vector at idx:%d\n", sccp_event_type2str(eventType), cb, _idx);
-			sccp_event_subscriber_t subscriber = {
-				.callback_function = cb,
-				.eventType = eventType,
-				.execution = allowAsyncExecution ? SCCP_EVENT_ASYNC : SCCP_EVENT_SYNC,
-			};
-			
-			sccp_event_vector_t *subscribers = &(event_subscriptions[_idx].subscribers);
-			SCCP_VECTOR_RW_WRLOCK(subscribers);
-			if (SCCP_VECTOR_APPEND(subscribers, subscriber) == 0) {
-				res = TRUE;
-			} else {
-				pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
-			}
-			SCCP_VECTOR_RW_UNLOCK(subscribers);
+	uint32_t _idx; 
+	uint32_t _mask = (uint32_t) eventType;
+	sccp_event_subscriber_t subscriber = {
+		.callback_function = cb,
+		.eventType = eventType,
+		.execution = allowAsyncExecution ? SCCP_EVENT_ASYNC : SCCP_EVENT_SYNC,
+	};
+
+	pbx_mutex_lock(&event_subscriptions_lock);
+	for (; sccp_event_running && _mask && (_idx = __builtin_ctz(_mask)) < NUMBER_OF_EVENT_TYPES; _mask &= _mask - 1) {
+		//sccp_log(DEBUGCAT_EVENT)(VERBOSE_PREFIX_3 "SCCP: (sccp_event_subscribe) Adding %s with callback:%p to snapshot at idx:%d\n", sccp_event_type2str(eventType), cb, _idx);
+		if (__replace_snapshot(_idx, &subscriber, TRUE)) {
+			res = TRUE;
 		}
 	}
+	pbx_mutex_unlock(&event_subscriptions_lock);
 	return res;
 }
 
@@ -194,74 +327,69 @@ boolean_t sccp_event_subscribe(sccp_event_type_t eventType, sccp_event_callback_
 boolean_t sccp_event_unsubscribe(sccp_event_type_t eventType, sccp_event_callback_t cb)
 {
 	boolean_t res = FALSE;
-	uint8_t _idx; 
-	sccp_event_type_t _mask;
+	uint32_t _idx; 
+	uint32_t _mask = (uint32_t) eventType;
+	sccp_event_subscriber_t subscriber = {
+		.callback_function = cb,
+	};
 	//sccp_log((DEBUGCAT_EVENT)) (VERBOSE_PREFIX_3 "SCCP: (sccp_event_unsubscribe) Removing %s.\n", sccp_event_type2str(eventType))
-	for (_idx = 0, _mask = 1 << _idx; sccp_event_running && _idx < NUMBER_OF_EVENT_TYPES; _mask = 1 << ++_idx) {
-		if (eventType & _mask) {
-			sccp_event_vector_t *subscribers = &(event_subscriptions[_idx].subscribers);
-			{
-				SCCP_VECTOR_RW_WRLOCK(subscribers);
-				if (SCCP_VECTOR_REMOVE_CMP_UNORDERED(subscribers, cb, SUBSCRIBER_CB_CMP, SCCP_VECTOR_ELEM_CLEANUP_NOOP) == 0) {
-					res = TRUE;
-				} else {
-					pbx_log(LOG_ERROR, "SCCP: (sccp_event_subscribe) Failed to remove subscriber from subscribers vector\n");
-				}
-				SCCP_VECTOR_RW_UNLOCK(subscribers);
-			}
+
+	pbx_mutex_lock(&event_subscriptions_lock);
+	for (; sccp_event_running && _mask && (_idx = __builtin_ctz(_mask)) < NUMBER_OF_EVENT_TYPES; _mask &= _mask - 1) {
+		if (__replace_snapshot(_idx, &subscriber, FALSE)) {
+			res = TRUE;
+		} else {
+			pbx_log(LOG_ERROR, "SCCP: (sccp_event_subscribe) Failed to remove subscriber from subscribers snapshot\n");
 		}
 	}
+	pbx_mutex_unlock(&event_subscriptions_lock);
 	return res;
 }
 
 /* helpers */
 /*!
- * \brief execute the callback off each subscriber in the subscribers array, for a particular event
- * \note should be handed an copied non-lockedable vector
+ * \brief execute the callback of subscribers [start, end) in a snapshot, for a particular event
  */
-static gcc_inline boolean_t __execute_callback_helper(const sccp_event_t *event, sccp_event_vector_t *subs_vector) 
+static gcc_inline boolean_t __execute_callback_helper(const sccp_event_t *event, const sccp_event_snapshot_t *snapshot, uint32_t start, uint32_t end) 
 {
 	boolean_t res = FALSE;
-	if (subs_vector) {
-		uint32_t n = 0;
-		for (n = 0; n < SCCP_VECTOR_SIZE(subs_vector) && sccp_event_running; n++) {
-			sccp_event_subscriber_t subscriber = SCCP_VECTOR_GET(subs_vector, n);
-			if (subscriber.callback_function != NULL) {
-				//sccp_log((DEBUGCAT_EVENT)) (VERBOSE_PREFIX_3 "Processing Event %p of Type %s via %d callback:%p\n", event, sccp_event_type2str(event->type), n, subscriber.callback_function);
-				subscriber.callback_function(event);
-				res = TRUE;
-			}
+	uint32_t n = 0;
+	for (n = start; n < end && sccp_event_running; n++) {
+		const sccp_event_subscriber_t *subscriber = &snapshot->subscriber[n];
+		if (subscriber->callback_function != NULL) {
+			//sccp_log((DEBUGCAT_EVENT)) (VERBOSE_PREFIX_3 "Processing Event %p of Type %s via %d callback:%p\n", event, sccp_event_type2str(event->type), n, subscriber->callback_function);
+			subscriber->callback_function(event);
+			res = TRUE;
 		}
-		SCCP_VECTOR_PTR_FREE(subs_vector);
 	}
 	return res;
 }
 
 /*!
- * search for position in event_subscriptions[] array 
+ * affinity key for async execution: events for the same device (or line) are handled by the threadpool in the order they were fired
  */
-static gcc_inline uint8_t __search_for_position_in_event_array(sccp_event_type_t eventType) {
-	uint8_t _idx = 0;
-	sccp_event_type_t _mask;
-	for (_idx = 0, _mask = 1 << _idx; sccp_event_running && _idx < NUMBER_OF_EVENT_TYPES; _mask = 1 << ++_idx) {
-		if (eventType & _mask) {
-			//sccp_log((DEBUGCAT_EVENT)) (VERBOSE_PREFIX_3 "SCCP: (__search_for_position_in_event_array) found index:%d\n", _idx);
-			break;
-		}
+static const char *__event_affinity(const sccp_event_t *event)
+{
+	switch (event->type) {
+		case SCCP_EVENT_DEVICE_REGISTERED:
+		case SCCP_EVENT_DEVICE_UNREGISTERED:
+		case SCCP_EVENT_DEVICE_PREREGISTERED:
+			return event->event.deviceRegistered.device ? event->event.deviceRegistered.device->id : NULL;
+		case SCCP_EVENT_DEVICE_ATTACHED:
+		case SCCP_EVENT_DEVICE_DETACHED:
+			return (event->event.deviceAttached.linedevice && event->event.deviceAttached.linedevice->device) ? event->event.deviceAttached.linedevice->device->id : NULL;
+		case SCCP_EVENT_FEATURE_CHANGED:
+			return event->event.featureChanged.device ? event->event.featureChanged.device->id : NULL;
+		case SCCP_EVENT_LINE_CREATED:
+			return event->event.lineCreated.line ? event->event.lineCreated.line->name : NULL;
+		case SCCP_EVENT_LINESTATUS_CHANGED:
+			return event->event.lineStatusChanged.line ? event->event.lineStatusChanged.line->name : NULL;
+		default:
+			return NULL;
 	}
-	return _idx;
 }
 /* end helpers */
 
-/*!
- * async thread arguments
- */
-typedef struct __aSyncEventProcessorThreadArg
-{
-	uint8_t idx;
-	sccp_event_t event;
-	sccp_event_vector_t *async_subscribers;
-} AsyncArgs_t;
 /*!
  * async thread run within threadpool
  */
@@ -270,9 +398,10 @@ static void *sccp_event_processor(void *data)
 	AsyncArgs_t *arg = data;
 	if (arg) {
 		//sccp_log((DEBUGCAT_EVENT)) (VERBOSE_PREFIX_3 "Async Processing Event Callbacks Type %s\n", sccp_event_type2str(arg->event.type));
-		__execute_callback_helper(&arg->event, arg->async_subscribers);
+		__execute_callback_helper(&arg->event, arg->snapshot, arg->snapshot->num_sync, arg->snapshot->num_sync + arg->snapshot->num_async);
 		sccp_event_destroy(&arg->event);
-		sccp_free(arg);
+		__async_args_put(arg);
+		ATOMIC_DECR(&sccp_event_inflight, 1, &event_subscriptions_lock);
 	}
 	return NULL;
 }
@@ -281,68 +410,49 @@ static void *sccp_event_processor(void *data)
  * \brief Fire an Event
  * \param event SCCP Event
  * \note event will be freed after event is fired
- * 
- * \warning
- *      - sccp_event_listeners->subscriber is not always locked
+ * \note does not lock or allocate: the subscribers snapshot is immutable and async arguments come from a preallocated pool
  */
 boolean_t sccp_event_fire(sccp_event_t * event)
 {
 	boolean_t res = FALSE;
 	if (event) {
-		sccp_event_vector_t *sync_subscribers_cpy = NULL, *async_subscribers_cpy = NULL;
-		size_t subsize = 0, syncsize = 0, asyncsize = 0;
-		uint8_t _idx = __search_for_position_in_event_array(event->type);
-		
-		/* copy both vectors to a local copy while holding the rwlock */
-		sccp_event_vector_t *subscribers = &event_subscriptions[_idx].subscribers;
-		SCCP_VECTOR_RW_RDLOCK(subscribers);
-		if ((subsize = SCCP_VECTOR_SIZE(subscribers))) {
-			sync_subscribers_cpy = SCCP_VECTOR_CALLBACK_MULTIPLE(subscribers, SUBSCRIBER_EXEC_CMP, SCCP_EVENT_SYNC);
-			async_subscribers_cpy = SCCP_VECTOR_CALLBACK_MULTIPLE(subscribers, SUBSCRIBER_EXEC_CMP, SCCP_EVENT_ASYNC);
-			syncsize = sync_subscribers_cpy ? SCCP_VECTOR_SIZE(sync_subscribers_cpy) : 0;
-			asyncsize = async_subscribers_cpy ? SCCP_VECTOR_SIZE(async_subscribers_cpy) : 0;
+		const sccp_event_snapshot_t *snapshot = NULL;
+		uint32_t _idx = event->type ? (uint32_t) __builtin_ctz((uint32_t) event->type) : NUMBER_OF_EVENT_TYPES;
+
+		ATOMIC_INCR(&sccp_event_inflight, 1, &event_subscriptions_lock);				/* before checking sccp_event_running, see sccp_event_module_stop */
+		if (sccp_event_running && _idx < NUMBER_OF_EVENT_TYPES) {
+			snapshot = event_subscriptions[_idx].snapshot;
 		}
-		SCCP_VECTOR_RW_UNLOCK(subscribers);
 
-		// handle synchronous events first (if any)
-		if (sync_subscribers_cpy) {
-			if (syncsize) {
-				res |= __execute_callback_helper(event, sync_subscribers_cpy);
-			} else {
-				SCCP_VECTOR_PTR_FREE(sync_subscribers_cpy);
+		if (snapshot) {
+			// handle synchronous events first (if any)
+			if (snapshot->num_sync) {
+				res |= __execute_callback_helper(event, snapshot, 0, snapshot->num_sync);
 			}
-		}
 
-		// handle the others asynchonously via threadpool (if any)
-		do {
-			if (async_subscribers_cpy) {
-				if (asyncsize) {
-					AsyncArgs_t *arg = NULL;
-					if (GLOB(general_threadpool) && sccp_event_running && (arg = sccp_malloc(sizeof *arg))) {
-						arg->idx = _idx;
-						memcpy(&arg->event, event, sizeof(sccp_event_t));
-						arg->async_subscribers = async_subscribers_cpy;
-						if (sccp_threadpool_add_work(GLOB(general_threadpool), (void *) sccp_event_processor, (void *) arg)) {
-							//sccp_log((DEBUGCAT_EVENT)) (VERBOSE_PREFIX_3 "Work added to threadpool for event: %p, type: %s\n", event, sccp_event_type2str(event->type));
-							event = NULL;					// set to NULL, thread will clean event up later.
-							res |= true;
-							break;						// break out of do/while loop, no further processing needed
-						} else {
-							pbx_log(LOG_ERROR, "Could not add work to threadpool for event: %s\n", sccp_event_type2str(event->type));
-							sccp_free(arg);					// explicit failure release
-						}
+			// handle the others asynchonously via threadpool (if any)
+			if (snapshot->num_async) {
+				AsyncArgs_t *arg = NULL;
+				if (GLOB(general_threadpool) && sccp_event_running && (arg = __async_args_get())) {
+					memcpy(&arg->event, event, sizeof(sccp_event_t));
+					arg->snapshot = snapshot;
+					ATOMIC_INCR(&sccp_event_inflight, 1, &event_subscriptions_lock);
+					if (sccp_threadpool_add_work_affinity(GLOB(general_threadpool), (void *) sccp_event_processor, (void *) arg, __event_affinity(&arg->event))) {
+						//sccp_log((DEBUGCAT_EVENT)) (VERBOSE_PREFIX_3 "Work added to threadpool for event: %p, type: %s\n", event, sccp_event_type2str(event->type));
+						ATOMIC_DECR(&sccp_event_inflight, 1, &event_subscriptions_lock);
+						return TRUE;								// thread will clean event up later.
 					}
-					res |= __execute_callback_helper(event, async_subscribers_cpy);	// fallback to handling synchronously in case something prevented async
-				} else {
-					SCCP_VECTOR_PTR_FREE(async_subscribers_cpy);
+					pbx_log(LOG_ERROR, "Could not add work to threadpool for event: %s\n", sccp_event_type2str(event->type));
+					ATOMIC_DECR(&sccp_event_inflight, 1, &event_subscriptions_lock);
+					__async_args_put(arg);							// explicit failure release
 				}
+				res |= __execute_callback_helper(event, snapshot, snapshot->num_sync, snapshot->num_sync + snapshot->num_async);	// fallback to handling synchronously in case something prevented async
 			}
-		} while (0);
+		}
+		ATOMIC_DECR(&sccp_event_inflight, 1, &event_subscriptions_lock);
 
 		/* cleanup */
-		if (event) {
-			sccp_event_destroy(event);
-		}
+		sccp_event_destroy(event);
 	}
 	return res;
 }
@@ -502,11 +612,59 @@ cleanup:
 	return rc;
 }
 
+#define EVENT_BENCH_EVENTS 100000
+static volatile int _sccp_event_BenchEventReceived = 0;
+
+static void sccp_event_benchListener(const sccp_event_t * event) {
+	ATOMIC_INCR(&_sccp_event_BenchEventReceived, 1, NULL);
+}
+
+AST_TEST_DEFINE(sccp_event_bench)
+{
+	int rc = AST_TEST_PASS;
+	switch(cmd) {
+		case TEST_INIT:
+			info->name = "bench";
+			info->category = "/channels/chan_sccp/event/";
+			info->summary = "chan-sccp-b event throughput";
+			info->description = "chan-sccp-b fire test events to synchronous and asynchronous subscribers and report events/sec";
+			return AST_TEST_NOT_RUN;
+		case TEST_EXECUTE:
+			break;
+	}
+	int mode = 0, loop = 0, loopcount = 0;
+
+	for (mode = 0; mode < 2 && rc == AST_TEST_PASS; mode++) {
+		boolean_t async = mode ? TRUE : FALSE;
+		pbx_test_validate(test, sccp_event_subscribe(SCCP_EVENT_TEST, sccp_event_benchListener, async));
+		_sccp_event_BenchEventReceived = 0;
+
+		struct timeval start = pbx_tvnow();
+		for (loop = 0; loop < EVENT_BENCH_EVENTS; loop++) {
+			sccp_event_t event = {{{0}}};
+			event.type = SCCP_EVENT_TEST;
+			event.event.TestEvent.value = loop;
+			sccp_event_fire(&event);
+		}
+		int64_t fire_us = ast_tvdiff_us(pbx_tvnow(), start);
+		for (loopcount = 0; ATOMIC_FETCH(&_sccp_event_BenchEventReceived, NULL) < EVENT_BENCH_EVENTS && 1000 > loopcount; loopcount++) {
+			sccp_safe_sleep(10);
+		}
+		int64_t elapsed_us = ast_tvdiff_us(pbx_tvnow(), start);
+		pbx_test_status_update(test, "%s: fired %d events in %.3f ms, delivered %d in %.3f ms, %.0f events/sec\n", async ? "async" : "sync", EVENT_BENCH_EVENTS, (double) fire_us / 1000, _sccp_event_BenchEventReceived, (double) elapsed_us / 1000, elapsed_us ? (double) _sccp_event_BenchEventReceived * 1000000 / elapsed_us : 0);
+		pbx_test_validate_cleanup(test, _sccp_event_BenchEventReceived == EVENT_BENCH_EVENTS, rc, cleanup);
+cleanup:
+		pbx_test_validate(test, sccp_event_unsubscribe(SCCP_EVENT_TEST, sccp_event_benchListener));
+	}
+	return rc;
+}
+
 static void __attribute__((constructor)) sccp_register_tests(void)
 {
 	AST_TEST_REGISTER(sccp_event_test_subscribe_single);
 	AST_TEST_REGISTER(sccp_event_test_subscribe_multi);
 	AST_TEST_REGISTER(sccp_event_test_subscribe_multi_sync);
+	AST_TEST_REGISTER(sccp_event_bench);
 }
 
 static void __attribute__((destructor)) sccp_unregister_tests(void)
@@ -514,6 +672,7 @@ static void __attribute__((destructor)) sccp_unregister_tests(void)
 	AST_TEST_UNREGISTER(sccp_event_test_subscribe_single);
 	AST_TEST_UNREGISTER(sccp_event_test_subscribe_multi);
 	AST_TEST_UNREGISTER(sccp_event_test_subscribe_multi_sync);
+	AST_TEST_UNREGISTER(sccp_event_bench);
 }
 #endif
 
@@ -36,6 +36,7 @@ struct subscriptionId {
 struct sccp_global_vars {
 	int keepalive;												/*!< KeepAlive */
 	int32_t debug;												/*!< Debug */
+	int32_t trace;												/*!< Trace Ring Categories */
 	int module_running;
 	pbx_rwlock_t lock;											/*!< Asterisk: Lock Me Up and Tie me Down */
 
@@ -49,6 +50,9 @@ struct sccp_global_vars {
 	SCCP_RWLIST_HEAD (, sccp_session_t) sessions;								/*!< SCCP Sessions */
 	SCCP_RWLIST_HEAD (, sccp_device_t) devices;								/*!< SCCP Devices */
 	SCCP_RWLIST_HEAD (, sccp_line_t) lines;									/*!< SCCP Lines */
+	sccp_hashtable_t *session_index;									/*!< SCCP Sessions by pointer (protected by the sessions lock) */
+	sccp_hashtable_t *device_index;										/*!< SCCP Devices by id (protected by the devices lock) */
+	sccp_hashtable_t *line_index;										/*!< SCCP Lines by name (protected by the lines lock) */
 
 	sccp_mutex_t socket_lock;										/*!< Socket Lock */
 #ifndef SCCP_ATOMIC	
@@ -153,6 +157,12 @@ struct sccp_global_vars {
 	int token_backoff_time;											/*!< Backoff time on TokenReject */
 	int server_priority;											/*!< Server Priority to fallback to */
 
+	boolean_t session_reactor;										/*!< Use the epoll session reactor instead of a thread per device */
+	uint8_t session_workers;										/*!< Number of session reactor worker threads (0 = number of cpu cores) */
+	uint16_t hint_coalesce_window;										/*!< Hint state change coalescing window in ms (0 = off) */
+	uint32_t registration_rate;										/*!< Registrations admitted per second (0 = unlimited) */
+	uint32_t registration_max_inprogress;									/*!< Max number of registrations in progress at the same time (0 = unlimited) */
+
 	boolean_t reload_in_progress;										/*!< Reload in Progress */
 	boolean_t pendingUpdate;
 };														/*!< SCCP Global Varable Structure */
@@ -0,0 +1,240 @@
+/*!
+ * \file        sccp_hashtable.c
+ * \brief       SCCP Hash Index
+ * \note        This program is free software and may be modified and distributed under the terms of the GNU Public License.
+ *              See the LICENSE file at the top of the source tree.
+ */
+
+/*!
+ * \section sccp_hashtable   Hash Index
+ *
+ * Small chained hash table used to index the global lists (devices by id, lines by name, sessions by pointer), so that
+ * lookups no longer have to walk the complete list. The table grows (doubling the number of buckets) when the number of
+ * entries exceeds the number of buckets, so chains stay short without having to be sized up front.
+ *
+ * The index does not lock, it is protected by the lock of the list it sits next to (see sccp_hashtable.h).
+ */
+
+#include "config.h"
+#include "common.h"
+#include "sccp_hashtable.h"
+#include "sccp_utils.h"
+
+SCCP_FILE_VERSION(__FILE__, "");
+
+#define SCCP_HASHTABLE_MIN_BUCKETS 16
+
+typedef struct sccp_hashtable_entry sccp_hashtable_entry_t;
+struct sccp_hashtable_entry {
+	sccp_hashtable_entry_t *next;
+	const void *key;
+	void *value;
+	uint32_t hash;
+};
+
+struct sccp_hashtable {
+	sccp_hashtable_entry_t **bucket;
+	uint32_t mask;												/*!< number of buckets - 1 (power of two) */
+	uint32_t size;
+	enum sccp_hashtable_keytype keytype;
+};
+
+/* case-insensitive FNV-1a */
+static inline uint32_t hashtable_hash_string_nocase(const char *str)
+{
+	uint32_t hash = 2166136261U;
+
+	while (*str) {
+		hash ^= (unsigned char) tolower((unsigned char) *str++);
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+/* integer finalizer, spreads pointer alignment / sequential ids over all buckets */
+static inline uint32_t hashtable_hash_int(uint64_t val)
+{
+	val ^= val >> 33;
+	val *= 0xff51afd7ed558ccdULL;
+	val ^= val >> 33;
+	return (uint32_t) val;
+}
+
+static inline uint32_t hashtable_hash(const sccp_hashtable_t * ht, const void *key)
+{
+	switch (ht->keytype) {
+		case SCCP_HASHTABLE_KEY_STRING_NOCASE:
+			return hashtable_hash_string_nocase((const char *) key);
+		case SCCP_HASHTABLE_KEY_POINTER:
+		case SCCP_HASHTABLE_KEY_UINT32:
+			return hashtable_hash_int((uintptr_t) key);
+	}
+	return 0;
+}
+
+static inline boolean_t hashtable_key_equals(const sccp_hashtable_t * ht, const sccp_hashtable_entry_t * entry, const void *key, uint32_t hash)
+{
+	if (entry->hash != hash) {
+		return FALSE;
+	}
+	if (ht->keytype == SCCP_HASHTABLE_KEY_STRING_NOCASE) {
+		return strcasecmp((const char *) entry->key, (const char *) key) == 0 ? TRUE : FALSE;
+	}
+	return entry->key == key ? TRUE : FALSE;
+}
+
+static void hashtable_grow(sccp_hashtable_t * ht)
+{
+	uint32_t newmask = (ht->mask << 1) | 1;
+	sccp_hashtable_entry_t **newbucket = (sccp_hashtable_entry_t **) sccp_calloc(newmask + 1, sizeof(sccp_hashtable_entry_t *));
+
+	if (!newbucket) {
+		return;												/* keep using the current (longer) chains */
+	}
+	for (uint32_t idx = 0; idx <= ht->mask; idx++) {
+		sccp_hashtable_entry_t *entry = NULL;
+		while ((entry = ht->bucket[idx])) {
+			ht->bucket[idx] = entry->next;
+			entry->next = newbucket[entry->hash & newmask];
+			newbucket[entry->hash & newmask] = entry;
+		}
+	}
+	sccp_free(ht->bucket);
+	ht->bucket = newbucket;
+	ht->mask = newmask;
+}
+
+/*!
+ * \brief Create a hash index
+ * \param keytype type of key
+ * \param buckets initial number of buckets (rounded up to a power of two)
+ */
+sccp_hashtable_t *sccp_hashtable_create(enum sccp_hashtable_keytype keytype, uint32_t buckets)
+{
+	sccp_hashtable_t *ht = NULL;
+	uint32_t size = SCCP_HASHTABLE_MIN_BUCKETS;
+
+	while (size < buckets && size < (1U << 30)) {
+		size <<= 1;
+	}
+	if (!(ht = (sccp_hashtable_t *) sccp_calloc(1, sizeof(sccp_hashtable_t)))) {
+		pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
+		return NULL;
+	}
+	if (!(ht->bucket = (sccp_hashtable_entry_t **) sccp_calloc(size, sizeof(sccp_hashtable_entry_t *)))) {
+		pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
+		sccp_free(ht);
+		return NULL;
+	}
+	ht->mask = size - 1;
+	ht->keytype = keytype;
+	return ht;
+}
+
+/*!
+ * \brief Destroy a hash index (the indexed values are not touched)
+ * \note *ht is set to NULL, so lookups racing module unload find an empty index instead of freed memory
+ */
+void sccp_hashtable_destroy(sccp_hashtable_t ** ht)
+{
+	if (!ht || !*ht) {
+		return;
+	}
+	for (uint32_t idx = 0; idx <= (*ht)->mask; idx++) {
+		sccp_hashtable_entry_t *entry = NULL;
+		while ((entry = (*ht)->bucket[idx])) {
+			(*ht)->bucket[idx] = entry->next;
+			sccp_free(entry);
+		}
+	}
+	sccp_free((*ht)->bucket);
+	sccp_free(*ht);
+	*ht = NULL;
+}
+
+/*!
+ * \brief Add value under key
+ * \note duplicate keys are allowed, find returns the most recently inserted one
+ */
+boolean_t sccp_hashtable_insert(sccp_hashtable_t * ht, const void *key, void *value)
+{
+	sccp_hashtable_entry_t *entry = NULL;
+
+	if (!ht || (!key && ht->keytype == SCCP_HASHTABLE_KEY_STRING_NOCASE)) {
+		return FALSE;
+	}
+	if (!(entry = (sccp_hashtable_entry_t *) sccp_malloc(sizeof(sccp_hashtable_entry_t)))) {
+		pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
+		return FALSE;
+	}
+	entry->key = key;
+	entry->value = value;
+	entry->hash = hashtable_hash(ht, key);
+	entry->next = ht->bucket[entry->hash & ht->mask];
+	ht->bucket[entry->hash & ht->mask] = entry;
+	if (++ht->size > ht->mask + 1) {
+		hashtable_grow(ht);
+	}
+	return TRUE;
+}
+
+/*!
+ * \brief Remove the entry for key, pointing to value
+ */
+boolean_t sccp_hashtable_remove(sccp_hashtable_t * ht, const void *key, const void *value)
+{
+	sccp_hashtable_entry_t **prev = NULL;
+	sccp_hashtable_entry_t *entry = NULL;
+	uint32_t hash;
+
+	if (!ht || (!key && ht->keytype == SCCP_HASHTABLE_KEY_STRING_NOCASE)) {
+		return FALSE;
+	}
+	hash = hashtable_hash(ht, key);
+	for (prev = &ht->bucket[hash & ht->mask]; (entry = *prev); prev = &entry->next) {
+		if (entry->value == value && hashtable_key_equals(ht, entry, key, hash)) {
+			*prev = entry->next;
+			ht->size--;
+			sccp_free(entry);
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/*!
+ * \brief Find the value stored under key
+ * \return value or NULL (the value is not retained)
+ */
+void *sccp_hashtable_find(const sccp_hashtable_t * ht, const void *key)
+{
+	sccp_hashtable_entry_t *entry = NULL;
+	uint32_t hash;
+
+	if (!ht || (!key && ht->keytype == SCCP_HASHTABLE_KEY_STRING_NOCASE)) {
+		return NULL;
+	}
+	hash = hashtable_hash(ht, key);
+	for (entry = ht->bucket[hash & ht->mask]; entry; entry = entry->next) {
+		if (hashtable_key_equals(ht, entry, key, hash)) {
+			return entry->value;
+		}
+	}
+	return NULL;
+}
+
+uint32_t sccp_hashtable_size(const sccp_hashtable_t * ht)
+{
+	return ht ? ht->size : 0;
+}
+
+uint32_t sccp_hashtable_buckets(const sccp_hashtable_t * ht)
+{
+	return ht ? ht->mask + 1 : 0;
+}
+
+uint32_t sccp_hashtable_hash_nocase(const char *str)
+{
+	return str ? hashtable_hash_string_nocase(str) : 0;
+}
+// kate: indent-width 8; replace-tabs off; indent-mode cstyle; auto-insert-doxygen on; line-numbers on; tab-indents on; keep-extra-spaces off; auto-brackets off;
@@ -0,0 +1,35 @@
+/*!
+ * \file        sccp_hashtable.h
+ * \brief       SCCP Hash Index Header
+ * \note        This program is free software and may be modified and distributed under the terms of the GNU Public License.
+ *              See the LICENSE file at the top of the source tree.
+ */
+#pragma once
+
+__BEGIN_C_EXTERN__
+/*!
+ * \brief Key types supported by the hash index
+ */
+enum sccp_hashtable_keytype {
+	SCCP_HASHTABLE_KEY_STRING_NOCASE,									/*!< key is a (const char *), compared case-insensitive */
+	SCCP_HASHTABLE_KEY_POINTER,										/*!< key is the pointer value itself */
+	SCCP_HASHTABLE_KEY_UINT32,										/*!< key is an uint32_t passed as (const void *)(uintptr_t) */
+};
+
+typedef struct sccp_hashtable sccp_hashtable_t;
+
+/*!
+ * \note The hash index does not do any locking of its own. It is meant to sit next to a list, and is protected by that
+ *       list's lock: insert/remove under the write lock, find under the read lock. String keys are not copied, the key
+ *       has to stay valid (and unchanged) for as long as the entry is in the index (i.e. point to d->id).
+ */
+SCCP_API sccp_hashtable_t * SCCP_CALL sccp_hashtable_create(enum sccp_hashtable_keytype keytype, uint32_t buckets);
+SCCP_API void SCCP_CALL sccp_hashtable_destroy(sccp_hashtable_t ** ht);
+SCCP_API boolean_t SCCP_CALL sccp_hashtable_insert(sccp_hashtable_t * ht, const void *key, void *value);
+SCCP_API boolean_t SCCP_CALL sccp_hashtable_remove(sccp_hashtable_t * ht, const void *key, const void *value);
+SCCP_API void * SCCP_CALL sccp_hashtable_find(const sccp_hashtable_t * ht, const void *key);
+SCCP_API uint32_t SCCP_CALL sccp_hashtable_size(const sccp_hashtable_t * ht);
+SCCP_API uint32_t SCCP_CALL sccp_hashtable_buckets(const sccp_hashtable_t * ht);
+SCCP_API uint32_t SCCP_CALL sccp_hashtable_hash_nocase(const char *str);				/*!< the string hash used by the index, for callers keeping their own table */
+__END_C_EXTERN__
+// kate: indent-width 8; replace-tabs off; indent-mode cstyle; auto-insert-doxygen on; line-numbers on; tab-indents on; keep-extra-spaces off; auto-brackets off;
@@ -34,6 +34,8 @@ SCCP_FILE_VERSION(__FILE__, "");
 #include "sccp_line.h"
 #include "sccp_utils.h"
 #include "sccp_labels.h"
+#include "sccp_hashtable.h"
+#include "sccp_packet.h"
 
 #if defined(CS_AST_HAS_EVENT) && defined(HAVE_PBX_EVENT_H) 	// ast_event_subscribe
 #  include <asterisk/event.h>
@@ -57,13 +59,28 @@ struct sccp_hint_SubscribingDevice
 	uint8_t positionOnDevice;										/*!< Instance */
 };														/*!< SCCP Hint Subscribing Device Structure */
 
+/*!
+ *\brief SCCP Hint Coalescing State (see \ref sccp_hint_coalesce)
+ */
+struct sccp_hint_coalesce {
+	int sched_id;												/*!< pending notification, -1 if none */
+	struct timeval lastNotify;										/*!< last time a notification was sent */
+	uint32_t notified;											/*!< notifications sent */
+	uint32_t suppressed;											/*!< updates folded into a later notification */
+	sccp_channelstate_t sentState;										/*!< last state actually sent (intermediate states may have been folded) */
+};
+
 /*!
  *\brief SCCP Hint Line State Structure
  */
 struct sccp_hint_lineState 
 {
+	char name[StationMaxNameSize];										/*!< Line Name (index key, never changes) */
+	uint32_t hash;
 	sccp_line_t *line;
 	sccp_channelstate_t state;
+	volatile sccp_channelstate_t publishedState;								/*!< state as returned to the pbx, only set after an update has completed */
+	struct sccp_hint_coalesce coalesce;									/*!< devicestate push to the pbx */
 
 	/*!
 	 * \brief Call Information Structure
@@ -102,6 +119,7 @@ struct sccp_hint_list {
 	skinny_calltype_t calltype;										/*!< Skinny Call Type */
 
 	int stateid;												/*!< subscription id in asterisk */
+	struct sccp_hint_coalesce coalesce;									/*!< notifications to the subscribers */
 #ifdef CS_USE_ASTERISK_DISTRIBUTED_DEVSTATE
 	PBX_EVENT_SUBSCRIPTION *device_state_sub;									/*!< asterisk distributed device state subscription */
 #endif
@@ -117,6 +135,9 @@ static void sccp_hint_updateLineStateForSingleChannel(struct sccp_hint_lineState
 static void sccp_hint_checkForDND(struct sccp_hint_lineState *lineState);
 static sccp_hint_list_t *sccp_hint_create(char *hint_exten, char *hint_context);
 static void sccp_hint_notifySubscribers(sccp_hint_list_t * hint);			/* old */
+static void sccp_hint_notifySubscribersCoalesced(sccp_hint_list_t * hint);
+static void sccp_hint_notifySubscribersViaPbx(struct sccp_hint_lineState *lineState, char *lineName, enum ast_device_state newDeviceState);
+static enum ast_device_state sccp_hint_hint2DeviceState(sccp_channelstate_t state);
 static void sccp_hint_notifyLineStateUpdate(struct sccp_hint_lineState *linestate); 	/* new */
 static void sccp_hint_deviceRegistered(const sccp_device_t * device);
 static void sccp_hint_deviceUnRegistered(const char *deviceName);
@@ -193,6 +214,203 @@ static void sccp_hint_distributed_devstate_cb(const pbx_event_t * event, void *d
 static SCCP_LIST_HEAD (, struct sccp_hint_lineState) lineStates;
 static SCCP_LIST_HEAD (, sccp_hint_list_t) sccp_hint_subscriptions;
 
+/* ========================================================================================================================= LineState Index */
+/*!
+ * \brief LineState Index
+ *
+ * Open addressed (linear probing) table of lineStates keyed by line name, so that sccp_hint_getLinestate (called by the pbx for
+ * every devicestate query) does not have to take the lineStates lock and strcasecmp its way through the list.
+ *
+ * Writers hold the lineStates lock. lineStates are never removed from the index (detaching the last device only releases the
+ * line), so a reader probing without a lock either finds an empty slot or a valid lineState. When the table gets half full, a
+ * table of twice the size is swapped in and the old one is kept on the retired chain until the index is destroyed.
+ */
+#define SCCP_HINT_LINESTATE_INDEX_MIN 64
+struct sccp_hint_lineStateIndex {
+	struct sccp_hint_lineStateIndex *retired;								/*!< previous (smaller) table */
+	uint32_t mask;
+	uint32_t used;
+	struct sccp_hint_lineState *volatile slot[];
+};
+static struct sccp_hint_lineStateIndex *volatile lineStateIndex = NULL;
+
+static struct sccp_hint_lineState *sccp_hint_lineStateIndex_find(const struct sccp_hint_lineStateIndex *lsindex, const char *name)
+{
+	struct sccp_hint_lineState *lineState = NULL;
+	uint32_t hash, pos;
+
+	if (!lsindex || !name) {
+		return NULL;
+	}
+	hash = sccp_hashtable_hash_nocase(name);
+	for (pos = hash & lsindex->mask; (lineState = lsindex->slot[pos]); pos = (pos + 1) & lsindex->mask) {
+		if (lineState->hash == hash && sccp_strcaseequals(lineState->name, name)) {
+			return lineState;
+		}
+	}
+	return NULL;
+}
+
+static boolean_t sccp_hint_lineStateIndex_add(struct sccp_hint_lineStateIndex *volatile *indexp, struct sccp_hint_lineState *lineState)
+{
+	struct sccp_hint_lineStateIndex *lsindex = *indexp;
+	uint32_t pos, n;
+
+	lineState->hash = sccp_hashtable_hash_nocase(lineState->name);
+	if (!lsindex || (lsindex->used + 1) * 2 > lsindex->mask + 1) {
+		uint32_t size = lsindex ? (lsindex->mask + 1) * 2 : SCCP_HINT_LINESTATE_INDEX_MIN;
+		struct sccp_hint_lineStateIndex *newlsindex = (struct sccp_hint_lineStateIndex *) sccp_calloc(1, sizeof(struct sccp_hint_lineStateIndex) + size * sizeof(struct sccp_hint_lineState *));
+
+		if (!newlsindex) {
+			pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
+			return FALSE;
+		}
+		newlsindex->mask = size - 1;
+		newlsindex->retired = lsindex;
+		for (n = 0; lsindex && n <= lsindex->mask; n++) {
+			if (lsindex->slot[n]) {
+				for (pos = lsindex->slot[n]->hash & newlsindex->mask; newlsindex->slot[pos]; pos = (pos + 1) & newlsindex->mask);
+				newlsindex->slot[pos] = lsindex->slot[n];
+				newlsindex->used++;
+			}
+		}
+		__sync_synchronize();										/* publish the copied slots before the table */
+		*indexp = lsindex = newlsindex;
+	}
+	for (pos = lineState->hash & lsindex->mask; lsindex->slot[pos]; pos = (pos + 1) & lsindex->mask);
+	__sync_synchronize();											/* publish the lineState contents before the slot */
+	lsindex->slot[pos] = lineState;
+	lsindex->used++;
+	return TRUE;
+}
+
+static void sccp_hint_lineStateIndex_destroy(struct sccp_hint_lineStateIndex *volatile *indexp)
+{
+	struct sccp_hint_lineStateIndex *lsindex = *indexp;
+	struct sccp_hint_lineStateIndex *retired = NULL;
+
+	*indexp = NULL;
+	while (lsindex) {
+		retired = lsindex->retired;
+		sccp_free(lsindex);
+		lsindex = retired;
+	}
+}
+
+/* ========================================================================================================================= Coalescing */
+/*!
+ * \brief Coalescing Window
+ *
+ * During a burst a line can go RINGIN -> CONNECTED -> ONHOOK within a few tens of milliseconds. When hint_coalesce_window is set,
+ * a state change arriving within the window after the previous notification is not sent right away: a scheduler task sends
+ * whatever the state is when the window closes, and any changes arriving in the meantime are folded into that (counted as
+ * suppressed). An isolated change is still sent immediately, and ringing always is, so a ring-in shows without delay.
+ *
+ * The fields are protected by the lock of the list the owner lives on (hint->subscribers / lineStates).
+ */
+#define SCCP_HINT_COALESCE_MAX_WINDOW 250									/* ms */
+
+static int sccp_hint_coalesceWindow(void)
+{
+	int window = GLOB(hint_coalesce_window);
+	return window > SCCP_HINT_COALESCE_MAX_WINDOW ? SCCP_HINT_COALESCE_MAX_WINDOW : window;
+}
+
+/*!
+ * \brief Decide whether an update has to be sent now
+ * \return TRUE when the caller should send now, FALSE when it is left to the (pending) scheduled notification
+ * \note needs to be called with the owner's lock held
+ */
+static boolean_t sccp_hint_coalesce(struct sccp_hint_coalesce *coalesce, boolean_t immediate, sccp_sched_cb callback, const void *data)
+{
+	struct timeval now = pbx_tvnow();
+	int window = sccp_hint_coalesceWindow();
+	int64_t elapsed = 0;
+
+	if (coalesce->sched_id > -1) {
+		if (!immediate && window) {
+			coalesce->suppressed++;									/* the pending notification will carry this state */
+			return FALSE;
+		}
+		if (SCCP_SCHED_DEL(coalesce->sched_id) == 0) {							/* sending now, supersedes the pending one */
+			coalesce->suppressed++;
+		}
+	}
+	elapsed = ast_tvdiff_ms(now, coalesce->lastNotify);
+	if (!immediate && window && elapsed >= 0 && elapsed < window) {
+		if ((coalesce->sched_id = iPbx.sched_add(window - elapsed, callback, data)) > -1) {
+			return FALSE;
+		}
+	}
+	coalesce->lastNotify = now;
+	coalesce->notified++;
+	return TRUE;
+}
+
+/*!
+ * \brief Scheduled notification is about to be sent
+ * \note needs to be called with the owner's lock held
+ */
+static void sccp_hint_coalesceFired(struct sccp_hint_coalesce *coalesce)
+{
+	coalesce->sched_id = -1;
+	coalesce->lastNotify = pbx_tvnow();
+	coalesce->notified++;
+}
+
+/*!
+ * \brief Record the state about to be sent, returning the one sent before it
+ * \note needs to be called with the owner's lock held
+ */
+static sccp_channelstate_t sccp_hint_coalesceSent(struct sccp_hint_coalesce *coalesce, sccp_channelstate_t state)
+{
+	sccp_channelstate_t sentState = coalesce->sentState;
+
+	coalesce->sentState = state;
+	return sentState;
+}
+
+static int sccp_hint_coalescedNotifySubscribers(const void *data)
+{
+	sccp_hint_list_t *hint = (sccp_hint_list_t *) data;
+
+	SCCP_LIST_LOCK(&hint->subscribers);
+	sccp_hint_coalesceFired(&hint->coalesce);
+	SCCP_LIST_UNLOCK(&hint->subscribers);
+	sccp_hint_notifySubscribers(hint);
+	return 0;
+}
+
+/*!
+ * \brief notify the hint subscribers, honoring the coalescing window
+ */
+static void sccp_hint_notifySubscribersCoalesced(sccp_hint_list_t * hint)
+{
+	boolean_t notifyNow = FALSE;
+
+	SCCP_LIST_LOCK(&hint->subscribers);
+	notifyNow = sccp_hint_coalesce(&hint->coalesce, hint->currentState == SCCP_CHANNELSTATE_RINGING, sccp_hint_coalescedNotifySubscribers, hint);
+	SCCP_LIST_UNLOCK(&hint->subscribers);
+	if (notifyNow) {
+		sccp_hint_notifySubscribers(hint);
+	} else {
+		sccp_log((DEBUGCAT_HINT)) (VERBOSE_PREFIX_3 "%s (hint_notifySubscribersCoalesced) state %s deferred to the end of the coalescing window\n", hint->exten, sccp_channelstate2str(hint->currentState));
+	}
+}
+
+static int sccp_hint_coalescedNotifyPbx(const void *data)
+{
+	struct sccp_hint_lineState *lineState = (struct sccp_hint_lineState *) data;
+	char lineName[StationMaxNameSize + 5];
+
+	SCCP_LIST_LOCK(&lineStates);
+	sccp_hint_coalesceFired(&lineState->coalesce);
+	SCCP_LIST_UNLOCK(&lineStates);
+	snprintf(lineName, sizeof(lineName), "SCCP/%s", lineState->name);
+	sccp_hint_notifySubscribersViaPbx(lineState, lineName, sccp_hint_hint2DeviceState(lineState->publishedState));
+	return 0;
+}
+
 /* ========================================================================================================================= Module Start/Stop */
 /*!
  * \brief starting hint-module
@@ -221,11 +439,15 @@ void sccp_hint_module_stop(void)
 
 		SCCP_LIST_LOCK(&lineStates);
 		while ((lineState = SCCP_LIST_REMOVE_HEAD(&lineStates, list))) {
+			if (lineState->coalesce.sched_id > -1) {
+				SCCP_SCHED_DEL(lineState->coalesce.sched_id);
+			}
 			if (lineState->line) {
 				sccp_line_release(&lineState->line);		/* explicit release*/
 			}
 			sccp_free(lineState);
 		}
+		sccp_hint_lineStateIndex_destroy(&lineStateIndex);
 		SCCP_LIST_UNLOCK(&lineStates);
 	}
 
@@ -239,6 +461,9 @@ void sccp_hint_module_stop(void)
 			pbx_event_unsubscribe(hint->device_state_sub);
 #endif
 			ast_extension_state_del(hint->stateid, NULL);
+			if (hint->coalesce.sched_id > -1) {
+				SCCP_SCHED_DEL(hint->coalesce.sched_id);
+			}
 
 			// All subscriptions that have this device should be removed, force cleanup 
 			SCCP_LIST_LOCK(&hint->subscribers);
@@ -370,7 +595,7 @@ static int sccp_hint_devstate_cb(char *context, char *id, enum ast_extension_sta
 			break;
 	}
 
-	sccp_hint_notifySubscribers(hint);
+	sccp_hint_notifySubscribersCoalesced(hint);
 	return 0;
 }
 
@@ -618,6 +843,7 @@ static sccp_hint_list_t *sccp_hint_create(char *hint_exten, char *hint_context)
 		return NULL;
 	}
 	hint->calltype = SKINNY_CALLTYPE_SENTINEL;
+	hint->coalesce.sched_id = -1;
 
 	SCCP_LIST_HEAD_INIT(&hint->subscribers);
 	//sccp_mutex_init(&hint->lock);
@@ -659,11 +885,7 @@ static void sccp_hint_attachLine(sccp_line_t * line, sccp_device_t * device)
 	struct sccp_hint_lineState *lineState = NULL;
 
 	SCCP_LIST_LOCK(&lineStates);
-	SCCP_LIST_TRAVERSE(&lineStates, lineState, list) {
-		if (lineState->line == line) {
-			break;
-		}
-	}
+	lineState = sccp_hint_lineStateIndex_find(lineStateIndex, line->name);
 	if (!lineState) {		/* create new lineState if necessary */
 		sccp_log((DEBUGCAT_HINT)) (VERBOSE_PREFIX_3 "%s (hint_attachLine) Create new hint_lineState for line: %s\n", DEV_ID_LOG(device), line->name);
 		lineState = sccp_calloc(sizeof *lineState, 1);
@@ -672,9 +894,20 @@ static void sccp_hint_attachLine(sccp_line_t * line, sccp_device_t * device)
 			SCCP_LIST_UNLOCK(&lineStates);
 			return;
 		}
+		sccp_copy_string(lineState->name, line->name, sizeof(lineState->name));
+		lineState->state = lineState->publishedState = SCCP_CHANNELSTATE_CONGESTION;
+		lineState->coalesce.sched_id = -1;
+		if (!sccp_hint_lineStateIndex_add(&lineStateIndex, lineState)) {
+			sccp_free(lineState);
+			SCCP_LIST_UNLOCK(&lineStates);
+			return;
+		}
 		SCCP_LIST_INSERT_HEAD(&lineStates, lineState, list);
 	}
 
+	if (lineState->line && lineState->line != line) {	/* line was recreated (reload), follow the new instance */
+		sccp_line_release(&lineState->line);		/* explicit release*/
+	}
 	if (!lineState->line) {		/* retain one instance of line in lineState->line */
 		//sccp_log((DEBUGCAT_HINT)) (VERBOSE_PREFIX_4 "%s (hint_attachLine) attaching line: %s\n", DEV_ID_LOG(device), line->name);
 		lineState->line = sccp_line_retain(line);
@@ -692,18 +925,13 @@ static void sccp_hint_detachLine(sccp_line_t * line, sccp_device_t * device)
 	if (line->statistic.numberOfActiveDevices == 0) {		/* release last instance of lineState->line */
 		//sccp_log((DEBUGCAT_HINT)) (VERBOSE_PREFIX_3 "%s (hint_detachLine) detaching line: %s, \n", DEV_ID_LOG(device), line->name);
 		SCCP_LIST_LOCK(&lineStates);
-		SCCP_LIST_TRAVERSE_SAFE_BEGIN(&lineStates, lineState, list) {
-			if (lineState->line == line) {
-				//sccp_log((DEBUGCAT_HINT)) (VERBOSE_PREFIX_4 "%s (hint_detachLine) line: %s detached\n", DEV_ID_LOG(device), line->name);
-				if (lineState->line) {
-					sccp_line_release(&lineState->line);		/* explicit release*/
-				}
-				SCCP_LIST_REMOVE_CURRENT(list);
-				sccp_free(lineState)
-				break;
-			}
+		lineState = sccp_hint_lineStateIndex_find(lineStateIndex, line->name);
+		if (lineState && lineState->line == line) {						/* lineState stays indexed (lock-free readers), only the line is let go */
+			//sccp_log((DEBUGCAT_HINT)) (VERBOSE_PREFIX_4 "%s (hint_detachLine) line: %s detached\n", DEV_ID_LOG(device), line->name);
+			sccp_line_release(&lineState->line);		/* explicit release*/
+			lineState->state = lineState->publishedState = SCCP_CHANNELSTATE_CONGESTION;
+			lineState->callInfo.calltype = SKINNY_CALLTYPE_SENTINEL;
 		}
-		SCCP_LIST_TRAVERSE_SAFE_END;
 		SCCP_LIST_UNLOCK(&lineStates);
 	}
 }
@@ -719,14 +947,13 @@ static void sccp_hint_lineStatusChanged(sccp_line_t * line, sccp_device_t * devi
 	struct sccp_hint_lineState *lineState = NULL;
 
 	SCCP_LIST_LOCK(&lineStates);
-	SCCP_LIST_TRAVERSE(&lineStates, lineState, list) {
-		if (lineState->line == line) {
-			break;
-		}
+	lineState = sccp_hint_lineStateIndex_find(lineStateIndex, line->name);
+	if (lineState && lineState->line != line) {
+		lineState = NULL;
 	}
 	SCCP_LIST_UNLOCK(&lineStates);
 	
-	if (lineState && lineState->line) {
+	if (lineState) {
 		sccp_hint_updateLineState(lineState);
 	}
 }
@@ -737,7 +964,7 @@ static void sccp_hint_lineStatusChanged(sccp_line_t * line, sccp_device_t * devi
  */
 static void sccp_hint_updateLineState(struct sccp_hint_lineState *lineState)
 {
-	AUTO_RELEASE(sccp_line_t, line , sccp_line_retain(lineState->line));
+	AUTO_RELEASE(sccp_line_t, line , lineState->line ? sccp_line_retain(lineState->line) : NULL);
 
 	if (line) {
 		sccp_log((DEBUGCAT_HINT)) (VERBOSE_PREFIX_4 "%s (hint_updateLineState) Update Line Channel State: %s(%d)\n", line->name, sccp_channelstate2str(lineState->state), lineState->state);
@@ -757,6 +984,7 @@ static void sccp_hint_updateLineState(struct sccp_hint_lineState *lineState)
 			/* just one device per line */
 			sccp_hint_updateLineStateForSingleChannel(lineState);
 		}
+		lineState->publishedState = lineState->state;
 
 		/* push changes to pbx */
 		sccp_hint_notifyLineStateUpdate(lineState);
@@ -1100,15 +1328,211 @@ static enum ast_device_state sccp_hint_hint2DeviceState(sccp_channelstate_t stat
 }
 
 /* ========================================================================================================================= Subscriber Notify : Updates Speeddial */
+/*!
+ * \brief Hint notification, everything about a state change that does not depend on the subscriber. Built once per state
+ * change and shared by all subscribers, so that notifying n subscribers costs n message copies instead of n message builds.
+ */
+struct sccp_hint_notification {
+#ifdef CS_DYNAMIC_SPEEDDIAL
+	/* protocol version >= 15: FeatureStatDynamicMessage */
+	sccp_msg_t *featureStat;										/*!< template, featureIndex and featureTextLabel are filled in per subscriber */
+	char labelPrefix[10];											/*!< prefix for the speeddial label (i.e. "(DND) ") */
+	char cidPrefix[StationMaxNameSize + 6];									/*!< "<cid> <direction> ", only shown on devices with room for it */
+#endif
+	/* older protocol versions: callstate / lamp / keyset */
+	skinny_callstate_t iconstate;
+	skinny_lampmode_t lamp;
+	uint8_t keymode;
+	boolean_t ringin;											/*!< ringing, shown as ringin on devices with allowRinginNotification */
+	boolean_t sendCallInfo;
+	boolean_t endRinging;											/*!< subscribers were last sent ringing, send congestion first (no missed call) */
+};
+
+/*!
+ * \brief Subscriber taken from hint->subscribers, so that messages are built and sent without holding the list lock
+ */
+struct sccp_hint_subscriberSnapshot {
+	sccp_device_t *device;
+	uint8_t instance;
+	uint8_t positionOnDevice;
+};
+
+static void sccp_hint_buildNotification(sccp_hint_list_t * hint, struct sccp_hint_notification *notification)
+{
+	memset(notification, 0, sizeof(struct sccp_hint_notification));
+#ifdef CS_DYNAMIC_SPEEDDIAL
+	skinny_busylampfield_state_t status = SKINNY_BLF_STATUS_UNKNOWN;
+	switch (hint->currentState) {
+		case SCCP_CHANNELSTATE_DOWN:
+			status = SKINNY_BLF_STATUS_UNKNOWN;	/* default state */
+			break;
+
+		case SCCP_CHANNELSTATE_ONHOOK:
+			status = SKINNY_BLF_STATUS_IDLE;
+			break;
+
+		case SCCP_CHANNELSTATE_DND:
+			sccp_copy_string(notification->labelPrefix, "(DND) ", sizeof(notification->labelPrefix));
+			status = SKINNY_BLF_STATUS_DND;	/* dnd */
+			break;
+
+		case SCCP_CHANNELSTATE_CONGESTION:
+			status = SKINNY_BLF_STATUS_UNKNOWN;	/* device/line not found */
+			break;
+
+		case SCCP_CHANNELSTATE_RINGING:
+			status = SKINNY_BLF_STATUS_ALERTING;	/* ringin */
+			/* fall through */
+
+		default:
+			{
+				char cidName[StationMaxNameSize] = "";
+				char cidNumber[StationMaxDirnumSize] = "";
+				const char *direction = (SCCP_CHANNELSTATE_CONNECTED == hint->currentState) ? "<=>" : ((hint->calltype == SKINNY_CALLTYPE_OUTBOUND) ? "<-" : "->");
+
+				if (hint->calltype == SKINNY_CALLTYPE_INBOUND) {
+					iCallInfo.Getter(hint->callInfo, 
+						SCCP_CALLINFO_CALLINGPARTY_NAME, &cidName, 
+						SCCP_CALLINFO_CALLINGPARTY_NUMBER, &cidNumber, 
+						SCCP_CALLINFO_KEY_SENTINEL);
+				} else {
+					iCallInfo.Getter(hint->callInfo, 
+						SCCP_CALLINFO_CALLEDPARTY_NAME, &cidName, 
+						SCCP_CALLINFO_CALLEDPARTY_NUMBER, &cidNumber, 
+						SCCP_CALLINFO_KEY_SENTINEL);
+				}
+				if (strlen(cidName) > 0) {
+					snprintf(notification->cidPrefix, sizeof(notification->cidPrefix), "%s %s ", cidName, direction);
+				} else if (strlen(cidNumber) > 0) {
+					snprintf(notification->cidPrefix, sizeof(notification->cidPrefix), "%s %s ", cidNumber, direction);
+				}
+			}
+			if (status == SKINNY_BLF_STATUS_UNKNOWN) {	/* still default value --> set */
+				status = SKINNY_BLF_STATUS_INUSE;
+			}
+			break;
+	}
+	REQ(notification->featureStat, FeatureStatDynamicMessage);
+	if (notification->featureStat) {
+		notification->featureStat->data.FeatureStatDynamicMessage.lel_featureID = htolel(SKINNY_BUTTONTYPE_BLFSPEEDDIAL);
+		notification->featureStat->data.FeatureStatDynamicMessage.lel_featureStatus = htolel(status);
+	}
+#endif
+
+	/*
+	   With the old hint style we should only use SCCP_CHANNELSTATE_ONHOOK and SCCP_CHANNELSTATE_CALLREMOTEMULTILINE as callstate,
+	   otherwise we get a callplane on device -> set all states except onhook to SCCP_CHANNELSTATE_CALLREMOTEMULTILINE -MC
+	 */
+	notification->iconstate = SKINNY_CALLSTATE_CALLREMOTEMULTILINE;
+	switch (hint->currentState) {
+		case SCCP_CHANNELSTATE_DOWN:
+		case SCCP_CHANNELSTATE_ONHOOK:
+			notification->iconstate = SKINNY_CALLSTATE_ONHOOK;
+			break;
+		case SCCP_CHANNELSTATE_RINGING:
+			notification->ringin = TRUE;
+			break;
+		default:
+			break;
+	}
+	if (hint->currentState == SCCP_CHANNELSTATE_ONHOOK || hint->currentState == SCCP_CHANNELSTATE_CONGESTION) {
+		notification->lamp = SKINNY_LAMP_OFF;
+		notification->keymode = KEYMODE_ONHOOK;
+	} else {
+		notification->lamp = SKINNY_LAMP_ON;
+		notification->keymode = KEYMODE_INUSEHINT;
+		notification->sendCallInfo = TRUE;
+	}
+}
+
+#ifdef CS_DYNAMIC_SPEEDDIAL
+static void sccp_hint_sendFeatureStat(sccp_hint_list_t * hint, const struct sccp_hint_notification *notification, const struct sccp_hint_subscriberSnapshot *subscriber)
+{
+	sccp_device_t *d = subscriber->device;
+	sccp_msg_t *msg = NULL;
+	sccp_speed_t k;
+	char displayMessage[80] = "";
+
+	sccp_dev_speed_find_byindex(d, subscriber->instance, TRUE, &k);
+	snprintf(displayMessage, sizeof(displayMessage), "%s%s%s", notification->labelPrefix, sccp_hint_isCIDavailabe(d, subscriber->positionOnDevice) == TRUE ? notification->cidPrefix : "", k.name);
+
+	sccp_log((DEBUGCAT_HINT)) (VERBOSE_PREFIX_4 "%s (hint_notifySubscribers) notify device: %s@%d, displayMessage:%s, state: %s ->  %s\n", hint->exten, DEV_ID_LOG(d), subscriber->instance, displayMessage, sccp_channelstate2str(hint->currentState), skinny_busylampfield_state2str(letohl(notification->featureStat->data.FeatureStatDynamicMessage.lel_featureStatus))); 
+	/*!
+	* hack to fix the white text without shadow issue -MC
+	*
+	* first send a label which is 1-character shorter than the correct one. 
+	* then send another message with a longer label (correct/final label) will force an update (in white over the back drop in black)
+	*/
+	REQ(msg, FeatureStatDynamicMessage);
+	if (msg) {
+		memcpy(&msg->data.FeatureStatDynamicMessage, &notification->featureStat->data.FeatureStatDynamicMessage, sizeof(msg->data.FeatureStatDynamicMessage));
+		sccp_copy_string(msg->data.FeatureStatDynamicMessage.featureTextLabel, displayMessage, sizeof(msg->data.FeatureStatDynamicMessage.featureTextLabel));
+		msg->data.FeatureStatDynamicMessage.lel_featureIndex = htolel(subscriber->instance);
+		if (strlen(displayMessage) > 0) {
+			msg->data.FeatureStatDynamicMessage.featureTextLabel[strlen(displayMessage)-1] = '\0';
+		}
+		sccp_dev_send(d, msg);
+	}
+
+	/*!
+	 * Send the actual message we wanted to send */
+	REQ(msg, FeatureStatDynamicMessage);
+	if (msg) {
+		memcpy(&msg->data.FeatureStatDynamicMessage, &notification->featureStat->data.FeatureStatDynamicMessage, sizeof(msg->data.FeatureStatDynamicMessage));
+		sccp_copy_string(msg->data.FeatureStatDynamicMessage.featureTextLabel, displayMessage, sizeof(msg->data.FeatureStatDynamicMessage.featureTextLabel));
+		msg->data.FeatureStatDynamicMessage.lel_featureIndex = htolel(subscriber->instance);
+		sccp_dev_send(d, msg);
+	}
+}
+#endif
+
+static void sccp_hint_sendCallState(sccp_hint_list_t * hint, const struct sccp_hint_notification *notification, const struct sccp_hint_subscriberSnapshot *subscriber)
+{
+	sccp_device_t *d = subscriber->device;
+	skinny_callstate_t iconstate = notification->iconstate;
+	skinny_lampmode_t lamp = notification->lamp;
+	uint8_t keymode = notification->keymode;
+	boolean_t sendCallInfo = notification->sendCallInfo;
+
+	/*
+	   we have dynamic speeddial enabled, but subscriber can not handle this.
+	   We have to switch back to old hint style and send old state.
+	 */
+	sccp_log((DEBUGCAT_HINT)) (VERBOSE_PREFIX_4 "%s (hint_notifySubscribers) can not handle dynamic speeddial, fall back to old behavior using state %s (%d)\n", DEV_ID_LOG(d), sccp_channelstate2str(hint->currentState), hint->currentState);
+
+	if (notification->ringin && d->allowRinginNotification) {
+		iconstate = SKINNY_CALLSTATE_RINGIN;
+		lamp = SKINNY_LAMP_BLINK;
+		sendCallInfo = FALSE;
+	}
+	sccp_log((DEBUGCAT_HINT)) (VERBOSE_PREFIX_4 "%s (hint_notifySubscribers) setting icon to state %s (%d)\n", DEV_ID_LOG(d), skinny_callstate2str(iconstate), iconstate);
+
+	if (notification->endRinging) {
+		/* we send a congestion to the phone, so call will not be marked as missed call */
+		sccp_device_sendcallstate(d, subscriber->instance, 0, SKINNY_CALLSTATE_CONGESTION, SKINNY_CALLPRIORITY_NORMAL, SKINNY_CALLINFO_VISIBILITY_HIDDEN);
+	}
+
+	sccp_device_sendcallstate(d, subscriber->instance, 0, iconstate, SKINNY_CALLPRIORITY_NORMAL, SKINNY_CALLINFO_VISIBILITY_DEFAULT); /** do not set visibility to COLLAPSED, this will hidde callInfo in state CALLREMOTEMULTILINE */
+	if (sendCallInfo) {
+		iCallInfo.Send(hint->callInfo, 0 /*callid*/, (hint->calltype == SKINNY_CALLTYPE_OUTBOUND) ? SKINNY_CALLTYPE_OUTBOUND : SKINNY_CALLTYPE_INBOUND, subscriber->instance, d, TRUE);
+	}
+	sccp_device_setLamp(d, SKINNY_STIMULUS_LINE, subscriber->instance, lamp);
+	sccp_dev_set_keyset(d, subscriber->instance, 0 /*callid*/, keymode);
+}
+
 /*!
  * \brief send hint status to subscriber
  * \param hint SCCP Hint Linked List Pointer
  *
- * \todo Check if the actual device still exists while going throughthe hint->subscribers and not pointing at rubish
+ * \note the subscribers are snapshotted (and retained) under the list lock, the messages are sent after releasing it
  */
 static void sccp_hint_notifySubscribers(sccp_hint_list_t * hint)
 {
 	sccp_hint_SubscribingDevice_t *subscriber = NULL;
+	struct sccp_hint_subscriberSnapshot *snapshot = NULL;
+	struct sccp_hint_notification notification;
+	sccp_channelstate_t sentState = SCCP_CHANNELSTATE_DOWN;
+	int numSubscribers = 0, n = 0;
 
 	if (!hint) {
 		pbx_log(LOG_ERROR, "SCCP: (sccp_hint_notifySubscribers) no hint provided to notifySubscribers about\n");
@@ -1123,193 +1547,46 @@ static void sccp_hint_notifySubscribers(sccp_hint_list_t * hint)
 	sccp_log((DEBUGCAT_HINT)) (VERBOSE_PREFIX_3 "%s (hint_notifySubscribers) notify %u subscriber(s) of %s's state %s\n", hint->exten, SCCP_LIST_GETSIZE(&hint->subscribers), hint->hint_dialplan, sccp_channelstate2str(hint->currentState));
 
 	SCCP_LIST_LOCK(&hint->subscribers);
-	SCCP_LIST_TRAVERSE(&hint->subscribers, subscriber, list) {
-		AUTO_RELEASE(sccp_device_t, d , sccp_device_retain((sccp_device_t *) subscriber->device));
-
-		if (d) {
-			//sccp_log((DEBUGCAT_HINT)) (VERBOSE_PREFIX_4 "%s (hint_notifySubscribers) notify subscriber %s of %s's state %s (%d)\n", DEV_ID_LOG(d), d->id, hint->hint_dialplan, sccp_channelstate2str(hint->currentState), hint->currentState);
-#ifdef CS_DYNAMIC_SPEEDDIAL
-			sccp_msg_t *msg = NULL;
-			sccp_speed_t k;
-			char displayMessage[80] = "";
-			skinny_busylampfield_state_t status = SKINNY_BLF_STATUS_UNKNOWN;
-			if (d->inuseprotocolversion >= 15) {
-				sccp_dev_speed_find_byindex( d, subscriber->instance, TRUE, &k);
-
-				char cidName[StationMaxNameSize] = "";
-				char cidNumber[StationMaxDirnumSize] = "";
+	sentState = sccp_hint_coalesceSent(&hint->coalesce, hint->currentState);
+	if (SCCP_LIST_GETSIZE(&hint->subscribers) > 0 && (snapshot = (struct sccp_hint_subscriberSnapshot *) sccp_calloc(SCCP_LIST_GETSIZE(&hint->subscribers), sizeof(struct sccp_hint_subscriberSnapshot)))) {
+		SCCP_LIST_TRAVERSE(&hint->subscribers, subscriber, list) {
+			if (subscriber->device && (snapshot[numSubscribers].device = sccp_device_retain(subscriber->device))) {
+				snapshot[numSubscribers].instance = subscriber->instance;
+				snapshot[numSubscribers].positionOnDevice = subscriber->positionOnDevice;
+				numSubscribers++;
+			} else {
+				sccp_log((DEBUGCAT_HINT)) (VERBOSE_PREFIX_4 "SCCP: (sccp_hint_notifySubscribers) device not found/retained\n");
+			}
+		}
+	}
+	SCCP_LIST_UNLOCK(&hint->subscribers);
 
-				switch (hint->currentState) {
-				case SCCP_CHANNELSTATE_DOWN:
-					snprintf(displayMessage, sizeof(displayMessage), "%s", k.name);
-					status = SKINNY_BLF_STATUS_UNKNOWN;	/* default state */
-					break;
-
-				case SCCP_CHANNELSTATE_ONHOOK:
-					snprintf(displayMessage, sizeof(displayMessage), "%s", k.name);
-					status = SKINNY_BLF_STATUS_IDLE;
-					break;
-
-				case SCCP_CHANNELSTATE_DND:
-					//snprintf(displayMessage, sizeof(displayMessage), k.name, sizeof(displayMessage));
-					snprintf(displayMessage, sizeof(displayMessage), "(DND) %s", k.name);
-					status = SKINNY_BLF_STATUS_DND;	/* dnd */
-					break;
-
-				case SCCP_CHANNELSTATE_CONGESTION:
-					snprintf(displayMessage, sizeof(displayMessage), "%s", k.name);
-					status = SKINNY_BLF_STATUS_UNKNOWN;	/* device/line not found */
-					break;
-
-				case SCCP_CHANNELSTATE_RINGING:
-					status = SKINNY_BLF_STATUS_ALERTING;	/* ringin */
-					/* fall through */
-
-				default:
+	if (numSubscribers > 0) {
+		sccp_hint_buildNotification(hint, &notification);
+		notification.endRinging = (SCCP_CHANNELSTATE_RINGING == sentState && SCCP_CHANNELSTATE_RINGING != hint->currentState);
+		for (n = 0; n < numSubscribers; n++) {
+			//sccp_log((DEBUGCAT_HINT)) (VERBOSE_PREFIX_4 "%s (hint_notifySubscribers) notify subscriber %s of %s's state %s (%d)\n", DEV_ID_LOG(snapshot[n].device), snapshot[n].device->id, hint->hint_dialplan, sccp_channelstate2str(hint->currentState), hint->currentState);
 #ifdef CS_DYNAMIC_SPEEDDIAL
-					if (sccp_hint_isCIDavailabe(d, subscriber->positionOnDevice) == TRUE) {
-						if (hint->calltype == SKINNY_CALLTYPE_INBOUND) {
-							iCallInfo.Getter(hint->callInfo, 
-								SCCP_CALLINFO_CALLINGPARTY_NAME, &cidName, 
-								SCCP_CALLINFO_CALLINGPARTY_NUMBER, &cidNumber, 
-								SCCP_CALLINFO_KEY_SENTINEL);
-						} else {
-							iCallInfo.Getter(hint->callInfo, 
-								SCCP_CALLINFO_CALLEDPARTY_NAME, &cidName, 
-								SCCP_CALLINFO_CALLEDPARTY_NUMBER, &cidNumber, 
-								SCCP_CALLINFO_KEY_SENTINEL);
-						}
-						if (strlen(cidName) > 0) {
-							snprintf(displayMessage, sizeof(displayMessage), "%s %s %s", cidName, (SCCP_CHANNELSTATE_CONNECTED == hint->currentState) ? "<=>" : ((hint->calltype == SKINNY_CALLTYPE_OUTBOUND) ? "<-" : "->"), k.name);
-						} else if (strlen(cidNumber) > 0) {
-							snprintf(displayMessage, sizeof(displayMessage), "%s %s %s", cidNumber, (SCCP_CHANNELSTATE_CONNECTED == hint->currentState) ? "<=>" : ((hint->calltype == SKINNY_CALLTYPE_OUTBOUND) ? "<-" : "->"), k.name);
-						} else {
-							snprintf(displayMessage, sizeof(displayMessage), "%s", k.name);
-						}
-					} else 
-#endif
-					{
-						snprintf(displayMessage, sizeof(displayMessage), "%s", k.name);
-					}
-					if (status == SKINNY_BLF_STATUS_UNKNOWN) {	/* still default value --> set */
-						status = SKINNY_BLF_STATUS_INUSE;
-					}
-					break;
-				}
-
-				sccp_log((DEBUGCAT_HINT)) (VERBOSE_PREFIX_4 "%s (hint_notifySubscribers) notify device: %s@%d, displayMessage:%s, state: %s ->  %s\n", hint->exten, DEV_ID_LOG(d), subscriber->instance, displayMessage, sccp_channelstate2str(hint->currentState), skinny_busylampfield_state2str(status)); 
-				/*!
-				* hack to fix the white text without shadow issue -MC
-				*
-				* first send a label which is 1-character shorter than the correct one. 
-				* then send another message with a longer label (correct/final label) will force an update (in white over the back drop in black)
-				*/
-				REQ(msg, FeatureStatDynamicMessage);
-				if (msg) {
-					sccp_copy_string(msg->data.FeatureStatDynamicMessage.featureTextLabel, displayMessage, sizeof(msg->data.FeatureStatDynamicMessage.featureTextLabel));
-					msg->data.FeatureStatDynamicMessage.lel_featureIndex = htolel(subscriber->instance);
-					msg->data.FeatureStatDynamicMessage.lel_featureID = htolel(SKINNY_BUTTONTYPE_BLFSPEEDDIAL);
-					msg->data.FeatureStatDynamicMessage.lel_featureStatus = htolel(status);
-					msg->data.FeatureStatDynamicMessage.featureTextLabel[strlen(displayMessage)-1] = '\0';
-					sccp_dev_send(d, msg);
-				} else {
-					sccp_free(msg);
-				}
-
-				/*!
-				 * Send the actual message we wanted to send */
-				REQ(msg, FeatureStatDynamicMessage);
-				if (msg) {
-					sccp_copy_string(msg->data.FeatureStatDynamicMessage.featureTextLabel, displayMessage, sizeof(msg->data.FeatureStatDynamicMessage.featureTextLabel));
-					msg->data.FeatureStatDynamicMessage.lel_featureIndex = htolel(subscriber->instance);
-					msg->data.FeatureStatDynamicMessage.lel_featureID = htolel(SKINNY_BUTTONTYPE_BLFSPEEDDIAL);
-					msg->data.FeatureStatDynamicMessage.lel_featureStatus = htolel(status);
-					sccp_dev_send(d, msg);
-				} else {
-					sccp_free(msg);
+			if (snapshot[n].device->inuseprotocolversion >= 15) {
+				if (notification.featureStat) {
+					sccp_hint_sendFeatureStat(hint, &notification, &snapshot[n]);
 				}
 			} else
 #endif
 			{
-				/*
-				   we have dynamic speeddial enabled, but subscriber can not handle this.
-				   We have to switch back to old hint style and send old state.
-				 */
-				sccp_log((DEBUGCAT_HINT)) (VERBOSE_PREFIX_4 "%s (hint_notifySubscribers) can not handle dynamic speeddial, fall back to old behavior using state %s (%d)\n", DEV_ID_LOG(d), sccp_channelstate2str(hint->currentState), hint->currentState);
-
-				/*
-				   With the old hint style we should only use SCCP_CHANNELSTATE_ONHOOK and SCCP_CHANNELSTATE_CALLREMOTEMULTILINE as callstate,
-				   otherwise we get a callplane on device -> set all states except onhook to SCCP_CHANNELSTATE_CALLREMOTEMULTILINE -MC
-				 */
-				skinny_callstate_t iconstate = SKINNY_CALLSTATE_CALLREMOTEMULTILINE;
-
-				switch (hint->currentState) {
-					case SCCP_CHANNELSTATE_DOWN:
-					case SCCP_CHANNELSTATE_ONHOOK:
-						iconstate = SKINNY_CALLSTATE_ONHOOK;
-						break;
-					case SCCP_CHANNELSTATE_RINGING:
-						if (d->allowRinginNotification) {
-							iconstate = SKINNY_CALLSTATE_RINGIN;
-						}
-						break;
-					case SCCP_CHANNELSTATE_ZOMBIE:
-					case SCCP_CHANNELSTATE_CONGESTION:
-					case SCCP_CHANNELSTATE_CONNECTED:
-					case SCCP_CHANNELSTATE_OFFHOOK:
-					case SCCP_CHANNELSTATE_RINGOUT:
-					case SCCP_CHANNELSTATE_RINGOUT_ALERTING:
-					case SCCP_CHANNELSTATE_BUSY:
-					case SCCP_CHANNELSTATE_HOLD:
-					case SCCP_CHANNELSTATE_CALLWAITING:
-					case SCCP_CHANNELSTATE_CALLPARK:
-					case SCCP_CHANNELSTATE_PROCEED:
-					case SCCP_CHANNELSTATE_CALLREMOTEMULTILINE:
-					case SCCP_CHANNELSTATE_INVALIDNUMBER:
-					case SCCP_CHANNELSTATE_DIALING:
-					case SCCP_CHANNELSTATE_PROGRESS:
-					case SCCP_CHANNELSTATE_GETDIGITS:
-					case SCCP_CHANNELSTATE_SPEEDDIAL:
-					case SCCP_CHANNELSTATE_DIGITSFOLL:
-					case SCCP_CHANNELSTATE_INVALIDCONFERENCE:
-					case SCCP_CHANNELSTATE_CONNECTEDCONFERENCE:
-					case SCCP_CHANNELSTATE_BLINDTRANSFER:
-					case SCCP_CHANNELSTATE_DND:
-					case SCCP_CHANNELSTATE_CALLTRANSFER:
-					case SCCP_CHANNELSTATE_CALLCONFERENCE:
-						iconstate = SKINNY_CALLSTATE_CALLREMOTEMULTILINE;
-						break;
-					case SCCP_CHANNELSTATE_SENTINEL:
-						break;
-				}
-				sccp_log((DEBUGCAT_HINT)) (VERBOSE_PREFIX_4 "%s (hint_notifySubscribers) setting icon to state %s (%d)\n", DEV_ID_LOG(d), skinny_callstate2str(iconstate), iconstate);
-
-				if (SCCP_CHANNELSTATE_RINGING == hint->previousState) {
-					/* we send a congestion to the phone, so call will not be marked as missed call */
-					sccp_device_sendcallstate(d, subscriber->instance, 0, SKINNY_CALLSTATE_CONGESTION, SKINNY_CALLPRIORITY_NORMAL, SKINNY_CALLINFO_VISIBILITY_HIDDEN);
-				}
-
-				sccp_device_sendcallstate(d, subscriber->instance, 0, iconstate, SKINNY_CALLPRIORITY_NORMAL, SKINNY_CALLINFO_VISIBILITY_DEFAULT); /** do not set visibility to COLLAPSED, this will hidde callInfo in state CALLREMOTEMULTILINE */
-
-				if (hint->currentState == SCCP_CHANNELSTATE_ONHOOK || hint->currentState == SCCP_CHANNELSTATE_CONGESTION) {
-					sccp_device_setLamp(d, SKINNY_STIMULUS_LINE, subscriber->instance, SKINNY_LAMP_OFF);
-					sccp_dev_set_keyset(d, subscriber->instance, 0, KEYMODE_ONHOOK);
-
-				} else if (hint->currentState == SCCP_CHANNELSTATE_RINGING && d->allowRinginNotification) {
-					sccp_device_setLamp(d, SKINNY_STIMULUS_LINE, subscriber->instance, SKINNY_LAMP_BLINK);
-					sccp_dev_set_keyset(d, subscriber->instance, 0, KEYMODE_INUSEHINT);
-
-				} else {
-					iCallInfo.Send(hint->callInfo, 0 /*callid*/, (hint->calltype == SKINNY_CALLTYPE_OUTBOUND) ? SKINNY_CALLTYPE_OUTBOUND : SKINNY_CALLTYPE_INBOUND, subscriber->instance, d, TRUE);
-					sccp_device_setLamp(d, SKINNY_STIMULUS_LINE, subscriber->instance, SKINNY_LAMP_ON);
-					sccp_dev_set_keyset(d, subscriber->instance, 0 /*callid*/, KEYMODE_INUSEHINT);
-				}
+				sccp_hint_sendCallState(hint, &notification, &snapshot[n]);
 			}
-		} else {
-			sccp_log((DEBUGCAT_HINT)) (VERBOSE_PREFIX_4 "SCCP: (sccp_hint_notifySubscribers) device not found/retained\n");
+			sccp_device_release(&snapshot[n].device);						/* explicit release */
 		}
+#ifdef CS_DYNAMIC_SPEEDDIAL
+		if (notification.featureStat) {
+			sccp_packet_free(notification.featureStat);
+		}
+#endif
+	}
+	if (snapshot) {
+		sccp_free(snapshot);
 	}
-	SCCP_LIST_UNLOCK(&hint->subscribers);
 }
 
 /* ========================================================================================================================= PBX Notify */
@@ -1319,7 +1596,7 @@ static void sccp_hint_notifySubscribers(sccp_hint_list_t * hint)
  */
 static void sccp_hint_notifySubscribersViaPbx(struct sccp_hint_lineState *lineState, char *lineName, enum ast_device_state newDeviceState)
 {
-	sccp_log((DEBUGCAT_HINT)) (VERBOSE_PREFIX_3 "SCCP: (sccp_hint_notifySubscribersViaPbx) Notify asterisk to set state to sccp channelstate '%s' (%d) => asterisk: '%s' (%d) on channel SCCP/%s\n", sccp_channelstate2str(lineState->state), lineState->state, pbxsccp_devicestate2str(newDeviceState), newDeviceState, lineState->line->name);
+	sccp_log((DEBUGCAT_HINT)) (VERBOSE_PREFIX_3 "SCCP: (sccp_hint_notifySubscribersViaPbx) Notify asterisk to set state to sccp channelstate '%s' (%d) => asterisk: '%s' (%d) on channel SCCP/%s\n", sccp_channelstate2str(lineState->state), lineState->state, pbxsccp_devicestate2str(newDeviceState), newDeviceState, lineState->name);
 #if defined(CS_USE_ASTERISK_DISTRIBUTED_DEVSTATE) && ASTERISK_VERSION_GROUP < 112		/* no distributed devstate support for ast-12 and up (yet) */
 	pbx_event_t *event = pbx_event_new(AST_EVENT_DEVICE_STATE_CHANGE,
 		AST_EVENT_IE_DEVICE, AST_EVENT_IE_PLTYPE_STR, lineName, 
@@ -1419,12 +1696,18 @@ static void sccp_hint_notifyLineStateUpdate(struct sccp_hint_lineState *lineStat
 			sccp_log((DEBUGCAT_HINT)) (VERBOSE_PREFIX_3 "SCCP: (sccp_hint_notifyLineStateUpdate) Notify asterisk to set state to sccp channelstate '%s' (%d) on line 'SCCP/%s'\n", sccp_channelstate2str(lineState->state), lineState->state, lineName);
 			sccp_log((DEBUGCAT_HINT)) (VERBOSE_PREFIX_3 "SCCP: (sccp_hint_notifyLineStateUpdate) => asterisk: '%s' (%d) => '%s' (%d) on line SCCP/%s\n", pbxsccp_devicestate2str(oldDeviceState), oldDeviceState, pbxsccp_devicestate2str(newDeviceState), newDeviceState, lineName);
 			if (newDeviceState == oldDeviceState) {
-				sccp_hint_notifySubscribers(hint);							/* shortcut to inform sccp subscribers about cid update changes only */
+				sccp_hint_notifySubscribersCoalesced(hint);						/* shortcut to inform sccp subscribers about cid update changes only */
 			}
 		}
 	}
 	SCCP_LIST_UNLOCK(&sccp_hint_subscriptions);
 
+	SCCP_LIST_LOCK(&lineStates);
+	boolean_t notifyNow = sccp_hint_coalesce(&lineState->coalesce, lineState->state == SCCP_CHANNELSTATE_RINGING, sccp_hint_coalescedNotifyPbx, lineState);
+	SCCP_LIST_UNLOCK(&lineStates);
+	if (!notifyNow) {
+		return;
+	}
 	sccp_hint_notifySubscribersViaPbx(lineState, lineName, newDeviceState);						/* go through pbx to inform subscribers about both state and cid */
 	sccp_log((DEBUGCAT_HINT)) (VERBOSE_PREFIX_3 "SCCP: (sccp_hint_notifyLineStateUpdate) Notified asterisk to set state to sccp channelstate '%s' (%d) => asterisk: '%s' (%d) on channel SCCP/%s\n", sccp_channelstate2str(lineState->state), lineState->state, pbxsccp_devicestate2str(newDeviceState), newDeviceState, lineState->line->name);
 }
@@ -1489,17 +1772,13 @@ sccp_channelstate_t sccp_hint_getLinestate(const char *linename, const char *dev
 	struct sccp_hint_lineState *lineState = NULL;
 	sccp_channelstate_t state = SCCP_CHANNELSTATE_CONGESTION;
 
-	SCCP_LIST_LOCK(&lineStates);
-	SCCP_LIST_TRAVERSE(&lineStates, lineState, list) {
-		if (lineState->line && sccp_strcaseequals(lineState->line->name, linename)) {
-                	sccp_log(DEBUGCAT_HINT)(VERBOSE_PREFIX_3 "%s (getLinestate) state:%s, party:%s/%s, calltype:%s\n", lineState->line->name, sccp_channelstate2str(lineState->state),
-                	        lineState->callInfo.partyNumber,lineState->callInfo.partyName,
-                	        (!SCCP_CHANNELSTATE_Idling(lineState->state) && lineState->callInfo.calltype) ? skinny_calltype2str(lineState->callInfo.calltype) : "INACTIVE");
-                        state = lineState->state;
-			break;
-		}
+	/* no locking: see LineState Index */
+	if ((lineState = sccp_hint_lineStateIndex_find(lineStateIndex, linename))) {
+		state = lineState->publishedState;
+		sccp_log(DEBUGCAT_HINT)(VERBOSE_PREFIX_3 "%s (getLinestate) state:%s, party:%s/%s, calltype:%s\n", lineState->name, sccp_channelstate2str(state),
+			lineState->callInfo.partyNumber,lineState->callInfo.partyName,
+			(!SCCP_CHANNELSTATE_Idling(state) && lineState->callInfo.calltype) ? skinny_calltype2str(lineState->callInfo.calltype) : "INACTIVE");
 	}
-	SCCP_LIST_UNLOCK(&lineStates);
 	return state;
 }
 
@@ -1528,12 +1807,18 @@ int sccp_show_hint_lineStates(int fd, sccp_cli_totals_t *totals, struct mansessi
 #define CLI_AMI_TABLE_LIST_LOCK SCCP_LIST_LOCK
 #define CLI_AMI_TABLE_LIST_ITERATOR SCCP_LIST_TRAVERSE
 #define CLI_AMI_TABLE_LIST_UNLOCK SCCP_LIST_UNLOCK
+#define CLI_AMI_TABLE_BEFORE_ITERATION														\
+	if (lineState->line) {															/* skip detached lines kept in the index */
+#define CLI_AMI_TABLE_AFTER_ITERATION 														\
+	}
 #define CLI_AMI_TABLE_FIELDS 															\
- 		CLI_AMI_TABLE_FIELD(LineName,		"-10.10",	s,	10,	lineState->line ? lineState->line->name : "")		\
+ 		CLI_AMI_TABLE_FIELD(LineName,		"-10.10",	s,	10,	lineState->name)					\
  		CLI_AMI_TABLE_FIELD(State,		"-22.22",	s,	22,	sccp_channelstate2str(lineState->state))		\
  		CLI_AMI_TABLE_FIELD(CallInfoNumber,	"-15.15",	s,	15,	lineState->callInfo.partyNumber)			\
  		CLI_AMI_TABLE_FIELD(CallInfoName,	"-30.30",	s,	30,	lineState->callInfo.partyName)				\
- 		CLI_AMI_TABLE_FIELD(Direction,		"-10.10",	s,	10,	(!SCCP_CHANNELSTATE_Idling(lineState->state) && lineState->callInfo.calltype) ? skinny_calltype2str(lineState->callInfo.calltype) : "INACTIVE")
+ 		CLI_AMI_TABLE_FIELD(Direction,		"-10.10",	s,	10,	(!SCCP_CHANNELSTATE_Idling(lineState->state) && lineState->callInfo.calltype) ? skinny_calltype2str(lineState->callInfo.calltype) : "INACTIVE")	\
+ 		CLI_AMI_TABLE_FIELD(Notified,		"-8",		d,	8,	lineState->coalesce.notified)				\
+ 		CLI_AMI_TABLE_FIELD(Suppressed,		"-10",		d,	10,	lineState->coalesce.suppressed)
 
 #include "sccp_cli_table.h"
 
@@ -1594,7 +1879,9 @@ int sccp_show_hint_subscriptions(int fd, sccp_cli_totals_t *totals, struct manse
  		CLI_AMI_TABLE_FIELD(CallInfoNumber,	"-15.15",	s,	15,	cidNumber)			\
  		CLI_AMI_TABLE_FIELD(CallInfoName,	"-30.30",	s,	30,	cidName)			\
  		CLI_AMI_TABLE_FIELD(Direction,		"-10.10",	s,	10,	(subscription->calltype && subscription->calltype != SKINNY_CALLTYPE_SENTINEL) ? skinny_calltype2str(subscription->calltype) : "") \
- 		CLI_AMI_TABLE_FIELD(Subs,		"-4",		d,	4,	SCCP_LIST_GETSIZE(&subscription->subscribers))
+ 		CLI_AMI_TABLE_FIELD(Subs,		"-4",		d,	4,	SCCP_LIST_GETSIZE(&subscription->subscribers))		\
+ 		CLI_AMI_TABLE_FIELD(Notified,		"-8",		d,	8,	subscription->coalesce.notified)			\
+ 		CLI_AMI_TABLE_FIELD(Suppressed,		"-10",		d,	10,	subscription->coalesce.suppressed)
 
 #include "sccp_cli_table.h"
 
@@ -1605,4 +1892,177 @@ int sccp_show_hint_subscriptions(int fd, sccp_cli_totals_t *totals, struct manse
 	return RESULT_SUCCESS;
 }
 
+#if CS_TEST_FRAMEWORK
+#include <asterisk/test.h>
+#define LINESTATE_BENCH_LINES 5000
+#define LINESTATE_BENCH_QUERIES 1000000
+#define LINESTATE_BENCH_SCAN_QUERIES 10000
+#define LINESTATE_BENCH_MAX_THREADS 8
+
+struct linestate_bench {
+	const struct sccp_hint_lineStateIndex *lsindex;
+	struct sccp_hint_lineState **lineStates;
+	int queries;
+	int errors;
+	unsigned int seed;
+};
+
+static void *linestate_bench_thread(void *data)
+{
+	struct linestate_bench *bench = data;
+	struct sccp_hint_lineState *lineState = NULL;
+	int query = 0, n = 0;
+
+	for (query = 0; query < bench->queries; query++) {
+		n = rand_r(&bench->seed) % LINESTATE_BENCH_LINES;
+		lineState = sccp_hint_lineStateIndex_find(bench->lsindex, bench->lineStates[n]->name);
+		if (lineState != bench->lineStates[n] || lineState->publishedState != (sccp_channelstate_t) (n % 8)) {
+			bench->errors++;
+		}
+	}
+	return NULL;
+}
+
+AST_TEST_DEFINE(sccp_hint_linestate_bench)
+{
+	int res = AST_TEST_PASS;
+	switch(cmd) {
+		case TEST_INIT:
+			info->name = "linestate_bench";
+			info->category = "/channels/chan_sccp/hint/";
+			info->summary = "chan-sccp-b hint lineState lookup throughput";
+			info->description = "chan-sccp-b devicestate query throughput against 5000 lines, indexed vs. list scan";
+			return AST_TEST_NOT_RUN;
+		case TEST_EXECUTE:
+			break;
+	}
+	struct sccp_hint_lineStateIndex *volatile benchIndex = NULL;
+	struct sccp_hint_lineState **lineStates = (struct sccp_hint_lineState **) sccp_calloc(LINESTATE_BENCH_LINES, sizeof(struct sccp_hint_lineState *));
+	struct linestate_bench bench[LINESTATE_BENCH_MAX_THREADS];
+	pthread_t t[LINESTATE_BENCH_MAX_THREADS];
+	int n = 0, thread = 0, numthreads = 0, errors = 0;
+	char name[StationMaxNameSize];
+
+	if (!lineStates) {
+		return AST_TEST_FAIL;
+	}
+	pbx_test_status_update(test, "Index %d lines...\n", LINESTATE_BENCH_LINES);
+	for (n = 0; n < LINESTATE_BENCH_LINES; n++) {
+		if (!(lineStates[n] = (struct sccp_hint_lineState *) sccp_calloc(1, sizeof(struct sccp_hint_lineState)))) {
+			res = AST_TEST_FAIL;
+			goto cleanup;
+		}
+		snprintf(lineStates[n]->name, sizeof(lineStates[n]->name), "BenchLine%04d", n);
+		lineStates[n]->publishedState = (sccp_channelstate_t) (n % 8);
+		pbx_test_validate_cleanup(test, sccp_hint_lineStateIndex_add(&benchIndex, lineStates[n]), res, cleanup);
+	}
+	pbx_test_validate_cleanup(test, sccp_hint_lineStateIndex_find(benchIndex, "benchline0042") == lineStates[42], res, cleanup);
+	pbx_test_validate_cleanup(test, sccp_hint_lineStateIndex_find(benchIndex, "BenchLine9999") == NULL, res, cleanup);
+
+	/* reference: the linear strcasecmp scan getLinestate used to do */
+	{
+		unsigned int seed = 1;
+		struct timeval start = pbx_tvnow();
+		for (n = 0; n < LINESTATE_BENCH_SCAN_QUERIES; n++) {
+			const char *linename = lineStates[rand_r(&seed) % LINESTATE_BENCH_LINES]->name;
+			for (thread = 0; thread < LINESTATE_BENCH_LINES && !sccp_strcaseequals(lineStates[thread]->name, linename); thread++);
+			errors += (thread == LINESTATE_BENCH_LINES);
+		}
+		int64_t elapsed_us = ast_tvdiff_us(pbx_tvnow(), start);
+		pbx_test_status_update(test, "list scan: %d queries in %.3f ms, %.0f queries/sec\n", LINESTATE_BENCH_SCAN_QUERIES, (double) elapsed_us / 1000, elapsed_us ? (double) LINESTATE_BENCH_SCAN_QUERIES * 1000000 / elapsed_us : 0);
+	}
+
+	for (numthreads = 1; numthreads <= LINESTATE_BENCH_MAX_THREADS; numthreads <<= 1) {
+		struct timeval start = pbx_tvnow();
+		for (thread = 0; thread < numthreads; thread++) {
+			bench[thread].lsindex = benchIndex;
+			bench[thread].lineStates = lineStates;
+			bench[thread].queries = LINESTATE_BENCH_QUERIES / numthreads;
+			bench[thread].errors = 0;
+			bench[thread].seed = thread + 1;
+			pbx_pthread_create(&t[thread], NULL, linestate_bench_thread, &bench[thread]);
+		}
+		for (thread = 0; thread < numthreads; thread++) {
+			pthread_join(t[thread], NULL);
+			errors += bench[thread].errors;
+		}
+		int64_t elapsed_us = ast_tvdiff_us(pbx_tvnow(), start);
+		int queries = (LINESTATE_BENCH_QUERIES / numthreads) * numthreads;
+		pbx_test_status_update(test, "index, %d threads: %d queries in %.3f ms, %.0f queries/sec\n", numthreads, queries, (double) elapsed_us / 1000, elapsed_us ? (double) queries * 1000000 / elapsed_us : 0);
+	}
+	pbx_test_validate_cleanup(test, errors == 0, res, cleanup);
+
+cleanup:
+	sccp_hint_lineStateIndex_destroy(&benchIndex);
+	for (n = 0; n < LINESTATE_BENCH_LINES; n++) {
+		if (lineStates[n]) {
+			sccp_free(lineStates[n]);
+		}
+	}
+	sccp_free(lineStates);
+	return res;
+}
+
+static int sccp_hint_coalesce_test_cb(const void *data)
+{
+	return 0;
+}
+
+AST_TEST_DEFINE(sccp_hint_coalesce_ringing_test)
+{
+	int res = AST_TEST_PASS;
+	switch(cmd) {
+		case TEST_INIT:
+			info->name = "coalesce_ringing";
+			info->category = "/channels/chan_sccp/hint/";
+			info->summary = "chan-sccp-b hint coalescing of a ringing line";
+			info->description = "RINGING -> CONNECTED -> ONHOOK inside one coalescing window still ends the ringing (congestion, no missed call)";
+			return AST_TEST_NOT_RUN;
+		case TEST_EXECUTE:
+			break;
+	}
+	struct sccp_hint_coalesce coalesce = {.sched_id = -1, .sentState = SCCP_CHANNELSTATE_ONHOOK };
+	int window = GLOB(hint_coalesce_window);
+
+	GLOB(hint_coalesce_window) = 200;
+
+	pbx_test_status_update(test, "RINGING is sent immediately\n");
+	pbx_test_validate_cleanup(test, sccp_hint_coalesce(&coalesce, TRUE, sccp_hint_coalesce_test_cb, NULL), res, cleanup);
+	pbx_test_validate_cleanup(test, sccp_hint_coalesceSent(&coalesce, SCCP_CHANNELSTATE_RINGING) == SCCP_CHANNELSTATE_ONHOOK, res, cleanup);
+
+	pbx_test_status_update(test, "CONNECTED inside the window is deferred\n");
+	pbx_test_validate_cleanup(test, !sccp_hint_coalesce(&coalesce, FALSE, sccp_hint_coalesce_test_cb, NULL), res, cleanup);
+	pbx_test_validate_cleanup(test, coalesce.sched_id > -1, res, cleanup);
+
+	pbx_test_status_update(test, "ONHOOK before the window closes is folded into the pending notification\n");
+	pbx_test_validate_cleanup(test, !sccp_hint_coalesce(&coalesce, FALSE, sccp_hint_coalesce_test_cb, NULL), res, cleanup);
+	pbx_test_validate_cleanup(test, coalesce.suppressed == 1, res, cleanup);
+
+	pbx_test_status_update(test, "window closes: ONHOOK is sent, subscribers last saw RINGING\n");
+	SCCP_SCHED_DEL(coalesce.sched_id);
+	sccp_hint_coalesceFired(&coalesce);
+	pbx_test_validate_cleanup(test, sccp_hint_coalesceSent(&coalesce, SCCP_CHANNELSTATE_ONHOOK) == SCCP_CHANNELSTATE_RINGING, res, cleanup);
+	pbx_test_validate_cleanup(test, coalesce.notified == 2, res, cleanup);
+
+cleanup:
+	if (coalesce.sched_id > -1) {
+		SCCP_SCHED_DEL(coalesce.sched_id);
+	}
+	GLOB(hint_coalesce_window) = window;
+	return res;
+}
+
+static void __attribute__((constructor)) sccp_register_tests(void)
+{
+	AST_TEST_REGISTER(sccp_hint_linestate_bench);
+	AST_TEST_REGISTER(sccp_hint_coalesce_ringing_test);
+}
+
+static void __attribute__((destructor)) sccp_unregister_tests(void)
+{
+	AST_TEST_UNREGISTER(sccp_hint_linestate_bench);
+	AST_TEST_UNREGISTER(sccp_hint_coalesce_ringing_test);
+}
+#endif
+
 // kate: indent-width 8; replace-tabs off; indent-mode cstyle; auto-insert-doxygen on; line-numbers on; tab-indents on; keep-extra-spaces off; auto-brackets off;
@@ -39,21 +39,30 @@ void sccp_line_pre_reload(void)
 {
 	sccp_line_t *l = NULL;
 	SCCP_RWLIST_TRAVERSE_SAFE_BEGIN(&GLOB(lines), l, list) {
-		if (GLOB(hotline)->line == l) {									/* always remove hotline from linedevice */
-			sccp_log((DEBUGCAT_CONFIG + DEBUGCAT_LINE)) (VERBOSE_PREFIX_3 "%s: Removing Hotline from Device\n", l->name);
-			sccp_line_removeDevice(l, NULL);
-		} else {											/* Don't want to include the hotline line */
+		sccp_line_pre_reload_line(l);
+	}
+	SCCP_LIST_TRAVERSE_SAFE_END;
+}
+
+/*!
+ * \brief prepare a single line for being re-read from sccp.conf
+ * \note used by sccp_line_pre_reload and by the incremental reload, for lines whose section has changed or was removed
+ */
+void sccp_line_pre_reload_line(sccp_line_t * l)
+{
+	if (GLOB(hotline)->line == l) {										/* always remove hotline from linedevice */
+		sccp_log((DEBUGCAT_CONFIG + DEBUGCAT_LINE)) (VERBOSE_PREFIX_3 "%s: Removing Hotline from Device\n", l->name);
+		sccp_line_removeDevice(l, NULL);
+	} else {												/* Don't want to include the hotline line */
 #ifdef CS_SCCP_REALTIME
-			if (l->realtime == FALSE)
+		if (l->realtime == FALSE)
 #endif
-			{
-				sccp_log((DEBUGCAT_CONFIG + DEBUGCAT_LINE)) (VERBOSE_PREFIX_3 "%s: Setting Line to Pending Delete=1\n", l->name);
-				l->pendingDelete = 1;
-			}
+		{
+			sccp_log((DEBUGCAT_CONFIG + DEBUGCAT_LINE)) (VERBOSE_PREFIX_3 "%s: Setting Line to Pending Delete=1\n", l->name);
+			l->pendingDelete = 1;
 		}
-		l->pendingUpdate = 0;
 	}
-	SCCP_LIST_TRAVERSE_SAFE_END;
+	l->pendingUpdate = 0;
 }
 
 /*!
@@ -149,6 +158,7 @@ void sccp_line_addToGlobals(sccp_line_t * line)
 		/* add to list */
 		sccp_line_retain(l);										/* add retained line to the list */
 		SCCP_RWLIST_INSERT_SORTALPHA(&GLOB(lines), l, list, cid_num);
+		sccp_hashtable_insert(GLOB(line_index), l->name, l);
 		sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_3 "Added line '%s' to Glob(lines)\n", l->name);
 
 		/* emit event */
@@ -174,7 +184,9 @@ void sccp_line_removeFromGlobals(sccp_line_t * line)
 	sccp_line_t *removed_line = NULL;
 	if (line) {
 		SCCP_RWLIST_WRLOCK(&GLOB(lines));
-		removed_line = SCCP_RWLIST_REMOVE(&GLOB(lines), line, list);
+		if ((removed_line = SCCP_RWLIST_REMOVE(&GLOB(lines), line, list))) {
+			sccp_hashtable_remove(GLOB(line_index), removed_line->name, removed_line);
+		}
 		SCCP_RWLIST_UNLOCK(&GLOB(lines));
 
 		sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_3 "Removed line '%s' from Glob(lines)\n", removed_line->name);
@@ -641,6 +653,7 @@ void sccp_line_addChannel(constLinePtr line, constChannelPtr channel)
 			} else {
 				SCCP_LIST_INSERT_HEAD(&l->channels, c, list);					// add to list
 			}
+			sccp_channel_index_add(c);
 		}
 		SCCP_LIST_UNLOCK(&l->channels);
 	}
@@ -667,6 +680,7 @@ void sccp_line_removeChannel(sccp_line_t * line, sccp_channel_t * channel)
 	if (l) {
 		SCCP_LIST_LOCK(&l->channels);
 		if ((c = SCCP_LIST_REMOVE(&l->channels, channel, list))) {
+			sccp_channel_index_remove(c);
 #if CS_REFCOUNT_DEBUG
 			sccp_refcount_removeWeakParent(l, c);
 #endif
@@ -819,7 +833,9 @@ sccp_line_t *sccp_line_find_byname(const char *name, uint8_t useRealtime)
 	sccp_line_t *l = NULL;
 
 	SCCP_RWLIST_RDLOCK(&GLOB(lines));
-	l = SCCP_RWLIST_FIND(&GLOB(lines), sccp_line_t, tmpl, list, (sccp_strcaseequals(tmpl->name, name)), TRUE, __FILE__, __LINE__, __PRETTY_FUNCTION__);
+	if ((l = (sccp_line_t *) sccp_hashtable_find(GLOB(line_index), name))) {
+		l = sccp_line_retain(l);
+	}
 	SCCP_RWLIST_UNLOCK(&GLOB(lines));
 #ifdef CS_SCCP_REALTIME
 	if (!l && useRealtime) {
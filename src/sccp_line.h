@@ -140,6 +140,7 @@ struct sccp_linedevices {
 };														/*!< SCCP Line-Device Structure */
 
 SCCP_API void SCCP_CALL sccp_line_pre_reload(void);
+SCCP_API void SCCP_CALL sccp_line_pre_reload_line(sccp_line_t * l);
 SCCP_API void SCCP_CALL sccp_line_post_reload(void);
 
 /* live cycle */
@@ -0,0 +1,501 @@
+/*!
+ * \file        sccp_msgstats.c
+ * \brief       SCCP Message Handler Statistics
+ * \note        This program is free software and may be modified and distributed under the terms of the GNU Public License.
+ *              See the LICENSE file at the top of the source tree.
+ */
+
+/*!
+ * \section sccp_msgstats   Message Handler Statistics
+ *
+ * sccp_handle_message times every handler call with the monotonic clock and accounts it to the message id: a counter, the total
+ * and maximum time and a log-linear histogram (four buckets per power of two nanoseconds), from which the percentiles are
+ * calculated. When the session reactor handles the data, the time between epoll_wait returning and the handler being called
+ * is accounted the same way (queue latency), messages handled by a device thread have no queue latency.
+ *
+ * Every thread accumulates into its own block, so recording never takes a lock or touches a shared cache line. The per message
+ * entries are allocated the first time a thread handles that message. Readers ('sccp show stats messages' / SCCPShowStatsMessages)
+ * merge the blocks, the counters are read while they are being updated, which is good enough for statistics.
+ *
+ * Resetting only bumps the generation: readers skip blocks of an older generation, and each thread clears its own block the next
+ * time it records something. Blocks of exited threads are taken over by new threads, like the trace rings (see sccp_trace.c).
+ */
+
+#include "config.h"
+#include "common.h"
+#include "sccp_msgstats.h"
+#include "sccp_protocol.h"
+#include "sccp_utils.h"
+#include <asterisk/cli.h>
+#include <pthread.h>
+#include <time.h>
+
+SCCP_FILE_VERSION(__FILE__, "");
+
+#define SCCP_MSGSTATS_SUBBUCKETS (1 << SCCP_MSGSTATS_SUBBUCKET_BITS)
+#define SCCP_MSGSTATS_SPCP_SLOT (SCCP_MESSAGE_HIGH_BOUNDARY + 1)
+#define SCCP_MSGSTATS_UNKNOWN_SLOT (SCCP_MSGSTATS_SPCP_SLOT + SPCP_MESSAGE_HIGH_BOUNDARY - SPCP_MESSAGE_LOW_BOUNDARY + 1)
+#define SCCP_MSGSTATS_SLOTS (SCCP_MSGSTATS_UNKNOWN_SLOT + 1)
+
+typedef struct sccp_msgstats_block sccp_msgstats_block_t;
+struct sccp_msgstats_block {
+	sccp_msgstats_entry_t *volatile entries[SCCP_MSGSTATS_SLOTS];						/*!< allocated on first use, only by the owner */
+	uint64_t ready;												/*!< see sccp_msgstats_setReady */
+	volatile uint32_t generation;										/*!< entries are cleared by the owner when this is behind */
+	boolean_t owned;											/*!< FALSE once the thread has exited, the block can be taken over */
+	sccp_msgstats_block_t *next;
+};
+
+static pthread_key_t msgstats_block_key;
+static volatile int msgstats_running = 0;
+static volatile uint32_t msgstats_generation = 1;
+AST_MUTEX_DEFINE_STATIC(msgstats_lock);										/* protects msgstats_blocks and the owned flags */
+static sccp_msgstats_block_t *msgstats_blocks = NULL;
+
+static inline uint32_t msgstats_slot(uint32_t mid)
+{
+	if (mid <= SCCP_MESSAGE_HIGH_BOUNDARY) {
+		return mid;
+	}
+	if (mid >= SPCP_MESSAGE_LOW_BOUNDARY && mid <= SPCP_MESSAGE_HIGH_BOUNDARY) {
+		return SCCP_MSGSTATS_SPCP_SLOT + mid - SPCP_MESSAGE_LOW_BOUNDARY;
+	}
+	return SCCP_MSGSTATS_UNKNOWN_SLOT;
+}
+
+static inline uint32_t msgstats_slot2mid(uint32_t slot)
+{
+	return slot < SCCP_MSGSTATS_SPCP_SLOT ? slot : slot - SCCP_MSGSTATS_SPCP_SLOT + SPCP_MESSAGE_LOW_BOUNDARY;
+}
+
+/* log-linear bucket: values below SCCP_MSGSTATS_SUBBUCKETS get their own bucket, above that every power of two is split in SCCP_MSGSTATS_SUBBUCKETS */
+static inline uint32_t msgstats_bucket(uint64_t ns)
+{
+	uint32_t msb = 0, bucket = 0;
+
+	if (ns < SCCP_MSGSTATS_SUBBUCKETS) {
+		return (uint32_t) ns;
+	}
+	msb = 63 - __builtin_clzll(ns);
+	bucket = ((msb - SCCP_MSGSTATS_SUBBUCKET_BITS + 1) << SCCP_MSGSTATS_SUBBUCKET_BITS) + (uint32_t) ((ns >> (msb - SCCP_MSGSTATS_SUBBUCKET_BITS)) & (SCCP_MSGSTATS_SUBBUCKETS - 1));
+	return bucket < SCCP_MSGSTATS_BUCKETS ? bucket : SCCP_MSGSTATS_BUCKETS - 1;
+}
+
+/* highest value ending up in bucket */
+static inline uint64_t msgstats_bucket_upper(uint32_t bucket)
+{
+	uint32_t shift = 0;
+
+	if (bucket < SCCP_MSGSTATS_SUBBUCKETS) {
+		return bucket;
+	}
+	shift = (bucket >> SCCP_MSGSTATS_SUBBUCKET_BITS) - 1;
+	return ((uint64_t) (SCCP_MSGSTATS_SUBBUCKETS + (bucket & (SCCP_MSGSTATS_SUBBUCKETS - 1)) + 1) << shift) - 1;
+}
+
+uint64_t sccp_msgstats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/* thread exit: keep the numbers, hand the block to the next thread that needs one */
+static void msgstats_block_destructor(void *data)
+{
+	sccp_msgstats_block_t *block = (sccp_msgstats_block_t *) data;
+
+	if (!block) {
+		return;
+	}
+	pbx_mutex_lock(&msgstats_lock);
+	block->ready = 0;
+	block->owned = FALSE;
+	pbx_mutex_unlock(&msgstats_lock);
+}
+
+static sccp_msgstats_block_t *msgstats_block_get(void)
+{
+	sccp_msgstats_block_t *block = NULL;
+
+	if (!msgstats_running) {
+		return NULL;
+	}
+	if ((block = (sccp_msgstats_block_t *) pthread_getspecific(msgstats_block_key))) {
+		return block;
+	}
+	pbx_mutex_lock(&msgstats_lock);
+	if (!msgstats_running) {
+		pbx_mutex_unlock(&msgstats_lock);
+		return NULL;
+	}
+	for (block = msgstats_blocks; block && block->owned; block = block->next) {
+		/* find a block left behind by an exited thread */
+	}
+	if (!block) {
+		if (!(block = (sccp_msgstats_block_t *) sccp_calloc(1, sizeof(sccp_msgstats_block_t)))) {
+			pbx_mutex_unlock(&msgstats_lock);
+			return NULL;
+		}
+		block->generation = msgstats_generation;
+		block->next = msgstats_blocks;
+		msgstats_blocks = block;
+	}
+	block->owned = TRUE;
+	pthread_setspecific(msgstats_block_key, block);
+	pbx_mutex_unlock(&msgstats_lock);
+	return block;
+}
+
+void sccp_msgstats_init(void)
+{
+	pbx_mutex_lock(&msgstats_lock);
+	if (!msgstats_running) {
+		if (pthread_key_create(&msgstats_block_key, msgstats_block_destructor) == 0) {
+			msgstats_running = 1;
+		} else {
+			pbx_log(LOG_WARNING, "SCCP: (sccp_msgstats_init) could not create thread key, message statistics disabled\n");
+		}
+	}
+	pbx_mutex_unlock(&msgstats_lock);
+}
+
+void sccp_msgstats_destroy(void)
+{
+	sccp_msgstats_block_t *block = NULL;
+	uint32_t slot = 0;
+
+	pbx_mutex_lock(&msgstats_lock);
+	if (!msgstats_running) {
+		pbx_mutex_unlock(&msgstats_lock);
+		return;
+	}
+	msgstats_running = 0;
+	pthread_key_delete(msgstats_block_key);
+	while ((block = msgstats_blocks)) {
+		msgstats_blocks = block->next;
+		for (slot = 0; slot < SCCP_MSGSTATS_SLOTS; slot++) {
+			if (block->entries[slot]) {
+				sccp_free(block->entries[slot]);
+			}
+		}
+		sccp_free(block);
+	}
+	pbx_mutex_unlock(&msgstats_lock);
+}
+
+/*!
+ * \brief Set the time the data the calling thread is about to handle became readable
+ * \note used by the session reactor, cleared (0) once the data has been handled
+ */
+void sccp_msgstats_setReady(uint64_t ready)
+{
+	sccp_msgstats_block_t *block = msgstats_block_get();
+
+	if (block) {
+		block->ready = ready;
+	}
+}
+
+/*!
+ * \brief Account a handler call for message mid, which started at start
+ */
+void sccp_msgstats_record(uint32_t mid, uint64_t start)
+{
+	sccp_msgstats_block_t *block = msgstats_block_get();
+	sccp_msgstats_entry_t *entry = NULL;
+	uint32_t slot = msgstats_slot(mid);
+	uint32_t generation = msgstats_generation;
+	uint64_t elapsed = 0;
+
+	if (!block) {
+		return;
+	}
+	if (dont_expect(block->generation != generation)) {							/* reset since this thread last recorded something */
+		for (slot = 0; slot < SCCP_MSGSTATS_SLOTS; slot++) {
+			if (block->entries[slot]) {
+				memset(block->entries[slot], 0, sizeof(sccp_msgstats_entry_t));
+			}
+		}
+		__sync_synchronize();
+		block->generation = generation;
+		slot = msgstats_slot(mid);
+	}
+	if (!(entry = block->entries[slot])) {
+		if (!(entry = (sccp_msgstats_entry_t *) sccp_calloc(1, sizeof(sccp_msgstats_entry_t)))) {
+			return;
+		}
+		__sync_synchronize();										/* publish the zeroed entry before the pointer */
+		block->entries[slot] = entry;
+	}
+	elapsed = sccp_msgstats_now() - start;
+	entry->count++;
+	entry->total_ns += elapsed;
+	if (elapsed > entry->max_ns) {
+		entry->max_ns = elapsed;
+	}
+	entry->handler_hist[msgstats_bucket(elapsed)]++;
+	if (block->ready && start >= block->ready) {
+		elapsed = start - block->ready;
+		entry->queued++;
+		entry->queue_total_ns += elapsed;
+		if (elapsed > entry->queue_max_ns) {
+			entry->queue_max_ns = elapsed;
+		}
+		entry->queue_hist[msgstats_bucket(elapsed)]++;
+	}
+}
+
+/*!
+ * \brief Forget everything recorded up to now
+ */
+void sccp_msgstats_reset(void)
+{
+	pbx_mutex_lock(&msgstats_lock);
+	msgstats_generation++;
+	pbx_mutex_unlock(&msgstats_lock);
+}
+
+/* merge slot over all blocks of the current generation, the caller holds msgstats_lock */
+static boolean_t __msgstats_merge(uint32_t slot, sccp_msgstats_entry_t * stats)
+{
+	const sccp_msgstats_block_t *block = NULL;
+	uint32_t generation = msgstats_generation;
+	uint32_t bucket = 0;
+
+	memset(stats, 0, sizeof(sccp_msgstats_entry_t));
+	for (block = msgstats_blocks; block; block = block->next) {
+		const sccp_msgstats_entry_t *entry = block->entries[slot];
+		if (!entry || block->generation != generation) {
+			continue;
+		}
+		stats->count += entry->count;
+		stats->total_ns += entry->total_ns;
+		stats->max_ns = entry->max_ns > stats->max_ns ? entry->max_ns : stats->max_ns;
+		stats->queued += entry->queued;
+		stats->queue_total_ns += entry->queue_total_ns;
+		stats->queue_max_ns = entry->queue_max_ns > stats->queue_max_ns ? entry->queue_max_ns : stats->queue_max_ns;
+		for (bucket = 0; bucket < SCCP_MSGSTATS_BUCKETS; bucket++) {
+			stats->handler_hist[bucket] += entry->handler_hist[bucket];
+			stats->queue_hist[bucket] += entry->queue_hist[bucket];
+		}
+	}
+	return stats->count ? TRUE : FALSE;
+}
+
+/*!
+ * \brief Get the statistics of message mid, merged over all threads
+ * \return FALSE when mid was not handled since the last reset
+ */
+boolean_t sccp_msgstats_get(uint32_t mid, sccp_msgstats_entry_t * stats)
+{
+	boolean_t res = FALSE;
+
+	pbx_mutex_lock(&msgstats_lock);
+	res = __msgstats_merge(msgstats_slot(mid), stats);
+	pbx_mutex_unlock(&msgstats_lock);
+	return res;
+}
+
+/*!
+ * \brief Percentile (0-100) of a histogram holding count values, in nanoseconds (upper bound of the bucket it falls in)
+ */
+uint64_t sccp_msgstats_percentile(const uint32_t hist[SCCP_MSGSTATS_BUCKETS], uint64_t count, uint32_t percentile)
+{
+	uint64_t target = (count * percentile + 99) / 100;
+	uint64_t seen = 0;
+	uint32_t bucket = 0, last = 0;
+
+	if (!count) {
+		return 0;
+	}
+	if (!target) {
+		target = 1;
+	}
+	for (bucket = 0; bucket < SCCP_MSGSTATS_BUCKETS; bucket++) {
+		if (!hist[bucket]) {
+			continue;
+		}
+		last = bucket;
+		seen += hist[bucket];
+		if (seen >= target) {
+			break;
+		}
+	}
+	return msgstats_bucket_upper(last);
+}
+
+typedef struct {
+	uint32_t mid;
+	uint64_t count;
+	uint64_t queued;
+	double avg;
+	double p50;
+	double p90;
+	double p99;
+	double max;
+	double queue_avg;
+	double queue_p99;
+	double queue_max;
+} sccp_msgstats_row_t;
+
+/* percentile in usec, never above the maximum seen */
+static inline double msgstats_percentile_us(const uint32_t hist[SCCP_MSGSTATS_BUCKETS], uint64_t count, uint32_t percentile, uint64_t max_ns)
+{
+	uint64_t value = sccp_msgstats_percentile(hist, count, percentile);
+
+	return (double) (value < max_ns ? value : max_ns) / 1000;
+}
+
+/*!
+ * \brief Show the per message handler statistics, optionally resetting them afterwards
+ */
+int sccp_show_stats_messages(int fd, sccp_cli_totals_t *totals, struct mansession *s, const struct message *m, int argc, char *argv[])
+{
+	int local_line_total = 0;
+	sccp_msgstats_row_t *rows = NULL;
+	sccp_msgstats_entry_t stats;
+	uint32_t slot = 0, numrows = 0, idx = 0;
+	boolean_t reset = (argc == 5 && !sccp_strlen_zero(argv[4]) && (sccp_strcaseequals(argv[4], "reset") || sccp_true(argv[4]))) ? TRUE : FALSE;
+
+	if (!(rows = (sccp_msgstats_row_t *) sccp_calloc(SCCP_MSGSTATS_SLOTS, sizeof(sccp_msgstats_row_t)))) {
+		pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
+		return RESULT_FAILURE;
+	}
+	pbx_mutex_lock(&msgstats_lock);
+	for (slot = 0; slot < SCCP_MSGSTATS_SLOTS; slot++) {
+		if (!__msgstats_merge(slot, &stats)) {
+			continue;
+		}
+		sccp_msgstats_row_t *row = &rows[numrows++];
+		row->mid = slot == SCCP_MSGSTATS_UNKNOWN_SLOT ? 0xFFFFFFFF : msgstats_slot2mid(slot);
+		row->count = stats.count;
+		row->avg = (double) stats.total_ns / stats.count / 1000;
+		row->p50 = msgstats_percentile_us(stats.handler_hist, stats.count, 50, stats.max_ns);
+		row->p90 = msgstats_percentile_us(stats.handler_hist, stats.count, 90, stats.max_ns);
+		row->p99 = msgstats_percentile_us(stats.handler_hist, stats.count, 99, stats.max_ns);
+		row->max = (double) stats.max_ns / 1000;
+		row->queued = stats.queued;
+		if (stats.queued) {
+			row->queue_avg = (double) stats.queue_total_ns / stats.queued / 1000;
+			row->queue_p99 = msgstats_percentile_us(stats.queue_hist, stats.queued, 99, stats.queue_max_ns);
+			row->queue_max = (double) stats.queue_max_ns / 1000;
+		}
+	}
+	if (reset) {
+		msgstats_generation++;
+	}
+	pbx_mutex_unlock(&msgstats_lock);
+
+#define CLI_AMI_TABLE_NAME MessageStats
+#define CLI_AMI_TABLE_PER_ENTRY_NAME Message
+#define CLI_AMI_TABLE_ITERATOR for(idx = 0; idx < numrows; idx++)
+#define CLI_AMI_TABLE_FIELDS 												\
+	CLI_AMI_TABLE_FIELD(Message,		"-40.40",	s,	40,	rows[idx].mid == 0xFFFFFFFF ? "Unknown" : msgtype2str(rows[idx].mid))	\
+	CLI_AMI_TABLE_FIELD(Id,			"-6",		x,	6,	rows[idx].mid == 0xFFFFFFFF ? 0 : rows[idx].mid)	\
+	CLI_AMI_TABLE_FIELD(Count,		"-9",		lu,	9,	(unsigned long) rows[idx].count)	\
+	CLI_AMI_TABLE_FIELD(AvgUs,		"9.1",		f,	9,	rows[idx].avg)				\
+	CLI_AMI_TABLE_FIELD(P50Us,		"9.1",		f,	9,	rows[idx].p50)				\
+	CLI_AMI_TABLE_FIELD(P90Us,		"9.1",		f,	9,	rows[idx].p90)				\
+	CLI_AMI_TABLE_FIELD(P99Us,		"9.1",		f,	9,	rows[idx].p99)				\
+	CLI_AMI_TABLE_FIELD(MaxUs,		"10.1",		f,	10,	rows[idx].max)				\
+	CLI_AMI_TABLE_FIELD(Queued,		"-9",		lu,	9,	(unsigned long) rows[idx].queued)	\
+	CLI_AMI_TABLE_FIELD(QAvgUs,		"9.1",		f,	9,	rows[idx].queue_avg)			\
+	CLI_AMI_TABLE_FIELD(QP99Us,		"9.1",		f,	9,	rows[idx].queue_p99)			\
+	CLI_AMI_TABLE_FIELD(QMaxUs,		"10.1",		f,	10,	rows[idx].queue_max)
+#include "sccp_cli_table.h"
+	local_line_total++;
+
+	if (reset && fd >= 0) {
+		pbx_cli(fd, "SCCP message statistics reset\n");
+	}
+	sccp_free(rows);
+	if (s) {
+		totals->lines = local_line_total;
+		totals->tables = 1;
+	}
+	return RESULT_SUCCESS;
+}
+
+#if CS_TEST_FRAMEWORK
+#include <asterisk/test.h>
+AST_TEST_DEFINE(sccp_msgstats_histogram_test)
+{
+	sccp_msgstats_entry_t stats;
+	uint32_t hist[SCCP_MSGSTATS_BUCKETS] = { 0 };
+	uint32_t bucket = 0, i = 0;
+	uint64_t ns = 0, start = 0;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "histogram";
+		info->category = "/channels/chan_sccp/msgstats/";
+		info->summary = "chan-sccp-b message statistics test";
+		info->description = "chan-sccp-b message statistics buckets, percentiles, recording and reset";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	pbx_test_status_update(test, "Bucket boundaries...\n");
+	for (ns = 0; ns < 1000000; ns += (ns < 4096 ? 1 : 997)) {
+		bucket = msgstats_bucket(ns);
+		pbx_test_validate(test, ns <= msgstats_bucket_upper(bucket));
+		pbx_test_validate(test, !bucket || ns > msgstats_bucket_upper(bucket - 1));
+	}
+	pbx_test_validate(test, msgstats_bucket(UINT64_MAX) == SCCP_MSGSTATS_BUCKETS - 1);
+	for (bucket = 1; bucket < SCCP_MSGSTATS_BUCKETS; bucket++) {
+		pbx_test_validate(test, msgstats_bucket_upper(bucket) > msgstats_bucket_upper(bucket - 1));
+		pbx_test_validate(test, msgstats_bucket(msgstats_bucket_upper(bucket)) == bucket);
+	}
+
+	pbx_test_status_update(test, "Percentiles...\n");
+	for (i = 1; i <= 100; i++) {
+		hist[msgstats_bucket(i * 1000)]++;
+	}
+	pbx_test_validate(test, sccp_msgstats_percentile(hist, 100, 50) >= 50000 && sccp_msgstats_percentile(hist, 100, 50) < 50000 * 5 / 4);
+	pbx_test_validate(test, sccp_msgstats_percentile(hist, 100, 99) >= 99000 && sccp_msgstats_percentile(hist, 100, 99) < 99000 * 5 / 4);
+	pbx_test_validate(test, sccp_msgstats_percentile(hist, 100, 100) >= 100000);
+	pbx_test_validate(test, sccp_msgstats_percentile(hist, 0, 50) == 0);
+
+	pbx_test_status_update(test, "Recording and reset...\n");
+	if (!msgstats_block_get()) {
+		pbx_test_status_update(test, "Message statistics are not running, skipping\n");
+		return AST_TEST_PASS;
+	}
+	sccp_msgstats_reset();
+	pbx_test_validate(test, sccp_msgstats_get(SPCPRegisterTokenAck, &stats) == FALSE);
+	start = sccp_msgstats_now();
+	sccp_msgstats_setReady(start - 2000);
+	for (i = 0; i < 10; i++) {
+		sccp_msgstats_record(SPCPRegisterTokenAck, start);
+	}
+	sccp_msgstats_setReady(0);
+	sccp_msgstats_record(SPCPRegisterTokenAck, sccp_msgstats_now());
+	sccp_msgstats_record(0xDEAD, sccp_msgstats_now());
+	pbx_test_validate(test, sccp_msgstats_get(SPCPRegisterTokenAck, &stats) == TRUE);
+	pbx_test_validate(test, stats.count == 11 && stats.queued == 10);
+	pbx_test_validate(test, stats.queue_total_ns == 20000 && stats.queue_max_ns == 2000);
+	pbx_test_validate(test, stats.max_ns >= stats.total_ns / stats.count);
+	pbx_test_validate(test, sccp_msgstats_get(0xBEEF, &stats) == TRUE && stats.count == 1);		/* unknown messages share one slot */
+
+	sccp_msgstats_reset();
+	pbx_test_validate(test, sccp_msgstats_get(SPCPRegisterTokenAck, &stats) == FALSE);
+	sccp_msgstats_record(SPCPRegisterTokenAck, sccp_msgstats_now());
+	pbx_test_validate(test, sccp_msgstats_get(SPCPRegisterTokenAck, &stats) == TRUE && stats.count == 1 && stats.queued == 0);
+	sccp_msgstats_reset();
+	return AST_TEST_PASS;
+}
+
+static void __attribute__((constructor)) sccp_register_tests(void)
+{
+	AST_TEST_REGISTER(sccp_msgstats_histogram_test);
+}
+
+static void __attribute__((destructor)) sccp_unregister_tests(void)
+{
+	AST_TEST_UNREGISTER(sccp_msgstats_histogram_test);
+}
+#endif
+// kate: indent-width 8; replace-tabs off; indent-mode cstyle; auto-insert-doxygen on; line-numbers on; tab-indents on; keep-extra-spaces off; auto-brackets off;
@@ -0,0 +1,43 @@
+/*!
+ * \file        sccp_msgstats.h
+ * \brief       SCCP Message Handler Statistics Header
+ * \note        This program is free software and may be modified and distributed under the terms of the GNU Public License.
+ *              See the LICENSE file at the top of the source tree.
+ */
+#pragma once
+
+#include "sccp_cli.h"
+
+/* forward declarations */
+struct mansession;
+struct message;
+
+__BEGIN_C_EXTERN__
+#define SCCP_MSGSTATS_SUBBUCKET_BITS 2										/*!< log-linear histogram: 4 buckets per power of two */
+#define SCCP_MSGSTATS_BUCKETS 128										/*!< nanoseconds, the last bucket collects everything above ~7.5 sec */
+
+/*!
+ * \brief Statistics of a single message type (per thread, or merged over all threads)
+ */
+typedef struct sccp_msgstats_entry {
+	uint64_t count;												/*!< number of messages handled */
+	uint64_t total_ns;											/*!< time spent in the handler */
+	uint64_t max_ns;
+	uint64_t queued;											/*!< number of messages with a known queue latency */
+	uint64_t queue_total_ns;										/*!< time between the data becoming readable and the handler being called */
+	uint64_t queue_max_ns;
+	uint32_t handler_hist[SCCP_MSGSTATS_BUCKETS];
+	uint32_t queue_hist[SCCP_MSGSTATS_BUCKETS];
+} sccp_msgstats_entry_t;
+
+SCCP_API void SCCP_CALL sccp_msgstats_init(void);
+SCCP_API void SCCP_CALL sccp_msgstats_destroy(void);
+SCCP_API uint64_t SCCP_CALL sccp_msgstats_now(void);							/*!< monotonic clock in nanoseconds */
+SCCP_API void SCCP_CALL sccp_msgstats_setReady(uint64_t ready);						/*!< time the data handled next by this thread became readable, 0 when unknown */
+SCCP_API void SCCP_CALL sccp_msgstats_record(uint32_t mid, uint64_t start);				/*!< account a handler call started at start (sccp_msgstats_now) */
+SCCP_API boolean_t SCCP_CALL sccp_msgstats_get(uint32_t mid, sccp_msgstats_entry_t * stats);		/*!< merged over all threads, FALSE when nothing was recorded */
+SCCP_API uint64_t SCCP_CALL sccp_msgstats_percentile(const uint32_t hist[SCCP_MSGSTATS_BUCKETS], uint64_t count, uint32_t percentile);
+SCCP_API void SCCP_CALL sccp_msgstats_reset(void);
+SCCP_API int SCCP_CALL sccp_show_stats_messages(int fd, sccp_cli_totals_t *totals, struct mansession *s, const struct message *m, int argc, char *argv[]);
+__END_C_EXTERN__
+// kate: indent-width 8; replace-tabs off; indent-mode cstyle; auto-insert-doxygen on; line-numbers on; tab-indents on; keep-extra-spaces off; auto-brackets off;
@@ -15,6 +15,8 @@
 #include "sccp_line.h"
 #include "sccp_utils.h"
 #include "sccp_labels.h"
+#include "sccp_hashtable.h"
+#include "sccp_vector.h"
 
 SCCP_FILE_VERSION(__FILE__, "");
 
@@ -28,6 +30,13 @@ SCCP_FILE_VERSION(__FILE__, "");
 #ifndef CS_AST_HAS_EVENT
 #define SCCP_MWI_CHECK_INTERVAL 30
 #endif
+#define SCCP_MWI_BATCH_INTERVAL 50										/* ms, collect a burst of mailbox events before updating the devices */
+
+#if defined(CS_AST_HAS_STASIS)
+#define SCCP_MAILBOX_UNIQUEID_SIZE AST_MAX_MAILBOX_UNIQUEID
+#else
+#define SCCP_MAILBOX_UNIQUEID_SIZE 121
+#endif
 
 /*!
  * \brief SCCP Mailbox Line Type Definition
@@ -62,6 +71,7 @@ typedef struct sccp_mailbox_subscriber_list sccp_mailbox_subscriber_list_t;
 struct sccp_mailbox_subscriber_list {
 	char mailbox[60];
 	char context[60];
+	char uniqueid[SCCP_MAILBOX_UNIQUEID_SIZE];								/*!< mailbox@context, key in sccp_mailbox_index */
 
 	SCCP_LIST_HEAD (, sccp_mailboxLine_t) sccp_mailboxLine;
 	SCCP_LIST_ENTRY (sccp_mailbox_subscriber_list_t) list;
@@ -75,18 +85,19 @@ struct sccp_mailbox_subscriber_list {
 	} currentVoicemailStatistic;								/*!< Current Voicemail Statistic Structure */
 
 	/*!
-	 * \brief Previous Voicemail Statistic Structure
+	 * \brief Previous Voicemail Statistic Structure (the values already added to the lines)
 	 */
 	struct {
 		int newmsgs;											/*!< New Messages */
 		int oldmsgs;											/*!< Old Messages */
 	} previousVoicemailStatistic;								/*!< Previous Voicemail Statistic Structure */
 
+	boolean_t pending;											/*!< queued in sccp_mwi_batch, protected by sccp_mwi_batch.lock */
+	sccp_mailbox_subscriber_list_t *nextPending;
 
 #if CS_AST_HAS_EVENT
 	struct pbx_event_sub *event_sub;
 #elif CS_AST_HAS_STASIS
-	char uniqueid[AST_MAX_MAILBOX_UNIQUEID];
 	struct stasis_subscription *event_sub;
 #else
 	int schedUpdate;
@@ -101,6 +112,26 @@ void sccp_mwi_addMailboxSubscription(char *mailbox, char *context, sccp_line_t *
 void sccp_mwi_lineStatusChangedEvent(const sccp_event_t * event);
 
 static SCCP_LIST_HEAD (, sccp_mailbox_subscriber_list_t) sccp_mailbox_subscriptions;
+static sccp_hashtable_t *sccp_mailbox_index;								/* mailbox@context -> subscription, protected by the sccp_mailbox_subscriptions lock */
+
+/*!
+ * \brief MWI Batch
+ *
+ * Mailbox events only store the new counts in their subscription and queue it. The queued subscriptions are processed
+ * together SCCP_MWI_BATCH_INTERVAL ms after the first event of a burst, so that every line lamp and device lamp/prompt
+ * is recalculated once per burst, instead of once per mailbox event (and once per line on the device).
+ */
+static struct {
+	ast_mutex_t lock;
+	sccp_mailbox_subscriber_list_t *pending;								/*!< subscriptions with unprocessed voicemail statistics */
+	int sched_id;
+	uint64_t events;
+	uint64_t batches;
+	uint64_t devices;											/*!< device lamp/prompt recalculations */
+} sccp_mwi_batch;
+
+static sccp_mailbox_subscriber_list_t *sccp_mwi_findSubscription(const char *mailbox, const char *context);
+static void sccp_mwi_processPending(void);
 
 /*!
  * start mwi module.
@@ -108,6 +139,10 @@ static SCCP_LIST_HEAD (, sccp_mailbox_subscriber_list_t) sccp_mailbox_subscripti
 void sccp_mwi_module_start(void)
 {
 	SCCP_LIST_HEAD_INIT(&sccp_mailbox_subscriptions);
+	sccp_mailbox_index = sccp_hashtable_create(SCCP_HASHTABLE_KEY_STRING_NOCASE, 64);
+	pbx_mutex_init(&sccp_mwi_batch.lock);
+	sccp_mwi_batch.pending = NULL;
+	sccp_mwi_batch.sched_id = -1;
 	sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_2 "SCCP: Starting MWI system\n");
 
 	sccp_event_subscribe(SCCP_EVENT_LINE_CREATED, sccp_mwi_linecreatedEvent, TRUE);
@@ -127,52 +162,66 @@ void sccp_mwi_module_stop(void)
 	sccp_event_unsubscribe(SCCP_EVENT_DEVICE_ATTACHED, sccp_mwi_deviceAttachedEvent);
 	sccp_event_unsubscribe(SCCP_EVENT_LINESTATUS_CHANGED, sccp_mwi_lineStatusChangedEvent);
 
+	if (sccp_mwi_batch.sched_id > -1) {
+		sccp_mwi_batch.sched_id = SCCP_SCHED_DEL(sccp_mwi_batch.sched_id);
+	}
+
 	SCCP_LIST_LOCK(&sccp_mailbox_subscriptions);
 	while ((subscription = SCCP_LIST_REMOVE_HEAD(&sccp_mailbox_subscriptions, list))) {
+		sccp_hashtable_remove(sccp_mailbox_index, subscription->uniqueid, subscription);
 		sccp_mwi_destroySubscription(subscription);
 	}
+	sccp_hashtable_destroy(&sccp_mailbox_index);
 	SCCP_LIST_UNLOCK(&sccp_mailbox_subscriptions);
 	SCCP_LIST_HEAD_DESTROY(&sccp_mailbox_subscriptions);
+	pbx_mutex_destroy(&sccp_mwi_batch.lock);
+}
+
+/*!
+ * \brief Scheduled processing of the MWI Batch
+ */
+static int sccp_mwi_processBatch(const void *ptr)
+{
+	pbx_mutex_lock(&sccp_mwi_batch.lock);
+	sccp_mwi_batch.sched_id = -1;
+	pbx_mutex_unlock(&sccp_mwi_batch.lock);
+
+	if (GLOB(module_running)) {
+		sccp_mwi_processPending();
+	}
+	return 0;
 }
 
 /*!
  * \brief Generic update mwi count
  * \param subscription Pointer to a mailbox subscription
+ * \param newmsgs New Messages
+ * \param oldmsgs Old Messages
+ *
+ * Stores the counts and queues the subscription for the next batch when they changed. Only takes the batch lock, never
+ * the subscription list lock, as destroySubscription waits for the pbx event threads while holding it.
  */
-static void sccp_mwi_updatecount(sccp_mailbox_subscriber_list_t * subscription)
+static void sccp_mwi_updatecount(sccp_mailbox_subscriber_list_t * subscription, int newmsgs, int oldmsgs)
 {
-	sccp_mailboxLine_t *mailboxLine = NULL;
-
-	sccp_log((DEBUGCAT_MWI)) (VERBOSE_PREFIX_3 "(sccp_mwi_updatecount)\n");
-	SCCP_LIST_LOCK(&subscription->sccp_mailboxLine);
-	SCCP_LIST_TRAVERSE(&subscription->sccp_mailboxLine, mailboxLine, list) {
-		AUTO_RELEASE(sccp_line_t, line , sccp_line_retain(mailboxLine->line));
-
-		if (line) {
-			sccp_linedevices_t *lineDevice = NULL;
-
-			/* update statistics for line  */
-			line->voicemailStatistic.oldmsgs -= subscription->previousVoicemailStatistic.oldmsgs;
-			line->voicemailStatistic.newmsgs -= subscription->previousVoicemailStatistic.newmsgs;
-
-			line->voicemailStatistic.oldmsgs += subscription->currentVoicemailStatistic.oldmsgs;
-			line->voicemailStatistic.newmsgs += subscription->currentVoicemailStatistic.newmsgs;
-			/* done */
-			sccp_log((DEBUGCAT_MWI)) (VERBOSE_PREFIX_3 "%s:(sccp_mwi_updatecount) newmsgs:%d, oldmsgs:%d\n", line->name, line->voicemailStatistic.newmsgs, line->voicemailStatistic.oldmsgs);
-
-			/* notify each device on line */
-			SCCP_LIST_LOCK(&line->devices);
-			SCCP_LIST_TRAVERSE(&line->devices, lineDevice, list) {
-				if (lineDevice && lineDevice->device) {
-					sccp_mwi_setMWILineStatus(lineDevice);
-				} else {
-					pbx_log(LOG_ERROR, "error: null line device.\n");
-				}
-			}
-			SCCP_LIST_UNLOCK(&line->devices);
+	if (newmsgs == -1 || oldmsgs == -1) {
+		return;
+	}
+	pbx_mutex_lock(&sccp_mwi_batch.lock);
+	sccp_mwi_batch.events++;
+	subscription->currentVoicemailStatistic.newmsgs = newmsgs;
+	subscription->currentVoicemailStatistic.oldmsgs = oldmsgs;
+	if (!subscription->pending && (newmsgs != subscription->previousVoicemailStatistic.newmsgs || oldmsgs != subscription->previousVoicemailStatistic.oldmsgs)) {
+		subscription->pending = TRUE;
+		subscription->nextPending = sccp_mwi_batch.pending;
+		sccp_mwi_batch.pending = subscription;
+	}
+	if (sccp_mwi_batch.pending && sccp_mwi_batch.sched_id < 0 && GLOB(module_running)) {			/* also retries after a failed sched_add, the queued subscriptions stay pending until then */
+		if ((sccp_mwi_batch.sched_id = iPbx.sched_add(SCCP_MWI_BATCH_INTERVAL, sccp_mwi_processBatch, NULL)) < 0) {
+			pbx_log(LOG_ERROR, "SCCP: (sccp_mwi_updatecount) Error scheduling mwi update, retrying on the next event.\n");
 		}
 	}
-	SCCP_LIST_UNLOCK(&subscription->sccp_mailboxLine);
+	pbx_mutex_unlock(&sccp_mwi_batch.lock);
+	sccp_log((DEBUGCAT_MWI)) (VERBOSE_PREFIX_3 "SCCP: (sccp_mwi_updatecount) %s, newmsgs:%d, oldmsgs:%d\n", subscription->uniqueid, newmsgs, oldmsgs);
 }
 
 #if defined(CS_AST_HAS_EVENT)
@@ -193,17 +242,7 @@ void sccp_mwi_event(const struct ast_event *event, void *data)
 	int oldmsgs = pbx_event_get_ie_uint(event, AST_EVENT_IE_OLDMSGS);
 	sccp_log((DEBUGCAT_MWI)) (VERBOSE_PREFIX_3 "SCCP: Received PBX mwi event (%s) for %s@%s, newmsgs:%d, oldmsgs:%d\n", ast_event_get_type_name(event), subscription->mailbox, subscription->context, newmsgs, oldmsgs);
 
-	/* for calculation store previous voicemail counts */
-	subscription->previousVoicemailStatistic.newmsgs = subscription->currentVoicemailStatistic.newmsgs;
-	subscription->previousVoicemailStatistic.oldmsgs = subscription->currentVoicemailStatistic.oldmsgs;
-
-	if (newmsgs != -1 && oldmsgs != -1) {
-		subscription->currentVoicemailStatistic.newmsgs = newmsgs;
-		subscription->currentVoicemailStatistic.oldmsgs = oldmsgs;
-		if (subscription->previousVoicemailStatistic.newmsgs != subscription->currentVoicemailStatistic.newmsgs && subscription->currentVoicemailStatistic.newmsgs != -1) {
-			sccp_mwi_updatecount(subscription);
-		}
-	}
+	sccp_mwi_updatecount(subscription, newmsgs, oldmsgs);
 }
 
 #elif defined(CS_AST_HAS_STASIS)
@@ -229,16 +268,7 @@ void sccp_mwi_event(void *userdata, struct stasis_subscription *sub, struct stas
 
 			sccp_log((DEBUGCAT_MWI)) (VERBOSE_PREFIX_3 "SCCP: Received PBX mwi event for %s@%s, newmsgs:%d, oldmsgs:%d\n", subscription->mailbox, subscription->context, newmsgs, oldmsgs);
 
-			subscription->previousVoicemailStatistic.newmsgs = subscription->currentVoicemailStatistic.newmsgs;
-			subscription->previousVoicemailStatistic.oldmsgs = subscription->currentVoicemailStatistic.oldmsgs;
-
-			if (newmsgs != -1 && oldmsgs != -1) {
-				subscription->currentVoicemailStatistic.newmsgs = newmsgs;
-				subscription->currentVoicemailStatistic.oldmsgs = oldmsgs;
-				if (subscription->previousVoicemailStatistic.newmsgs != subscription->currentVoicemailStatistic.newmsgs) {
-					sccp_mwi_updatecount(subscription);
-				}
-			}
+			sccp_mwi_updatecount(subscription, newmsgs, oldmsgs);
 		}
 	} else if (stasis_message_type(msg) == stasis_subscription_change_type()) {
 		struct stasis_subscription_change *change = stasis_message_data(msg);
@@ -266,9 +296,6 @@ int sccp_mwi_checksubscription(const void *ptr)
 	if (!subscription || !GLOB(module_running)) {
 		return -1;
 	}
-	subscription->previousVoicemailStatistic.newmsgs = subscription->currentVoicemailStatistic.newmsgs;
-	subscription->previousVoicemailStatistic.oldmsgs = subscription->currentVoicemailStatistic.oldmsgs;
-
 	char buffer[512];
 	int newmsgs = 0, oldmsgs = 0;
 	int interval = SCCP_MWI_CHECK_INTERVAL;
@@ -276,15 +303,7 @@ int sccp_mwi_checksubscription(const void *ptr)
 	snprintf(buffer, 512, "%s@%s", subscription->mailbox, subscription->context);
 	sccp_log((DEBUGCAT_MWI)) (VERBOSE_PREFIX_4 "SCCP: checking mailbox: %s\n", buffer);
 	if (pbx_app_inboxcount(buffer, &newmsgs, &oldmsgs) == 0) {
-		if (newmsgs != -1 && oldmsgs != -1) {
-			subscription->currentVoicemailStatistic.newmsgs = newmsgs;
-			subscription->currentVoicemailStatistic.oldmsgs = oldmsgs;
-
-			/* update devices if something changed */
-			if (subscription->previousVoicemailStatistic.newmsgs != subscription->currentVoicemailStatistic.newmsgs) {
-				sccp_mwi_updatecount(subscription);
-			}
-		}
+		sccp_mwi_updatecount(subscription, newmsgs, oldmsgs);				/* update devices if something changed */
 	} else {
 		interval = SCCP_MWI_CHECK_INTERVAL * 10;			/* if we failed, slow down polling */
 	}	
@@ -326,6 +345,19 @@ void sccp_mwi_destroySubscription(sccp_mailbox_subscriber_list_t *subscription)
 		subscription->schedUpdate = SCCP_SCHED_DEL(subscription->schedUpdate);
 	}
 #endif
+	/* no more events can queue it now, take it out of the batch */
+	pbx_mutex_lock(&sccp_mwi_batch.lock);
+	if (subscription->pending) {
+		sccp_mailbox_subscriber_list_t **prev = NULL;
+		for (prev = &sccp_mwi_batch.pending; *prev; prev = &(*prev)->nextPending) {
+			if (*prev == subscription) {
+				*prev = subscription->nextPending;
+				break;
+			}
+		}
+		subscription->pending = FALSE;
+	}
+	pbx_mutex_unlock(&sccp_mwi_batch.lock);
 	sccp_free(subscription);
 }
 
@@ -345,13 +377,11 @@ void sccp_mwi_unsubscribeMailbox(sccp_mailbox_t * mailbox)
 	sccp_mailbox_subscriber_list_t *subscription = NULL;
 
 	SCCP_LIST_LOCK(&sccp_mailbox_subscriptions);
-	SCCP_LIST_TRAVERSE_SAFE_BEGIN(&sccp_mailbox_subscriptions, subscription, list) {
-		if (sccp_strequals(mailbox->mailbox, subscription->mailbox) && sccp_strequals(mailbox->context, subscription->context)) {
-			SCCP_LIST_REMOVE_CURRENT(list);
-			sccp_mwi_destroySubscription(subscription);
-		}
+	if ((subscription = sccp_mwi_findSubscription(mailbox->mailbox, mailbox->context))) {
+		sccp_hashtable_remove(sccp_mailbox_index, subscription->uniqueid, subscription);
+		SCCP_LIST_REMOVE(&sccp_mailbox_subscriptions, subscription, list);
+		sccp_mwi_destroySubscription(subscription);
 	}
-	SCCP_LIST_TRAVERSE_SAFE_END;
 	SCCP_LIST_UNLOCK(&sccp_mailbox_subscriptions);
 }
 
@@ -439,14 +469,92 @@ void sccp_mwi_linecreatedEvent(const sccp_event_t * event)
 }
 
 
+/*!
+ * \brief Find Mailbox Subscription by mailbox@context
+ * \note sccp_mailbox_subscriptions needs to be locked
+ */
+static sccp_mailbox_subscriber_list_t *sccp_mwi_findSubscription(const char *mailbox, const char *context)
+{
+	char uniqueid[SCCP_MAILBOX_UNIQUEID_SIZE];
+
+	snprintf(uniqueid, sizeof(uniqueid), "%s@%s", mailbox, context);
+	return (sccp_mailbox_subscriber_list_t *) sccp_hashtable_find(sccp_mailbox_index, uniqueid);
+}
+
+/*!
+ * \brief Create Mailbox Subscription (not yet listed, nor subscribed to the pbx)
+ */
+static sccp_mailbox_subscriber_list_t *sccp_mwi_createSubscription(const char *mailbox, const char *context)
+{
+	sccp_mailbox_subscriber_list_t *subscription = sccp_calloc(sizeof *subscription, 1);
+
+	if (!subscription) {
+		pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
+		return NULL;
+	}
+	SCCP_LIST_HEAD_INIT(&subscription->sccp_mailboxLine);
+
+	sccp_copy_string(subscription->mailbox, mailbox, sizeof(subscription->mailbox));
+	sccp_copy_string(subscription->context, context, sizeof(subscription->context));
+	snprintf(subscription->uniqueid, sizeof(subscription->uniqueid), "%s@%s", subscription->mailbox, subscription->context);
+#if !defined(CS_AST_HAS_EVENT) && !defined(CS_AST_HAS_STASIS)
+	subscription->schedUpdate = -1;
+#endif
+	return subscription;
+}
+
+/*!
+ * \brief Add Mailbox Subscription to the list and index
+ */
+static void sccp_mwi_listSubscription(sccp_mailbox_subscriber_list_t * subscription)
+{
+	SCCP_LIST_LOCK(&sccp_mailbox_subscriptions);
+	SCCP_LIST_INSERT_HEAD(&sccp_mailbox_subscriptions, subscription, list);
+	sccp_hashtable_insert(sccp_mailbox_index, subscription->uniqueid, subscription);
+	SCCP_LIST_UNLOCK(&sccp_mailbox_subscriptions);
+}
+
+/*!
+ * \brief Add Line to Mailbox Subscription
+ */
+static void sccp_mwi_addMailboxLine(sccp_mailbox_subscriber_list_t * subscription, sccp_line_t * line)
+{
+	sccp_mailboxLine_t *mailboxLine = NULL;
+
+	/* we already have this subscription */
+	SCCP_LIST_LOCK(&subscription->sccp_mailboxLine);
+	SCCP_LIST_TRAVERSE(&subscription->sccp_mailboxLine, mailboxLine, list) {
+		if (line == mailboxLine->line) {
+			break;
+		}
+	}
+
+	if (!mailboxLine) {
+		mailboxLine = sccp_calloc(sizeof *mailboxLine, 1);
+		if (!mailboxLine) {
+			SCCP_LIST_UNLOCK(&subscription->sccp_mailboxLine);
+			pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, line->name);
+			return;
+		}
+
+		mailboxLine->line = line;
+
+		/* the counts already handed out to the other lines, a pending update will add the difference */
+		pbx_mutex_lock(&sccp_mwi_batch.lock);
+		line->voicemailStatistic.newmsgs = subscription->previousVoicemailStatistic.newmsgs;
+		line->voicemailStatistic.oldmsgs = subscription->previousVoicemailStatistic.oldmsgs;
+		pbx_mutex_unlock(&sccp_mwi_batch.lock);
+
+		SCCP_LIST_INSERT_HEAD(&subscription->sccp_mailboxLine, mailboxLine, list);
+	}
+	SCCP_LIST_UNLOCK(&subscription->sccp_mailboxLine);
+}
+
 /*!
  * \brief Add Mailbox Subscription
  * \param mailbox Mailbox as char
  * \param context Mailbox Context
  * \param line SCCP Line
- *
- * \warning
- *  - subscription->sccp_mailboxLine is not always locked
  */
 void sccp_mwi_addMailboxSubscription(char *mailbox, char *context, sccp_line_t * line)
 {
@@ -455,32 +563,17 @@ void sccp_mwi_addMailboxSubscription(char *mailbox, char *context, sccp_line_t *
 		return;
 	}
 	sccp_mailbox_subscriber_list_t *subscription = NULL;
-	sccp_mailboxLine_t *mailboxLine = NULL;
 
 	SCCP_LIST_LOCK(&sccp_mailbox_subscriptions);
-	SCCP_LIST_TRAVERSE(&sccp_mailbox_subscriptions, subscription, list) {
-		if (sccp_strequals(mailbox, subscription->mailbox) && sccp_strequals(context, subscription->context)) {
-			break;
-		}
-	}
+	subscription = sccp_mwi_findSubscription(mailbox, context);
 	SCCP_LIST_UNLOCK(&sccp_mailbox_subscriptions);
 
 	if (!subscription) {
-		subscription = sccp_calloc(sizeof *subscription, 1);
-		if (!subscription) {
-			pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, line->name);
+		if (!(subscription = sccp_mwi_createSubscription(mailbox, context))) {
 			return;
 		}
-		SCCP_LIST_HEAD_INIT(&subscription->sccp_mailboxLine);
-
-		sccp_copy_string(subscription->mailbox, mailbox, sizeof(subscription->mailbox));
-		sccp_copy_string(subscription->context, context, sizeof(subscription->context));
 		sccp_log((DEBUGCAT_MWI)) (VERBOSE_PREFIX_3 "SCCP: (mwi_addMailboxSubscription) creating subscription for: %s@%s\n", subscription->mailbox, subscription->context);
 
-		SCCP_LIST_LOCK(&sccp_mailbox_subscriptions);
-		SCCP_LIST_INSERT_HEAD(&sccp_mailbox_subscriptions, subscription, list);
-		SCCP_LIST_UNLOCK(&sccp_mailbox_subscriptions);
-
 		/* get initial value */
 
 #ifdef CS_AST_HAS_EVENT
@@ -500,7 +593,6 @@ void sccp_mwi_addMailboxSubscription(char *mailbox, char *context, sccp_line_t *
 		} else
 #elif CS_AST_HAS_STASIS
 		RAII(struct stasis_message *, mwi_message, NULL, ao2_cleanup);
-		snprintf(subscription->uniqueid, sizeof(subscription->uniqueid), "%s@%s", subscription->mailbox, subscription->context);
 		sccp_log(DEBUGCAT_MWI)(VERBOSE_PREFIX_3 "SCCP: (mwi_addMailboxSubscription) mailbox_uniqueid:%s, mailbox:%s, context:%s\n", subscription->uniqueid, subscription->mailbox, subscription->context)
 
 		mwi_message = stasis_cache_get(ast_mwi_state_cache(), ast_mwi_state_type(), subscription->uniqueid);
@@ -528,6 +620,10 @@ void sccp_mwi_addMailboxSubscription(char *mailbox, char *context, sccp_line_t *
 			}
 		}
 
+		subscription->previousVoicemailStatistic.newmsgs = subscription->currentVoicemailStatistic.newmsgs;
+		subscription->previousVoicemailStatistic.oldmsgs = subscription->currentVoicemailStatistic.oldmsgs;
+		sccp_mwi_listSubscription(subscription);
+
 		/* register asterisk event */
 #if defined( CS_AST_HAS_EVENT)
 #  if ASTERISK_VERSION_NUMBER >= 10800
@@ -556,37 +652,14 @@ void sccp_mwi_addMailboxSubscription(char *mailbox, char *context, sccp_line_t *
 #endif // defined( CS_AST_HAS_EVENT)
 		/* end register asterisk event */
 	}
-
-	/* we already have this subscription */
-	SCCP_LIST_TRAVERSE(&subscription->sccp_mailboxLine, mailboxLine, list) {
-		if (line == mailboxLine->line) {
-			break;
-		}
-	}
-
-	if (!mailboxLine) {
-		mailboxLine = sccp_calloc(sizeof *mailboxLine, 1);
-		if (!mailboxLine) {
-			pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, line->name);
-			return;
-		}
-
-		mailboxLine->line = line;
-
-		line->voicemailStatistic.newmsgs = subscription->currentVoicemailStatistic.newmsgs;
-		line->voicemailStatistic.oldmsgs = subscription->currentVoicemailStatistic.oldmsgs;
-
-		SCCP_LIST_LOCK(&subscription->sccp_mailboxLine);
-		SCCP_LIST_INSERT_HEAD(&subscription->sccp_mailboxLine, mailboxLine, list);
-		SCCP_LIST_UNLOCK(&subscription->sccp_mailboxLine);
-	}
+	sccp_mwi_addMailboxLine(subscription, line);
 }
 
 /*!
- * \brief Set MWI Line Status
+ * \brief Set the MWI lamp of a line button, without rechecking the device lamp/prompt
  * \param lineDevice SCCP LineDevice
  */
-void sccp_mwi_setMWILineStatus(sccp_linedevices_t * lineDevice)
+static void sccp_mwi_setMWILineLamp(sccp_linedevices_t * lineDevice)
 {
 	pbx_assert(lineDevice != NULL && lineDevice->device != NULL);
 	
@@ -625,11 +698,130 @@ void sccp_mwi_setMWILineStatus(sccp_linedevices_t * lineDevice)
 	} else {
 		sccp_log((DEBUGCAT_MWI)) (VERBOSE_PREFIX_3 "%s: (mwi_setMWILineStatus) Device already knows this state %s on line %s (%d). skipping update\n", DEV_ID_LOG(d), status ? "ON" : "OFF", (l ? l->name : "unknown"), instance);
 	}
-	if (sccp_device_getRegistrationState(d) == SKINNY_DEVICE_RS_OK) {
-		sccp_mwi_check(d); /* we need to check mwi status again, to enable/disable device mwi light */
+}
+
+/*!
+ * \brief Set MWI Line Status
+ * \param lineDevice SCCP LineDevice
+ */
+void sccp_mwi_setMWILineStatus(sccp_linedevices_t * lineDevice)
+{
+	sccp_mwi_setMWILineLamp(lineDevice);
+	if (sccp_device_getRegistrationState(lineDevice->device) == SKINNY_DEVICE_RS_OK) {
+		sccp_mwi_check(lineDevice->device); /* we need to check mwi status again, to enable/disable device mwi light */
 	}
 }
 
+/*!
+ * \brief Process the MWI Batch
+ *
+ * Adds the changed counts of all pending subscriptions to their lines first, collecting every linedevice involved, and
+ * only then updates the line lamps and rechecks each device once. The pbx event threads never wait for this, they only
+ * take sccp_mwi_batch.lock.
+ */
+static void sccp_mwi_processPending(void)
+{
+	sccp_mailbox_subscriber_list_t *pending = NULL;
+	sccp_mailbox_subscriber_list_t *subscription = NULL;
+	sccp_mailboxLine_t *mailboxLine = NULL;
+	sccp_linedevices_t *lineDevice = NULL;
+	sccp_hashtable_t *seen = sccp_hashtable_create(SCCP_HASHTABLE_KEY_POINTER, 64);			/* linedevices and devices already collected */
+	SCCP_VECTOR(, sccp_linedevices_t *) lineDevices;
+	SCCP_VECTOR(, sccp_device_t *) devices;
+	size_t idx = 0;
+
+	SCCP_VECTOR_INIT(&lineDevices, 16);
+	SCCP_VECTOR_INIT(&devices, 16);
+
+	/* destroySubscription runs under the list lock, which keeps the pending subscriptions alive while we work on them */
+	SCCP_LIST_LOCK(&sccp_mailbox_subscriptions);
+	pbx_mutex_lock(&sccp_mwi_batch.lock);
+	pending = sccp_mwi_batch.pending;
+	sccp_mwi_batch.pending = NULL;
+	sccp_mwi_batch.batches++;
+	pbx_mutex_unlock(&sccp_mwi_batch.lock);
+
+	while ((subscription = pending)) {
+		int newmsgs, oldmsgs;
+
+		pbx_mutex_lock(&sccp_mwi_batch.lock);
+		pending = subscription->nextPending;
+		subscription->nextPending = NULL;
+		subscription->pending = FALSE;
+		newmsgs = subscription->currentVoicemailStatistic.newmsgs - subscription->previousVoicemailStatistic.newmsgs;
+		oldmsgs = subscription->currentVoicemailStatistic.oldmsgs - subscription->previousVoicemailStatistic.oldmsgs;
+		subscription->previousVoicemailStatistic.newmsgs = subscription->currentVoicemailStatistic.newmsgs;
+		subscription->previousVoicemailStatistic.oldmsgs = subscription->currentVoicemailStatistic.oldmsgs;
+		pbx_mutex_unlock(&sccp_mwi_batch.lock);
+
+		if (!newmsgs && !oldmsgs) {
+			continue;										/* changed back before we got to it */
+		}
+		SCCP_LIST_LOCK(&subscription->sccp_mailboxLine);
+		SCCP_LIST_TRAVERSE(&subscription->sccp_mailboxLine, mailboxLine, list) {
+			AUTO_RELEASE(sccp_line_t, line , sccp_line_retain(mailboxLine->line));
+
+			if (line) {
+				/* update statistics for line  */
+				line->voicemailStatistic.oldmsgs += oldmsgs;
+				line->voicemailStatistic.newmsgs += newmsgs;
+				sccp_log((DEBUGCAT_MWI)) (VERBOSE_PREFIX_3 "%s:(sccp_mwi_processPending) newmsgs:%d, oldmsgs:%d\n", line->name, line->voicemailStatistic.newmsgs, line->voicemailStatistic.oldmsgs);
+
+				/* collect each device on line */
+				SCCP_LIST_LOCK(&line->devices);
+				SCCP_LIST_TRAVERSE(&line->devices, lineDevice, list) {
+					if (lineDevice->device && !sccp_hashtable_find(seen, lineDevice)) {
+						sccp_linedevices_t *ld = sccp_linedevice_retain(lineDevice);
+						if (ld) {
+							sccp_hashtable_insert(seen, ld, ld);
+							if (SCCP_VECTOR_APPEND(&lineDevices, ld)) {
+								sccp_linedevice_release(&ld);
+							}
+						}
+					}
+				}
+				SCCP_LIST_UNLOCK(&line->devices);
+			}
+		}
+		SCCP_LIST_UNLOCK(&subscription->sccp_mailboxLine);
+	}
+	SCCP_LIST_UNLOCK(&sccp_mailbox_subscriptions);
+
+	/* all line counts are final now, set the line lamps and collect the devices */
+	for (idx = 0; idx < SCCP_VECTOR_SIZE(&lineDevices); idx++) {
+		sccp_linedevices_t *ld = SCCP_VECTOR_GET(&lineDevices, idx);
+
+		sccp_mwi_setMWILineLamp(ld);
+		if (!sccp_hashtable_find(seen, ld->device)) {
+			sccp_device_t *d = sccp_device_retain(ld->device);
+			if (d) {
+				sccp_hashtable_insert(seen, d, d);
+				if (SCCP_VECTOR_APPEND(&devices, d)) {
+					sccp_device_release(&d);
+				}
+			}
+		}
+		sccp_linedevice_release(&ld);
+	}
+
+	/* device lamp and prompt, once per device */
+	for (idx = 0; idx < SCCP_VECTOR_SIZE(&devices); idx++) {
+		sccp_device_t *d = SCCP_VECTOR_GET(&devices, idx);
+
+		if (sccp_device_getRegistrationState(d) == SKINNY_DEVICE_RS_OK) {
+			sccp_mwi_check(d);
+		}
+		sccp_device_release(&d);
+	}
+	pbx_mutex_lock(&sccp_mwi_batch.lock);
+	sccp_mwi_batch.devices += SCCP_VECTOR_SIZE(&devices);
+	pbx_mutex_unlock(&sccp_mwi_batch.lock);
+
+	SCCP_VECTOR_FREE(&lineDevices);
+	SCCP_VECTOR_FREE(&devices);
+	sccp_hashtable_destroy(&seen);
+}
+
 /*!
  * \brief Check MWI Status for Device
  * \param d SCCP Device
@@ -650,26 +842,32 @@ void sccp_mwi_check(sccp_device_t * d)
 	for (instance = SCCP_FIRST_LINEINSTANCE; instance < device->lineButtons.size; instance++) {
 		if (device->lineButtons.instance[instance] && device->lineButtons.instance[instance]->line) {
 			sccp_line_t *line =  device->lineButtons.instance[instance]->line;
-			sccp_log((DEBUGCAT_MWI)) (VERBOSE_PREFIX_3 "%s: Checking Line Instance: %d = %s, mwioncall: %s\n", DEV_ID_LOG(device), instance, line->name, device->mwioncall ? "On" : "Off");
-			if (!device->mwioncall) {									// check if mwi suppression is required
+			/* pre-collect number of voicemails on device to be set later */
+			oldmsgs += line->voicemailStatistic.oldmsgs;
+			newmsgs += line->voicemailStatistic.newmsgs;
+			
+			sccp_log((DEBUGCAT_MWI)) (VERBOSE_PREFIX_3 "%s: (mwi_check) line %s voicemail count %d new/%d old (instance: %d)\n", DEV_ID_LOG(device), line->name, line->voicemailStatistic.newmsgs, line->voicemailStatistic.oldmsgs, instance);
+		}
+	}
+	/* the channels only matter when the lamp would be lit, stop at the first active one */
+	if (newmsgs && !device->mwioncall) {									// check if mwi suppression is required
+		for (instance = SCCP_FIRST_LINEINSTANCE; instance < device->lineButtons.size && !suppress_lamp; instance++) {
+			if (device->lineButtons.instance[instance] && device->lineButtons.instance[instance]->line) {
+				sccp_line_t *line =  device->lineButtons.instance[instance]->line;
 				sccp_channel_t *c = NULL;
 				SCCP_LIST_LOCK(&line->channels);
 				SCCP_LIST_TRAVERSE(&line->channels, c, list) {
 					AUTO_RELEASE(sccp_device_t, tmpDevice , sccp_channel_getDevice(c));
 					if (tmpDevice && tmpDevice == device) {						// We have a channel belonging to our device (no remote shared line channel)
 						if ((c->state != SCCP_CHANNELSTATE_ONHOOK && c->state != SCCP_CHANNELSTATE_DOWN) || c->state == SCCP_CHANNELSTATE_RINGING) {
-							sccp_log((DEBUGCAT_MWI)) (VERBOSE_PREFIX_3 "%s: we have an active channel, suppress mwi light\n", DEV_ID_LOG(device));
+							sccp_log((DEBUGCAT_MWI)) (VERBOSE_PREFIX_3 "%s: we have an active channel on line %s, suppress mwi light\n", DEV_ID_LOG(device), line->name);
 							suppress_lamp = TRUE;
+							break;
 						}
 					}
 				}
 				SCCP_LIST_UNLOCK(&line->channels);
 			}
-			/* pre-collect number of voicemails on device to be set later */
-			oldmsgs += line->voicemailStatistic.oldmsgs;
-			newmsgs += line->voicemailStatistic.newmsgs;
-			
-			sccp_log((DEBUGCAT_MWI)) (VERBOSE_PREFIX_3 "%s: (mwi_check) line %s voicemail count %d new/%d old (instance: %d)\n", DEV_ID_LOG(device), line->name, line->voicemailStatistic.newmsgs, line->voicemailStatistic.oldmsgs, instance);
 		}
 	}
 	/* check current device mwi light status*/
@@ -776,4 +974,157 @@ int sccp_show_mwi_subscriptions(int fd, sccp_cli_totals_t *totals, struct manses
 	}
 	return RESULT_SUCCESS;
 }
+#if CS_TEST_FRAMEWORK
+#include <asterisk/test.h>
+#define MWI_TEST_MAILBOXES 2000
+#define MWI_TEST_LINES_PER_DEVICE 10
+#define MWI_TEST_DEVICES (MWI_TEST_MAILBOXES / MWI_TEST_LINES_PER_DEVICE)
+#define MWI_TEST_EVENTS 10000
+AST_TEST_DEFINE(sccp_mwi_stress)
+{
+	sccp_line_t **lines = NULL;
+	sccp_device_t **devices = NULL;
+	sccp_mailbox_subscriber_list_t **subscriptions = NULL;
+	int (*expected)[2] = NULL;
+	char name[StationMaxNameSize];
+	struct timeval start;
+	int64_t single_us, batch_us;
+	uint64_t recalcs, single_recalcs, batch_recalcs;
+	enum ast_test_result_state res = AST_TEST_PASS;
+	int idx, n, errors = 0;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "stress";
+		info->category = "/channels/chan_sccp/mwi/";
+		info->summary = "chan-sccp-b mwi stress test";
+		info->description = "Sends 10k mwi events for 2000 mailboxes on 200 devices, processing them one at a time and as a single batch";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	lines = (sccp_line_t **) sccp_calloc(MWI_TEST_MAILBOXES, sizeof(sccp_line_t *));
+	devices = (sccp_device_t **) sccp_calloc(MWI_TEST_DEVICES, sizeof(sccp_device_t *));
+	subscriptions = (sccp_mailbox_subscriber_list_t **) sccp_calloc(MWI_TEST_MAILBOXES, sizeof(sccp_mailbox_subscriber_list_t *));
+	expected = sccp_calloc(MWI_TEST_MAILBOXES, sizeof(*expected));
+	if (!lines || !devices || !subscriptions || !expected) {
+		res = AST_TEST_FAIL;
+		goto cleanup;
+	}
+
+	pbx_test_status_update(test, "Creating %d mailboxes/lines on %d devices...\n", MWI_TEST_MAILBOXES, MWI_TEST_DEVICES);
+	for (idx = 0; idx < MWI_TEST_DEVICES; idx++) {
+		snprintf(name, sizeof(name), "SEPMWITEST%04d", idx);
+		if (!(devices[idx] = sccp_device_create(name))) {
+			res = AST_TEST_FAIL;
+			goto cleanup;
+		}
+	}
+	for (idx = 0; idx < MWI_TEST_MAILBOXES; idx++) {
+		snprintf(name, sizeof(name), "mwitest%04d", idx);
+		if (!(lines[idx] = sccp_line_create(name))) {
+			res = AST_TEST_FAIL;
+			goto cleanup;
+		}
+		sccp_line_addDevice(lines[idx], devices[idx / MWI_TEST_LINES_PER_DEVICE], (idx % MWI_TEST_LINES_PER_DEVICE) + 1, NULL);
+	}
+	for (idx = 0; idx < MWI_TEST_MAILBOXES; idx++) {
+		snprintf(name, sizeof(name), "%d", 9000 + idx);
+		if (!(subscriptions[idx] = sccp_mwi_createSubscription(name, "sccp_mwi_test"))) {
+			res = AST_TEST_FAIL;
+			goto cleanup;
+		}
+		sccp_mwi_listSubscription(subscriptions[idx]);
+		sccp_mwi_addMailboxLine(subscriptions[idx], lines[idx]);
+	}
+
+	/* one update per event */
+	recalcs = sccp_mwi_batch.devices;
+	start = pbx_tvnow();
+	for (n = 0; n < MWI_TEST_EVENTS; n++) {
+		idx = (n * 7919) % MWI_TEST_MAILBOXES;
+		expected[idx][0] = n % 5;
+		expected[idx][1] = n % 3;
+		sccp_mwi_updatecount(subscriptions[idx], expected[idx][0], expected[idx][1]);
+		sccp_mwi_processPending();
+	}
+	single_us = ast_tvdiff_us(pbx_tvnow(), start);
+	single_recalcs = sccp_mwi_batch.devices - recalcs;
+
+	for (idx = 0; idx < MWI_TEST_MAILBOXES; idx++) {
+		sccp_mwi_updatecount(subscriptions[idx], 0, 0);
+	}
+	sccp_mwi_processPending();
+
+	/* the same burst, processed as one batch */
+	recalcs = sccp_mwi_batch.devices;
+	start = pbx_tvnow();
+	for (n = 0; n < MWI_TEST_EVENTS; n++) {
+		idx = (n * 7919) % MWI_TEST_MAILBOXES;
+		sccp_mwi_updatecount(subscriptions[idx], n % 5, n % 3);
+	}
+	sccp_mwi_processPending();
+	batch_us = ast_tvdiff_us(pbx_tvnow(), start);
+	batch_recalcs = sccp_mwi_batch.devices - recalcs;
+
+	pbx_test_status_update(test, "per event: %.3f ms, %.0f events/sec, %d device recalculations\n", (double) single_us / 1000, (double) MWI_TEST_EVENTS * 1000000 / (single_us ? single_us : 1), (int) single_recalcs);
+	pbx_test_status_update(test, "batched  : %.3f ms, %.0f events/sec, %d device recalculations\n", (double) batch_us / 1000, (double) MWI_TEST_EVENTS * 1000000 / (batch_us ? batch_us : 1), (int) batch_recalcs);
+	pbx_test_status_update(test, "totals   : %d events in %d batches\n", (int) sccp_mwi_batch.events, (int) sccp_mwi_batch.batches);
+
+	for (idx = 0; idx < MWI_TEST_MAILBOXES; idx++) {
+		uint32_t lamp = 1 << ((idx % MWI_TEST_LINES_PER_DEVICE) + 1);
+		if (lines[idx]->voicemailStatistic.newmsgs != expected[idx][0] || lines[idx]->voicemailStatistic.oldmsgs != expected[idx][1]) {
+			errors++;
+		} else if (((devices[idx / MWI_TEST_LINES_PER_DEVICE]->mwilight & lamp) ? 1 : 0) != (expected[idx][0] ? 1 : 0)) {
+			errors++;
+		}
+	}
+	pbx_test_validate_cleanup(test, errors == 0, res, cleanup);
+	pbx_test_validate_cleanup(test, batch_recalcs < single_recalcs, res, cleanup);
+
+cleanup:
+	if (subscriptions) {
+		SCCP_LIST_LOCK(&sccp_mailbox_subscriptions);
+		for (idx = 0; idx < MWI_TEST_MAILBOXES; idx++) {
+			if (subscriptions[idx]) {
+				sccp_hashtable_remove(sccp_mailbox_index, subscriptions[idx]->uniqueid, subscriptions[idx]);
+				SCCP_LIST_REMOVE(&sccp_mailbox_subscriptions, subscriptions[idx], list);
+				sccp_mwi_destroySubscription(subscriptions[idx]);
+			}
+		}
+		SCCP_LIST_UNLOCK(&sccp_mailbox_subscriptions);
+	}
+	if (lines) {
+		for (idx = 0; idx < MWI_TEST_MAILBOXES; idx++) {
+			if (lines[idx]) {
+				sccp_line_removeDevice(lines[idx], NULL);
+				sccp_line_release(&lines[idx]);
+			}
+		}
+	}
+	if (devices) {
+		for (idx = 0; idx < MWI_TEST_DEVICES; idx++) {
+			if (devices[idx]) {
+				sccp_device_release(&devices[idx]);
+			}
+		}
+	}
+	sccp_free(lines);
+	sccp_free(devices);
+	sccp_free(subscriptions);
+	sccp_free(expected);
+	return res;
+}
+
+static void __attribute__((constructor)) sccp_register_tests(void)
+{
+	AST_TEST_REGISTER(sccp_mwi_stress);
+}
+
+static void __attribute__((destructor)) sccp_unregister_tests(void)
+{
+	AST_TEST_UNREGISTER(sccp_mwi_stress);
+}
+#endif
 // kate: indent-width 8; replace-tabs off; indent-mode cstyle; auto-insert-doxygen on; line-numbers on; tab-indents on; keep-extra-spaces off; auto-brackets off;
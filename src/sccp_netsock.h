@@ -33,11 +33,13 @@
  * navigate the list, and an externally visible 'struct ast_ha_entry', at least in the short term it is more convenient to make the whole
  * thing public and let users play with them.
  */
+struct sccp_ha_trie;
 struct sccp_ha {
 	struct sockaddr_storage netaddr;
 	struct sockaddr_storage netmask;
 	struct sccp_ha *next;
 	int sense;
+	struct sccp_ha_trie *trie;										/*!< compiled form of the whole list, only set on the head (sccp_compile_ha) */
 };
 
 __BEGIN_C_EXTERN__
@@ -0,0 +1,408 @@
+/*!
+ * \file        sccp_packet.c
+ * \brief       SCCP Packet Buffer Pool
+ * \note        This program is free software and may be modified and distributed under the terms of the GNU Public License.
+ *              See the LICENSE file at the top of the source tree.
+ */
+
+/*!
+ * \section sccp_packet   Packet Buffer Pool
+ *
+ * Every outbound message is built by sccp_build_packet and released again once sccp_session_send2 has written it to the socket,
+ * which makes the message buffer by far the most frequently allocated object in chan-sccp. Instead of going through the allocator
+ * for each of them, buffers are kept in power of two size classes (32 to 4096 bytes), which covers every entry in sccp_messagetypes.
+ *
+ * Each thread keeps a small free list per size class. Allocating pops from the calling thread's list and releasing pushes onto the
+ * releasing thread's list, so the fast path does not take any lock. Lists are bounded to SCCP_PACKET_POOL_CACHE_DEPTH buffers,
+ * anything beyond that (and any request larger than the biggest class) goes straight to sccp_calloc / sccp_free.
+ *
+ * A small header in front of each buffer records the size class, so sccp_packet_release does not need to be told the size.
+ * Buffers allocated by the pool must therefore always be released using sccp_packet_free, never with sccp_free.
+ *
+ * The per thread caches use their own pthread key (instead of PBX_THREADSTORAGE), so that the key can be deleted and the caches
+ * reclaimed in sccp_packet_pool_destroy, before the module (and with it the key destructor) is unloaded.
+ */
+
+#include "config.h"
+#include "common.h"
+#include "sccp_packet.h"
+#include "sccp_protocol.h"
+#include "sccp_utils.h"
+#include <asterisk/cli.h>
+#include <pthread.h>
+
+SCCP_FILE_VERSION(__FILE__, "");
+
+#define SCCP_PACKET_MAGIC 0x53504B54										/* 'SPKT' */
+#define SCCP_PACKET_DIRECT SCCP_PACKET_POOL_CLASSES								/* sizeclass marker for unpooled buffers */
+
+typedef struct sccp_packet_hdr sccp_packet_hdr_t;
+struct sccp_packet_hdr {
+	sccp_packet_hdr_t *next;										/*!< free list link, only valid while cached */
+	uint32_t magic;
+	uint32_t sizeclass;
+} __attribute__ ((aligned (8)));
+
+typedef struct sccp_packet_stats {
+	unsigned long allocs;
+	unsigned long hits;
+	unsigned long frees;
+} sccp_packet_stats_t;
+
+typedef struct sccp_packet_cache sccp_packet_cache_t;
+struct sccp_packet_cache {
+	sccp_packet_hdr_t *freelist[SCCP_PACKET_POOL_CLASSES];
+	uint32_t depth[SCCP_PACKET_POOL_CLASSES];
+	sccp_packet_stats_t stats[SCCP_PACKET_POOL_CLASSES + 1];						/* +1: direct (oversized) allocations */
+	sccp_packet_cache_t *prev;
+	sccp_packet_cache_t *next;
+};
+
+static pthread_key_t packet_cache_key;
+static volatile int packet_pool_running = 0;
+AST_MUTEX_DEFINE_STATIC(packet_pool_lock);									/* protects packet_caches and packet_retired */
+static sccp_packet_cache_t *packet_caches = NULL;
+static sccp_packet_stats_t packet_retired[SCCP_PACKET_POOL_CLASSES + 1];					/* stats of exited threads */
+
+static inline size_t packet_class_size(uint32_t sizeclass)
+{
+	return (size_t) SCCP_PACKET_POOL_MIN_SIZE << sizeclass;
+}
+
+static inline uint32_t packet_size2class(size_t size)
+{
+	uint32_t sizeclass = 0;
+
+	while (sizeclass < SCCP_PACKET_POOL_CLASSES && packet_class_size(sizeclass) < size) {
+		sizeclass++;
+	}
+	return sizeclass;
+}
+
+static void packet_cache_fold(sccp_packet_cache_t *cache)
+{
+	for (uint32_t sizeclass = 0; sizeclass <= SCCP_PACKET_POOL_CLASSES; sizeclass++) {
+		packet_retired[sizeclass].allocs += cache->stats[sizeclass].allocs;
+		packet_retired[sizeclass].hits += cache->stats[sizeclass].hits;
+		packet_retired[sizeclass].frees += cache->stats[sizeclass].frees;
+	}
+}
+
+static void packet_cache_purge(sccp_packet_cache_t *cache)
+{
+	for (uint32_t sizeclass = 0; sizeclass < SCCP_PACKET_POOL_CLASSES; sizeclass++) {
+		sccp_packet_hdr_t *hdr = NULL;
+		while ((hdr = cache->freelist[sizeclass])) {
+			cache->freelist[sizeclass] = hdr->next;
+			sccp_free(hdr);
+		}
+		cache->depth[sizeclass] = 0;
+	}
+}
+
+/* thread exit: hand stats over to the retired totals and give the cached buffers back */
+static void packet_cache_destructor(void *data)
+{
+	sccp_packet_cache_t *cache = (sccp_packet_cache_t *) data;
+
+	if (!cache) {
+		return;
+	}
+	pbx_mutex_lock(&packet_pool_lock);
+	if (cache->prev) {
+		cache->prev->next = cache->next;
+	} else {
+		packet_caches = cache->next;
+	}
+	if (cache->next) {
+		cache->next->prev = cache->prev;
+	}
+	packet_cache_fold(cache);
+	pbx_mutex_unlock(&packet_pool_lock);
+
+	packet_cache_purge(cache);
+	sccp_free(cache);
+}
+
+static sccp_packet_cache_t *packet_cache_get(void)
+{
+	sccp_packet_cache_t *cache = NULL;
+
+	if (!packet_pool_running) {
+		return NULL;
+	}
+	if ((cache = (sccp_packet_cache_t *) pthread_getspecific(packet_cache_key))) {
+		return cache;
+	}
+	if (!(cache = (sccp_packet_cache_t *) sccp_calloc(1, sizeof(sccp_packet_cache_t)))) {
+		return NULL;
+	}
+	pbx_mutex_lock(&packet_pool_lock);
+	if (!packet_pool_running) {
+		pbx_mutex_unlock(&packet_pool_lock);
+		sccp_free(cache);
+		return NULL;
+	}
+	cache->next = packet_caches;
+	if (packet_caches) {
+		packet_caches->prev = cache;
+	}
+	packet_caches = cache;
+	pthread_setspecific(packet_cache_key, cache);
+	pbx_mutex_unlock(&packet_pool_lock);
+	return cache;
+}
+
+void sccp_packet_pool_init(void)
+{
+	pbx_mutex_lock(&packet_pool_lock);
+	if (!packet_pool_running) {
+		memset(packet_retired, 0, sizeof(packet_retired));
+		if (pthread_key_create(&packet_cache_key, packet_cache_destructor) == 0) {
+			packet_pool_running = 1;
+		} else {
+			pbx_log(LOG_WARNING, "SCCP: (sccp_packet_pool_init) could not create thread key, packet buffers will not be cached\n");
+		}
+	}
+	pbx_mutex_unlock(&packet_pool_lock);
+}
+
+void sccp_packet_pool_destroy(void)
+{
+	sccp_packet_cache_t *cache = NULL;
+
+	pbx_mutex_lock(&packet_pool_lock);
+	if (!packet_pool_running) {
+		pbx_mutex_unlock(&packet_pool_lock);
+		return;
+	}
+	packet_pool_running = 0;
+	pthread_key_delete(packet_cache_key);
+	while ((cache = packet_caches)) {
+		packet_caches = cache->next;
+		packet_cache_fold(cache);
+		packet_cache_purge(cache);
+		sccp_free(cache);
+	}
+	pbx_mutex_unlock(&packet_pool_lock);
+}
+
+/*!
+ * \brief Allocate a zeroed packet buffer of at least size bytes
+ * \note Has to be released using sccp_packet_free
+ */
+void *sccp_packet_alloc(size_t size)
+{
+	sccp_packet_cache_t *cache = packet_cache_get();
+	sccp_packet_hdr_t *hdr = NULL;
+	uint32_t sizeclass = packet_size2class(size);
+
+	if (cache && sizeclass < SCCP_PACKET_POOL_CLASSES && (hdr = cache->freelist[sizeclass])) {
+		cache->freelist[sizeclass] = hdr->next;
+		cache->depth[sizeclass]--;
+		cache->stats[sizeclass].hits++;
+	} else {
+		size_t bufsize = sizeclass < SCCP_PACKET_POOL_CLASSES ? packet_class_size(sizeclass) : size;
+		if (!(hdr = (sccp_packet_hdr_t *) sccp_malloc(sizeof(sccp_packet_hdr_t) + bufsize))) {
+			return NULL;
+		}
+		hdr->magic = SCCP_PACKET_MAGIC;
+		hdr->sizeclass = sizeclass;
+	}
+	hdr->next = NULL;
+	if (cache) {
+		cache->stats[sizeclass].allocs++;
+	}
+	memset(hdr + 1, 0, size);
+	return hdr + 1;
+}
+
+/*!
+ * \brief Return a packet buffer obtained from sccp_packet_alloc to the calling thread's cache
+ */
+void sccp_packet_release(void *ptr)
+{
+	sccp_packet_cache_t *cache = NULL;
+	sccp_packet_hdr_t *hdr = NULL;
+
+	if (!ptr) {
+		return;
+	}
+	hdr = ((sccp_packet_hdr_t *) ptr) - 1;
+	if (hdr->magic != SCCP_PACKET_MAGIC) {
+		pbx_log(LOG_ERROR, "SCCP: (sccp_packet_release) %p was not allocated by the packet pool\n", ptr);
+		return;
+	}
+	cache = packet_cache_get();
+	if (cache) {
+		cache->stats[hdr->sizeclass].frees++;
+		if (hdr->sizeclass < SCCP_PACKET_POOL_CLASSES && cache->depth[hdr->sizeclass] < SCCP_PACKET_POOL_CACHE_DEPTH) {
+			hdr->next = cache->freelist[hdr->sizeclass];
+			cache->freelist[hdr->sizeclass] = hdr;
+			cache->depth[hdr->sizeclass]++;
+			return;
+		}
+	}
+	hdr->magic = 0;
+	sccp_free(hdr);
+}
+
+/*!
+ * \brief Show Packet Pool Usage
+ * \note counters of running threads are read without stopping them, totals are a close approximation while the pool is busy
+ */
+int sccp_show_memory(int fd, sccp_cli_totals_t *totals, struct mansession *s, const struct message *m, int argc, char *argv[])
+{
+	int local_line_total = 0;
+	sccp_packet_stats_t stats[SCCP_PACKET_POOL_CLASSES + 1];
+	sccp_packet_stats_t total = {0, 0, 0};
+	unsigned long cached[SCCP_PACKET_POOL_CLASSES + 1] = {0};
+	unsigned long totalcached = 0;
+	uint32_t msgtypes[SCCP_PACKET_POOL_CLASSES + 1] = {0};
+	int threads = 0;
+	uint32_t sizeclass = 0;
+
+	pbx_mutex_lock(&packet_pool_lock);
+	memcpy(stats, packet_retired, sizeof(stats));
+	for (sccp_packet_cache_t *cache = packet_caches; cache; cache = cache->next) {
+		for (sizeclass = 0; sizeclass <= SCCP_PACKET_POOL_CLASSES; sizeclass++) {
+			stats[sizeclass].allocs += cache->stats[sizeclass].allocs;
+			stats[sizeclass].hits += cache->stats[sizeclass].hits;
+			stats[sizeclass].frees += cache->stats[sizeclass].frees;
+			if (sizeclass < SCCP_PACKET_POOL_CLASSES) {
+				cached[sizeclass] += cache->depth[sizeclass];
+			}
+		}
+		threads++;
+	}
+	pbx_mutex_unlock(&packet_pool_lock);
+
+	/* which size class will each known message type end up in (see sccp_build_packet) */
+	for (uint32_t mid = 0; mid <= SCCP_MESSAGE_HIGH_BOUNDARY; mid++) {
+		if (sccp_messagetypes[mid].text) {
+			msgtypes[packet_size2class(sccp_messagetypes[mid].size + SCCP_PACKET_HEADER + 4)]++;
+		}
+	}
+	for (sizeclass = 0; sizeclass <= SCCP_PACKET_POOL_CLASSES; sizeclass++) {
+		total.allocs += stats[sizeclass].allocs;
+		total.hits += stats[sizeclass].hits;
+		total.frees += stats[sizeclass].frees;
+		totalcached += cached[sizeclass];
+	}
+
+	char classname[12];
+#define CLI_AMI_TABLE_NAME PacketPool
+#define CLI_AMI_TABLE_PER_ENTRY_NAME SizeClass
+#define CLI_AMI_TABLE_ITERATOR for(sizeclass = 0; sizeclass <= SCCP_PACKET_POOL_CLASSES; sizeclass++)
+#define CLI_AMI_TABLE_BEFORE_ITERATION 											\
+		if (sizeclass < SCCP_PACKET_POOL_CLASSES) {								\
+			snprintf(classname, sizeof(classname), "%d", (int) packet_class_size(sizeclass));		\
+		} else {												\
+			snprintf(classname, sizeof(classname), "direct");						\
+		}
+#define CLI_AMI_TABLE_FIELDS 												\
+	CLI_AMI_TABLE_FIELD(Class,		"-8.8",		s,	8,	classname)				\
+	CLI_AMI_TABLE_FIELD(MsgTypes,		"-8",		d,	8,	msgtypes[sizeclass])			\
+	CLI_AMI_TABLE_FIELD(Allocs,		"-12",		lu,	12,	stats[sizeclass].allocs)		\
+	CLI_AMI_TABLE_FIELD(Hits,		"-12",		lu,	12,	stats[sizeclass].hits)			\
+	CLI_AMI_TABLE_FIELD(HitRate,		"6.02",		f,	7,	stats[sizeclass].allocs ? 100.0 * stats[sizeclass].hits / stats[sizeclass].allocs : 0.0)	\
+	CLI_AMI_TABLE_FIELD(Outstanding,	"-11",		ld,	11,	(long) (stats[sizeclass].allocs - stats[sizeclass].frees))	\
+	CLI_AMI_TABLE_FIELD(Cached,		"-6",		lu,	6,	cached[sizeclass])
+#include "sccp_cli_table.h"
+	local_line_total++;
+
+	int once;
+#define CLI_AMI_TABLE_NAME PacketPoolTotals
+#define CLI_AMI_TABLE_PER_ENTRY_NAME Total
+#define CLI_AMI_TABLE_ITERATOR for(once=0;once<1;once++)
+#define CLI_AMI_TABLE_FIELDS 												\
+	CLI_AMI_TABLE_FIELD(Threads,		"-8",		d,	8,	threads)				\
+	CLI_AMI_TABLE_FIELD(Allocs,		"-12",		lu,	12,	total.allocs)				\
+	CLI_AMI_TABLE_FIELD(Hits,		"-12",		lu,	12,	total.hits)				\
+	CLI_AMI_TABLE_FIELD(HitRate,		"6.02",		f,	7,	total.allocs ? 100.0 * total.hits / total.allocs : 0.0)	\
+	CLI_AMI_TABLE_FIELD(Outstanding,	"-11",		ld,	11,	(long) (total.allocs - total.frees))	\
+	CLI_AMI_TABLE_FIELD(Cached,		"-6",		lu,	6,	totalcached)				\
+	CLI_AMI_TABLE_FIELD(Running,		"-7.7",		s,	7,	packet_pool_running ? "yes" : "no")
+#include "sccp_cli_table.h"
+	local_line_total++;
+
+	if (s) {
+		totals->lines = local_line_total;
+		totals->tables = 2;
+	}
+	return RESULT_SUCCESS;
+}
+
+#if CS_TEST_FRAMEWORK
+#include <asterisk/test.h>
+AST_TEST_DEFINE(sccp_packet_pool_test)
+{
+	void *buffers[SCCP_PACKET_POOL_CACHE_DEPTH + 1];
+	sccp_packet_cache_t *cache = NULL;
+	sccp_packet_stats_t before;
+	uint32_t sizeclass = packet_size2class(sizeof(sccp_msg_t));
+	uint i;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "pool";
+		info->category = "/channels/chan_sccp/packet/";
+		info->summary = "chan-sccp-b packet pool test";
+		info->description = "chan-sccp-b packet buffer pool reuse, zeroing and hit counting";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	pbx_test_status_update(test, "Executing chan-sccp-b packet pool tests...\n");
+	pbx_test_validate(test, packet_size2class(1) == 0);
+	pbx_test_validate(test, packet_size2class(SCCP_PACKET_POOL_MIN_SIZE + 1) == 1);
+	pbx_test_validate(test, sizeclass < SCCP_PACKET_POOL_CLASSES);
+
+	for (i = 0; i < ARRAY_LEN(buffers); i++) {
+		buffers[i] = sccp_packet_alloc(sizeof(sccp_msg_t));
+		pbx_test_validate(test, buffers[i] != NULL);
+		memset(buffers[i], 0xff, sizeof(sccp_msg_t));
+	}
+	if (!(cache = packet_cache_get())) {
+		pbx_test_status_update(test, "Packet pool is not running, skipping cache tests\n");
+		for (i = 0; i < ARRAY_LEN(buffers); i++) {
+			sccp_packet_free(buffers[i]);
+		}
+		return AST_TEST_PASS;
+	}
+	for (i = 0; i < ARRAY_LEN(buffers); i++) {
+		sccp_packet_free(buffers[i]);
+		pbx_test_validate(test, buffers[i] == NULL);
+	}
+	pbx_test_status_update(test, "Cache depth after release: %d\n", cache->depth[sizeclass]);
+	pbx_test_validate(test, cache->depth[sizeclass] == SCCP_PACKET_POOL_CACHE_DEPTH);
+
+	before = cache->stats[sizeclass];
+	sccp_msg_t *msg = (sccp_msg_t *) sccp_packet_alloc(sizeof(sccp_msg_t));
+	pbx_test_validate(test, msg != NULL);
+	pbx_test_validate(test, cache->stats[sizeclass].hits == before.hits + 1);
+	pbx_test_validate(test, cache->stats[sizeclass].allocs == before.allocs + 1);
+	pbx_test_validate(test, msg->header.length == 0 && msg->header.lel_messageId == 0);
+	sccp_packet_free(msg);
+	pbx_test_validate(test, cache->stats[sizeclass].frees == before.frees + 1);
+
+	void *big = sccp_packet_alloc(packet_class_size(SCCP_PACKET_POOL_CLASSES - 1) + 1);
+	pbx_test_validate(test, big != NULL);
+	pbx_test_validate(test, (((sccp_packet_hdr_t *) big) - 1)->sizeclass == SCCP_PACKET_DIRECT);
+	sccp_packet_free(big);
+
+	return AST_TEST_PASS;
+}
+
+static void __attribute__((constructor)) sccp_register_tests(void)
+{
+	AST_TEST_REGISTER(sccp_packet_pool_test);
+}
+
+static void __attribute__((destructor)) sccp_unregister_tests(void)
+{
+	AST_TEST_UNREGISTER(sccp_packet_pool_test);
+}
+#endif
+// kate: indent-width 8; replace-tabs off; indent-mode cstyle; auto-insert-doxygen on; line-numbers on; tab-indents on; keep-extra-spaces off; auto-brackets off;
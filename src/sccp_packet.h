@@ -0,0 +1,29 @@
+/*!
+ * \file        sccp_packet.h
+ * \brief       SCCP Packet Buffer Pool Header
+ * \note        This program is free software and may be modified and distributed under the terms of the GNU Public License.
+ *              See the LICENSE file at the top of the source tree.
+ */
+#pragma once
+
+#include "sccp_cli.h"
+
+/* forward declarations */
+struct mansession;
+struct message;
+
+__BEGIN_C_EXTERN__
+#define SCCP_PACKET_POOL_MIN_SIZE 32										/*!< smallest size class (bytes) */
+#define SCCP_PACKET_POOL_CLASSES 8										/*!< power of two classes: 32 .. 4096 bytes */
+#define SCCP_PACKET_POOL_CACHE_DEPTH 32										/*!< max buffers cached per class per thread */
+
+SCCP_API void SCCP_CALL sccp_packet_pool_init(void);
+SCCP_API void SCCP_CALL sccp_packet_pool_destroy(void);
+SCCP_API void * SCCP_CALL sccp_packet_alloc(size_t size);
+SCCP_API void SCCP_CALL sccp_packet_release(void *ptr);
+SCCP_API int SCCP_CALL sccp_show_memory(int fd, sccp_cli_totals_t *totals, struct mansession *s, const struct message *m, int argc, char *argv[]);
+
+/* release a packet buffer and nullify the pointer, mirrors sccp_free */
+#define sccp_packet_free(_x) {sccp_packet_release((void *)(_x)); (_x) = NULL; }
+__END_C_EXTERN__
+// kate: indent-width 8; replace-tabs off; indent-mode cstyle; auto-insert-doxygen on; line-numbers on; tab-indents on; keep-extra-spaces off; auto-brackets off;
@@ -0,0 +1,574 @@
+/*!
+ * \file        sccp_pcap.c
+ * \brief       SCCP Packet Capture
+ * \note        This program is free software and may be modified and distributed under the terms of the GNU Public License.
+ *              See the LICENSE file at the top of the source tree.
+ */
+
+/*!
+ * \section sccp_pcap   Packet Capture
+ *
+ * Writes the SCCP messages of a session to a pcap file and reads them back. Messages are captured where the session reads
+ * and writes them (one message per frame), so there is no tcp stream to capture: every frame gets a synthetic IPv4 (or IPv6)
+ * and TCP header, using the addresses of the session and sequence numbers that follow the bytes sent in either direction.
+ * That is enough for wireshark to follow the stream and apply its skinny dissector.
+ *
+ * The reader accepts these files, as well as tcpdump captures (ethernet or linux cooked) of an sccp port. It returns the tcp
+ * payload of every segment, in file order, without reassembling the stream, the consumer (session replay) already does that.
+ */
+
+#include "config.h"
+#include "common.h"
+#include "sccp_pcap.h"
+#include "sccp_netsock.h"
+#include "sccp_utils.h"
+#include <fcntl.h>
+
+SCCP_FILE_VERSION(__FILE__, "");
+
+#define PCAP_MAGIC 0xa1b2c3d4											/* microsecond timestamps */
+#define PCAP_MAGIC_NSEC 0xa1b23c4d										/* nanosecond timestamps */
+#define PCAP_LINKTYPE_ETHERNET 1
+#define PCAP_LINKTYPE_RAW 101
+#define PCAP_LINKTYPE_LINUX_SLL 113
+#define PCAP_LINKTYPE_IPV4 228
+#define PCAP_LINKTYPE_IPV6 229
+#define PCAP_IPV4_HEADER 20
+#define PCAP_IPV6_HEADER 40
+#define PCAP_TCP_HEADER 20
+#define PCAP_TCP_FLAGS_PSH_ACK 0x18
+#define PCAP_MAX_RECORD (SCCP_PCAP_SNAPLEN * 4)
+
+/*!
+ * \brief pcap file header
+ */
+typedef struct {
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+} pcap_file_header_t;
+
+/*!
+ * \brief pcap record header
+ */
+typedef struct {
+	uint32_t ts_sec;
+	uint32_t ts_usec;
+	uint32_t incl_len;
+	uint32_t orig_len;
+} pcap_record_header_t;
+
+/*!
+ * \brief endpoint as written in the synthetic ip/tcp headers (network byte order)
+ */
+typedef struct {
+	int family;
+	unsigned char addr[16];
+	uint16_t port;
+} pcap_endpoint_t;
+
+struct sccp_pcap {
+	FILE *file;
+	char filename[SCCP_PATH_MAX];
+	boolean_t ipv6;
+	pcap_endpoint_t endpoint[2];										/* indexed by the sender: [SCCP_PCAP_INBOUND] = phone */
+	uint32_t seq[2];											/* next tcp sequence number per sender */
+	uint16_t ip_id;
+	uint32_t frames;
+};
+
+static void pcap_endpoint_set(pcap_endpoint_t * endpoint, const struct sockaddr_storage *addr)
+{
+	struct sockaddr_storage mapped;
+
+	memset(endpoint, 0, sizeof(*endpoint));
+	if (sccp_netsock_ipv4_mapped(addr, &mapped)) {
+		addr = &mapped;
+	}
+	endpoint->port = htons(sccp_netsock_getPort(addr));
+	if (addr->ss_family == AF_INET6) {
+		endpoint->family = AF_INET6;
+		memcpy(endpoint->addr, &((const struct sockaddr_in6 *) addr)->sin6_addr, 16);
+	} else {
+		endpoint->family = AF_INET;
+		memcpy(endpoint->addr, &((const struct sockaddr_in *) addr)->sin_addr, 4);
+	}
+}
+
+/* write an IPv4 endpoint as IPv4-mapped IPv6 address, when the other side is IPv6 */
+static void pcap_endpoint_map6(pcap_endpoint_t * endpoint)
+{
+	if (endpoint->family == AF_INET) {
+		memmove(endpoint->addr + 12, endpoint->addr, 4);
+		memset(endpoint->addr, 0, 10);
+		endpoint->addr[10] = endpoint->addr[11] = 0xff;
+		endpoint->family = AF_INET6;
+	}
+}
+
+static inline unsigned char *pcap_put16(unsigned char *p, uint16_t value)
+{
+	p[0] = (unsigned char) (value >> 8);
+	p[1] = (unsigned char) value;
+	return p + 2;
+}
+
+static inline unsigned char *pcap_put32(unsigned char *p, uint32_t value)
+{
+	p[0] = (unsigned char) (value >> 24);
+	p[1] = (unsigned char) (value >> 16);
+	p[2] = (unsigned char) (value >> 8);
+	p[3] = (unsigned char) value;
+	return p + 4;
+}
+
+static inline uint16_t pcap_get16(const unsigned char *p)
+{
+	return (uint16_t) ((p[0] << 8) | p[1]);
+}
+
+static uint16_t pcap_ipv4_checksum(const unsigned char *header)
+{
+	uint32_t sum = 0;
+	int i;
+
+	for (i = 0; i < PCAP_IPV4_HEADER; i += 2) {
+		sum += pcap_get16(header + i);
+	}
+	while (sum >> 16) {
+		sum = (sum & 0xffff) + (sum >> 16);
+	}
+	return (uint16_t) ~sum;
+}
+
+/*!
+ * \brief Create a capture file for a session
+ * \param filename File to create, fails when it exists (or is a symlink)
+ * \param phone Address of the phone (remote end of the session)
+ * \param server Address of chan-sccp (local end of the session)
+ * \return capture or NULL on failure
+ */
+sccp_pcap_t *sccp_pcap_open(const char *filename, const struct sockaddr_storage *phone, const struct sockaddr_storage *server)
+{
+	sccp_pcap_t *pcap = NULL;
+	int fd = -1;
+	pcap_file_header_t header = {
+		.magic = PCAP_MAGIC,
+		.version_major = 2,
+		.version_minor = 4,
+		.snaplen = SCCP_PCAP_SNAPLEN,
+		.linktype = PCAP_LINKTYPE_RAW,
+	};
+
+	if (!filename || !phone || !server) {
+		return NULL;
+	}
+	if (!(pcap = (sccp_pcap_t *) sccp_calloc(1, sizeof(sccp_pcap_t)))) {
+		pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
+		return NULL;
+	}
+	if ((fd = open(filename, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0600)) < 0 || !(pcap->file = fdopen(fd, "w"))) {
+		pbx_log(LOG_WARNING, "SCCP: (sccp_pcap_open) could not create '%s': %s\n", filename, strerror(errno));
+		if (fd > -1) {
+			close(fd);
+		}
+		sccp_free(pcap);
+		return NULL;
+	}
+	sccp_copy_string(pcap->filename, filename, sizeof(pcap->filename));
+	pcap_endpoint_set(&pcap->endpoint[SCCP_PCAP_INBOUND], phone);
+	pcap_endpoint_set(&pcap->endpoint[SCCP_PCAP_OUTBOUND], server);
+	if (pcap->endpoint[SCCP_PCAP_INBOUND].family != pcap->endpoint[SCCP_PCAP_OUTBOUND].family) {
+		pcap_endpoint_map6(&pcap->endpoint[SCCP_PCAP_INBOUND]);
+		pcap_endpoint_map6(&pcap->endpoint[SCCP_PCAP_OUTBOUND]);
+	}
+	pcap->ipv6 = pcap->endpoint[SCCP_PCAP_INBOUND].family == AF_INET6;
+	pcap->seq[SCCP_PCAP_INBOUND] = 1;
+	pcap->seq[SCCP_PCAP_OUTBOUND] = 1;
+
+	if (fwrite(&header, sizeof(header), 1, pcap->file) != 1) {
+		pbx_log(LOG_WARNING, "SCCP: (sccp_pcap_open) could not write to '%s': %s\n", filename, strerror(errno));
+		fclose(pcap->file);
+		sccp_free(pcap);
+		return NULL;
+	}
+	return pcap;
+}
+
+/*!
+ * \brief Close a capture file and free the capture
+ */
+void sccp_pcap_close(sccp_pcap_t * pcap)
+{
+	if (!pcap) {
+		return;
+	}
+	if (fclose(pcap->file)) {
+		pbx_log(LOG_WARNING, "SCCP: (sccp_pcap_close) writing '%s' failed: %s\n", pcap->filename, strerror(errno));
+	}
+	sccp_free(pcap);
+}
+
+/*!
+ * \brief Append one SCCP message to the capture
+ * \param pcap Capture
+ * \param direction Sender of the message
+ * \param data Message (including the sccp header)
+ * \param len Length of the message
+ * \return 0 on success, -1 on failure
+ * \note not thread safe, the caller serializes the writes to the same capture (session write_lock)
+ */
+int sccp_pcap_write(sccp_pcap_t * pcap, sccp_pcap_direction_t direction, const void *data, size_t len)
+{
+	unsigned char headers[PCAP_IPV6_HEADER + PCAP_TCP_HEADER];
+	unsigned char *p = headers;
+	const pcap_endpoint_t *src = NULL, *dst = NULL;
+	pcap_record_header_t record;
+	size_t iplen = 0;
+	struct timeval now;
+
+	if (!pcap || !data || len > SCCP_PCAP_SNAPLEN - sizeof(headers)) {
+		return -1;
+	}
+	src = &pcap->endpoint[direction];
+	dst = &pcap->endpoint[direction == SCCP_PCAP_INBOUND ? SCCP_PCAP_OUTBOUND : SCCP_PCAP_INBOUND];
+
+	if (pcap->ipv6) {
+		iplen = PCAP_IPV6_HEADER;
+		p = pcap_put32(p, 0x60000000);									/* version 6, no traffic class / flow label */
+		p = pcap_put16(p, (uint16_t) (PCAP_TCP_HEADER + len));
+		*p++ = IPPROTO_TCP;
+		*p++ = 64;											/* hop limit */
+		memcpy(p, src->addr, 16);
+		memcpy(p + 16, dst->addr, 16);
+		p += 32;
+	} else {
+		iplen = PCAP_IPV4_HEADER;
+		*p++ = 0x45;											/* version 4, header length 5 words */
+		*p++ = 0;
+		p = pcap_put16(p, (uint16_t) (PCAP_IPV4_HEADER + PCAP_TCP_HEADER + len));
+		p = pcap_put16(p, pcap->ip_id++);
+		p = pcap_put16(p, 0x4000);									/* don't fragment */
+		*p++ = 64;											/* ttl */
+		*p++ = IPPROTO_TCP;
+		p = pcap_put16(p, 0);										/* checksum, filled in below */
+		memcpy(p, src->addr, 4);
+		memcpy(p + 4, dst->addr, 4);
+		p += 8;
+		pcap_put16(headers + 10, pcap_ipv4_checksum(headers));
+	}
+	memcpy(p, &src->port, 2);
+	memcpy(p + 2, &dst->port, 2);
+	p += 4;
+	p = pcap_put32(p, pcap->seq[direction]);
+	p = pcap_put32(p, pcap->seq[direction == SCCP_PCAP_INBOUND ? SCCP_PCAP_OUTBOUND : SCCP_PCAP_INBOUND]);
+	*p++ = (PCAP_TCP_HEADER / 4) << 4;
+	*p++ = PCAP_TCP_FLAGS_PSH_ACK;
+	p = pcap_put16(p, 65535);										/* window */
+	p = pcap_put16(p, 0);											/* checksum (not calculated) */
+	p = pcap_put16(p, 0);											/* urgent pointer */
+	pcap->seq[direction] += (uint32_t) len;
+
+	gettimeofday(&now, NULL);
+	record.ts_sec = (uint32_t) now.tv_sec;
+	record.ts_usec = (uint32_t) now.tv_usec;
+	record.incl_len = record.orig_len = (uint32_t) (iplen + PCAP_TCP_HEADER + len);
+	if (fwrite(&record, sizeof(record), 1, pcap->file) != 1 || fwrite(headers, iplen + PCAP_TCP_HEADER, 1, pcap->file) != 1 || fwrite(data, len, 1, pcap->file) != 1) {
+		return -1;
+	}
+	pcap->frames++;
+	return 0;
+}
+
+const char *sccp_pcap_getFilename(const sccp_pcap_t * pcap)
+{
+	return pcap ? pcap->filename : "";
+}
+
+uint32_t sccp_pcap_getFrames(const sccp_pcap_t * pcap)
+{
+	return pcap ? pcap->frames : 0;
+}
+
+static inline uint32_t pcap_swap32(uint32_t value, boolean_t swapped)
+{
+	return swapped ? __builtin_bswap32(value) : value;
+}
+
+/* store an address from an ip header in a sockaddr_storage */
+static void pcap_sockaddr_set(struct sockaddr_storage *addr, int family, const unsigned char *ip, uint16_t port)
+{
+	memset(addr, 0, sizeof(*addr));
+	if (family == AF_INET6) {
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) addr;
+		sin6->sin6_family = AF_INET6;
+		memcpy(&sin6->sin6_addr, ip, 16);
+		sin6->sin6_port = htons(port);
+	} else {
+		struct sockaddr_in *sin = (struct sockaddr_in *) addr;
+		sin->sin_family = AF_INET;
+		memcpy(&sin->sin_addr, ip, 4);
+		sin->sin_port = htons(port);
+	}
+}
+
+/*!
+ * \brief Decode the ip and tcp header of a frame
+ * \return 1 when the frame carries tcp payload to or from serverport, 0 when it should be skipped
+ */
+static int pcap_decode_frame(const unsigned char *ip, size_t caplen, uint16_t serverport, sccp_pcap_frame_t * frame)
+{
+	const unsigned char *tcp = NULL;
+	const unsigned char *srcaddr = NULL, *dstaddr = NULL;
+	size_t iplen = 0, tcplen = 0;
+	int family;
+
+	if (caplen < PCAP_IPV4_HEADER) {
+		return 0;
+	}
+	if ((ip[0] >> 4) == 4) {
+		size_t hdrlen = (ip[0] & 0x0f) * 4;
+		iplen = pcap_get16(ip + 2);
+		if (ip[9] != IPPROTO_TCP || hdrlen < PCAP_IPV4_HEADER || iplen < hdrlen || (pcap_get16(ip + 6) & 0x3fff)) {
+			return 0;										/* not tcp, or a fragment */
+		}
+		family = AF_INET;
+		srcaddr = ip + 12;
+		dstaddr = ip + 16;
+		tcp = ip + hdrlen;
+	} else if ((ip[0] >> 4) == 6 && caplen >= PCAP_IPV6_HEADER) {
+		iplen = PCAP_IPV6_HEADER + pcap_get16(ip + 4);
+		if (ip[6] != IPPROTO_TCP) {
+			return 0;										/* not tcp (or extension headers) */
+		}
+		family = AF_INET6;
+		srcaddr = ip + 8;
+		dstaddr = ip + 24;
+		tcp = ip + PCAP_IPV6_HEADER;
+	} else {
+		return 0;
+	}
+	if (iplen > caplen) {
+		return 0;											/* truncated by the snaplen */
+	}
+	if ((size_t) (tcp - ip) + PCAP_TCP_HEADER > iplen || (tcplen = (tcp[12] >> 4) * 4) < PCAP_TCP_HEADER || (size_t) (tcp - ip) + tcplen > iplen) {
+		return 0;
+	}
+	uint16_t srcport = pcap_get16(tcp);
+	uint16_t dstport = pcap_get16(tcp + 2);
+
+	if (dstport == serverport) {
+		frame->direction = SCCP_PCAP_INBOUND;
+		pcap_sockaddr_set(&frame->phone, family, srcaddr, srcport);
+		pcap_sockaddr_set(&frame->server, family, dstaddr, dstport);
+	} else if (srcport == serverport) {
+		frame->direction = SCCP_PCAP_OUTBOUND;
+		pcap_sockaddr_set(&frame->phone, family, dstaddr, dstport);
+		pcap_sockaddr_set(&frame->server, family, srcaddr, srcport);
+	} else {
+		return 0;
+	}
+	frame->data = tcp + tcplen;
+	frame->len = iplen - (size_t) (tcp - ip) - tcplen;
+	return frame->len > 0;
+}
+
+/*!
+ * \brief Read a capture file and hand the SCCP payload of every frame to callback
+ * \param filename Capture file (written by sccp_pcap_write or tcpdump)
+ * \param serverport TCP Port chan-sccp was listening on, determines the direction of the frames
+ * \param callback Called for each frame carrying payload, in file order. Returning non-zero stops reading.
+ * \param userdata Passed to callback
+ * \return number of frames handed to callback or -1 on failure
+ */
+int sccp_pcap_read(const char *filename, uint16_t serverport, sccp_pcap_frame_cb_t callback, void *userdata)
+{
+	pcap_file_header_t header;
+	pcap_record_header_t record;
+	unsigned char *buffer = NULL;
+	sccp_pcap_frame_t frame;
+	boolean_t swapped = FALSE, nsec = FALSE;
+	uint32_t linktype;
+	FILE *f = NULL;
+	int frames = 0;
+
+	if (!filename || !callback || !(f = fopen(filename, "r"))) {
+		pbx_log(LOG_WARNING, "SCCP: (sccp_pcap_read) could not open '%s'\n", filename ? filename : "");
+		return -1;
+	}
+	if (fread(&header, sizeof(header), 1, f) != 1) {
+		pbx_log(LOG_WARNING, "SCCP: (sccp_pcap_read) '%s' is too short\n", filename);
+		fclose(f);
+		return -1;
+	}
+	switch (header.magic) {
+		case PCAP_MAGIC:
+			break;
+		case PCAP_MAGIC_NSEC:
+			nsec = TRUE;
+			break;
+		default:
+			swapped = TRUE;
+			nsec = __builtin_bswap32(header.magic) == PCAP_MAGIC_NSEC;
+			if (!nsec && __builtin_bswap32(header.magic) != PCAP_MAGIC) {
+				pbx_log(LOG_WARNING, "SCCP: (sccp_pcap_read) '%s' is not a pcap file (pcapng is not supported)\n", filename);
+				fclose(f);
+				return -1;
+			}
+			break;
+	}
+	linktype = pcap_swap32(header.linktype, swapped) & 0xffff;
+	if (linktype != PCAP_LINKTYPE_RAW && linktype != PCAP_LINKTYPE_IPV4 && linktype != PCAP_LINKTYPE_IPV6 && linktype != PCAP_LINKTYPE_ETHERNET && linktype != PCAP_LINKTYPE_LINUX_SLL) {
+		pbx_log(LOG_WARNING, "SCCP: (sccp_pcap_read) '%s' uses unsupported linktype %u\n", filename, linktype);
+		fclose(f);
+		return -1;
+	}
+	if (!(buffer = (unsigned char *) sccp_malloc(PCAP_MAX_RECORD))) {
+		pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
+		fclose(f);
+		return -1;
+	}
+
+	while (fread(&record, sizeof(record), 1, f) == 1) {
+		size_t caplen = pcap_swap32(record.incl_len, swapped);
+		const unsigned char *ip = buffer;
+		uint16_t ethertype = 0;
+
+		if (caplen > PCAP_MAX_RECORD || fread(buffer, 1, caplen, f) != caplen) {
+			pbx_log(LOG_WARNING, "SCCP: (sccp_pcap_read) '%s' is truncated or corrupt after %d frames\n", filename, frames);
+			break;
+		}
+		if (linktype == PCAP_LINKTYPE_ETHERNET || linktype == PCAP_LINKTYPE_LINUX_SLL) {
+			size_t offset = linktype == PCAP_LINKTYPE_ETHERNET ? 12 : 14;
+			if (caplen < offset + 2) {
+				continue;
+			}
+			ethertype = pcap_get16(buffer + offset);
+			if (ethertype == 0x8100 && caplen >= offset + 6) {					/* 802.1Q vlan tag */
+				offset += 4;
+				ethertype = pcap_get16(buffer + offset);
+			}
+			if (ethertype != 0x0800 && ethertype != 0x86dd) {
+				continue;
+			}
+			ip += offset + 2;
+			caplen -= offset + 2;
+		}
+		memset(&frame, 0, sizeof(frame));
+		if (!pcap_decode_frame(ip, caplen, serverport, &frame)) {
+			continue;
+		}
+		frame.ts.tv_sec = pcap_swap32(record.ts_sec, swapped);
+		frame.ts.tv_usec = nsec ? pcap_swap32(record.ts_usec, swapped) / 1000 : pcap_swap32(record.ts_usec, swapped);
+		frames++;
+		if (callback(&frame, userdata)) {
+			break;
+		}
+	}
+	sccp_free(buffer);
+	fclose(f);
+	return frames;
+}
+
+#if CS_TEST_FRAMEWORK
+#include <asterisk/test.h>
+typedef struct {
+	int frames[2];
+	size_t bytes[2];
+	uint16_t phoneport;
+	boolean_t ok;
+} pcap_test_result_t;
+
+static int pcap_test_frame(const sccp_pcap_frame_t * frame, void *userdata)
+{
+	pcap_test_result_t *result = (pcap_test_result_t *) userdata;
+
+	result->frames[frame->direction]++;
+	result->bytes[frame->direction] += frame->len;
+	if (sccp_netsock_getPort(&frame->phone) != result->phoneport || frame->len < 12 || frame->data[0] != (unsigned char) (frame->len - 8)) {
+		result->ok = FALSE;
+	}
+	return 0;
+}
+
+AST_TEST_DEFINE(sccp_pcap_roundtrip)
+{
+	char filename[] = "/tmp/sccp_pcap_test_XXXXXX";
+	unsigned char msg[64] = { 0 };
+	struct sockaddr_storage phone = { 0 }, server = { 0 };
+	struct sockaddr_in6 *phone6 = (struct sockaddr_in6 *) &phone;
+	struct sockaddr_in *phone4 = (struct sockaddr_in *) &phone;
+	struct sockaddr_in *server4 = (struct sockaddr_in *) &server;
+	sccp_pcap_t *pcap = NULL;
+	pcap_test_result_t result = { {0, 0}, {0, 0}, 51234, TRUE };
+	int fd, i, ipv6;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "roundtrip";
+		info->category = "/channels/chan_sccp/pcap/";
+		info->summary = "chan-sccp-b pcap capture test";
+		info->description = "chan-sccp-b write a session capture and read it back (IPv4 and IPv6)";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	if ((fd = mkstemp(filename)) < 0) {
+		pbx_test_status_update(test, "Could not create a temporary file\n");
+		return AST_TEST_FAIL;
+	}
+	close(fd);
+	unlink(filename);											/* sccp_pcap_open only creates new files */
+	for (ipv6 = 0; ipv6 < 2; ipv6++) {
+		memset(&result, 0, sizeof(result));
+		result.phoneport = 51234;
+		result.ok = TRUE;
+		memset(&phone, 0, sizeof(phone));
+		if (ipv6) {
+			phone6->sin6_family = AF_INET6;
+			phone6->sin6_addr.s6_addr[15] = 2;
+		} else {
+			phone4->sin_family = AF_INET;
+			phone4->sin_addr.s_addr = htonl(0xC0A80102);						/* 192.168.1.2 */
+		}
+		server4->sin_family = AF_INET;
+		server4->sin_addr.s_addr = htonl(0xC0A80101);							/* 192.168.1.1 */
+		sccp_netsock_setPort(&phone, 51234);
+		sccp_netsock_setPort(&server, 2000);
+
+		pcap = sccp_pcap_open(filename, &phone, &server);
+		pbx_test_validate(test, pcap != NULL);
+		for (i = 0; i < 10; i++) {
+			msg[0] = (unsigned char) (12 + i * 4 - 8);						/* sccp header length: payload + 4 */
+			pbx_test_validate(test, sccp_pcap_write(pcap, i % 3 ? SCCP_PCAP_OUTBOUND : SCCP_PCAP_INBOUND, msg, 12 + i * 4) == 0);
+		}
+		pbx_test_validate(test, sccp_pcap_getFrames(pcap) == 10);
+		sccp_pcap_close(pcap);
+
+		pbx_test_validate(test, sccp_pcap_read(filename, 2000, pcap_test_frame, &result) == 10);
+		pbx_test_status_update(test, "%s: inbound %d frames/%d bytes, outbound %d frames/%d bytes\n", ipv6 ? "IPv6" : "IPv4", result.frames[SCCP_PCAP_INBOUND], (int) result.bytes[SCCP_PCAP_INBOUND], result.frames[SCCP_PCAP_OUTBOUND], (int) result.bytes[SCCP_PCAP_OUTBOUND]);
+		pbx_test_validate(test, result.ok);
+		pbx_test_validate(test, result.frames[SCCP_PCAP_INBOUND] == 4 && result.frames[SCCP_PCAP_OUTBOUND] == 6);
+		pbx_test_validate(test, result.bytes[SCCP_PCAP_INBOUND] + result.bytes[SCCP_PCAP_OUTBOUND] == 10 * 12 + 4 * 45);
+		pbx_test_validate(test, sccp_pcap_read(filename, 2001, pcap_test_frame, &result) == 0);
+	}
+	unlink(filename);
+	return AST_TEST_PASS;
+}
+
+static void __attribute__((constructor)) sccp_register_tests(void)
+{
+	AST_TEST_REGISTER(sccp_pcap_roundtrip);
+}
+
+static void __attribute__((destructor)) sccp_unregister_tests(void)
+{
+	AST_TEST_UNREGISTER(sccp_pcap_roundtrip);
+}
+#endif
+// kate: indent-width 8; replace-tabs off; indent-mode cstyle; auto-insert-doxygen on; line-numbers on; tab-indents on; keep-extra-spaces off; auto-brackets off;
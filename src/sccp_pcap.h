@@ -0,0 +1,43 @@
+/*!
+ * \file        sccp_pcap.h
+ * \brief       SCCP Packet Capture Header
+ * \note        This program is free software and may be modified and distributed under the terms of the GNU Public License.
+ *              See the LICENSE file at the top of the source tree.
+ */
+#pragma once
+
+__BEGIN_C_EXTERN__
+#define SCCP_PCAP_SNAPLEN 65535											/*!< largest frame written to / read from a capture file */
+
+typedef struct sccp_pcap sccp_pcap_t;
+
+/*!
+ * \brief Direction of a captured SCCP frame, as seen from chan-sccp
+ */
+typedef enum {
+	SCCP_PCAP_INBOUND,											/*!< phone -> chan-sccp */
+	SCCP_PCAP_OUTBOUND,											/*!< chan-sccp -> phone */
+} sccp_pcap_direction_t;
+
+/*!
+ * \brief Frame read back from a capture file (see sccp_pcap_read)
+ */
+typedef struct sccp_pcap_frame {
+	sccp_pcap_direction_t direction;
+	struct timeval ts;
+	struct sockaddr_storage phone;
+	struct sockaddr_storage server;
+	const unsigned char *data;										/*!< tcp payload (only valid during the callback) */
+	size_t len;
+} sccp_pcap_frame_t;
+
+typedef int (*sccp_pcap_frame_cb_t) (const sccp_pcap_frame_t * frame, void *userdata);
+
+SCCP_API sccp_pcap_t * SCCP_CALL sccp_pcap_open(const char *filename, const struct sockaddr_storage *phone, const struct sockaddr_storage *server);
+SCCP_API void SCCP_CALL sccp_pcap_close(sccp_pcap_t * pcap);
+SCCP_API int SCCP_CALL sccp_pcap_write(sccp_pcap_t * pcap, sccp_pcap_direction_t direction, const void *data, size_t len);
+SCCP_API const char * SCCP_CALL sccp_pcap_getFilename(const sccp_pcap_t * pcap);
+SCCP_API uint32_t SCCP_CALL sccp_pcap_getFrames(const sccp_pcap_t * pcap);
+SCCP_API int SCCP_CALL sccp_pcap_read(const char *filename, uint16_t serverport, sccp_pcap_frame_cb_t callback, void *userdata);
+__END_C_EXTERN__
+// kate: indent-width 8; replace-tabs off; indent-mode cstyle; auto-insert-doxygen on; line-numbers on; tab-indents on; keep-extra-spaces off; auto-brackets off;
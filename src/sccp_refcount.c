@@ -50,8 +50,9 @@
 
 SCCP_FILE_VERSION(__FILE__, "");
 
-//nb: SCCP_HASH_PRIME defined in config.h, default 563
-#define SCCP_SIMPLE_HASH(_a) (((uintptr_t)(_a)) % SCCP_HASH_PRIME)
+/* objects are registered in one of SCCP_REFCOUNT_STRIPES independently locked lists (power of two), picked by hashing the pointer */
+#define SCCP_REFCOUNT_STRIPES 128
+#define SCCP_REFCOUNT_STRIPE(_a) (((((uint32_t) (((uintptr_t)(_a)) >> 4)) * 2654435761U) >> 16) & (SCCP_REFCOUNT_STRIPES - 1))
 #define SCCP_LIVE_MARKER 13
 #if CS_REFCOUNT_DEBUG
 #define REFCOUNT_MAX_PARENTS 3
@@ -100,17 +101,23 @@ struct refcount_object {
 #endif	
 	uint16_t len;
 	uint16_t alive;
-	SCCP_RWLIST_ENTRY (RefCountedObject) list;
+	SCCP_LIST_ENTRY (RefCountedObject) list;
 	unsigned char data[0] __attribute__((aligned(8)));
 };
 
 
-static ast_rwlock_t objectslock;										// general lock to modify hash table entries
-static struct refcount_objentry{
-	SCCP_RWLIST_HEAD (, RefCountedObject) refCountedObjects  __attribute__((aligned(8)));			//!< one rwlock per hash table entry, used to modify list
-} *objects[SCCP_HASH_PRIME] = {0};										//!< objects hash table
+/*!
+ * \brief Object registry stripe
+ * \note The registry is only touched when an object is created or finally destroyed (and by the cli / shutdown), never by
+ *       retain/release. Objects sit on a doubly linked list, so registering and unregistering only hold one stripe lock
+ *       for a constant amount of time, independent of the number of objects.
+ */
+static struct refcount_stripe {
+	SCCP_LIST_HEAD (, RefCountedObject) refCountedObjects;
+} __attribute__((aligned(64))) stripes[SCCP_REFCOUNT_STRIPES];						//!< aligned to keep the stripe locks on separate cachelines
 
 #if CS_REFCOUNT_DEBUG
+AST_MUTEX_DEFINE_STATIC(ref_debug_lock);								// protects debug file rotation
 static FILE *sccp_ref_debug_log;
 static volatile uint32_t ref_debug_size;
 #endif
@@ -118,36 +125,41 @@ static volatile uint32_t ref_debug_size;
 void sccp_refcount_init(void)
 {
 	sccp_log((DEBUGCAT_REFCOUNT + DEBUGCAT_HIGH)) (VERBOSE_PREFIX_1 "SCCP: (Refcount) init\n");
-	pbx_rwlock_init_notracking(&objectslock);								// No tracking to safe cpu cycles
+	for (uint32_t stripe = 0; stripe < SCCP_REFCOUNT_STRIPES; stripe++) {
+		SCCP_LIST_HEAD_INIT(&stripes[stripe].refCountedObjects);					// No tracking to safe cpu cycles
+	}
 #if CS_REFCOUNT_DEBUG
 	sccp_ref_debug_log = NULL;
 	ref_debug_size = 0;
 	__rotate_debug_file();
 #endif
-//	memset(objects, 0, sizeof(RefCountedObject) * SCCP_HASH_PRIME);
 	runState = SCCP_REF_RUNNING;
 }
 
 void sccp_refcount_destroy(void)
 {
-	uint32_t hash, type;
+	uint32_t stripe, type;
 	RefCountedObject *obj;
 
 	pbx_log(LOG_NOTICE, "SCCP: (Refcount) Shutting Down. Checking Clean Shutdown...\n");
 	int numObjects = 0;
 	runState = SCCP_REF_STOPPED;
 
-	sched_yield();												//make sure all other threads can finish their work first.
-
 	// cleanup if necessary, if everything is well, this should not be necessary
-	ast_rwlock_wrlock(&objectslock);
 	for (type = 0; type < ARRAY_LEN(obj_info); type++) { 							// unwind in order of type priority
-		for (hash = 0; hash < SCCP_HASH_PRIME && objects[hash]; hash++) {
-			SCCP_RWLIST_WRLOCK(&(objects[hash]->refCountedObjects));
-			SCCP_RWLIST_TRAVERSE_SAFE_BEGIN(&(objects[hash]->refCountedObjects), obj, list) {
-				if (obj->type == type) {
-					pbx_log(LOG_NOTICE, "Cleaning up [%3d]=type:%17s, id:%25s, ptr:%15p, refcount:%4d, alive:%4s, size:%4d\n", hash, (obj_info[obj->type]).datatype, obj->identifier, obj, (int) obj->refcount, SCCP_LIVE_MARKER == obj->alive ? "yes" : "no", obj->len);
-					SCCP_RWLIST_REMOVE_CURRENT(list);
+		for (stripe = 0; stripe < SCCP_REFCOUNT_STRIPES; stripe++) {
+			do {
+				/* unlink one object at a time and run the destructor without holding the stripe lock, the destructor might release other objects */
+				SCCP_LIST_LOCK(&stripes[stripe].refCountedObjects);
+				SCCP_LIST_TRAVERSE(&stripes[stripe].refCountedObjects, obj, list) {
+					if (obj->type == type) {
+						SCCP_LIST_REMOVE(&stripes[stripe].refCountedObjects, obj, list);
+						break;
+					}
+				}
+				SCCP_LIST_UNLOCK(&stripes[stripe].refCountedObjects);
+				if (obj) {
+					pbx_log(LOG_NOTICE, "Cleaning up [%3d]=type:%17s, id:%25s, ptr:%15p, refcount:%4d, alive:%4s, size:%4d\n", stripe, (obj_info[obj->type]).datatype, obj->identifier, obj, (int) obj->refcount, SCCP_LIVE_MARKER == obj->alive ? "yes" : "no", obj->len);
 					if ((&obj_info[obj->type])->destructor) {
 						(&obj_info[obj->type])->destructor(obj->data);
 					}
@@ -156,20 +168,14 @@ void sccp_refcount_destroy(void)
 #endif
 					memset(obj, 0, sizeof(RefCountedObject));
 					sccp_free(obj);
-					obj = NULL;
 					numObjects++;
 				}
-			}
-			SCCP_RWLIST_TRAVERSE_SAFE_END;
-			SCCP_RWLIST_UNLOCK(&(objects[hash]->refCountedObjects));
-			SCCP_RWLIST_HEAD_DESTROY(&(objects[hash]->refCountedObjects));
-
-			sccp_free(objects[hash]);								// free hashtable entry
-			objects[hash] = NULL;
+			} while (obj);
 		}
 	}
-	ast_rwlock_unlock(&objectslock);
-	pbx_rwlock_destroy(&objectslock);
+	for (stripe = 0; stripe < SCCP_REFCOUNT_STRIPES; stripe++) {
+		SCCP_LIST_HEAD_DESTROY(&stripes[stripe].refCountedObjects);
+	}
 	if (numObjects) {
 		pbx_log(LOG_WARNING, "SCCP: (Refcount) Note: We found %d objects which had to be forcefulfy removed during refcount shutdown, see above.\n", numObjects);
 	}
@@ -214,41 +220,21 @@ void *const sccp_refcount_object_alloc(size_t size, enum sccp_refcounted_types t
 #endif
 	sccp_copy_string(obj->identifier, identifier, sizeof(obj->identifier));
 
-	// generate hash
+	// register object
 	void *ptr = obj->data;
-	uint32_t hash = SCCP_SIMPLE_HASH(ptr);
-
-	if (!objects[hash]) {
-		// create new hashtable head when necessary (should this possibly be moved to refcount_init, to avoid raceconditions ?)
-		ast_rwlock_wrlock(&objectslock);
-		if (!objects[hash]) {										// check again after getting the lock, to see if another thread did not create the head already
-			if (!(objects[hash] = sccp_calloc(sizeof *objects[hash], 1))) {
-				pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP: hashtable");
-				sccp_free(obj);
-				obj = NULL;
-				ast_rwlock_unlock(&objectslock);
-				return NULL;
-			}
-			SCCP_RWLIST_HEAD_INIT(&(objects[hash]->refCountedObjects));
-			SCCP_RWLIST_INSERT_HEAD(&(objects[hash]->refCountedObjects), obj, list);
-		}
-		ast_rwlock_unlock(&objectslock);
-	} else {
-		// add object to hash table
-		ast_rwlock_rdlock(&objectslock);
-		SCCP_RWLIST_WRLOCK(&(objects[hash]->refCountedObjects));
-		SCCP_RWLIST_INSERT_HEAD(&(objects[hash]->refCountedObjects), obj, list);
-		SCCP_RWLIST_UNLOCK(&(objects[hash]->refCountedObjects));
-		ast_rwlock_unlock(&objectslock);
-	}
+	uint32_t stripe = SCCP_REFCOUNT_STRIPE(ptr);
+
+	SCCP_LIST_LOCK(&stripes[stripe].refCountedObjects);
+	SCCP_LIST_INSERT_HEAD(&stripes[stripe].refCountedObjects, obj, list);
+	SCCP_LIST_UNLOCK(&stripes[stripe].refCountedObjects);
 
-	sccp_log((DEBUGCAT_REFCOUNT)) (VERBOSE_PREFIX_1 "SCCP: (alloc_obj) Creating new %s %s (%p) inside %p at hash: %d\n", (&obj_info[obj->type])->datatype, identifier, ptr, obj, hash);
+	sccp_log((DEBUGCAT_REFCOUNT)) (VERBOSE_PREFIX_1 "SCCP: (alloc_obj) Creating new %s %s (%p) inside %p at stripe: %d\n", (&obj_info[obj->type])->datatype, identifier, ptr, obj, stripe);
 	obj->alive = SCCP_LIVE_MARKER;
+	sccp_trace(DEBUGCAT_REFCOUNT, SCCP_TRACE_REF_ALLOC, ptr, type, 1, __LINE__);
 
 #if CS_REFCOUNT_DEBUG
 	if (sccp_ref_debug_log) {
 		fprintf(sccp_ref_debug_log, "%p|+1|%d|%s|%d|%s|**constructor**|%s:%s\n", ptr, ast_get_tid(), __FILE__, __LINE__, __PRETTY_FUNCTION__, (&obj_info[obj->type])->datatype, obj->identifier);
-		fflush(sccp_ref_debug_log);
 	}
 #endif
 	//memset(ptr, 0, size);
@@ -297,12 +283,12 @@ static gcc_inline int __sccp_refcount_debug(const void *ptr, RefCountedObject *
 	static char fmt[] = "%p|%s%d|%d|%s|%d|%s|%d|%s:%s\n";
 
 	if (!sccp_ref_debug_log || ref_debug_size > REF_DEBUG_FILE_MAX_SIZE) {			/* check debug file rotation requirement */
-		ast_rwlock_wrlock(&objectslock);
+		ast_mutex_lock(&ref_debug_lock);
 		if (__rotate_debug_file() != 0) {
-			ast_rwlock_unlock(&objectslock);
+			ast_mutex_unlock(&ref_debug_lock);
 			return -1;
 		}
-		ast_rwlock_unlock(&objectslock);
+		ast_mutex_unlock(&ref_debug_lock);
 	}
 	if (sccp_ref_debug_log) {	
 		do {
@@ -331,7 +317,6 @@ static gcc_inline int __sccp_refcount_debug(const void *ptr, RefCountedObject *
 			}
 			ref_debug_size += fprintf(sccp_ref_debug_log, fmt, ptr, "E", 0, ptr, ast_get_tid(),file, line, func, "**UNKNOWN**", "", "");
 		} while (0);
-		fflush(sccp_ref_debug_log);
 	}
 	return res;
 }
@@ -364,57 +349,31 @@ static gcc_inline RefCountedObject *sccp_refcount_find_obj(const void * const pt
 
 static gcc_inline void sccp_refcount_remove_obj(const void *ptr)
 {
-	RefCountedObject *obj = NULL;
-	boolean_t cleanup_objects = FALSE;
-
 	if (ptr == NULL) {
 		return;
 	}
 
-	uint32_t hash = SCCP_SIMPLE_HASH(ptr);
+	RefCountedObject *obj = container_of(((void *) ptr), RefCountedObject, data);
+	uint32_t stripe = SCCP_REFCOUNT_STRIPE(ptr);
 
-	sccp_log((DEBUGCAT_REFCOUNT)) (VERBOSE_PREFIX_1 "SCCP: (sccp_refcount_remove_obj) Removing %p from hash table at hash: %d\n", ptr, hash);
+	sccp_log((DEBUGCAT_REFCOUNT)) (VERBOSE_PREFIX_1 "SCCP: (sccp_refcount_remove_obj) Removing %p from registry at stripe: %d\n", ptr, stripe);
+
+	/* the refcount reached zero and the object was declared dead by our caller, nobody can retain it anymore */
+	if (obj->data == ptr && SCCP_LIVE_MARKER != obj->alive) {
+		SCCP_LIST_LOCK(&stripes[stripe].refCountedObjects);
+		SCCP_LIST_REMOVE(&stripes[stripe].refCountedObjects, obj, list);
+		SCCP_LIST_UNLOCK(&stripes[stripe].refCountedObjects);
 
-	if (objects[hash]) {
-		SCCP_RWLIST_WRLOCK(&(objects[hash]->refCountedObjects));
-		SCCP_RWLIST_TRAVERSE_SAFE_BEGIN(&(objects[hash]->refCountedObjects), obj, list) {
-			if (obj->data == ptr && SCCP_LIVE_MARKER != obj->alive) {
-				SCCP_RWLIST_REMOVE_CURRENT(list);
-				break;
-			}
-		}
-		SCCP_RWLIST_TRAVERSE_SAFE_END;
-		if (SCCP_RWLIST_GETSIZE(&(objects[hash]->refCountedObjects)) == 0) {
-			cleanup_objects = TRUE;
-		}
-		SCCP_RWLIST_UNLOCK(&(objects[hash]->refCountedObjects));
-	}
-	if (obj) {
-		sched_yield();											// make sure all other threads can finish their work first.
-		// should resolve lockless refcount SMP issues
-		// BTW we are not allowed to sleep whilst having a reference
 		// fire destructor
-		if (obj && obj->data == ptr && SCCP_LIVE_MARKER != obj->alive) {
-			sccp_log((DEBUGCAT_REFCOUNT)) (VERBOSE_PREFIX_1 "SCCP: (sccp_refcount_remove_obj) Destroying %p at hash: %d\n", obj, hash);
-			if ((&obj_info[obj->type])->destructor) {
-				(&obj_info[obj->type])->destructor(ptr);
-			}
-			memset(obj, 0, sizeof(RefCountedObject));
-			sccp_free(obj);
-			obj = NULL;
-		}
-	}
-	if (cleanup_objects && runState == SCCP_REF_RUNNING && objects[hash]) {
-		ast_rwlock_wrlock(&objectslock);
-		SCCP_RWLIST_WRLOCK(&(objects[hash]->refCountedObjects));
-		if (SCCP_RWLIST_GETSIZE(&(objects[hash]->refCountedObjects)) == 0) {			/* recheck size */
-			SCCP_RWLIST_HEAD_DESTROY(&(objects[hash]->refCountedObjects));
-			sccp_free(objects[hash]);
-			objects[hash] = NULL;
-		} else {
-			SCCP_RWLIST_UNLOCK(&(objects[hash]->refCountedObjects));
+		sccp_log((DEBUGCAT_REFCOUNT)) (VERBOSE_PREFIX_1 "SCCP: (sccp_refcount_remove_obj) Destroying %p at stripe: %d\n", obj, stripe);
+		if ((&obj_info[obj->type])->destructor) {
+			(&obj_info[obj->type])->destructor(ptr);
 		}
-		ast_rwlock_unlock(&objectslock);
+#ifndef SCCP_ATOMIC
+		ast_mutex_destroy(&obj->lock);
+#endif
+		memset(obj, 0, sizeof(RefCountedObject));
+		sccp_free(obj);
 	}
 }
 
@@ -437,28 +396,24 @@ void sccp_refcount_gen_report(const void * const ptr, pbx_str_t **buf)
 	);
 	
 	pbx_str_append(buf, 0, "== related objects =======================================================================\n");
-	ast_rwlock_rdlock(&objectslock);
 	RefCountedObject *rel_obj = NULL;
-	for(int bucket = 0; bucket < SCCP_HASH_PRIME; bucket++) {
-		if (objects[bucket]) {
-			SCCP_RWLIST_RDLOCK(&(objects[bucket]->refCountedObjects));
-			SCCP_RWLIST_TRAVERSE(&(objects[bucket]->refCountedObjects), rel_obj, list) {
-				for (int parentIndex = 0; parentIndex < REFCOUNT_MAX_PARENTS; parentIndex++) {
-					if (rel_obj->parentWeakPtr[parentIndex] && rel_obj->parentWeakPtr[parentIndex] == obj) {
-						pbx_str_append(buf, 0, " %-17.17s %-25.25s (%15p), refcount:%-4.4d, alive:%-5.5s\n", 
-							(obj_info[rel_obj->type]).datatype, 
-							rel_obj->identifier, 
-							rel_obj, 
-							rel_obj->refcount,
-							SCCP_LIVE_MARKER == rel_obj->alive ? "yes" : "no"
-						);
-					}
+	for(int stripe = 0; stripe < SCCP_REFCOUNT_STRIPES; stripe++) {
+		SCCP_LIST_LOCK(&stripes[stripe].refCountedObjects);
+		SCCP_LIST_TRAVERSE(&stripes[stripe].refCountedObjects, rel_obj, list) {
+			for (int parentIndex = 0; parentIndex < REFCOUNT_MAX_PARENTS; parentIndex++) {
+				if (rel_obj->parentWeakPtr[parentIndex] && rel_obj->parentWeakPtr[parentIndex] == obj) {
+					pbx_str_append(buf, 0, " %-17.17s %-25.25s (%15p), refcount:%-4.4d, alive:%-5.5s\n", 
+						(obj_info[rel_obj->type]).datatype, 
+						rel_obj->identifier, 
+						rel_obj, 
+						rel_obj->refcount,
+						SCCP_LIVE_MARKER == rel_obj->alive ? "yes" : "no"
+					);
 				}
 			}
-			SCCP_RWLIST_UNLOCK(&(objects[bucket]->refCountedObjects));
 		}
+		SCCP_LIST_UNLOCK(&stripes[stripe].refCountedObjects);
 	}
-	ast_rwlock_unlock(&objectslock);
 	pbx_str_append(buf, 0, "==========================================================================================\n");
 }
 #endif
@@ -482,14 +437,13 @@ int sccp_show_refcount(int fd, sccp_cli_totals_t *totals, struct mansession *s,
 		}
 	}
 
-	ast_rwlock_rdlock(&objectslock);
 #define CLI_AMI_TABLE_NAME Refcount
 #define CLI_AMI_TABLE_PER_ENTRY_NAME Entry
-#define CLI_AMI_TABLE_ITERATOR for(bucket = 0; bucket < SCCP_HASH_PRIME; bucket++)
+#define CLI_AMI_TABLE_ITERATOR for(bucket = 0; bucket < SCCP_REFCOUNT_STRIPES; bucket++)
 #define CLI_AMI_TABLE_BEFORE_ITERATION 											\
-		if (objects[bucket]) {											\
-			SCCP_RWLIST_RDLOCK(&(objects[bucket]->refCountedObjects));					\
-			SCCP_RWLIST_TRAVERSE(&(objects[bucket]->refCountedObjects), obj, list) {			\
+		{													\
+			SCCP_LIST_LOCK(&stripes[bucket].refCountedObjects);						\
+			SCCP_LIST_TRAVERSE(&stripes[bucket].refCountedObjects, obj, list) {				\
 				char bucketstr[8];									\
 				if (!s) {										\
 					if (prev == bucket) {								\
@@ -545,10 +499,10 @@ int sccp_show_refcount(int fd, sccp_cli_totals_t *totals, struct mansession *s,
 				prev = bucket;										\
 				numentries++;										\
 			}												\
-			if (maxdepth < SCCP_RWLIST_GETSIZE(&(objects[bucket]->refCountedObjects))) {			\
-				maxdepth = SCCP_RWLIST_GETSIZE(&(objects[bucket]->refCountedObjects));			\
+			if (maxdepth < SCCP_LIST_GETSIZE(&stripes[bucket].refCountedObjects)) {				\
+				maxdepth = SCCP_LIST_GETSIZE(&stripes[bucket].refCountedObjects);			\
 			}												\
-			SCCP_RWLIST_UNLOCK(&(objects[bucket]->refCountedObjects));					\
+			SCCP_LIST_UNLOCK(&stripes[bucket].refCountedObjects);						\
 		}
 
 #define CLI_AMI_TABLE_FIELDS 												\
@@ -562,29 +516,20 @@ int sccp_show_refcount(int fd, sccp_cli_totals_t *totals, struct mansession *s,
 	CLI_AMI_TABLE_FIELD(Size,	"-4.4",		d,	4,	obj->len)
 #include "sccp_cli_table.h"
 	local_line_total++;
-	ast_rwlock_unlock(&objectslock);
 
 	// FillFactor
-	fillfactor = (float) numentries / SCCP_HASH_PRIME;
+	fillfactor = (float) numentries / SCCP_REFCOUNT_STRIPES;
 	int once;
 #define CLI_AMI_TABLE_NAME FillFactor
 #define CLI_AMI_TABLE_PER_ENTRY_NAME Factor
 #define CLI_AMI_TABLE_ITERATOR for(once=0;once<1;once++)
 #define CLI_AMI_TABLE_FIELDS 												\
 	CLI_AMI_TABLE_FIELD(Entries,		"-8.8",		d,	8,	numentries)				\
-	CLI_AMI_TABLE_FIELD(Buckets,		"-8.8",		d,	8,	SCCP_HASH_PRIME)			\
+	CLI_AMI_TABLE_FIELD(Buckets,		"-8.8",		d,	8,	SCCP_REFCOUNT_STRIPES)			\
 	CLI_AMI_TABLE_FIELD(Factor,		"08.02",	f,	8,	fillfactor)				\
 	CLI_AMI_TABLE_FIELD(MaxDepth,		"-8.8",		d,	8,	maxdepth)
 #include "sccp_cli_table.h"
 	local_line_total++;
-	if (fillfactor > 1.00) {
-		if (!s) {
-			pbx_cli(fd, "\033[1m\033[41m\033[37mPlease keep fillfactor below 1.00. Check ./configure --with-hash-size.\033[0m\n");
-		} else {
-			astman_append(s, "Please keep fillfactor below 1.00. Check ./configure --with-hash-size.\r\n");
-			local_line_total++;
-		}
-	}
 
 	if (s) {
 		totals->lines = local_line_total;
@@ -596,23 +541,19 @@ int sccp_show_refcount(int fd, sccp_cli_totals_t *totals, struct mansession *s,
 #ifdef CS_EXPERIMENTAL
 int sccp_refcount_force_release(long findobj, char *identifier)
 {
-	uint32_t hash;
+	uint32_t stripe;
 	RefCountedObject *obj = NULL;
 	void *ptr = NULL;
 
-	ast_rwlock_rdlock(&objectslock);
-	for (hash = 0; hash < SCCP_HASH_PRIME; hash++) {
-		if (objects[hash]) {
-			SCCP_RWLIST_RDLOCK(&(objects[hash]->refCountedObjects));
-			SCCP_RWLIST_TRAVERSE(&(objects[hash]->refCountedObjects), obj, list) {
-				if (sccp_strequals(obj->identifier, identifier) && (long) obj == findobj) {
-					ptr = obj->data;
-				}
+	for (stripe = 0; stripe < SCCP_REFCOUNT_STRIPES; stripe++) {
+		SCCP_LIST_LOCK(&stripes[stripe].refCountedObjects);
+		SCCP_LIST_TRAVERSE(&stripes[stripe].refCountedObjects, obj, list) {
+			if (sccp_strequals(obj->identifier, identifier) && (long) obj == findobj) {
+				ptr = obj->data;
 			}
-			SCCP_RWLIST_UNLOCK(&(objects[hash]->refCountedObjects));
 		}
+		SCCP_LIST_UNLOCK(&stripes[stripe].refCountedObjects);
 	}
-	ast_rwlock_unlock(&objectslock);
 	if (ptr) {
 		sccp_log(DEBUGCAT_CORE) (VERBOSE_PREFIX_1 "Forcefully releasing one instance of %s\n", identifier);
 		sccp_refcount_release((const void ** const)&ptr, __FILE__, __LINE__, __PRETTY_FUNCTION__);
@@ -694,11 +635,19 @@ gcc_inline void * const sccp_refcount_retain(const void * const ptr, const char
 #if CS_REFCOUNT_DEBUG
 		__sccp_refcount_debug(ptr, obj, 1, filename, lineno, func);
 #endif
+		int newrefcountval, refcountval;
 		// ANNOTATE_HAPPENS_BEFORE(&obj->refcount);
-		volatile int refcountval = ATOMIC_INCR((&obj->refcount), 1, &obj->lock);
+		do {													/* never revive an object whose last reference is being released */
+			refcountval = obj->refcount;
+			if (refcountval <= 0) {
+				sccp_log((DEBUGCAT_REFCOUNT)) (VERBOSE_PREFIX_1 "SCCP: %-15.15s:%-4.4d (%-35.35s)) (retain) %p is being finalized, not retaining\n", filename, lineno, func, ptr);
+				return NULL;
+			}
+			newrefcountval = refcountval + 1;
+		} while ((CAS32(&obj->refcount, refcountval, newrefcountval, &obj->lock)) != refcountval);
 		// ANNOTATE_HAPPENS_AFTER(&obj->refcount);
-		int newrefcountval = refcountval + 1;
 		
+		sccp_trace(DEBUGCAT_REFCOUNT, SCCP_TRACE_REF_RETAIN, ptr, obj->type, newrefcountval, lineno);
 		if (dont_expect( (sccp_globals->debug & (((&obj_info[obj->type])->debugcat + DEBUGCAT_REFCOUNT))) == ((&obj_info[obj->type])->debugcat + DEBUGCAT_REFCOUNT))) {
 			pbx_log(__LOG_VERBOSE, __FILE__, 0, "", " %-15.15s:%-4.4d (%-35.35s) %*.*s> %*s refcount increased %.2d  +> %.2d for %10s: %s (%p)\n", filename, lineno, func, refcountval, refcountval, "--------------------", 20 - refcountval, " ", refcountval, newrefcountval, (&obj_info[obj->type])->datatype, obj->identifier, obj);
 		}
@@ -707,6 +656,7 @@ gcc_inline void * const sccp_refcount_retain(const void * const ptr, const char
 #if CS_REFCOUNT_DEBUG
 	__sccp_refcount_debug((void *) ptr, NULL, 1, filename, lineno, func);
 #endif
+	sccp_trace(DEBUGCAT_REFCOUNT, SCCP_TRACE_REF_ERROR, ptr, 1, 0, lineno);
 	pbx_log(__LOG_VERBOSE, __FILE__, 0, "retain", "SCCP: (%-15.15s:%-4.4d (%-35.35s)) ALARM !! trying to retain %p with invalid memory reference! this should never happen !\n", filename, lineno, func, obj);
 	pbx_log(LOG_ERROR, "SCCP: (release) Refcount Object %p could not be found (Major Logic Error). Please report to developers\n", ptr);
 	#ifdef DEBUG
@@ -745,6 +695,7 @@ gcc_inline void * const sccp_refcount_release(const void * * const ptr, const ch
 			newrefcountval = refcountval - 1;
 		} while ((CAS32(&obj->refcount, refcountval, newrefcountval, &obj->lock)) != refcountval);
 		// ANNOTATE_HAPPENS_AFTER(&obj->refcount);
+		sccp_trace(DEBUGCAT_REFCOUNT, SCCP_TRACE_REF_RELEASE, *ptr, obj->type, newrefcountval, lineno);
 		
 		if (dont_expect(newrefcountval == 0)) {
 			int alive = ATOMIC_DECR(&obj->alive, SCCP_LIVE_MARKER, &obj->lock);
@@ -761,6 +712,7 @@ gcc_inline void * const sccp_refcount_release(const void * * const ptr, const ch
 #if CS_REFCOUNT_DEBUG
 	__sccp_refcount_debug((void *) *ptr, NULL, -1, filename, lineno, func);
 #endif
+	sccp_trace(DEBUGCAT_REFCOUNT, SCCP_TRACE_REF_ERROR, *ptr, (uint32_t) -1, 0, lineno);
 	pbx_log(__LOG_VERBOSE, __FILE__, 0, "release", "SCCP (%-15.15s:%-4.4d (%-35.35s)) ALARM !! trying to release a %p with invalid memory reference! this should never happen !\n", filename, lineno, func, obj);
 	pbx_log(LOG_ERROR, "SCCP: (release) Refcount Object %p could not be found (Major Logic Error). Please report to developers\n", *ptr);
 	#ifdef DEBUG
@@ -818,8 +770,7 @@ struct refcount_test **object;
 
 static void refcount_test_destroy(struct refcount_test *obj)
 {
-	sccp_free(object[obj->id]->str);
-	object[obj->id]->str = NULL;
+	sccp_free(obj->str);
 };
 
 static void *refcount_test_thread(void *data)
@@ -928,30 +879,128 @@ AST_TEST_DEFINE(sccp_refcount_tests)
 	sleep(1);
 
 	/* peer directly inside refcounted objects to see if there are any stranded refcounted objects, which should have been destroyed */
-	ast_rwlock_rdlock(&objectslock);
 	RefCountedObject *obj = NULL;
-	for (loop = 0; loop < SCCP_HASH_PRIME; loop++) {
-		if (objects[loop]) {
-			SCCP_RWLIST_RDLOCK(&(objects[loop]->refCountedObjects));
-			SCCP_RWLIST_TRAVERSE(&(objects[loop]->refCountedObjects), obj, list) {
-				pbx_test_validate(test, obj->type != SCCP_REF_TEST);
+	int stranded = 0;
+	for (loop = 0; loop < SCCP_REFCOUNT_STRIPES; loop++) {
+		SCCP_LIST_LOCK(&stripes[loop].refCountedObjects);
+		SCCP_LIST_TRAVERSE(&stripes[loop].refCountedObjects, obj, list) {
+			if (obj->type == SCCP_REF_TEST) {
+				stranded++;
 			}
-			SCCP_RWLIST_UNLOCK(&(objects[loop]->refCountedObjects));
 		}
+		SCCP_LIST_UNLOCK(&stripes[loop].refCountedObjects);
 	}
-	ast_rwlock_unlock(&objectslock);
+	pbx_test_validate(test, stranded == 0);
 	sccp_free(object);
 	return AST_TEST_PASS;
 }
 
+#define BENCH_MAX_THREADS 64
+#define BENCH_OPERATIONS 200000
+struct refcount_bench {
+	int operations;
+	unsigned int seed;
+	enum ast_test_result_state result;
+};
+
+/* same retain/retain/release/release pattern as refcount_test_thread, plus the create / final release of a short lived object
+ * every 16 operations (the way events and linedevices are used), so both retain/release and the object registry are exercised */
+static void *refcount_bench_thread(void *data)
+{
+	struct refcount_bench *bench = data;
+	struct refcount_test *obj = NULL, *obj1 = NULL, *tmp = NULL;
+
+	bench->result = AST_TEST_PASS;
+	for (int op = 0; op < bench->operations; op++) {
+		if (!(obj = sccp_refcount_retain(object[rand_r(&bench->seed) % NUM_OBJECTS], __FILE__, __LINE__, __PRETTY_FUNCTION__))) {
+			bench->result = AST_TEST_FAIL;
+			break;
+		}
+		if (!(obj1 = sccp_refcount_retain(obj, __FILE__, __LINE__, __PRETTY_FUNCTION__))) {
+			sccp_refcount_release((const void ** const)&obj, __FILE__, __LINE__, __PRETTY_FUNCTION__);
+			bench->result = AST_TEST_FAIL;
+			break;
+		}
+		sccp_refcount_release((const void ** const)&obj1, __FILE__, __LINE__, __PRETTY_FUNCTION__);
+		sccp_refcount_release((const void ** const)&obj, __FILE__, __LINE__, __PRETTY_FUNCTION__);
+		if ((op & 15) == 0) {
+			if (!(tmp = (struct refcount_test *) sccp_refcount_object_alloc(sizeof(struct refcount_test), SCCP_REF_TEST, "bench", refcount_test_destroy))) {
+				bench->result = AST_TEST_FAIL;
+				break;
+			}
+			sccp_refcount_release((const void ** const)&tmp, __FILE__, __LINE__, __PRETTY_FUNCTION__);
+		}
+	}
+	return NULL;
+}
+
+AST_TEST_DEFINE(sccp_refcount_bench)
+{
+	switch(cmd) {
+		case TEST_INIT:
+			info->name = "refcount_bench";
+			info->category = "/channels/chan_sccp/";
+			info->summary = "chan-sccp-b refcount benchmark";
+			info->description = "chan-sccp-b retain/release and object registry throughput using 1 to 64 threads";
+			return AST_TEST_NOT_RUN;
+		case TEST_EXECUTE:
+			break;
+	}
+
+	pthread_t t[BENCH_MAX_THREADS];
+	struct refcount_bench bench[BENCH_MAX_THREADS];
+	enum ast_test_result_state res = AST_TEST_PASS;
+	char id[23];
+	int loop, thread, numthreads;
+
+	object = sccp_calloc(NUM_OBJECTS, sizeof(struct refcount_test *));
+	for (loop = 0; loop < NUM_OBJECTS; loop++) {
+		snprintf(id, sizeof(id), "bench/%d", loop);
+		object[loop] = (struct refcount_test *) sccp_refcount_object_alloc(sizeof(struct refcount_test), SCCP_REF_TEST, id, refcount_test_destroy);
+		if (!object[loop]) {
+			res = AST_TEST_FAIL;
+			break;
+		}
+		object[loop]->id = loop;
+	}
+
+	for (numthreads = 1; res == AST_TEST_PASS && numthreads <= BENCH_MAX_THREADS; numthreads <<= 1) {
+		struct timeval start = pbx_tvnow();
+		for (thread = 0; thread < numthreads; thread++) {
+			bench[thread].operations = BENCH_OPERATIONS / numthreads;
+			bench[thread].seed = (unsigned int) (thread + 1);
+			pbx_pthread_create(&t[thread], NULL, refcount_bench_thread, &bench[thread]);
+		}
+		for (thread = 0; thread < numthreads; thread++) {
+			pthread_join(t[thread], NULL);
+			if (bench[thread].result != AST_TEST_PASS) {
+				res = AST_TEST_FAIL;
+			}
+		}
+		int64_t elapsed_us = ast_tvdiff_us(pbx_tvnow(), start);
+		int pairs = (BENCH_OPERATIONS / numthreads) * numthreads * 2;
+		pbx_test_status_update(test, "%2d threads: %d retain/release pairs in %.3f ms, %.0f pairs/sec\n", numthreads, pairs, (double) elapsed_us / 1000, elapsed_us ? (double) pairs * 1000000 / elapsed_us : 0);
+	}
+
+	for (loop = 0; loop < NUM_OBJECTS; loop++) {
+		if (object[loop]) {
+			sccp_refcount_release((const void ** const)&object[loop], __FILE__, __LINE__, __PRETTY_FUNCTION__);
+		}
+	}
+	sccp_free(object);
+	return res;
+}
+
 static void __attribute__((constructor)) sccp_register_tests(void)
 {
 	AST_TEST_REGISTER(sccp_refcount_tests);
+	AST_TEST_REGISTER(sccp_refcount_bench);
 }
 
 static void __attribute__((destructor)) sccp_unregister_tests(void)
 {
 	AST_TEST_UNREGISTER(sccp_refcount_tests);
+	AST_TEST_UNREGISTER(sccp_refcount_bench);
 }
 #endif
 
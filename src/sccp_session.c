@@ -15,11 +15,18 @@
 SCCP_FILE_VERSION(__FILE__, "");
 
 #include "sccp_actions.h"
+#include "sccp_atomic.h"
 #include "sccp_cli.h"
 #include "sccp_device.h"
+#include "sccp_msgstats.h"
 #include "sccp_netsock.h"
+#include "sccp_packet.h"
+#include "sccp_pcap.h"
 #include "sccp_utils.h"
+#include <fnmatch.h>
 #include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #ifndef CS_USE_POLL_COMPAT
 #include <poll.h>
@@ -37,7 +44,12 @@ SCCP_FILE_VERSION(__FILE__, "");
 #  include <asterisk/acl.h>
 #endif
 #include <asterisk/cli.h>
+#include <asterisk/paths.h>
 #include <signal.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#include <fcntl.h>
+#endif
 
 /* global variables -> GLOBALS */
 static pthread_t accept_tid;
@@ -48,6 +60,13 @@ static int accept_sock = -1;
 #define KEEPALIVE_ADDITIONAL_PERCENT_SESSION 1.05								/* extra time allowed for device keepalive overrun (percentage of GLOB(keepalive)) */
 #define KEEPALIVE_ADDITIONAL_PERCENT_DEVICE 1.20								/* extra time allowed for device keepalive overrun (percentage of GLOB(keepalive)) */
 #define KEEPALIVE_ADDITIONAL_PERCENT_ON_CALL 2.00								/* extra time allowed for device keepalive overrun (percentage of GLOB(keepalive)) */
+#define SESSION_REACTOR_MAX_WORKERS 64										/* upper limit for the number of session reactor worker threads */
+#define SESSION_REACTOR_MAX_EVENTS 64										/* max number of epoll events handled per epoll_wait call */
+#define SESSION_REACTOR_WHEEL_SLOTS 256										/* number of one second slots in the keepalive timer wheel */
+#define SESSION_REACTOR_STOP_TIMEOUT 5000									/* max millisecs to wait for a reactor session to be destroyed by its worker */
+#define SESSION_RECV_RING_SIZE (SCCP_MAX_PACKET * 2)								/* size of the session receive ring buffer (excluding the spill area) */
+#define SESSION_SENDQ_MAX_MSGS 32										/* max number of outbound messages coalesced into one sendmsg call */
+#define SESSION_SENDQ_BACKLOG_MAX (SCCP_MAX_PACKET * 256)							/* max number of bytes a reactor session may have waiting for the socket */
 
 /* Lock Macro for Sessions */
 #define sccp_session_lock(x)			pbx_mutex_lock(&(x)->lock)
@@ -59,6 +78,51 @@ void sccp_session_device_thread_exit(void *session);
 void *sccp_session_device_thread(void *session);
 void __sccp_session_stopthread(sessionPtr session, uint8_t newRegistrationState);
 gcc_inline void recalc_wait_time(sccp_session_t *s);
+static void session_capture_check(sccp_session_t * s);
+#ifdef HAVE_SYS_EPOLL_H
+typedef struct sccp_session_reactor_worker sccp_session_reactor_worker_t;
+typedef struct sccp_session_reactor_ack sccp_session_reactor_ack_t;
+static boolean_t sccp_session_reactor_add(sccp_session_t * s);
+static void sccp_session_reactor_end_session(sccp_session_t * s);
+static void sccp_session_reactor_ack_done(sccp_session_reactor_ack_t * ack);
+static void sccp_session_reactor_stop(void);
+static void sccp_session_reactor_watch_writable(sccp_session_t * s, boolean_t writable);
+#endif
+
+/*!
+ * \brief Session Receive Ring Buffer
+ * \note Incoming data is appended behind the unprocessed data, wrapping around at SESSION_RECV_RING_SIZE. When a complete
+ *       message wraps around the end of the ring, the wrapped part is copied into the spill area behind the ring, so that
+ *       every message is contiguous, without moving the buffer. Processed messages are zeroed again, so that everything but
+ *       the unprocessed data (including the spill area) is always zero and the last message can be dispatched in place.
+ */
+typedef struct sccp_session_recvbuf {
+	size_t head;												/*!< Offset of the first unprocessed byte */
+	size_t len;												/*!< Number of unprocessed bytes */
+	unsigned char data[SESSION_RECV_RING_SIZE + SCCP_MAX_PACKET] __attribute__((aligned(8)));		/*!< Ring + Spill Area */
+} sccp_session_recvbuf_t;
+
+/*!
+ * \brief Session Send Queue
+ * \note While the session thread is handling received messages the queue is corked: messages it sends are collected and written
+ *       with a single sendmsg call once the received data has been processed (flush on idle), or as soon as the queue fills up.
+ *       Messages sent by any other thread are written immediately, together with whatever was queued before them.
+ *       Reactor sessions never block the sender: what the socket does not accept is kept in the backlog, which the owning worker
+ *       writes out once the socket is writable again (EPOLLOUT).
+ *       Protected by the session write_lock.
+ */
+typedef struct sccp_session_sendq {
+	sccp_msg_t *msgs[SESSION_SENDQ_MAX_MSGS];								/*!< Queued messages, in send order */
+	uint32_t count;												/*!< Number of queued messages */
+	boolean_t corked;											/*!< Collect messages sent by the owner thread */
+	pthread_t owner;											/*!< Thread that corked the queue */
+	unsigned long messages;											/*!< Statistics: messages written */
+	unsigned long syscalls;											/*!< Statistics: sendmsg calls used to write them */
+#ifdef HAVE_SYS_EPOLL_H
+	unsigned char *backlog;											/*!< Reactor sessions: bytes not accepted by the socket yet, in send order */
+	size_t backlog_len;
+#endif
+} sccp_session_sendq_t;
 
 /*!
  * \brief SCCP Session Structure
@@ -80,6 +144,20 @@ struct sccp_session {
 	struct sockaddr_storage ourip;										/*!< Our IP is for rtp use */
 	struct sockaddr_storage ourIPv4;
 	char designator[40];
+	boolean_t oncall;											/*!< Device had an active channel during the last keepalive recalculation */
+	boolean_t tokenThread;											/*!< Device holds a token, only TCP-Keepalive is checked */
+	sccp_session_recvbuf_t recv;										/*!< Receive Buffer, holds partially received messages between reads */
+	sccp_session_sendq_t sendq;										/*!< Send Queue, coalesces outbound messages (write_lock) */
+	sccp_pcap_t *capture;											/*!< Packet Capture, NULL when not capturing (write_lock) */
+	boolean_t replay;											/*!< Replay Session (sccp replay): no socket, sent messages are dropped */
+#ifdef HAVE_SYS_EPOLL_H
+	sccp_session_reactor_worker_t *worker;									/*!< Reactor Worker owning this session (NULL when using a device thread) */
+	sccp_session_t *pending_next;										/*!< Next session waiting to be adopted by the worker */
+	sccp_session_t *timer_next;										/*!< Next session in the same timer wheel slot */
+	sccp_session_t **timer_prev;										/*!< Pointer to the pointer referencing us in the timer wheel (NULL = not armed) */
+	time_t timer_expire;											/*!< Time of the next keepalive check */
+	sccp_session_reactor_ack_t *stop_ack;									/*!< Signalled once destroyed, for threads waiting in end_session (lock) */
+#endif
 };														/*!< SCCP Session Structure */
 
 boolean_t sccp_session_getOurIP(constSessionPtr session, struct sockaddr_storage * const sockAddrStorage, int family)
@@ -231,62 +309,413 @@ static int session_dissect_header(sccp_session_t * s, sccp_header_t * header)
 	return result;
 }
 
-static gcc_inline int session_buffer2msg(sccp_session_t * s, unsigned char *buffer, int lenAccordingToPacketHeader, sccp_msg_t *msg) 
+/*!
+ * \brief Dispatch a complete message from the receive buffer
+ * \param s SCCP Session
+ * \param buffer Start of the message inside the receive buffer (contiguous)
+ * \param lenAccordingToPacketHeader Message length including header, as announced by the device
+ * \param padded The receive buffer is zero behind this message (it is the last data received)
+ * \param msg Scratch message, used when the message cannot be handed out as a view into the receive buffer
+ * \param dispatch Message Handler
+ *
+ * \note Handlers may read up to SCCP_MAX_PACKET and expect zeros past the known size of the message. When the message is the
+ *       last data in the receive buffer (the common case for a phone) and has at least the known size, the handlers get a view
+ *       straight into the receive buffer, which is zero behind it. Otherwise the message is copied into the zeroed msg.
+ */
+static gcc_inline int session_buffer2msg(sccp_session_t * s, unsigned char *buffer, int lenAccordingToPacketHeader, boolean_t padded, sccp_msg_t *msg, int (*const dispatch)(constMessagePtr msg, constSessionPtr s))
 {
 	sccp_header_t msg_header = {0};
 	memcpy(&msg_header, buffer, SCCP_PACKET_HEADER);
 	int lenAccordingToOurProtocolSpec = session_dissect_header(s, &msg_header);
 	if (dont_expect(lenAccordingToOurProtocolSpec < 0)) {
-		if (lenAccordingToOurProtocolSpec == -2) {
-			return 0;
-		}
-		lenAccordingToOurProtocolSpec = 0;									// unknown message, read it and discard content completely
+		return 0;											// invalid or unknown message, read it and discard content completely
 	}
 	if (dont_expect(lenAccordingToPacketHeader > lenAccordingToOurProtocolSpec)) {					// show out discarded bytes
 		pbx_log(LOG_WARNING, "%s: (session_dissect_msg) Incoming message is bigger(%d) than known size(%d). Packet looks like!\n", DEV_ID_LOG(s->device), lenAccordingToPacketHeader, lenAccordingToOurProtocolSpec);
-		buffer[lenAccordingToPacketHeader + 1] = '\0';								// terminate buffer
 		sccp_dump_packet(buffer, lenAccordingToPacketHeader);
 	}
-	
+
+	if (do_expect(padded && lenAccordingToPacketHeader >= lenAccordingToOurProtocolSpec && !((uintptr_t) buffer & (sizeof(uint32_t) - 1)))) {
+		sccp_msg_t *view = (sccp_msg_t *) buffer;
+		if (dont_expect(lenAccordingToPacketHeader > lenAccordingToOurProtocolSpec)) {
+			memset(buffer + lenAccordingToOurProtocolSpec, 0, lenAccordingToPacketHeader - lenAccordingToOurProtocolSpec);	// hide the bytes we do not know about, like the copy does
+		}
+		view->header.length = lenAccordingToOurProtocolSpec;						// patch up header.length to new size (already captured, consumed after dispatch)
+		return dispatch(view, s);
+	}
+
 	if (((unsigned int)lenAccordingToPacketHeader) < ((unsigned int)lenAccordingToOurProtocolSpec)){
 		sccp_log_and((DEBUGCAT_SOCKET + DEBUGCAT_MESSAGE)) (VERBOSE_PREFIX_3 "%s: (session_dissect_msg) Incoming message is smaller(%d) than known size(%d).\n", DEV_ID_LOG(s->device), lenAccordingToPacketHeader, lenAccordingToOurProtocolSpec);
 		lenAccordingToOurProtocolSpec = lenAccordingToPacketHeader;
 	}
-
 	memset(msg, 0, SCCP_MAX_PACKET);
 	memcpy(msg, buffer, lenAccordingToOurProtocolSpec);
 	msg->header.length = lenAccordingToOurProtocolSpec;								// patch up msg->header.length to new size
-	return sccp_handle_message(msg, s);
+	return dispatch(msg, s);
+}
+
+/*!
+ * \brief Get the contiguous free space at the end of the receive ring buffer
+ * \param rb Receive Buffer
+ * \param space Returns the number of bytes that can be written at the returned position
+ * \return position to append new data
+ */
+static gcc_inline unsigned char *session_recvbuf_space(sccp_session_recvbuf_t *rb, size_t *space)
+{
+	size_t tail = rb->head + rb->len;
+	if (tail >= SESSION_RECV_RING_SIZE) {
+		tail -= SESSION_RECV_RING_SIZE;
+		*space = rb->head - tail;
+	} else {
+		*space = SESSION_RECV_RING_SIZE - tail;
+	}
+	return rb->data + tail;
+}
+
+static gcc_inline unsigned char session_recvbuf_peek(const sccp_session_recvbuf_t *rb, size_t offset)
+{
+	offset += rb->head;
+	return rb->data[offset < SESSION_RECV_RING_SIZE ? offset : offset - SESSION_RECV_RING_SIZE];
+}
+
+/*!
+ * \brief Stop capturing the session
+ * \lock
+ *      - session->write_lock (has to be held by the caller)
+ */
+static void __session_capture_stop(sccp_session_t * s)
+{
+	if (s->capture) {
+		sccp_log((DEBUGCAT_SOCKET)) (VERBOSE_PREFIX_3 "%s: Capture to '%s' stopped after %u frames\n", s->designator, sccp_pcap_getFilename(s->capture), sccp_pcap_getFrames(s->capture));
+		sccp_pcap_close(s->capture);
+		s->capture = NULL;
+	}
+}
+
+/*!
+ * \brief Add a message to the session capture, stops capturing when the file cannot be written
+ * \lock
+ *      - session->write_lock (has to be held by the caller)
+ */
+static void __session_capture(sccp_session_t * s, sccp_pcap_direction_t direction, const void *data, size_t len)
+{
+	if (s->capture && sccp_pcap_write(s->capture, direction, data, len) != 0) {
+		pbx_log(LOG_WARNING, "%s: Could not write to capture '%s', capture stopped\n", s->designator, sccp_pcap_getFilename(s->capture));
+		__session_capture_stop(s);
+	}
+}
+
+/* received messages are captured by the session thread, which does not hold the write_lock */
+static void session_capture_inbound(sccp_session_t * s, const unsigned char *data, size_t len)
+{
+	pbx_mutex_lock(&s->write_lock);
+	__session_capture(s, SCCP_PCAP_INBOUND, data, len);
+	pbx_mutex_unlock(&s->write_lock);
 }
 
-static gcc_inline int process_buffer(sccp_session_t * s, sccp_msg_t *msg, unsigned char *buffer, size_t *len)
+static gcc_inline int process_buffer(sccp_session_t * s, sccp_msg_t *msg, sccp_session_recvbuf_t *rb, int (*const dispatch)(constMessagePtr msg, constSessionPtr s))
 {
 	int res = 0;
-	while (*len >= SCCP_PACKET_HEADER && *len <= SCCP_MAX_PACKET * 2) {										// We have at least SCCP_PACKET_HEADER, so we have the payload length
-		uint32_t hdr_len = buffer[0] | (buffer[1] << 8) | (buffer[2] << 16) | (buffer[3] << 24);
+	while (rb->len >= SCCP_PACKET_HEADER) {									// We have at least SCCP_PACKET_HEADER, so we have the payload length
+		uint32_t hdr_len = session_recvbuf_peek(rb, 0) | (session_recvbuf_peek(rb, 1) << 8) | (session_recvbuf_peek(rb, 2) << 16) | (session_recvbuf_peek(rb, 3) << 24);
 		uint32_t payload_len = letohl(hdr_len) + (SCCP_PACKET_HEADER - 4);
-		if (*len < payload_len) {
-			break;												// Too short - haven't received whole payload yet, go poll for more
-		}
-
 		if (dont_expect(payload_len < SCCP_PACKET_HEADER || payload_len > SCCP_MAX_PACKET)) {
 			pbx_log(LOG_ERROR, "%s: (process_buffer) Size of the data payload in the packet is bigger than max packet, close connection !\n", DEV_ID_LOG(s->device));
 			res = -1;
 			break;
 		}
-		if (dont_expect(session_buffer2msg(s, buffer, payload_len, msg) != 0)) {
+		if (rb->len < payload_len) {
+			break;												// Too short - haven't received whole payload yet, go poll for more
+		}
+
+		if (rb->head + payload_len > SESSION_RECV_RING_SIZE) {						// message wraps around, mirror the wrapped part into the spill area
+			memcpy(rb->data + SESSION_RECV_RING_SIZE, rb->data, rb->head + payload_len - SESSION_RECV_RING_SIZE);
+		}
+		if (dont_expect(s->capture != NULL)) {								/* before dispatching, which patches up the header */
+			session_capture_inbound(s, rb->data + rb->head, payload_len);
+		}
+		if (dont_expect(session_buffer2msg(s, rb->data + rb->head, payload_len, rb->len == payload_len, msg, dispatch) != 0)) {
 			res = -2;
 			break;
 		}
 
-		*len -= payload_len;
-		if (*len > 0) {												// Now shuffle the remaining data in the buffer back to the start
-			memmove(buffer + 0, buffer + payload_len, *len);
+		memset(rb->data + rb->head, 0, payload_len);							// keep everything but the unprocessed data zeroed
+		if (rb->head + payload_len > SESSION_RECV_RING_SIZE) {
+			memset(rb->data, 0, rb->head + payload_len - SESSION_RECV_RING_SIZE);
+		}
+		rb->len -= payload_len;
+		rb->head += payload_len;
+		if (rb->head >= SESSION_RECV_RING_SIZE) {
+			rb->head -= SESSION_RECV_RING_SIZE;
+		}
+		if (!rb->len) {
+			rb->head = 0;										// start at the beginning again, keeps most messages contiguous
 		}
 	}
 	return res;
 }
 
+#ifdef HAVE_SYS_EPOLL_H
+/*!
+ * \brief Write all queued messages of a reactor session without blocking, keeping what the socket does not accept in the backlog
+ * \param s SCCP Session
+ * \param more More messages will follow shortly (MSG_MORE)
+ * \return number of bytes written or kept in the backlog, -1 on failure
+ * \note New messages are appended behind a non-empty backlog, to keep them in order
+ *
+ * \lock
+ *      - session->write_lock (has to be held by the caller)
+ */
+static int session_sendq_flush_nonblocking(sccp_session_t * s, boolean_t more)
+{
+	sccp_session_sendq_t *q = &s->sendq;
+	struct iovec iov[SESSION_SENDQ_MAX_MSGS];
+	struct msghdr mh = { 0 };
+	unsigned char *backlog = NULL;
+	size_t remaining = 0;
+	ssize_t bufLen = 0;
+	ssize_t res = 0;
+	uint32_t idx;
+	int flags = MSG_DONTWAIT;
+
+	for (idx = 0; idx < q->count; idx++) {
+		iov[idx].iov_base = q->msgs[idx];
+		iov[idx].iov_len = letohl(q->msgs[idx]->header.length) + 8;
+		bufLen += iov[idx].iov_len;
+	}
+	mh.msg_iov = iov;
+	mh.msg_iovlen = q->count;
+#ifdef MSG_MORE
+	if (more) {
+		flags |= MSG_MORE;
+	}
+#endif
+	if (!q->backlog_len) {
+		do {
+			res = sendmsg(s->fds[0].fd, &mh, flags);
+			q->syscalls++;
+		} while (res < 0 && errno == EINTR);
+		if (res < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+			socket_get_error(s, __FILE__, __LINE__, __PRETTY_FUNCTION__, errno);
+			bufLen = -1;
+			goto EXIT;
+		}
+		while (res > 0 && mh.msg_iovlen > 0 && (size_t) res >= mh.msg_iov->iov_len) {			/* skip the messages that were written completely */
+			res -= mh.msg_iov->iov_len;
+			mh.msg_iov++;
+			mh.msg_iovlen--;
+		}
+		if (res > 0) {
+			mh.msg_iov->iov_base = (uint8_t *) mh.msg_iov->iov_base + res;
+			mh.msg_iov->iov_len -= res;
+		}
+	}
+	for (idx = 0; idx < mh.msg_iovlen; idx++) {
+		remaining += mh.msg_iov[idx].iov_len;
+	}
+	if (remaining) {
+		if (q->backlog_len + remaining > SESSION_SENDQ_BACKLOG_MAX || !(backlog = (unsigned char *) sccp_realloc(q->backlog, q->backlog_len + remaining))) {
+			pbx_log(LOG_ERROR, "%s: Device is not reading, %d bytes waiting to be sent, giving up session\n", DEV_ID_LOG(s->device), (int) (q->backlog_len + remaining));
+			bufLen = -1;
+			goto EXIT;
+		}
+		q->backlog = backlog;
+		for (idx = 0; idx < mh.msg_iovlen; idx++) {
+			memcpy(q->backlog + q->backlog_len, mh.msg_iov[idx].iov_base, mh.msg_iov[idx].iov_len);
+			q->backlog_len += mh.msg_iov[idx].iov_len;
+		}
+		if (q->backlog_len == remaining) {
+			sccp_session_reactor_watch_writable(s, TRUE);
+		}
+	}
+EXIT:
+	q->messages += q->count;
+	for (idx = 0; idx < q->count; idx++) {
+		sccp_packet_free(q->msgs[idx]);
+	}
+	q->count = 0;
+	return (int) bufLen;
+}
+
+/*!
+ * \brief Write as much of the backlog of a reactor session as the socket accepts (called by the owning worker on EPOLLOUT)
+ * \return 0 on success, -1 on failure
+ *
+ * \lock
+ *      - session->write_lock
+ */
+static int session_sendq_write_backlog(sccp_session_t * s)
+{
+	sccp_session_sendq_t *q = &s->sendq;
+	ssize_t res = 0;
+	int result = 0;
+
+	pbx_mutex_lock(&s->write_lock);
+	while (q->backlog_len) {
+		res = send(s->fds[0].fd, q->backlog, q->backlog_len, MSG_DONTWAIT);
+		q->syscalls++;
+		if (res < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				socket_get_error(s, __FILE__, __LINE__, __PRETTY_FUNCTION__, errno);
+				result = -1;
+			}
+			break;
+		}
+		q->backlog_len -= res;
+		memmove(q->backlog, q->backlog + res, q->backlog_len);
+	}
+	if (!q->backlog_len && q->backlog) {
+		sccp_free(q->backlog);
+		sccp_session_reactor_watch_writable(s, FALSE);
+	}
+	pbx_mutex_unlock(&s->write_lock);
+	return result;
+}
+#endif
+
+/*!
+ * \brief Write all queued messages to the socket using as few sendmsg calls as possible
+ * \param s SCCP Session
+ * \param more More messages will follow shortly (MSG_MORE), don't push a partial segment out yet
+ * \return number of bytes written or -1 on failure
+ * \note The queued messages are released, whether they could be written or not
+ *
+ * \lock
+ *      - session->write_lock (has to be held by the caller)
+ */
+static int session_sendq_flush(sccp_session_t * s, boolean_t more)
+{
+	sccp_session_sendq_t *q = &s->sendq;
+	struct iovec iov[SESSION_SENDQ_MAX_MSGS];
+	struct msghdr mh = { 0 };
+	ssize_t bytesSent = 0;
+	ssize_t bufLen = 0;
+	ssize_t res = 0;
+	uint backoff = WRITE_BACKOFF;
+	uint32_t idx;
+	int flags = 0;
+
+	if (!q->count) {
+		return 0;
+	}
+	if (s->replay) {											/* no socket, the messages only end up in the capture */
+		for (idx = 0; idx < q->count; idx++) {
+			bufLen += letohl(q->msgs[idx]->header.length) + 8;
+			sccp_packet_free(q->msgs[idx]);
+		}
+		q->messages += q->count;
+		q->count = 0;
+		return (int) bufLen;
+	}
+#ifdef HAVE_SYS_EPOLL_H
+	if (s->worker) {											/* never block the sender, the owning worker writes the rest */
+		return session_sendq_flush_nonblocking(s, more);
+	}
+#endif
+	for (idx = 0; idx < q->count; idx++) {
+		iov[idx].iov_base = q->msgs[idx];
+		iov[idx].iov_len = letohl(q->msgs[idx]->header.length) + 8;
+		bufLen += iov[idx].iov_len;
+	}
+	mh.msg_iov = iov;
+	mh.msg_iovlen = q->count;
+#ifdef MSG_MORE
+	if (more) {
+		flags |= MSG_MORE;
+	}
+#endif
+	do {														/* a stopping session still gets its last messages (i.e. UnregisterAck) */
+		res = sendmsg(s->fds[0].fd, &mh, flags);
+		q->syscalls++;
+		if (res <= 0) {
+			if (res < 0 && errno == EINTR) {
+				usleep(backoff);								/* back off to give network/other threads some time */
+				backoff *= 2;
+				continue;
+			}
+			socket_get_error(s, __FILE__, __LINE__, __PRETTY_FUNCTION__, errno);
+			break;
+		}
+		bytesSent += res;
+		while (mh.msg_iovlen > 0 && (size_t) res >= mh.msg_iov->iov_len) {				/* skip the messages that were written completely */
+			res -= mh.msg_iov->iov_len;
+			mh.msg_iov++;
+			mh.msg_iovlen--;
+		}
+		if (mh.msg_iovlen > 0) {
+			mh.msg_iov->iov_base = (uint8_t *) mh.msg_iov->iov_base + res;
+			mh.msg_iov->iov_len -= res;
+		}
+	} while (mh.msg_iovlen > 0 && !s->session_stop && s->fds[0].fd > 0);
+	q->messages += q->count;
+	for (idx = 0; idx < q->count; idx++) {
+		sccp_packet_free(q->msgs[idx]);
+	}
+	q->count = 0;
+
+	if (bytesSent < bufLen) {
+		pbx_log(LOG_ERROR, "%s: Could only send %d of %d bytes!\n", DEV_ID_LOG(s->device), (int) bytesSent, (int) bufLen);
+		return -1;
+	}
+	return (int) bytesSent;
+}
+
+/*!
+ * \brief Start collecting the messages sent by the calling thread
+ */
+static void session_sendq_cork(sccp_session_t * s)
+{
+	pbx_mutex_lock(&s->write_lock);
+	s->sendq.corked = TRUE;
+	s->sendq.owner = pthread_self();
+	pbx_mutex_unlock(&s->write_lock);
+}
+
+/*!
+ * \brief Stop collecting and write out everything that was queued
+ */
+static void session_sendq_uncork(sccp_session_t * s)
+{
+	int res = 0;
+
+	pbx_mutex_lock(&s->write_lock);
+	s->sendq.corked = FALSE;
+	res = session_sendq_flush(s, FALSE);
+	pbx_mutex_unlock(&s->write_lock);
+	if (res < 0) {
+		__sccp_session_stopthread(s, SKINNY_DEVICE_RS_FAILED);
+	}
+}
+
+/*!
+ * \brief Receive data from the session socket into the receive buffer and dispatch all complete messages
+ * \param s SCCP Session
+ * \param msg Scratch Message
+ * \param result Result of recv
+ * \return 0 on success, -1 when the message stream could not be handled
+ */
+static int session_recv_and_process(sccp_session_t * s, sccp_msg_t *msg, int *result)
+{
+	size_t space = 0;
+	unsigned char *pos = session_recvbuf_space(&s->recv, &space);
+
+	*result = recv(s->fds[0].fd, pos, space, 0);
+	if (*result <= 0) {
+		return 0;
+	}
+	s->recv.len += *result;
+	if (s->recv.len >= SESSION_RECV_RING_SIZE) {
+		return -1;
+	}
+	session_sendq_cork(s);
+	int res = process_buffer(s, msg, &s->recv, sccp_handle_message);
+	session_sendq_uncork(s);
+	return res != 0 ? -1 : 0;
+}
+
 /*!
  * \brief Find Session in Globals Lists
  * \param s SCCP Session
@@ -297,16 +726,10 @@ static gcc_inline int process_buffer(sccp_session_t * s, sccp_msg_t *msg, unsign
  */
 static boolean_t sccp_session_findBySession(sccp_session_t * s)
 {
-	sccp_session_t *session;
 	boolean_t res = FALSE;
 
-	SCCP_RWLIST_WRLOCK(&GLOB(sessions));
-	SCCP_RWLIST_TRAVERSE(&GLOB(sessions), session, list) {
-		if (session == s) {
-			res = TRUE;
-			break;
-		}
-	}
+	SCCP_RWLIST_RDLOCK(&GLOB(sessions));
+	res = sccp_hashtable_find(GLOB(session_index), s) ? TRUE : FALSE;
 	SCCP_RWLIST_UNLOCK(&GLOB(sessions));
 	return res;
 }
@@ -324,12 +747,13 @@ static boolean_t sccp_session_addToGlobals(sccp_session_t * s)
 	boolean_t res = FALSE;
 
 	if (s) {
-		if (!sccp_session_findBySession(s)) {;
-			SCCP_RWLIST_WRLOCK(&GLOB(sessions));
+		SCCP_RWLIST_WRLOCK(&GLOB(sessions));
+		if (!sccp_hashtable_find(GLOB(session_index), s)) {
 			SCCP_LIST_INSERT_HEAD(&GLOB(sessions), s, list);
+			sccp_hashtable_insert(GLOB(session_index), s, s);
 			res = TRUE;
-			SCCP_RWLIST_UNLOCK(&GLOB(sessions));
 		}
+		SCCP_RWLIST_UNLOCK(&GLOB(sessions));
 	}
 	return res;
 }
@@ -344,19 +768,14 @@ static boolean_t sccp_session_addToGlobals(sccp_session_t * s)
  */
 static boolean_t sccp_session_removeFromGlobals(sccp_session_t * s)
 {
-	sccp_session_t *session;
 	boolean_t res = FALSE;
 
 	if (s) {
 		SCCP_RWLIST_WRLOCK(&GLOB(sessions));
-		SCCP_RWLIST_TRAVERSE_SAFE_BEGIN(&GLOB(sessions), session, list) {
-			if (session == s) {
-				SCCP_LIST_REMOVE_CURRENT(list);
-				res = TRUE;
-				break;
-			}
+		if (sccp_hashtable_remove(GLOB(session_index), s, s)) {
+			SCCP_RWLIST_REMOVE(&GLOB(sessions), s, list);
+			res = TRUE;
 		}
-		SCCP_RWLIST_TRAVERSE_SAFE_END;
 		SCCP_RWLIST_UNLOCK(&GLOB(sessions));
 	}
 	return res;
@@ -385,8 +804,12 @@ void sccp_session_terminateAll()
 	while (!SCCP_LIST_EMPTY(&GLOB(sessions)) && waitloop-- > 0) {
 		usleep(100);
 	}
+#ifdef HAVE_SYS_EPOLL_H
+	sccp_session_reactor_stop();
+#endif
 
 	if (SCCP_LIST_EMPTY(&GLOB(sessions))) {
+		sccp_hashtable_destroy(&GLOB(session_index));
 		SCCP_RWLIST_HEAD_DESTROY(&GLOB(sessions));
 	}
 }
@@ -443,6 +866,9 @@ static int __sccp_session_addDevice(sessionPtr session, constDevicePtr device)
 			}
 		}
 		sccp_session_unlock(session);
+		if (res == 1) {
+			session_capture_check(session);								/* device name might match the capture pattern */
+		}
 	}
 	return res;
 }
@@ -505,9 +931,16 @@ static void destroy_session(sccp_session_t * s, uint8_t cleanupTime)
 	}
 	
 	if (s) {
+#ifdef HAVE_SYS_EPOLL_H
+		sccp_session_reactor_ack_t *ack = NULL;
+#endif
 		sccp_log((DEBUGCAT_SOCKET)) (VERBOSE_PREFIX_3 "SCCP: Destroy Session %s\n", addrStr);
 		/* closing fd's */
 		sccp_session_lock(s);
+#ifdef HAVE_SYS_EPOLL_H
+		ack = s->stop_ack;
+		s->stop_ack = NULL;
+#endif
 		if (s->fds[0].fd > 0) {
 			sccp_log((DEBUGCAT_SOCKET)) (VERBOSE_PREFIX_3 "SCCP: Shutdown socket %d\n", s->fds[0].fd);
 			shutdown(s->fds[0].fd, SHUT_RDWR);
@@ -517,10 +950,28 @@ static void destroy_session(sccp_session_t * s, uint8_t cleanupTime)
 		}
 		sccp_session_unlock(s);
 
+		/* dropping messages that could not be sent anymore */
+		pbx_mutex_lock(&s->write_lock);
+		while (s->sendq.count) {
+			sccp_packet_free(s->sendq.msgs[--s->sendq.count]);
+		}
+#ifdef HAVE_SYS_EPOLL_H
+		if (s->sendq.backlog) {
+			sccp_free(s->sendq.backlog);
+			s->sendq.backlog_len = 0;
+		}
+#endif
+		__session_capture_stop(s);
+		pbx_mutex_unlock(&s->write_lock);
+
 		/* destroying mutex and cleaning the session */
+		sccp_mutex_destroy(&s->write_lock);
 		sccp_mutex_destroy(&s->lock);
 		sccp_free(s);
 		s = NULL;
+#ifdef HAVE_SYS_EPOLL_H
+		sccp_session_reactor_ack_done(ack);
+#endif
 	}
 }
 
@@ -584,6 +1035,36 @@ gcc_inline void recalc_wait_time(sccp_session_t *s)
 	}
 }
 
+/*!
+ * \brief Check the device attached to the session for pending updates and keepalive changes
+ * \param s SCCP Session
+ * \return TRUE if a pending device update was handled (s->device might have changed)
+ */
+static boolean_t session_check_device(sccp_session_t * s)
+{
+	sccp_device_t *d = s->device;
+	if (!d) {
+		return FALSE;
+	}
+	if (d->pendingUpdate || d->pendingDelete) {
+		pbx_rwlock_rdlock(&GLOB(lock));
+		boolean_t reload_in_progress = GLOB(reload_in_progress);
+		pbx_rwlock_unlock(&GLOB(lock));
+		if (reload_in_progress == FALSE) {
+			sccp_device_check_update(d);
+		}
+		return TRUE;
+	}
+	if ((d->active_channel ? TRUE : FALSE) != s->oncall) {
+		recalc_wait_time(s);
+		s->oncall = (d->active_channel) ? TRUE : FALSE;
+	}
+	if (d->status.token == SCCP_TOKEN_STATE_ACK) {
+		s->tokenThread = TRUE;										// only does TCP-Keepalive
+	}
+	return FALSE;
+}
+
 /*!
  * \brief Socket Device Thread
  * \param session SCCP Session
@@ -600,10 +1081,6 @@ void *sccp_session_device_thread(void *session)
 		return NULL;
 	}
 
-	boolean_t oncall = TRUE;
-	boolean_t tokenThread = FALSE;
-	unsigned char recv_buffer[SCCP_MAX_PACKET * 2] = "";
-	size_t recv_len = 0;
 	sccp_msg_t msg = { {0,} };
 
 	pthread_cleanup_push(sccp_session_device_thread_exit, session);
@@ -611,24 +1088,8 @@ void *sccp_session_device_thread(void *session)
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
 
 	while (s->fds[0].fd > 0 && !s->session_stop) {
-		if (s->device) {
-			sccp_device_t *d = s->device;
-			if (d->pendingUpdate || d->pendingDelete) {
-				pbx_rwlock_rdlock(&GLOB(lock));
-				boolean_t reload_in_progress = GLOB(reload_in_progress);
-				pbx_rwlock_unlock(&GLOB(lock));
-				if (reload_in_progress == FALSE) {
-					sccp_device_check_update(d);
-				}
-				continue;									// make sure  s->device is still valid
-			}
-			if ((d->active_channel ? TRUE : FALSE) != oncall) {
-				recalc_wait_time(s);
-				oncall = (d->active_channel) ? TRUE : FALSE;
-			}
-			if (d->status.token == SCCP_TOKEN_STATE_ACK) {
-				tokenThread = TRUE;								// only does TCP-Keepalive
-			}
+		if (session_check_device(s)) {
+			continue;										// make sure  s->device is still valid
 		}
 		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
 		sccp_log_and((DEBUGCAT_SOCKET + DEBUGCAT_HIGH)) (VERBOSE_PREFIX_4 "%s: set poll timeout %d for session %d\n", DEV_ID_LOG(s->device), (int) s->keepAliveInterval, s->fds[0].fd);
@@ -645,22 +1106,23 @@ void *sccp_session_device_thread(void *session)
 			}
 		} else if (0 == res) {										/* poll timeout */
 			uintmax_t timediff = (uintmax_t)time(0) - (uintmax_t)s->lastKeepAlive;
-			if (!tokenThread && timediff >= s->keepAlive) {
+			if (!s->tokenThread && timediff >= s->keepAlive) {
 				pbx_log(LOG_NOTICE, "%s: Closing session because connection timed out after %ju seconds (ip-address: %s).\n", DEV_ID_LOG(s->device), timediff, s->designator);
 				__sccp_session_stopthread(s, SKINNY_DEVICE_RS_TIMEOUT);
 				break;
 			}
 		} else if (res > 0) {										/* poll data processing */
 			if (s->fds[0].revents & POLLIN || s->fds[0].revents & POLLPRI) {			/* POLLIN | POLLPRI */
-				//sccp_log_and((DEBUGCAT_SOCKET + DEBUGCAT_HIGH)) (VERBOSE_PREFIX_2 "%s: Session New Data Arriving at buffer position:%lu\n", DEV_ID_LOG(s->device), recv_len);
-				int result = recv(s->fds[0].fd, recv_buffer + recv_len, (SCCP_MAX_PACKET * 2) - recv_len, 0);
+				//sccp_log_and((DEBUGCAT_SOCKET + DEBUGCAT_HIGH)) (VERBOSE_PREFIX_2 "%s: Session New Data Arriving at buffer position:%lu\n", DEV_ID_LOG(s->device), s->recv.len);
+				int result = 0;
+				int processed = session_recv_and_process(s, &msg, &result);
 				s->lastKeepAlive = time(0);
 				if (result <= 0) {
 					if (result < 0 || (errno != EINTR || errno != EAGAIN)) {
 						socket_get_error(s, __FILE__, __LINE__, __PRETTY_FUNCTION__, errno);
 						break;
 					}				
-				} else if (!((recv_len += result) && ((SCCP_MAX_PACKET * 2) - recv_len) && process_buffer(s, &msg, recv_buffer, &recv_len) == 0)) {
+				} else if (processed != 0) {
 					pbx_log(LOG_ERROR, "%s: (netsock_device_thread) Received a packet or message (with result:%d) which we could not handle, giving up session: %p!\n", s->designator, result, s);
 					sccp_dump_msg(&msg);
 					if (s->device) {
@@ -738,50 +1200,629 @@ gcc_inline void sccp_session_stopthread(constSessionPtr session, uint8_t newRegi
 		pthread_t ptid = pthread_self();
 		if (ptid == s->session_thread) {
 			__sccp_session_stopthread(s, newRegistrationState);
+#ifdef HAVE_SYS_EPOLL_H
+		} else if (s->worker) {
+			sccp_session_reactor_end_session(s);
+#endif
 		} else {
 			__sccp_netsock_end_device_thread(s);
 		}
 	}
 }
 
-static boolean_t sccp_session_new_socket_allowed(struct sockaddr_storage *sin)
+#ifdef HAVE_SYS_EPOLL_H
+/* -------------------------------------------------------------------------------------------------------SESSION REACTOR- */
+/*!
+ * \brief Session Reactor Worker
+ * \note Each worker owns an epoll set, a set of sessions and a keepalive timer wheel. A session is only ever read and
+ *       dispatched by the worker it was assigned to, which preserves message ordering per device.
+ */
+struct sccp_session_reactor_worker {
+	int epfd;												/*!< Epoll File Descriptor */
+	int wakeup[2];												/*!< Wakeup Pipe (used to hand over new sessions / stop the worker) */
+	pthread_t thread;											/*!< Worker Thread */
+	volatile boolean_t running;										/*!< Worker should keep running */
+	sccp_mutex_t pending_lock;										/*!< Protects the pending list */
+	sccp_session_t *pending;										/*!< Sessions handed over by the accept thread, waiting to be adopted */
+	uint32_t num_sessions;											/*!< Number of sessions owned by this worker */
+	time_t wheel_time;											/*!< Last processed timer wheel tick */
+	sccp_session_t *wheel[SESSION_REACTOR_WHEEL_SLOTS];							/*!< Keepalive Timer Wheel (one slot per second) */
+	sccp_msg_t msg;												/*!< Scratch Message used while dispatching */
+	struct epoll_event *events;										/*!< Epoll events being dispatched (NULL outside of dispatching) */
+	int num_events;												/*!< Number of epoll events being dispatched */
+	sccp_session_t *current;										/*!< Session being dispatched */
+	volatile int waiting;											/*!< Worker is waiting for another worker to destroy a session */
+};
+
+AST_MUTEX_DEFINE_STATIC(reactor_lock);
+static sccp_session_reactor_worker_t *reactor_workers = NULL;
+static uint32_t reactor_num_workers = 0;
+static uint32_t reactor_next_worker = 0;
+static pthread_once_t reactor_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t reactor_worker_key;									/* points to its worker on a reactor worker thread, NULL elsewhere */
+static boolean_t reactor_key_created = FALSE;
+
+/*!
+ * \brief Session Destroy Acknowledgement
+ * \note Shared by destroy_session and the threads waiting for it in end_session, the last one to let go frees it. Waiting on
+ *       this, instead of looking the session pointer up, can not be fooled by a new session allocated at the same address.
+ */
+struct sccp_session_reactor_ack {
+	sccp_mutex_t lock;
+	pbx_cond_t cond;
+	boolean_t done;												/*!< Session has been destroyed */
+	int refcount;												/*!< destroy_session + waiting threads */
+};
+
+static void sccp_session_reactor_ack_release(sccp_session_reactor_ack_t * ack)
 {
-	char addrStr[INET6_ADDRSTRLEN];
-	sccp_copy_string(addrStr, sccp_netsock_stringify(sin), sizeof(addrStr));
-	if (GLOB(ha) && sccp_apply_ha(GLOB(ha), sin) != AST_SENSE_ALLOW) {
-		struct ast_str *buf = pbx_str_alloca(DEFAULT_PBX_STR_BUFFERSIZE);
-		if (buf) {
-			sccp_print_ha(buf, DEFAULT_PBX_STR_BUFFERSIZE, GLOB(ha));
-			pbx_log(LOG_NOTICE, "SCCP: Rejecting Connection: Ip-address '%s' denied. Check general deny/permit settings (%s).\n", addrStr, pbx_str_buffer(buf));
-		} else {
-			pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
-		}
-		//sccp_session_reject(s, "Device ip not authorized");
-		return FALSE;
+	int refcount = 0;
+
+	pbx_mutex_lock(&ack->lock);
+	refcount = --ack->refcount;
+	pbx_mutex_unlock(&ack->lock);
+	if (!refcount) {
+		pbx_cond_destroy(&ack->cond);
+		sccp_mutex_destroy(&ack->lock);
+		sccp_free(ack);
 	}
-	sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_3 "SCCP: Accepted Client Connection from %s\n", addrStr);
-	return TRUE;
 }
 
-static sccp_session_t * sccp_create_session(int new_socket)
+/*!
+ * \brief Get (or attach) the destroy acknowledgement of a session
+ * \return Acknowledgement (to be released by the caller) or NULL when the session is already being destroyed
+ */
+static sccp_session_reactor_ack_t *sccp_session_reactor_ack_get(sccp_session_t * s)
 {
-	sccp_session_t *s;
+	sccp_session_reactor_ack_t *ack = NULL;
 
-	if (!(s = sccp_calloc(sizeof *s, 1))) {
-		pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
-		return NULL;
+	sccp_session_lock(s);
+	if (s->fds[0].fd > 0) {											/* destroy_session has not detached the acknowledgement yet */
+		if (!s->stop_ack && (s->stop_ack = sccp_calloc(sizeof *s->stop_ack, 1))) {
+			sccp_mutex_init(&s->stop_ack->lock);
+			pbx_cond_init(&s->stop_ack->cond, NULL);
+			s->stop_ack->refcount = 1;								/* destroy_session */
+		}
+		if ((ack = s->stop_ack)) {
+			pbx_mutex_lock(&ack->lock);
+			ack->refcount++;
+			pbx_mutex_unlock(&ack->lock);
+		}
 	}
+	sccp_session_unlock(s);
+	return ack;
+}
 
-	sccp_mutex_init(&s->lock);
+/*!
+ * \brief Wait until the session the acknowledgement belongs to has been destroyed
+ * \return TRUE when destroyed, FALSE on timeout
+ */
+static boolean_t sccp_session_reactor_ack_wait(sccp_session_reactor_ack_t * ack, int timeout_ms)
+{
+	struct timeval tv = ast_tvadd(ast_tvnow(), ast_samp2tv(timeout_ms, 1000));
+	struct timespec ts = { tv.tv_sec, tv.tv_usec * 1000 };
+	boolean_t done = FALSE;
+	int res = 0;
 
-	s->fds[0].events = POLLIN | POLLPRI;
-	s->fds[0].revents = 0;
-	s->fds[0].fd = new_socket;
-	s->protocolType = SCCP_PROTOCOL;
-	s->lastKeepAlive = time(0);
-	
-	return s;
-} 
+	pbx_mutex_lock(&ack->lock);
+	while (!ack->done && res != ETIMEDOUT) {
+		res = pbx_cond_timedwait(&ack->cond, &ack->lock, &ts);
+	}
+	done = ack->done;
+	pbx_mutex_unlock(&ack->lock);
+	return done;
+}
+
+/*!
+ * \brief Acknowledge the destruction of a session to the threads waiting for it (called by destroy_session)
+ */
+static void sccp_session_reactor_ack_done(sccp_session_reactor_ack_t * ack)
+{
+	if (ack) {
+		pbx_mutex_lock(&ack->lock);
+		ack->done = TRUE;
+		pbx_cond_broadcast(&ack->cond);
+		pbx_mutex_unlock(&ack->lock);
+		sccp_session_reactor_ack_release(ack);
+	}
+}
+
+/* the key is never deleted, threads can still ask whether they are a worker while (and after) the pool is stopped */
+static void sccp_session_reactor_key_create(void)
+{
+	if (pthread_key_create(&reactor_worker_key, NULL) == 0) {
+		reactor_key_created = TRUE;
+	} else {
+		pbx_log(LOG_ERROR, "SCCP: (reactor) Failed to create worker thread key: %s\n", strerror(errno));
+	}
+}
+
+static void sccp_session_reactor_timer_remove(sccp_session_t * s)
+{
+	if (s->timer_prev) {
+		*s->timer_prev = s->timer_next;
+		if (s->timer_next) {
+			s->timer_next->timer_prev = s->timer_prev;
+		}
+		s->timer_next = NULL;
+		s->timer_prev = NULL;
+	}
+}
+
+static void sccp_session_reactor_timer_arm(sccp_session_reactor_worker_t * w, sccp_session_t * s, time_t expire)
+{
+	sccp_session_t **slot = &w->wheel[expire % SESSION_REACTOR_WHEEL_SLOTS];
+
+	sccp_session_reactor_timer_remove(s);
+	s->timer_expire = expire;
+	s->timer_next = *slot;
+	if (s->timer_next) {
+		s->timer_next->timer_prev = &s->timer_next;
+	}
+	s->timer_prev = slot;
+	*slot = s;
+}
+
+/*!
+ * \brief Start/Stop waiting for the socket of a reactor session to become writable, to write out its send backlog
+ * \note Can be called from any thread (epoll_ctl is thread safe)
+ *
+ * \lock
+ *      - session->write_lock (has to be held by the caller)
+ */
+static void sccp_session_reactor_watch_writable(sccp_session_t * s, boolean_t writable)
+{
+	struct epoll_event ev = {
+		.events = EPOLLIN | EPOLLPRI | EPOLLRDHUP | (writable ? EPOLLOUT : 0),
+		.data.ptr = s,
+	};
+
+	if (s->worker && s->fds[0].fd > 0 && epoll_ctl(s->worker->epfd, EPOLL_CTL_MOD, s->fds[0].fd, &ev) < 0 && errno != ENOENT) {
+		pbx_log(LOG_ERROR, "%s: (reactor) Failed to update epoll events for socket %d: %s\n", s->designator, s->fds[0].fd, strerror(errno));
+	}
+}
+
+/*!
+ * \brief Remove a stopped session from its worker and destroy it
+ * \note Only called from the owning worker thread
+ */
+static void sccp_session_reactor_release(sccp_session_reactor_worker_t * w, sccp_session_t * s)
+{
+	int i = 0;
+
+	for (i = 0; w->events && i < w->num_events; i++) {							/* skip events for this session still waiting in the current batch */
+		if (w->events[i].data.ptr == s) {
+			w->events[i].events = 0;
+		}
+	}
+	sccp_session_reactor_timer_remove(s);
+	if (s->fds[0].fd > 0) {
+		epoll_ctl(w->epfd, EPOLL_CTL_DEL, s->fds[0].fd, NULL);
+		session_sendq_write_backlog(s);								/* last chance for the final messages (i.e. UnregisterAck) */
+	}
+	w->num_sessions--;
+	sccp_log((DEBUGCAT_SOCKET)) (VERBOSE_PREFIX_3 "%s: Removing session from reactor worker\n", DEV_ID_LOG(s->device));
+	s->session_stop = TRUE;
+	s->session_thread = AST_PTHREADT_NULL;
+	destroy_session(s, SESSION_DEVICE_CLEANUP_TIME);
+}
+
+/*!
+ * \brief Adopt the sessions handed over by the accept thread
+ */
+static void sccp_session_reactor_adopt(sccp_session_reactor_worker_t * w)
+{
+	char drain[32];
+	sccp_session_t *s = NULL;
+	sccp_session_t *next = NULL;
+	int res = 0;
+
+	while (read(w->wakeup[0], drain, sizeof(drain)) > 0);
+
+	pbx_mutex_lock(&w->pending_lock);
+	s = w->pending;
+	w->pending = NULL;
+	pbx_mutex_unlock(&w->pending_lock);
+
+	for (; s; s = next) {
+		next = s->pending_next;
+		s->pending_next = NULL;
+		w->num_sessions++;
+
+		struct epoll_event ev = {
+			.events = EPOLLIN | EPOLLPRI | EPOLLRDHUP,
+			.data.ptr = s,
+		};
+		pbx_mutex_lock(&s->write_lock);								/* messages sent before adoption may have left a backlog */
+		if (s->sendq.backlog_len) {
+			ev.events |= EPOLLOUT;
+		}
+		res = epoll_ctl(w->epfd, EPOLL_CTL_ADD, s->fds[0].fd, &ev);
+		pbx_mutex_unlock(&s->write_lock);
+		if (res < 0) {
+			pbx_log(LOG_ERROR, "%s: (reactor) Failed to add socket %d to epoll set: %s\n", s->designator, s->fds[0].fd, strerror(errno));
+			sccp_session_reactor_release(w, s);
+			continue;
+		}
+		sccp_session_reactor_timer_arm(w, s, time(0) + s->keepAliveInterval);
+	}
+}
+
+/*!
+ * \brief Read and dispatch the data waiting on a session socket
+ */
+static void sccp_session_reactor_read(sccp_session_reactor_worker_t * w, sccp_session_t * s, uint32_t events)
+{
+	if (!s->session_stop && (events & EPOLLOUT) && session_sendq_write_backlog(s) < 0) {
+		__sccp_session_stopthread(s, SKINNY_DEVICE_RS_FAILED);
+	}
+	if (!s->session_stop && (events & (EPOLLIN | EPOLLPRI))) {
+		int result = 0;
+		int processed = session_recv_and_process(s, &w->msg, &result);
+		s->lastKeepAlive = time(0);
+		if (result <= 0) {
+			if (result < 0 && (errno == EINTR || errno == EAGAIN)) {
+				return;
+			}
+			socket_get_error(s, __FILE__, __LINE__, __PRETTY_FUNCTION__, errno);
+			s->session_stop = TRUE;
+		} else if (processed != 0) {
+			pbx_log(LOG_ERROR, "%s: (reactor) Received a packet or message (with result:%d) which we could not handle, giving up session: %p!\n", s->designator, result, s);
+			sccp_dump_msg(&w->msg);
+			if (s->device) {
+				sccp_device_sendReset(s->device, SKINNY_RESETTYPE_RESTART);
+			}
+			__sccp_session_stopthread(s, SKINNY_DEVICE_RS_FAILED);
+		}
+	} else if (!s->session_stop && (events & (EPOLLERR | EPOLLHUP))) {
+		pbx_log(LOG_NOTICE, "%s: Closing session because we received EPOLLHUP/EPOLLERR\n", s->designator);
+		__sccp_session_stopthread(s, SKINNY_DEVICE_RS_FAILED);
+	}
+	if (!s->session_stop) {
+		session_check_device(s);
+	}
+	if (s->session_stop) {
+		sccp_session_reactor_release(w, s);
+	}
+}
+
+/*!
+ * \brief Advance the timer wheel up to now, checking keepalive timeouts of the sessions that expire
+ */
+static void sccp_session_reactor_tick(sccp_session_reactor_worker_t * w, time_t now)
+{
+	sccp_session_t *s = NULL;
+	sccp_session_t *next = NULL;
+
+	if (now - w->wheel_time > SESSION_REACTOR_WHEEL_SLOTS) {
+		w->wheel_time = now - SESSION_REACTOR_WHEEL_SLOTS;
+	}
+	while (w->wheel_time < now) {
+		w->wheel_time++;
+		sccp_session_t **slot = &w->wheel[w->wheel_time % SESSION_REACTOR_WHEEL_SLOTS];
+
+		s = *slot;											/* detach the slot, so that re-armed sessions are not revisited */
+		*slot = NULL;
+		for (; s; s = next) {
+			next = s->timer_next;
+			s->timer_next = NULL;
+			s->timer_prev = NULL;
+			if (s->timer_expire > w->wheel_time) {							/* not due yet, expires in a later round */
+				sccp_session_reactor_timer_arm(w, s, s->timer_expire);
+				continue;
+			}
+			if (!s->session_stop) {
+				session_check_device(s);
+			}
+			if (!s->session_stop) {
+				uintmax_t timediff = (uintmax_t)now - (uintmax_t)s->lastKeepAlive;
+				if (!s->tokenThread && timediff >= s->keepAlive) {
+					pbx_log(LOG_NOTICE, "%s: Closing session because connection timed out after %ju seconds (ip-address: %s).\n", DEV_ID_LOG(s->device), timediff, s->designator);
+					__sccp_session_stopthread(s, SKINNY_DEVICE_RS_TIMEOUT);
+				}
+			}
+			if (s->session_stop) {
+				sccp_session_reactor_release(w, s);
+				continue;
+			}
+			sccp_session_reactor_timer_arm(w, s, now + (s->keepAliveInterval ? s->keepAliveInterval : 1));
+		}
+	}
+}
+
+/*!
+ * \brief Session Reactor Worker Thread
+ * \param data Session Reactor Worker
+ */
+static void *sccp_session_reactor_worker_thread(void *data)
+{
+	sccp_session_reactor_worker_t *w = (sccp_session_reactor_worker_t *) data;
+	struct epoll_event events[SESSION_REACTOR_MAX_EVENTS];
+	int n = 0;
+	int i = 0;
+
+	pthread_setspecific(reactor_worker_key, w);
+	w->wheel_time = time(0);
+	while (w->running) {
+		n = epoll_wait(w->epfd, events, SESSION_REACTOR_MAX_EVENTS, 1000);
+		if (n < 0) {
+			if (errno != EINTR) {
+				pbx_log(LOG_ERROR, "SCCP: (reactor) epoll_wait returned error: %s\n", strerror(errno));
+				usleep(1000);
+			}
+			n = 0;
+		}
+		if (n > 0) {
+			sccp_msgstats_setReady(sccp_msgstats_now());						/* queue latency: from here until each handler is called */
+		}
+		w->events = events;
+		w->num_events = n;
+		for (i = 0; i < n; i++) {
+			if (!events[i].events) {								/* session was released while dispatching this batch */
+				continue;
+			}
+			if (!events[i].data.ptr) {
+				sccp_session_reactor_adopt(w);
+			} else {
+				w->current = (sccp_session_t *) events[i].data.ptr;
+				sccp_session_reactor_read(w, w->current, events[i].events);
+				w->current = NULL;
+			}
+		}
+		w->events = NULL;
+		w->num_events = 0;
+		if (n > 0) {
+			sccp_msgstats_setReady(0);
+		}
+		sccp_session_reactor_tick(w, time(0));
+	}
+
+	/* shutting down, destroy whatever is left */
+	sccp_session_reactor_adopt(w);
+	for (i = 0; i < SESSION_REACTOR_WHEEL_SLOTS; i++) {
+		while (w->wheel[i]) {
+			sccp_session_reactor_release(w, w->wheel[i]);
+		}
+	}
+	return NULL;
+}
+
+static void sccp_session_reactor_worker_destroy(sccp_session_reactor_worker_t * w)
+{
+	if (w->epfd > -1) {
+		close(w->epfd);
+	}
+	if (w->wakeup[0] > -1) {
+		close(w->wakeup[0]);
+		close(w->wakeup[1]);
+	}
+	sccp_mutex_destroy(&w->pending_lock);
+}
+
+/*!
+ * \brief Stop and join all session reactor workers
+ * \note reactor_lock needs to be held
+ */
+static void __sccp_session_reactor_stop_workers(void)
+{
+	uint32_t idx = 0;
+
+	for (idx = 0; idx < reactor_num_workers; idx++) {
+		sccp_session_reactor_worker_t *w = &reactor_workers[idx];
+		w->running = FALSE;
+		if (write(w->wakeup[1], "", 1) < 0 && errno != EAGAIN) {
+			pbx_log(LOG_ERROR, "SCCP: (reactor) Failed to wakeup worker %d: %s\n", idx, strerror(errno));
+		}
+		pthread_join(w->thread, NULL);
+		sccp_session_reactor_worker_destroy(w);
+	}
+	sccp_free(reactor_workers);
+	reactor_workers = NULL;
+	reactor_num_workers = 0;
+}
+
+/*!
+ * \brief Start the session reactor worker pool
+ * \note reactor_lock needs to be held
+ */
+static boolean_t __sccp_session_reactor_start(void)
+{
+	uint32_t num_workers = GLOB(session_workers);
+	uint32_t idx = 0;
+
+	pthread_once(&reactor_key_once, sccp_session_reactor_key_create);
+	if (!reactor_key_created) {
+		return FALSE;
+	}
+	if (!num_workers) {
+		long cores = sysconf(_SC_NPROCESSORS_ONLN);
+		num_workers = cores > 0 ? (uint32_t) cores : 1;
+	}
+	if (num_workers > SESSION_REACTOR_MAX_WORKERS) {
+		num_workers = SESSION_REACTOR_MAX_WORKERS;
+	}
+	if (!(reactor_workers = sccp_calloc(num_workers, sizeof(sccp_session_reactor_worker_t)))) {
+		pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
+		return FALSE;
+	}
+	for (idx = 0; idx < num_workers; idx++) {
+		sccp_session_reactor_worker_t *w = &reactor_workers[idx];
+		struct epoll_event ev = {
+			.events = EPOLLIN,
+			.data.ptr = NULL,
+		};
+
+		sccp_mutex_init(&w->pending_lock);
+		w->wakeup[0] = w->wakeup[1] = -1;
+		w->running = TRUE;
+		if ((w->epfd = epoll_create(SESSION_REACTOR_MAX_EVENTS)) < 0 || pipe(w->wakeup) < 0) {
+			pbx_log(LOG_ERROR, "SCCP: (reactor) Failed to create epoll set for worker %d: %s\n", idx, strerror(errno));
+			break;
+		}
+		fcntl(w->wakeup[0], F_SETFL, fcntl(w->wakeup[0], F_GETFL) | O_NONBLOCK);
+		fcntl(w->wakeup[1], F_SETFL, fcntl(w->wakeup[1], F_GETFL) | O_NONBLOCK);
+		if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->wakeup[0], &ev) < 0 || pbx_pthread_create(&w->thread, NULL, sccp_session_reactor_worker_thread, w)) {
+			pbx_log(LOG_ERROR, "SCCP: (reactor) Failed to start worker %d\n", idx);
+			break;
+		}
+	}
+	if (idx < num_workers) {										/* roll back */
+		sccp_session_reactor_worker_destroy(&reactor_workers[idx]);
+		reactor_num_workers = idx;
+		__sccp_session_reactor_stop_workers();
+		return FALSE;
+	}
+	reactor_num_workers = num_workers;
+	sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_3 "SCCP: Started session reactor with %d workers\n", num_workers);
+	return TRUE;
+}
+
+/*!
+ * \brief Stop the session reactor worker pool, destroying any remaining reactor sessions
+ */
+static void sccp_session_reactor_stop(void)
+{
+	pbx_mutex_lock(&reactor_lock);
+	if (reactor_workers) {
+		sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_3 "SCCP: Stopping session reactor\n");
+		__sccp_session_reactor_stop_workers();
+	}
+	pbx_mutex_unlock(&reactor_lock);
+}
+
+/*!
+ * \brief Hand a new session over to one of the reactor workers (starting the worker pool if necessary)
+ * \param s SCCP Session
+ * \return TRUE if the session is now owned by a reactor worker
+ */
+static boolean_t sccp_session_reactor_add(sccp_session_t * s)
+{
+	sccp_session_reactor_worker_t *w = NULL;
+
+	pbx_mutex_lock(&reactor_lock);
+	if (reactor_workers || __sccp_session_reactor_start()) {
+		w = &reactor_workers[reactor_next_worker++ % reactor_num_workers];
+	}
+	pbx_mutex_unlock(&reactor_lock);
+	if (!w) {
+		return FALSE;
+	}
+
+	s->worker = w;
+	s->session_thread = w->thread;
+	pbx_mutex_lock(&w->pending_lock);
+	s->pending_next = w->pending;
+	w->pending = s;
+	pbx_mutex_unlock(&w->pending_lock);
+	if (write(w->wakeup[1], "", 1) < 0 && errno != EAGAIN) {
+		pbx_log(LOG_ERROR, "SCCP: (reactor) Failed to wakeup worker: %s\n", strerror(errno));
+	}
+	return TRUE;
+}
+
+/*!
+ * \brief Return the reactor worker running on the current thread
+ * \return Worker or NULL when not called from a reactor worker thread
+ * \note Uses the thread key set by the worker itself, so reactor_workers (reactor_lock) is not touched
+ */
+static sccp_session_reactor_worker_t *sccp_session_reactor_self(void)
+{
+	pthread_once(&reactor_key_once, sccp_session_reactor_key_create);
+	return reactor_key_created ? (sccp_session_reactor_worker_t *) pthread_getspecific(reactor_worker_key) : NULL;
+}
+
+/*!
+ * \brief Stop a reactor session from a thread other than the one dispatching it, and wait until it has been destroyed
+ * \param s SCCP Session
+ *
+ * \note When called from the owning worker (i.e. while dispatching the new session of the same device), the session is
+ *       released right away. Outside of dispatching the owner can not release it safely (it may be walking its timer wheel),
+ *       and can not wait for itself either, so the session is only marked as stopped.
+ *       A worker waiting on another worker flags itself as waiting first, and does not wait when the owner is flagged
+ *       too, so two workers never wait on each other.
+ */
+static void sccp_session_reactor_end_session(sccp_session_t * s)
+{
+	sccp_session_reactor_worker_t *self = sccp_session_reactor_self();
+	sccp_session_reactor_worker_t *owner = s->worker;
+	sccp_session_reactor_ack_t *ack = NULL;
+	boolean_t wait = TRUE;
+
+	sccp_log((DEBUGCAT_SOCKET)) (VERBOSE_PREFIX_2 "%s: Stopping Reactor Session\n", DEV_ID_LOG(s->device));
+	s->session_stop = TRUE;
+	if (self && self == owner) {
+		if (self->current && self->current != s && s->timer_prev) {					/* adopted and not being dispatched */
+			sccp_session_reactor_release(self, s);
+		} else if (s->fds[0].fd > 0) {
+			shutdown(s->fds[0].fd, SHUT_RD);							// released when the worker gets to it
+		}
+		return;
+	}
+	if (self) {
+		ATOMIC_INCR(&self->waiting, 1, &self->pending_lock);
+		if (ATOMIC_FETCH(&owner->waiting, &owner->pending_lock)) {
+			sccp_log((DEBUGCAT_SOCKET)) (VERBOSE_PREFIX_3 "%s: (reactor) Owning worker is waiting itself, not waiting for session %p\n", DEV_ID_LOG(s->device), s);
+			wait = FALSE;
+		}
+	}
+	if (wait) {
+		ack = sccp_session_reactor_ack_get(s);								/* before waking up the owner, s may be gone afterwards */
+	}
+	if (s->fds[0].fd > 0) {
+		shutdown(s->fds[0].fd, SHUT_RD);								// this will wake up the worker owning the session
+	}
+	if (ack) {
+		if (!sccp_session_reactor_ack_wait(ack, SESSION_REACTOR_STOP_TIMEOUT)) {
+			pbx_log(LOG_WARNING, "SCCP: (reactor) Session %p was not destroyed within %d ms\n", s, SESSION_REACTOR_STOP_TIMEOUT);
+		}
+		sccp_session_reactor_ack_release(ack);
+	}
+	if (self) {
+		ATOMIC_DECR(&self->waiting, 1, &self->pending_lock);
+	}
+}
+#endif
+
+static boolean_t sccp_session_new_socket_allowed(struct sockaddr_storage *sin)
+{
+	char addrStr[INET6_ADDRSTRLEN];
+	sccp_copy_string(addrStr, sccp_netsock_stringify(sin), sizeof(addrStr));
+	if (GLOB(ha) && sccp_apply_ha(GLOB(ha), sin) != AST_SENSE_ALLOW) {
+		struct ast_str *buf = pbx_str_alloca(DEFAULT_PBX_STR_BUFFERSIZE);
+		if (buf) {
+			sccp_print_ha(buf, DEFAULT_PBX_STR_BUFFERSIZE, GLOB(ha));
+			pbx_log(LOG_NOTICE, "SCCP: Rejecting Connection: Ip-address '%s' denied. Check general deny/permit settings (%s).\n", addrStr, pbx_str_buffer(buf));
+		} else {
+			pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
+		}
+		//sccp_session_reject(s, "Device ip not authorized");
+		return FALSE;
+	}
+	sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_3 "SCCP: Accepted Client Connection from %s\n", addrStr);
+	return TRUE;
+}
+
+static sccp_session_t * sccp_create_session(int new_socket)
+{
+	sccp_session_t *s;
+
+	if (!(s = sccp_calloc(sizeof *s, 1))) {
+		pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
+		return NULL;
+	}
+
+	sccp_mutex_init(&s->lock);
+	sccp_mutex_init(&s->write_lock);
+
+	s->fds[0].events = POLLIN | POLLPRI;
+	s->fds[0].revents = 0;
+	s->fds[0].fd = new_socket;
+	s->protocolType = SCCP_PROTOCOL;
+	s->lastKeepAlive = time(0);
+	s->oncall = TRUE;
+	
+	return s;
+} 
 
 static void sccp_session_set_ourip(sccp_session_t *s)
 {
@@ -801,7 +1842,7 @@ static void sccp_session_set_ourip(sccp_session_t *s)
  * - checks if the incoming ip-address is within the global deny/permit range
  * - creates a new session struct
  * - adds the new session struct to the global sessions list
- * - starts a new sccp_session_device_thread
+ * - hands the session over to a session reactor worker (session_reactor=yes) or starts a new sccp_session_device_thread
  */
 static void *accept_thread(void *ignore)
 {
@@ -832,6 +1873,11 @@ static void *accept_thread(void *ignore)
 		sccp_session_addToGlobals(s);
 		recalc_wait_time(s);
 		
+#ifdef HAVE_SYS_EPOLL_H
+		if (GLOB(session_reactor) && sccp_session_reactor_add(s)) {
+			continue;
+		}
+#endif
 		if (pbx_pthread_create(&s->session_thread, NULL, sccp_session_device_thread, s)) {
 			destroy_session(s, 0);
 		}
@@ -985,7 +2031,8 @@ int sccp_session_send(constDevicePtr device, const sccp_msg_t * msg_in)
 
 	if (s && !s->session_stop) {
 		return sccp_session_send2(s, msg);
-	} 
+	}
+	sccp_packet_free(msg);
 	return -1;
 }
 
@@ -994,33 +2041,31 @@ int sccp_session_send(constDevicePtr device, const sccp_msg_t * msg_in)
  * \param session Session SCCP Session (can't be null)
  * \param msg Message Data Structure (sccp_msg_t) (Will be freed automatically at the end)
  * \return Result as Int
+ * \note When called by the session thread while it is handling received messages, the message is only queued and will be
+ *       written together with the other replies, once all received data has been processed (see session_sendq_flush)
  *
  * \lock
- *      - session
+ *      - session->write_lock
  */
 int sccp_session_send2(constSessionPtr session, sccp_msg_t * msg)
 {
 	sessionPtr s = (sessionPtr)session;										/* discard const */
-	ssize_t res = 0;
+	int res = 0;
 	uint32_t msgid = letohl(msg->header.lel_messageId);
-	ssize_t bytesSent;
-	ssize_t bufLen;
-	uint8_t *bufAddr;
 
 	if (s && s->session_stop) {
+		sccp_packet_free(msg);
 		return -1;
 	}
 
-	if (!s || s->fds[0].fd <= 0) {
+	if (!s || (s->fds[0].fd <= 0 && !s->replay)) {
 		sccp_log((DEBUGCAT_HIGH)) (VERBOSE_PREFIX_3 "SCCP: Tried to send packet over DOWN device.\n");
 		if (s) {
 			__sccp_session_stopthread(s, SKINNY_DEVICE_RS_FAILED);
 		}
-		sccp_free(msg);
-		msg = NULL;
+		sccp_packet_free(msg);
 		return -1;
 	}
-	int mysocket = s->fds[0].fd;
 
 	if (msgid == KeepAliveAckMessage || msgid == RegisterAckMessage || msgid == UnregisterAckMessage) {
 		msg->header.lel_protocolVer = 0;
@@ -1037,38 +2082,24 @@ int sccp_session_send2(constSessionPtr session, sccp_msg_t * msg)
 		sccp_dump_msg(msg);
 	}
 
-	uint backoff = WRITE_BACKOFF;
-	bytesSent = 0;
-	bufAddr = ((uint8_t *) msg);
-	bufLen = (ssize_t) (letohl(msg->header.length) + 8);
-	do {
-		pbx_mutex_lock(&s->write_lock);									/* prevent two threads writing at the same time. That should happen in a synchronized way */
-		res = send(mysocket, bufAddr + bytesSent, bufLen - bytesSent, 0);
-		pbx_mutex_unlock(&s->write_lock);
-		if (res <= 0) {
-			if (errno == EINTR) {
-				usleep(backoff);								/* back off to give network/other threads some time */
-				backoff *= 2;
-				continue;
-			}
-			socket_get_error(s, __FILE__, __LINE__, __PRETTY_FUNCTION__, errno);
-			if (s) {
-				__sccp_session_stopthread(s, SKINNY_DEVICE_RS_FAILED);
-			}
-			res = -1;
-			break;
-		}
-		bytesSent += res;
-	} while (bytesSent < bufLen && s && !s->session_stop && mysocket > 0);
+	sccp_trace(DEBUGCAT_MESSAGE, SCCP_TRACE_MSG_TX, s, letohl(msg->header.lel_messageId), letohl(msg->header.length), 0);
 
-	sccp_free(msg);
-	msg = NULL;
-
-	if (bytesSent < bufLen) {
-		pbx_log(LOG_ERROR, "%s: Could only send %d of %d bytes!\n", DEV_ID_LOG(s->device), (int) bytesSent, (int) bufLen);
-		res = -1;
+	res = (int) (letohl(msg->header.length) + 8);
+	pbx_mutex_lock(&s->write_lock);										/* prevent two threads writing at the same time. That should happen in a synchronized way */
+	if (dont_expect(s->capture != NULL)) {
+		__session_capture(s, SCCP_PCAP_OUTBOUND, msg, letohl(msg->header.length) + 8);
+	}
+	s->sendq.msgs[s->sendq.count++] = msg;
+	if (!s->sendq.corked || !pthread_equal(s->sendq.owner, pthread_self())) {
+		res = session_sendq_flush(s, FALSE);
+	} else if (s->sendq.count == SESSION_SENDQ_MAX_MSGS) {
+		res = session_sendq_flush(s, TRUE);								/* queue full, more replies will follow */
 	}
+	pbx_mutex_unlock(&s->write_lock);
 
+	if (res < 0) {
+		__sccp_session_stopthread(s, SKINNY_DEVICE_RS_FAILED);
+	}
 	return res;
 }
 
@@ -1101,6 +2132,12 @@ void sccp_session_crossdevice_cleanup(constSessionPtr current_session, sessionPt
 	}
 	if (current_session != previous_session && previous_session->session_thread) {
 		sccp_log(DEBUGCAT_CORE) (VERBOSE_PREFIX_2 "%s: Session %p needs to be closed!\n", current_session->designator, previous_session->designator);
+#ifdef HAVE_SYS_EPOLL_H
+		if (previous_session->worker) {
+			sccp_session_reactor_end_session(previous_session);
+			return;
+		}
+#endif
 		__sccp_netsock_end_device_thread(previous_session);
 	}
 	return;
@@ -1235,12 +2272,347 @@ gcc_inline sccp_device_t * const sccp_session_getDevice(constSessionPtr session,
 
 boolean_t sccp_session_isValid(constSessionPtr session)
 {
-	if (session && session->fds[0].fd > 0 && !session->session_stop && !sccp_netsock_is_any_addr(&session->ourip)) {
+	if (session && (session->fds[0].fd > 0 || session->replay) && !session->session_stop && !sccp_netsock_is_any_addr(&session->ourip)) {
 		return TRUE;
 	}
 	return FALSE;
 }
 
+/* -------------------------------------------------------------------------------------------------------------CAPTURE- */
+/*
+ * Session Capture
+ *
+ * 'sccp capture start <pattern>' writes the messages of every session whose device name (or ip-address, before the device
+ * registered) matches the shell wildcard pattern to its own pcap file. The pattern is remembered, so sessions of devices that
+ * register later on are captured as well, until 'sccp capture stop'.
+ */
+AST_MUTEX_DEFINE_STATIC(session_capture_lock);
+static char session_capture_pattern[80] = "";									/* empty when no capture is active (session_capture_lock) */
+static char session_capture_dir[SCCP_PATH_MAX] = "";						/* (session_capture_lock) */
+
+/* port chan-sccp listens on, used to tell the direction of the frames in a capture */
+static uint16_t session_serverport(void)
+{
+	uint16_t port = sccp_netsock_getPort(&GLOB(bindaddr));
+	return port ? port : DEFAULT_SCCP_PORT;
+}
+
+/* name used to match the capture pattern and to name the capture file */
+static void session_capture_name(sccp_session_t * s, char *name, size_t len)
+{
+	char *c = NULL;
+
+	sccp_session_lock(s);
+	sccp_copy_string(name, s->device ? s->device->id : sccp_netsock_stringify_addr(&s->sin), len);
+	sccp_session_unlock(s);
+	for (c = name; *c; c++) {
+		if (*c == ':' || *c == '/') {
+			*c = '_';
+		}
+	}
+}
+
+static boolean_t session_capture_matches(const char *pattern, const char *name)
+{
+#ifdef FNM_CASEFOLD
+	return fnmatch(pattern, name, FNM_CASEFOLD) == 0 ? TRUE : FALSE;
+#else
+	return fnmatch(pattern, name, 0) == 0 ? TRUE : FALSE;
+#endif
+}
+
+/*!
+ * \brief Start capturing a session to a new file in directory
+ * \return TRUE when a new capture was started
+ */
+static boolean_t session_capture_start(sccp_session_t * s, const char *name, const char *directory)
+{
+	char filename[SCCP_PATH_MAX];
+	char timestamp[20];
+	struct sockaddr_storage server;
+	struct tm tm;
+	time_t now = time(0);
+	boolean_t res = FALSE;
+
+	localtime_r(&now, &tm);
+	strftime(timestamp, sizeof(timestamp), "%Y%m%d-%H%M%S", &tm);
+	snprintf(filename, sizeof(filename), "%s/sccp-%s-%s.pcap", directory, name, timestamp);
+	memcpy(&server, &s->ourip, sizeof(server));
+	sccp_netsock_setPort(&server, session_serverport());
+
+	pbx_mutex_lock(&s->write_lock);
+	if (!s->capture && !s->session_stop) {
+		if ((s->capture = sccp_pcap_open(filename, &s->sin, &server))) {
+			pbx_log(LOG_NOTICE, "%s: Capturing session to '%s'\n", s->designator, filename);
+			res = TRUE;
+		}
+	}
+	pbx_mutex_unlock(&s->write_lock);
+	return res;
+}
+
+/* start capturing a session that just got its device, when it matches the active capture pattern */
+static void session_capture_check(sccp_session_t * s)
+{
+	char name[INET6_ADDRSTRLEN];
+	char directory[SCCP_PATH_MAX];
+	boolean_t matches = FALSE;
+
+	if (sccp_strlen_zero(session_capture_pattern) || s->capture || s->replay) {
+		return;
+	}
+	session_capture_name(s, name, sizeof(name));
+	pbx_mutex_lock(&session_capture_lock);
+	if (!sccp_strlen_zero(session_capture_pattern) && session_capture_matches(session_capture_pattern, name)) {
+		sccp_copy_string(directory, session_capture_dir, sizeof(directory));
+		matches = TRUE;
+	}
+	pbx_mutex_unlock(&session_capture_lock);
+	if (matches) {
+		session_capture_start(s, name, directory);
+	}
+}
+
+/*!
+ * \brief Capture the sessions of all devices matching pattern, now and when they register later on
+ * \param pattern Device name or ip-address, shell wildcards are allowed ('*' captures all sessions)
+ * \param directory Directory to write the capture files to (NULL for the default)
+ * \return number of captures started
+ */
+int sccp_session_startCapture(const char *pattern, const char *directory)
+{
+	sccp_session_t *session = NULL;
+	char name[INET6_ADDRSTRLEN];
+	int started = 0;
+
+	if (sccp_strlen_zero(pattern)) {
+		return 0;
+	}
+	if (sccp_strlen_zero(directory)) {
+		directory = ast_config_AST_LOG_DIR;
+	}
+	pbx_mutex_lock(&session_capture_lock);
+	sccp_copy_string(session_capture_pattern, pattern, sizeof(session_capture_pattern));
+	sccp_copy_string(session_capture_dir, directory, sizeof(session_capture_dir));
+	pbx_mutex_unlock(&session_capture_lock);
+
+	SCCP_RWLIST_RDLOCK(&GLOB(sessions));
+	SCCP_RWLIST_TRAVERSE(&GLOB(sessions), session, list) {
+		session_capture_name(session, name, sizeof(name));
+		if (!session->replay && session_capture_matches(pattern, name) && session_capture_start(session, name, directory)) {
+			started++;
+		}
+	}
+	SCCP_RWLIST_UNLOCK(&GLOB(sessions));
+	return started;
+}
+
+/*!
+ * \brief Stop capturing the sessions matching pattern (NULL: all sessions)
+ * \return number of captures stopped
+ */
+int sccp_session_stopCapture(const char *pattern)
+{
+	sccp_session_t *session = NULL;
+	char name[INET6_ADDRSTRLEN];
+	int stopped = 0;
+
+	pbx_mutex_lock(&session_capture_lock);
+	if (sccp_strlen_zero(pattern) || sccp_strequals(pattern, session_capture_pattern)) {
+		session_capture_pattern[0] = '\0';
+	}
+	pbx_mutex_unlock(&session_capture_lock);
+
+	SCCP_RWLIST_RDLOCK(&GLOB(sessions));
+	SCCP_RWLIST_TRAVERSE(&GLOB(sessions), session, list) {
+		if (!session->capture) {
+			continue;
+		}
+		session_capture_name(session, name, sizeof(name));
+		if (sccp_strlen_zero(pattern) || session_capture_matches(pattern, name)) {
+			pbx_mutex_lock(&session->write_lock);
+			if (session->capture) {
+				__session_capture_stop(session);
+				stopped++;
+			}
+			pbx_mutex_unlock(&session->write_lock);
+		}
+	}
+	SCCP_RWLIST_UNLOCK(&GLOB(sessions));
+	return stopped;
+}
+
+/* ---------------------------------------------------------------------------------------------------------------REPLAY- */
+typedef struct session_replay {
+	sccp_session_t *session;
+	sccp_msg_t *msg;
+	int (*dispatch)(constMessagePtr msg, constSessionPtr s);
+	boolean_t realtime;
+	struct timeval first;
+	struct timeval start;
+	sccp_session_replay_stats_t *stats;
+	int res;
+} session_replay_t;
+
+/* feed one inbound frame to the replay session, the same way session_recv_and_process handles received data */
+static int session_replay_frame(const sccp_pcap_frame_t * frame, void *userdata)
+{
+	session_replay_t *replay = (session_replay_t *) userdata;
+	sccp_session_t *s = replay->session;
+	const unsigned char *data = frame->data;
+	size_t len = frame->len;
+
+	if (frame->direction == SCCP_PCAP_OUTBOUND) {
+		replay->stats->captured_replies++;
+		return 0;
+	}
+	if (!replay->stats->frames++) {
+		memcpy(&s->sin, &frame->phone, sizeof(s->sin));							/* take over the addresses of the captured session */
+		memcpy(&s->ourip, &frame->server, sizeof(s->ourip));
+		replay->first = frame->ts;
+	} else if (replay->realtime) {
+		int64_t wait_us;
+		while ((wait_us = ast_tvdiff_us(frame->ts, replay->first) - ast_tvdiff_us(pbx_tvnow(), replay->start)) > 0 && !s->session_stop) {
+			usleep(wait_us < 100000 ? (useconds_t) wait_us : 100000);
+		}
+	}
+	while (len > 0) {
+		size_t space = 0;
+		unsigned char *pos = session_recvbuf_space(&s->recv, &space);
+		size_t chunk = len < space ? len : space;
+
+		memcpy(pos, data, chunk);
+		s->recv.len += chunk;
+		data += chunk;
+		len -= chunk;
+		if (s->recv.len >= SESSION_RECV_RING_SIZE) {
+			replay->res = -1;
+			return -1;
+		}
+		session_sendq_cork(s);
+		int res = process_buffer(s, replay->msg, &s->recv, replay->dispatch);
+		session_sendq_uncork(s);
+		if (res != 0) {
+			pbx_log(LOG_WARNING, "SCCP: (replay) frame %u could not be handled, stopping replay\n", replay->stats->frames);
+			replay->res = -1;
+			return -1;
+		}
+	}
+	return s->session_stop ? -1 : 0;
+}
+
+static int session_replay(sccp_session_t * s, const char *filename, int (*const dispatch)(constMessagePtr msg, constSessionPtr s), boolean_t realtime, sccp_session_replay_stats_t * stats)
+{
+	sccp_msg_t msg = { {0,} };
+	session_replay_t replay = {
+		.session = s,
+		.msg = &msg,
+		.dispatch = dispatch,
+		.realtime = realtime,
+		.stats = stats,
+		.res = 0,
+	};
+	int frames = 0;
+
+	memset(stats, 0, sizeof(*stats));
+	replay.start = pbx_tvnow();
+	frames = sccp_pcap_read(filename, session_serverport(), session_replay_frame, &replay);
+	stats->duration_us = ast_tvdiff_us(pbx_tvnow(), replay.start);
+	stats->replies = s->sendq.messages;
+	return frames < 0 ? -1 : replay.res;
+}
+
+/*!
+ * \brief Replay the messages a phone sent in a capture file through the message handlers
+ * \param filename Capture file (sccp capture or tcpdump of the sccp port)
+ * \param realtime Keep the time between the captured messages, instead of replaying them as fast as possible
+ * \param stats Returns the number of replayed frames, the number of replies and the duration
+ * \return 0 on success, -1 on failure
+ *
+ * \note The replay session has no socket: the replies are counted and dropped. Replaying a registration registers the captured
+ *       device, taking over from the session of that device when it is connected, so this is meant for test systems.
+ */
+int sccp_session_replay(const char *filename, boolean_t realtime, sccp_session_replay_stats_t * stats)
+{
+	sccp_session_t *s = NULL;
+	int res = 0;
+
+	memset(stats, 0, sizeof(*stats));
+	if (!(s = sccp_create_session(-1))) {
+		return -1;
+	}
+	s->replay = TRUE;
+	s->session_thread = AST_PTHREADT_NULL;
+	sccp_copy_string(s->designator, "replay", sizeof(s->designator));
+	sccp_session_addToGlobals(s);
+
+	res = session_replay(s, filename, sccp_handle_message, realtime, stats);
+
+	destroy_session(s, 0);
+	return res;
+}
+
+/* --------------------------------------------------------------------------------------------------------SHOW CAPTURES- */
+/*!
+ * \brief Show Session Captures
+ * \param fd Fd as int
+ * \param total Total number of lines as int
+ * \param s AMI Session
+ * \param m Message
+ * \param argc Argc as int
+ * \param argv[] Argv[] as char
+ * \return Result as int
+ *
+ * \called_from_asterisk
+ */
+int sccp_cli_show_captures(int fd, sccp_cli_totals_t *totals, struct mansession *s, const struct message *m, int argc, char *argv[])
+{
+	int local_line_total = 0;
+	char pattern[sizeof(session_capture_pattern)];
+	char directory[SCCP_PATH_MAX];
+
+#define CLI_AMI_TABLE_NAME Captures
+#define CLI_AMI_TABLE_PER_ENTRY_NAME Capture
+#define CLI_AMI_TABLE_LIST_ITER_HEAD &GLOB(sessions)
+#define CLI_AMI_TABLE_LIST_ITER_TYPE sccp_session_t
+#define CLI_AMI_TABLE_LIST_ITER_VAR session
+#define CLI_AMI_TABLE_LIST_LOCK SCCP_RWLIST_RDLOCK
+#define CLI_AMI_TABLE_LIST_ITERATOR SCCP_RWLIST_TRAVERSE
+#define CLI_AMI_TABLE_LIST_UNLOCK SCCP_RWLIST_UNLOCK
+#define CLI_AMI_TABLE_BEFORE_ITERATION 														\
+		pbx_mutex_lock(&session->write_lock);												\
+		if (session->capture) {														\
+
+#define CLI_AMI_TABLE_AFTER_ITERATION 														\
+		}																\
+		pbx_mutex_unlock(&session->write_lock);												\
+
+#define CLI_AMI_TABLE_FIELDS 															\
+		CLI_AMI_TABLE_FIELD(Session,		"-25.25",	s,	25,	session->designator)					\
+		CLI_AMI_TABLE_FIELD(Frames,		"-8",		u,	8,	sccp_pcap_getFrames(session->capture))			\
+		CLI_AMI_TABLE_FIELD(File,		"-80.80",	s,	80,	sccp_pcap_getFilename(session->capture))
+#include "sccp_cli_table.h"
+
+	pbx_mutex_lock(&session_capture_lock);
+	sccp_copy_string(pattern, session_capture_pattern, sizeof(pattern));
+	sccp_copy_string(directory, session_capture_dir, sizeof(directory));
+	pbx_mutex_unlock(&session_capture_lock);
+	int once;
+#define CLI_AMI_TABLE_NAME CapturePattern
+#define CLI_AMI_TABLE_PER_ENTRY_NAME Pattern
+#define CLI_AMI_TABLE_ITERATOR for(once=0;once<1;once++)
+#define CLI_AMI_TABLE_FIELDS 															\
+		CLI_AMI_TABLE_FIELD(Pattern,		"-25.25",	s,	25,	sccp_strlen_zero(pattern) ? "--" : pattern)		\
+		CLI_AMI_TABLE_FIELD(Directory,		"-80.80",	s,	80,	directory)
+#include "sccp_cli_table.h"
+
+	if (s) {
+		totals->lines = local_line_total;
+		totals->tables = 2;
+	}
+	return RESULT_SUCCESS;
+}
+
 /* -------------------------------------------------------------------------------------------------------SHOW SESSIONS- */
 /*!
  * \brief Show Sessions
@@ -1259,6 +2631,9 @@ int sccp_cli_show_sessions(int fd, sccp_cli_totals_t *totals, struct mansession
 {
 	int local_line_total = 0;
 	char clientAddress[INET6_ADDRSTRLEN] = "";
+	unsigned long sent_messages = 0;
+	unsigned long sent_syscalls = 0;
+	float msgpersyscall = 0.00;
 
 #define CLI_AMI_TABLE_NAME Sessions
 #define CLI_AMI_TABLE_PER_ENTRY_NAME Session
@@ -1271,6 +2646,9 @@ int sccp_cli_show_sessions(int fd, sccp_cli_totals_t *totals, struct mansession
 #define CLI_AMI_TABLE_BEFORE_ITERATION 														\
 		sccp_session_lock(session);													\
 		sccp_copy_string(clientAddress, sccp_netsock_stringify_addr(&session->sin), sizeof(clientAddress));				\
+		msgpersyscall = session->sendq.syscalls ? (float) session->sendq.messages / session->sendq.syscalls : 0.00;			\
+		sent_messages += session->sendq.messages;											\
+		sent_syscalls += session->sendq.syscalls;											\
 		AUTO_RELEASE(sccp_device_t, d , session->device ? sccp_device_retain(session->device) : NULL);								\
 		if (d || (argc == 4 && sccp_strcaseequals(argv[3],"all"))) {									\
 
@@ -1289,14 +2667,552 @@ int sccp_cli_show_sessions(int fd, sccp_cli_totals_t *totals, struct mansession
 		CLI_AMI_TABLE_FIELD(State,		"-14.14",	s,	14,	(d) ? sccp_devicestate2str(sccp_device_getDeviceState(d)) : "--")		\
 		CLI_AMI_TABLE_FIELD(Type,		"-15.15",	s,	15,	(d) ? skinny_devicetype2str(d->skinny_type) : "--")	\
 		CLI_AMI_TABLE_FIELD(RegState,		"-10.10",	s,	10,	(d) ? skinny_registrationstate2str(sccp_device_getRegistrationState(d)) : "--")	\
-		CLI_AMI_TABLE_FIELD(Token,		"-10.10",	s,	10,	d ? sccp_tokenstate2str(d->status.token) : "--")
+		CLI_AMI_TABLE_FIELD(Token,		"-10.10",	s,	10,	d ? sccp_tokenstate2str(d->status.token) : "--")	\
+		CLI_AMI_TABLE_FIELD(MsgSys,		"6.02",		f,	6,	msgpersyscall)
+#include "sccp_cli_table.h"
+
+	// Average number of messages written per sendmsg call
+	msgpersyscall = sent_syscalls ? (float) sent_messages / sent_syscalls : 0.00;
+	int once;
+#define CLI_AMI_TABLE_NAME SendQueue
+#define CLI_AMI_TABLE_PER_ENTRY_NAME Total
+#define CLI_AMI_TABLE_ITERATOR for(once=0;once<1;once++)
+#define CLI_AMI_TABLE_FIELDS 															\
+		CLI_AMI_TABLE_FIELD(Messages,		"-12",		lu,	12,	sent_messages)						\
+		CLI_AMI_TABLE_FIELD(Syscalls,		"-12",		lu,	12,	sent_syscalls)						\
+		CLI_AMI_TABLE_FIELD(MsgPerSyscall,	"13.02",	f,	13,	msgpersyscall)
 #include "sccp_cli_table.h"
 
 	if (s) {
 		totals->lines = local_line_total;
-		totals->tables = 1;
+		totals->tables = 2;
 	}
 	return RESULT_SUCCESS;
 }
 
+#if CS_TEST_FRAMEWORK
+#include <asterisk/test.h>
+#define SESSION_TEST_LOOPS 20000
+#define SESSION_TEST_SEGMENT 1460										/* feed the stream in tcp segment sized chunks */
+
+static unsigned int session_test_dispatched = 0;
+
+static int session_test_dispatch(constMessagePtr msg, constSessionPtr s)
+{
+	session_test_dispatched += letohl(msg->header.lel_messageId) + 1;					/* touch the message, so the checksum proves both paths saw the same stream */
+	return 0;
+}
+
+/* reference implementation of the previous receive path: memset/memcpy into a full sccp_msg_t and memmove of the remainder */
+static int session_test_process_buffer_copy(sccp_session_t * s, sccp_msg_t *msg, unsigned char *buffer, size_t *len)
+{
+	while (*len >= SCCP_PACKET_HEADER) {
+		uint32_t payload_len = letohl(buffer[0] | (buffer[1] << 8) | (buffer[2] << 16) | (buffer[3] << 24)) + (SCCP_PACKET_HEADER - 4);
+		if (*len < payload_len) {
+			break;
+		}
+		sccp_header_t msg_header = {0};
+		memcpy(&msg_header, buffer, SCCP_PACKET_HEADER);
+		int known = session_dissect_header(s, &msg_header);
+		if (known < 0) {
+			return -1;
+		}
+		memset(msg, 0, SCCP_MAX_PACKET);
+		memcpy(msg, buffer, (int) payload_len < known ? (int) payload_len : known);
+		session_test_dispatch(msg, s);
+		*len -= payload_len;
+		if (*len > 0) {
+			memmove(buffer + 0, buffer + payload_len, *len);
+		}
+	}
+	return 0;
+}
+
+/* registration followed by a call setup and teardown, as sent by a 79xx phone */
+static size_t session_test_build_stream(unsigned char *stream, size_t size, int *num_messages)
+{
+	static const struct {
+		sccp_mid_t mid;
+		size_t len;
+	} capture[] = {
+		{RegisterMessage, 0}, {IpPortMessage, 0}, {CapabilitiesResMessage, 0}, {ButtonTemplateReqMessage, 0},
+		{SoftKeyTemplateReqMessage, 0}, {SoftKeySetReqMessage, 0}, {ConfigStatReqMessage, 0}, {LineStatReqMessage, 0},
+		{ForwardStatReqMessage, 0}, {TimeDateReqMessage, 0}, {KeepAliveMessage, 0}, {OffHookMessage, 0},
+		{KeypadButtonMessage, 0}, {KeypadButtonMessage, 0}, {KeypadButtonMessage, 0}, {KeypadButtonMessage, 0},
+		{OpenReceiveChannelAck, offsize(sccp_data_t, OpenReceiveChannelAck.v3)}, {KeepAliveMessage, 0},
+		{SoftKeyEventMessage, 0}, {OnHookMessage, 0}, {ConnectionStatisticsRes, 0}, {KeepAliveMessage, 0},
+	};
+	size_t pos = 0;
+	uint32_t idx = 0;
+
+	for (idx = 0; idx < ARRAY_LEN(capture); idx++) {
+		size_t len = capture[idx].len ? capture[idx].len : sccp_messagetypes[capture[idx].mid].size;
+		sccp_msg_t *msg = (sccp_msg_t *) (stream + pos);
+		if (pos + len + SCCP_PACKET_HEADER > size) {
+			break;
+		}
+		memset(msg, 0, len + SCCP_PACKET_HEADER);
+		msg->header.length = htolel(len + 4);
+		msg->header.lel_messageId = htolel(capture[idx].mid);
+		pos += len + SCCP_PACKET_HEADER;
+	}
+	*num_messages = idx;
+	return pos;
+}
+
+AST_TEST_DEFINE(sccp_session_process_buffer_bench)
+{
+	switch(cmd) {
+		case TEST_INIT:
+			info->name = "process_buffer";
+			info->category = "/channels/chan_sccp/session/";
+			info->summary = "chan-sccp-b session receive path benchmark";
+			info->description = "Push a registration plus call-setup stream through process_buffer, comparing the previous copying receive path with the ring buffer";
+			return AST_TEST_NOT_RUN;
+		case TEST_EXECUTE:
+			break;
+	}
+
+	enum ast_test_result_state res = AST_TEST_PASS;
+	unsigned char stream[SCCP_MAX_PACKET * 4];
+	unsigned char copy_buffer[SCCP_MAX_PACKET * 2];
+	size_t copy_len = 0;
+	int num_messages = 0;
+	size_t stream_len = session_test_build_stream(stream, sizeof(stream), &num_messages);
+	unsigned int checksum_copy = 0;
+	int loop = 0;
+	size_t offset = 0;
+	struct timeval start;
+	int64_t copy_us = 0;
+	int64_t ring_us = 0;
+	sccp_msg_t msg = { {0,} };
+	sccp_session_t *s = sccp_create_session(-1);
+
+	pbx_test_validate(test, s != NULL);
+	pbx_test_status_update(test, "Stream of %d messages, %d bytes, pushed %d times...\n", num_messages, (int) stream_len, SESSION_TEST_LOOPS);
+
+	session_test_dispatched = 0;
+	start = pbx_tvnow();
+	for (loop = 0; loop < SESSION_TEST_LOOPS && res == AST_TEST_PASS; loop++) {
+		for (offset = 0; offset < stream_len;) {
+			size_t chunk = stream_len - offset < SESSION_TEST_SEGMENT ? stream_len - offset : SESSION_TEST_SEGMENT;
+			chunk = chunk < sizeof(copy_buffer) - copy_len ? chunk : sizeof(copy_buffer) - copy_len;
+			memcpy(copy_buffer + copy_len, stream + offset, chunk);
+			copy_len += chunk;
+			offset += chunk;
+			if (session_test_process_buffer_copy(s, &msg, copy_buffer, &copy_len) != 0) {
+				res = AST_TEST_FAIL;
+				break;
+			}
+		}
+	}
+	copy_us = ast_tvdiff_us(pbx_tvnow(), start);
+	checksum_copy = session_test_dispatched;
+
+	session_test_dispatched = 0;
+	start = pbx_tvnow();
+	for (loop = 0; loop < SESSION_TEST_LOOPS && res == AST_TEST_PASS; loop++) {
+		for (offset = 0; offset < stream_len;) {
+			size_t space = 0;
+			unsigned char *pos = session_recvbuf_space(&s->recv, &space);
+			size_t chunk = stream_len - offset < SESSION_TEST_SEGMENT ? stream_len - offset : SESSION_TEST_SEGMENT;
+			chunk = chunk < space ? chunk : space;
+			memcpy(pos, stream + offset, chunk);
+			s->recv.len += chunk;
+			offset += chunk;
+			if (process_buffer(s, &msg, &s->recv, session_test_dispatch) != 0) {
+				res = AST_TEST_FAIL;
+				break;
+			}
+		}
+	}
+	ring_us = ast_tvdiff_us(pbx_tvnow(), start);
+
+	pbx_test_validate(test, res == AST_TEST_PASS);
+	pbx_test_validate(test, copy_len == 0 && s->recv.len == 0);
+	pbx_test_validate(test, checksum_copy == session_test_dispatched);
+	pbx_test_status_update(test, "copy path: %.0f messages/sec\n", (double) num_messages * SESSION_TEST_LOOPS * 1000000 / (copy_us ? copy_us : 1));
+	pbx_test_status_update(test, "ring path: %.0f messages/sec\n", (double) num_messages * SESSION_TEST_LOOPS * 1000000 / (ring_us ? ring_us : 1));
+
+	sccp_mutex_destroy(&s->write_lock);
+	sccp_mutex_destroy(&s->lock);
+	sccp_free(s);
+	return res;
+}
+
+static int session_test_padding_errors = 0;
+
+/* handlers expect zeros from the known size of the message up to SCCP_MAX_PACKET */
+static int session_test_dispatch_padding(constMessagePtr msg, constSessionPtr s)
+{
+	const unsigned char *data = (const unsigned char *) msg;
+	size_t pos;
+
+	for (pos = msg->header.length; pos < SCCP_MAX_PACKET; pos++) {
+		if (data[pos]) {
+			session_test_padding_errors++;
+			break;
+		}
+	}
+	session_test_dispatched++;
+	return 0;
+}
+
+/* message with the payload (and extra bytes beyond the known size) filled with garbage */
+static size_t session_test_append_garbage(unsigned char *stream, sccp_mid_t mid, size_t len, size_t extra)
+{
+	sccp_msg_t *msg = (sccp_msg_t *) stream;
+
+	memset(stream, 0, SCCP_PACKET_HEADER);
+	memset(stream + SCCP_PACKET_HEADER, 0xff, len + extra);
+	msg->header.length = htolel(len + extra + 4);
+	msg->header.lel_messageId = htolel(mid);
+	return len + extra + SCCP_PACKET_HEADER;
+}
+
+AST_TEST_DEFINE(sccp_session_padding_test)
+{
+	switch(cmd) {
+		case TEST_INIT:
+			info->name = "zeroPadding";
+			info->category = "/channels/chan_sccp/session/";
+			info->summary = "chan-sccp-b session receive path zero padding";
+			info->description = "Messages handed to the handlers are zero from their known size up to SCCP_MAX_PACKET, whether copied or dispatched in place";
+			return AST_TEST_NOT_RUN;
+		case TEST_EXECUTE:
+			break;
+	}
+
+	unsigned char stream[SCCP_MAX_PACKET];
+	size_t stream_len = 0;
+	size_t keypad_len = sccp_messagetypes[KeypadButtonMessage].size;
+	size_t pos = 0;
+	int round = 0;
+	sccp_msg_t msg = { {0,} };
+	sccp_session_t *s = sccp_create_session(-1);
+
+	pbx_test_validate(test, s != NULL);
+	stream_len += session_test_append_garbage(stream + stream_len, KeypadButtonMessage, keypad_len, 0);	/* copied, followed by more data */
+	stream_len += session_test_append_garbage(stream + stream_len, OpenReceiveChannelAck, offsize(sccp_data_t, OpenReceiveChannelAck.v3), 0);	/* shorter than known */
+	stream_len += session_test_append_garbage(stream + stream_len, KeypadButtonMessage, keypad_len, 0);
+	stream_len += session_test_append_garbage(stream + stream_len, KeypadButtonMessage, keypad_len, 16);	/* last, longer than known, in place */
+
+	session_test_dispatched = 0;
+	session_test_padding_errors = 0;
+	for (round = 0; round < 2; round++) {									/* second round reuses the scratch message */
+		size_t space = 0;
+		unsigned char *recvpos = session_recvbuf_space(&s->recv, &space);
+
+		pbx_test_validate(test, space >= stream_len);
+		memcpy(recvpos, stream, stream_len);
+		s->recv.len += stream_len;
+		pbx_test_validate(test, process_buffer(s, &msg, &s->recv, session_test_dispatch_padding) == 0);
+	}
+	pbx_test_status_update(test, "%u messages dispatched, %d not zero padded\n", session_test_dispatched, session_test_padding_errors);
+	pbx_test_validate(test, session_test_dispatched == 8);
+	pbx_test_validate(test, session_test_padding_errors == 0);
+
+	pbx_test_validate(test, s->recv.len == 0);
+	for (pos = 0; pos < sizeof(s->recv.data) && !s->recv.data[pos]; pos++);
+	pbx_test_validate(test, pos == sizeof(s->recv.data));
+
+	sccp_mutex_destroy(&s->write_lock);
+	sccp_mutex_destroy(&s->lock);
+	sccp_free(s);
+	return AST_TEST_PASS;
+}
+
+AST_TEST_DEFINE(sccp_session_sendq_test)
+{
+	sccp_session_t *s = NULL;
+	sccp_msg_t *msg = NULL;
+	unsigned char rbuf[1024];
+	int sv[2] = { -1, -1 };
+	ssize_t len = 0;
+	ssize_t total = 0;
+	ssize_t expected = 0;
+	int idx;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "sendQueue";
+		info->category = "/channels/chan_sccp/session/";
+		info->summary = "chan-sccp-b session send queue";
+		info->description = "Checks that replies sent while handling received messages are coalesced into a single sendmsg call";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+		pbx_test_status_update(test, "socketpair failed: %s\n", strerror(errno));
+		return AST_TEST_FAIL;
+	}
+	if (!(s = sccp_calloc(sizeof *s, 1))) {
+		close(sv[0]);
+		close(sv[1]);
+		return AST_TEST_FAIL;
+	}
+	sccp_mutex_init(&s->lock);
+	sccp_mutex_init(&s->write_lock);
+	s->fds[0].fd = sv[0];
+	s->session_thread = AST_PTHREADT_NULL;
+
+	pbx_test_status_update(test, "Sending 10 messages while corked...\n");
+	session_sendq_cork(s);
+	for (idx = 0; idx < 10; idx++) {
+		REQ(msg, SetLampMessage);
+		pbx_test_validate(test, msg != NULL);
+		msg->data.SetLampMessage.lel_stimulusInstance = htolel(idx);
+		expected += letohl(msg->header.length) + 8;
+		sccp_session_send2(s, msg);
+	}
+	pbx_test_validate(test, s->sendq.count == 10 && s->sendq.syscalls == 0);
+	pbx_test_validate(test, recv(sv[1], rbuf, sizeof(rbuf), MSG_DONTWAIT) < 0);
+
+	session_sendq_uncork(s);
+	pbx_test_validate(test, s->sendq.count == 0);
+	pbx_test_validate(test, s->sendq.messages == 10 && s->sendq.syscalls == 1);
+	while (total < expected && (len = recv(sv[1], rbuf + total, sizeof(rbuf) - total, 0)) > 0) {
+		total += len;
+	}
+	pbx_test_validate(test, total == expected);
+	for (idx = 0, len = 0; idx < 10 && len < total; idx++) {
+		sccp_msg_t *rmsg = (sccp_msg_t *) (rbuf + len);
+		pbx_test_validate(test, letohl(rmsg->header.lel_messageId) == SetLampMessage);
+		pbx_test_validate(test, letohl(rmsg->data.SetLampMessage.lel_stimulusInstance) == (uint32_t) idx);
+		len += letohl(rmsg->header.length) + 8;
+	}
+
+	pbx_test_status_update(test, "Sending 1 message uncorked...\n");
+	REQ(msg, SetLampMessage);
+	pbx_test_validate(test, msg != NULL);
+	sccp_session_send2(s, msg);
+	pbx_test_validate(test, s->sendq.count == 0 && s->sendq.syscalls == 2);
+
+	close(sv[0]);
+	close(sv[1]);
+	sccp_mutex_destroy(&s->write_lock);
+	sccp_mutex_destroy(&s->lock);
+	sccp_free(s);
+	return AST_TEST_PASS;
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+AST_TEST_DEFINE(sccp_session_sendq_backlog_test)
+{
+	sccp_session_reactor_worker_t worker;
+	sccp_session_t *s = NULL;
+	sccp_msg_t *msg = NULL;
+	struct epoll_event ev = { 0 };
+	unsigned char rbuf[SCCP_MAX_PACKET];
+	int sv[2] = { -1, -1 };
+	int sndbuf = 4096;
+	ssize_t len = 0;
+	size_t msglen = 0;
+	size_t have = 0;
+	uint32_t sent = 0;
+	uint32_t received = 0;
+	int loops = 0;
+	enum ast_test_result_state res = AST_TEST_PASS;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "sendBacklog";
+		info->category = "/channels/chan_sccp/session/";
+		info->summary = "chan-sccp-b reactor session send backlog";
+		info->description = "Checks that sending to a reactor session whose socket is full does not block, and that the backlog is written out in order once the socket is writable";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	memset(&worker, 0, sizeof(worker));
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0 || (worker.epfd = epoll_create(1)) < 0) {
+		pbx_test_status_update(test, "socketpair/epoll_create failed: %s\n", strerror(errno));
+		return AST_TEST_FAIL;
+	}
+	setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+	if (!(s = sccp_calloc(sizeof *s, 1))) {
+		close(worker.epfd);
+		close(sv[0]);
+		close(sv[1]);
+		return AST_TEST_FAIL;
+	}
+	sccp_mutex_init(&s->lock);
+	sccp_mutex_init(&s->write_lock);
+	s->fds[0].fd = sv[0];
+	s->session_thread = AST_PTHREADT_NULL;
+	s->worker = &worker;
+	ev.events = EPOLLIN | EPOLLPRI | EPOLLRDHUP;							/* as sccp_session_reactor_adopt */
+	ev.data.ptr = s;
+	epoll_ctl(worker.epfd, EPOLL_CTL_ADD, sv[0], &ev);
+
+	pbx_test_status_update(test, "Sending until the socket is full...\n");
+	while (!s->sendq.backlog_len && sent < 65536) {
+		REQ(msg, SetLampMessage);
+		pbx_test_validate_cleanup(test, msg != NULL, res, cleanup);
+		msg->data.SetLampMessage.lel_stimulusInstance = htolel(sent);
+		msglen = letohl(msg->header.length) + 8;
+		pbx_test_validate_cleanup(test, sccp_session_send2(s, msg) == (int) msglen, res, cleanup);
+		sent++;
+	}
+	pbx_test_validate_cleanup(test, s->sendq.backlog_len > 0, res, cleanup);
+	for (loops = 0; loops < 10 && sent < 65536; loops++, sent++) {					/* queued behind the backlog, without a syscall */
+		unsigned long syscalls = s->sendq.syscalls;
+		REQ(msg, SetLampMessage);
+		pbx_test_validate_cleanup(test, msg != NULL, res, cleanup);
+		msg->data.SetLampMessage.lel_stimulusInstance = htolel(sent);
+		pbx_test_validate_cleanup(test, sccp_session_send2(s, msg) == (int) msglen, res, cleanup);
+		pbx_test_validate_cleanup(test, s->sendq.syscalls == syscalls, res, cleanup);
+	}
+	pbx_test_status_update(test, "Sent %u messages, %d bytes in the backlog\n", sent, (int) s->sendq.backlog_len);
+
+	pbx_test_status_update(test, "Reading while the worker writes out the backlog...\n");
+	for (loops = 0; received < sent && loops < 1000000; loops++) {
+		if (epoll_wait(worker.epfd, &ev, 1, 0) == 1 && (ev.events & EPOLLOUT)) {
+			pbx_test_validate_cleanup(test, session_sendq_write_backlog(s) == 0, res, cleanup);
+		}
+		if ((len = recv(sv[1], rbuf + have, msglen - have, MSG_DONTWAIT)) > 0 && (have += len) == msglen) {
+			sccp_msg_t *rmsg = (sccp_msg_t *) rbuf;
+			pbx_test_validate_cleanup(test, letohl(rmsg->header.lel_messageId) == SetLampMessage, res, cleanup);
+			pbx_test_validate_cleanup(test, letohl(rmsg->data.SetLampMessage.lel_stimulusInstance) == received, res, cleanup);
+			received++;
+			have = 0;
+		}
+	}
+	pbx_test_validate_cleanup(test, received == sent, res, cleanup);
+	pbx_test_validate_cleanup(test, s->sendq.backlog == NULL && s->sendq.backlog_len == 0, res, cleanup);
+	pbx_test_validate_cleanup(test, epoll_wait(worker.epfd, &ev, 1, 0) == 0, res, cleanup);			/* EPOLLOUT is not watched anymore */
+
+cleanup:
+	if (s->sendq.backlog) {
+		sccp_free(s->sendq.backlog);
+	}
+	close(worker.epfd);
+	close(sv[0]);
+	close(sv[1]);
+	sccp_mutex_destroy(&s->write_lock);
+	sccp_mutex_destroy(&s->lock);
+	sccp_free(s);
+	return res;
+}
+#endif
+
+AST_TEST_DEFINE(sccp_session_capture_replay_test)
+{
+	char filename[] = "/tmp/sccp_session_replay_XXXXXX";
+	unsigned char stream[SCCP_MAX_PACKET * 4];
+	int num_messages = 0;
+	size_t stream_len = session_test_build_stream(stream, sizeof(stream), &num_messages);
+	sccp_session_replay_stats_t stats;
+	struct sockaddr_storage server;
+	struct sockaddr_in *sin = NULL;
+	sccp_session_t *s = NULL;
+	sccp_msg_t msg = { {0,} };
+	sccp_msg_t *reply = NULL;
+	unsigned int checksum = 0;
+	size_t offset = 0;
+	int fd, idx;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "captureReplay";
+		info->category = "/channels/chan_sccp/session/";
+		info->summary = "chan-sccp-b session capture and replay";
+		info->description = "Captures a registration plus call-setup stream and its replies, then replays the capture through process_buffer";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	if ((fd = mkstemp(filename)) < 0) {
+		pbx_test_status_update(test, "Could not create a temporary file\n");
+		return AST_TEST_FAIL;
+	}
+	close(fd);
+	unlink(filename);											/* sccp_pcap_open only creates new files */
+
+	/* capture */
+	pbx_test_validate(test, (s = sccp_create_session(-1)) != NULL);
+	s->replay = TRUE;
+	s->session_thread = AST_PTHREADT_NULL;
+	sin = (struct sockaddr_in *) &s->sin;
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = htonl(0xC0A80102);
+	sin->sin_port = htons(51234);
+	sin = (struct sockaddr_in *) &server;
+	memset(&server, 0, sizeof(server));
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = htonl(0xC0A80101);
+	sin->sin_port = htons(session_serverport());
+	s->capture = sccp_pcap_open(filename, &s->sin, &server);
+	pbx_test_validate(test, s->capture != NULL);
+
+	session_test_dispatched = 0;
+	for (offset = 0; offset < stream_len;) {
+		size_t space = 0;
+		unsigned char *pos = session_recvbuf_space(&s->recv, &space);
+		size_t chunk = stream_len - offset < SESSION_TEST_SEGMENT ? stream_len - offset : SESSION_TEST_SEGMENT;
+		chunk = chunk < space ? chunk : space;
+		memcpy(pos, stream + offset, chunk);
+		s->recv.len += chunk;
+		offset += chunk;
+		pbx_test_validate(test, process_buffer(s, &msg, &s->recv, session_test_dispatch) == 0);
+	}
+	checksum = session_test_dispatched;
+	for (idx = 0; idx < 3; idx++) {
+		REQ(reply, SetLampMessage);
+		pbx_test_validate(test, reply != NULL);
+		pbx_test_validate(test, sccp_session_send2(s, reply) > 0);
+	}
+	pbx_test_validate(test, sccp_pcap_getFrames(s->capture) == (uint32_t) num_messages + 3);
+	pbx_mutex_lock(&s->write_lock);
+	__session_capture_stop(s);
+	pbx_mutex_unlock(&s->write_lock);
+	sccp_mutex_destroy(&s->write_lock);
+	sccp_mutex_destroy(&s->lock);
+	sccp_free(s);
+
+	/* replay */
+	pbx_test_validate(test, (s = sccp_create_session(-1)) != NULL);
+	s->replay = TRUE;
+	s->session_thread = AST_PTHREADT_NULL;
+	session_test_dispatched = 0;
+	pbx_test_validate(test, session_replay(s, filename, session_test_dispatch, FALSE, &stats) == 0);
+	pbx_test_status_update(test, "Replayed %u frames (%u captured replies) in %.3f ms\n", stats.frames, stats.captured_replies, (double) stats.duration_us / 1000);
+	pbx_test_validate(test, stats.frames == (uint32_t) num_messages && stats.captured_replies == 3);
+	pbx_test_validate(test, session_test_dispatched == checksum);
+	pbx_test_validate(test, sccp_netsock_getPort(&s->sin) == 51234 && s->recv.len == 0);
+
+	sccp_mutex_destroy(&s->write_lock);
+	sccp_mutex_destroy(&s->lock);
+	sccp_free(s);
+	unlink(filename);
+	return AST_TEST_PASS;
+}
+
+static void __attribute__((constructor)) sccp_register_tests(void)
+{
+	AST_TEST_REGISTER(sccp_session_process_buffer_bench);
+	AST_TEST_REGISTER(sccp_session_padding_test);
+	AST_TEST_REGISTER(sccp_session_sendq_test);
+#ifdef HAVE_SYS_EPOLL_H
+	AST_TEST_REGISTER(sccp_session_sendq_backlog_test);
+#endif
+	AST_TEST_REGISTER(sccp_session_capture_replay_test);
+}
+
+static void __attribute__((destructor)) sccp_unregister_tests(void)
+{
+	AST_TEST_UNREGISTER(sccp_session_process_buffer_bench);
+	AST_TEST_UNREGISTER(sccp_session_padding_test);
+	AST_TEST_UNREGISTER(sccp_session_sendq_test);
+#ifdef HAVE_SYS_EPOLL_H
+	AST_TEST_UNREGISTER(sccp_session_sendq_backlog_test);
+#endif
+	AST_TEST_UNREGISTER(sccp_session_capture_replay_test);
+}
+#endif
+
 // kate: indent-width 8; replace-tabs off; indent-mode cstyle; auto-insert-doxygen on; line-numbers on; tab-indents on; keep-extra-spaces off; auto-brackets off;
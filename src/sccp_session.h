@@ -38,6 +38,21 @@ SCCP_API sccp_device_t * const SCCP_CALL sccp_session_getDevice(constSessionPtr
 SCCP_API boolean_t SCCP_CALL sccp_session_isValid(constSessionPtr session);
 SCCP_API int SCCP_CALL sccp_cli_show_sessions(int fd, sccp_cli_totals_t *totals, struct mansession *s, const struct message *m, int argc, char *argv[]);
 
+/*!
+ * \brief Result of sccp_session_replay
+ */
+typedef struct sccp_session_replay_stats {
+	uint32_t frames;											/*!< frames sent by the phone, fed to the message handlers */
+	uint32_t captured_replies;										/*!< frames sent by chan-sccp in the capture */
+	unsigned long replies;											/*!< messages sent by chan-sccp during the replay */
+	int64_t duration_us;
+} sccp_session_replay_stats_t;
+
+SCCP_API int SCCP_CALL sccp_session_startCapture(const char *pattern, const char *directory);
+SCCP_API int SCCP_CALL sccp_session_stopCapture(const char *pattern);
+SCCP_API int SCCP_CALL sccp_session_replay(const char *filename, boolean_t realtime, sccp_session_replay_stats_t * stats);
+SCCP_API int SCCP_CALL sccp_cli_show_captures(int fd, sccp_cli_totals_t *totals, struct mansession *s, const struct message *m, int argc, char *argv[]);
+
 SCCP_API boolean_t SCCP_CALL sccp_session_bind_and_listen(struct sockaddr_storage *bindaddr);
 SCCP_API void SCCP_CALL sccp_session_stop_accept_thread(void);
 __END_C_EXTERN__
@@ -15,6 +15,8 @@
 
 SCCP_FILE_VERSION(__FILE__, "");
 #include "sccp_threadpool.h"
+#include "sccp_atomic.h"
+#include <asterisk/cli.h>
 #include <signal.h>
 #undef pthread_create
 #if defined(__GNUC__) && __GNUC__ > 3 && defined(HAVE_SYS_INFO_H)
@@ -22,6 +24,8 @@ SCCP_FILE_VERSION(__FILE__, "");
 #endif
 //#define SEMAPHORE_LOCKED	(0)
 //#define SEMAPHORE_UNLOCKED	(1)
+#define THREADPOOL_JOB_CACHE_SIZE 256										/*!< max number of job nodes kept for reuse */
+#define THREADPOOL_LATENCY_BUCKETS 24										/*!< log2(usec) buckets, the last one collects everything above ~8s */
 void sccp_threadpool_grow(sccp_threadpool_t * tp_p, int amount);
 void sccp_threadpool_shrink(sccp_threadpool_t * tp_p, int amount);
 
@@ -31,18 +35,37 @@ struct sccp_threadpool_thread {
 	pthread_t thread;
 	sccp_threadpool_t *tp_p;
 	SCCP_LIST_ENTRY (sccp_threadpool_thread_t) list;
+	SCCP_LIST_HEAD (, sccp_threadpool_job_t) jobs;								/*!< this thread's job queue */
 	boolean_t die;
+	boolean_t idle;
+	unsigned long executed;
+	unsigned long stolen;											/*!< jobs this thread took from another thread's queue */
+	unsigned long latency[THREADPOOL_LATENCY_BUCKETS];							/*!< time between adding and starting a job */
 };
 
 /* The threadpool */
 struct sccp_threadpool {
-	SCCP_LIST_HEAD (, sccp_threadpool_job_t) jobs;
 	SCCP_LIST_HEAD (, sccp_threadpool_thread_t) threads;
+	SCCP_LIST_HEAD (, sccp_threadpool_job_t) freejobs;							/*!< recycled job nodes */
+	ast_rwlock_t workers_lock;										/*!< protects workers / num_workers, read locked while queueing */
+	sccp_threadpool_thread_t **workers;									/*!< job queue owners, the first num_permanent never go away */
+	int num_workers;
+	int max_workers;
+	int num_permanent;
+	pbx_mutex_t lock;											/*!< idle threads wait on work using this lock */
 	pbx_cond_t work;
 	pbx_cond_t exit;
-	time_t last_size_check;											/*!< Time since last size check */
+	volatile int num_idle;
+	volatile int queued;											/*!< jobs on any queue */
+	volatile int stealable;											/*!< jobs without affinity on any queue */
+	volatile unsigned int next_worker;
 	time_t last_resize;											/*!< Time since last resize */
-	int job_high_water_mark;										/*!< Highest number of jobs outstanding since last resize check */
+	int job_high_water_mark;										/*!< Highest number of jobs outstanding */
+	unsigned long jobs_allocated;
+	unsigned long jobs_recycled;
+	unsigned long retired_executed;										/*!< stats of threads that have exited */
+	unsigned long retired_stolen;
+	unsigned long retired_latency[THREADPOOL_LATENCY_BUCKETS];
 	volatile int sccp_threadpool_shuttingdown;
 };
 
@@ -77,13 +100,18 @@ sccp_threadpool_t *sccp_threadpool_init(int threadsN)
 		pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
 		return NULL;
 	}
+	tp_p->max_workers = THREADPOOL_MAX_SIZE;
+	if (!(tp_p->workers = sccp_calloc(tp_p->max_workers, sizeof(sccp_threadpool_thread_t *)))) {
+		pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
+		sccp_free(tp_p);
+		return NULL;
+	}
 
 	/* initialize the thread pool */
 	SCCP_LIST_HEAD_INIT(&tp_p->threads);
-
-	/* Initialise the job queue */
-	SCCP_LIST_HEAD_INIT(&tp_p->jobs);
-	tp_p->last_size_check = time(0);
+	SCCP_LIST_HEAD_INIT(&tp_p->freejobs);
+	pbx_rwlock_init_notracking(&tp_p->workers_lock);
+	pbx_mutex_init(&tp_p->lock);
 	tp_p->job_high_water_mark = 0;
 	tp_p->last_resize = time(0);
 	tp_p->sccp_threadpool_shuttingdown = 0;
@@ -92,9 +120,10 @@ sccp_threadpool_t *sccp_threadpool_init(int threadsN)
 	pbx_cond_init(&(tp_p->work), NULL);
 	pbx_cond_init(&(tp_p->exit), NULL);
 
-	/* Make threads in pool */
+	/* Make threads in pool, the initial threads are permanent and are the ones handling jobs with an affinity key */
 	SCCP_LIST_LOCK(&(tp_p->threads));
 	sccp_threadpool_grow(tp_p, threadsN);
+	tp_p->num_permanent = tp_p->num_workers;
 	SCCP_LIST_UNLOCK(&(tp_p->threads));
 
 	sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_3 "Threadpool Started\n");
@@ -116,6 +145,23 @@ void sccp_threadpool_grow(sccp_threadpool_t * tp_p, int amount)
 			}
 			tp_thread->die = FALSE;
 			tp_thread->tp_p = tp_p;
+			SCCP_LIST_HEAD_INIT(&tp_thread->jobs);
+
+			pbx_rwlock_wrlock(&tp_p->workers_lock);
+			if (tp_p->num_workers == tp_p->max_workers) {
+				sccp_threadpool_thread_t **workers = sccp_realloc(tp_p->workers, tp_p->max_workers * 2 * sizeof(sccp_threadpool_thread_t *));
+				if (!workers) {
+					pbx_rwlock_unlock(&tp_p->workers_lock);
+					pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
+					SCCP_LIST_HEAD_DESTROY(&tp_thread->jobs);
+					sccp_free(tp_thread);
+					return;
+				}
+				tp_p->workers = workers;
+				tp_p->max_workers *= 2;
+			}
+			tp_p->workers[tp_p->num_workers++] = tp_thread;
+			pbx_rwlock_unlock(&tp_p->workers_lock);
 
 			pthread_attr_init(&attr);
 			pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
@@ -126,7 +172,6 @@ void sccp_threadpool_grow(sccp_threadpool_t * tp_p, int amount)
 			SCCP_LIST_UNLOCK(&(tp_p->threads));
 			pbx_pthread_create(&(tp_thread->thread), &attr, (void *) sccp_threadpool_thread_do, (void *) tp_thread);
 			sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_3 "Created thread %d(%p) in pool \n", t, (void *) tp_thread->thread);
-			pbx_cond_broadcast(&(tp_p->work));
 		}
 	}
 }
@@ -135,23 +180,28 @@ void sccp_threadpool_grow(sccp_threadpool_t * tp_p, int amount)
 void sccp_threadpool_shrink(sccp_threadpool_t * tp_p, int amount)
 {
 	sccp_threadpool_thread_t *tp_thread;
-	int t;
+	int t, idx;
 
 	if (tp_p && !tp_p->sccp_threadpool_shuttingdown) {
 		for (t = 0; t < amount; t++) {
-			SCCP_LIST_LOCK(&(tp_p->threads));
-			SCCP_LIST_TRAVERSE(&(tp_p->threads), tp_thread, list) {
-				if (tp_thread->die == FALSE) {
+			/* only non permanent threads are stopped, the permanent ones own the affinity keys */
+			tp_thread = NULL;
+			pbx_rwlock_rdlock(&tp_p->workers_lock);
+			for (idx = tp_p->num_workers - 1; idx >= tp_p->num_permanent; idx--) {
+				if (tp_p->workers[idx]->die == FALSE) {
+					tp_thread = tp_p->workers[idx];
 					tp_thread->die = TRUE;
 					break;
 				}
 			}
-			SCCP_LIST_UNLOCK(&(tp_p->threads));
+			pbx_rwlock_unlock(&tp_p->workers_lock);
 			
 			if (tp_thread) {
 				// wake up all threads
 				sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_3 "Sending die signal to thread %p in pool \n", (void *) tp_thread->thread);
+				pbx_mutex_lock(&tp_p->lock);
 				pbx_cond_broadcast(&(tp_p->work));
+				pbx_mutex_unlock(&tp_p->lock);
 			}
 		}
 	}
@@ -164,20 +214,19 @@ static void sccp_threadpool_check_size(sccp_threadpool_t * tp_p)
 		sccp_log((DEBUGCAT_THPOOL)) (VERBOSE_PREFIX_3 "(sccp_threadpool_check_resize) in thread: %p\n", (void *) pthread_self());
 		SCCP_LIST_LOCK(&(tp_p->threads));
 		{
-			if (SCCP_LIST_GETSIZE(&tp_p->jobs) > (SCCP_LIST_GETSIZE(&tp_p->threads) * 2) && SCCP_LIST_GETSIZE(&tp_p->threads) < THREADPOOL_MAX_SIZE) {	// increase
+			int queued = tp_p->queued;
+			int threads = (int) SCCP_LIST_GETSIZE(&tp_p->threads);
+			if (queued > threads * 2 && threads < THREADPOOL_MAX_SIZE) {				// increase
 				sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_3 "Add new thread to threadpool %p\n", tp_p);
 				sccp_threadpool_grow(tp_p, 1);
 				tp_p->last_resize = time(0);
 			} else if (((time(0) - tp_p->last_resize) > THREADPOOL_RESIZE_INTERVAL * 3) &&		// wait a little longer to decrease
-				   (SCCP_LIST_GETSIZE(&tp_p->threads) > THREADPOOL_MIN_SIZE && SCCP_LIST_GETSIZE(&tp_p->jobs) < (SCCP_LIST_GETSIZE(&tp_p->threads) / 2))) {	// decrease
-				sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_3 "Remove thread %d from threadpool %p\n", SCCP_LIST_GETSIZE(&tp_p->threads) - 1, tp_p);
-				// kill last thread only if it is not executed by itself
+				   (threads > THREADPOOL_MIN_SIZE && queued < (threads / 2))) {			// decrease
+				sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_3 "Remove thread %d from threadpool %p\n", threads - 1, tp_p);
 				sccp_threadpool_shrink(tp_p, 1);
 				tp_p->last_resize = time(0);
 			}
-			tp_p->last_size_check = time(0);
-			tp_p->job_high_water_mark = SCCP_LIST_GETSIZE(&tp_p->jobs);
-			sccp_log((DEBUGCAT_THPOOL)) (VERBOSE_PREFIX_3 "(sccp_threadpool_check_resize) Number of threads: %d, job_high_water_mark: %d\n", SCCP_LIST_GETSIZE(&tp_p->threads), tp_p->job_high_water_mark);
+			sccp_log((DEBUGCAT_THPOOL)) (VERBOSE_PREFIX_3 "(sccp_threadpool_check_resize) Number of threads: %d, queued: %d, job_high_water_mark: %d\n", threads, queued, tp_p->job_high_water_mark);
 		}
 		SCCP_LIST_UNLOCK(&(tp_p->threads));
 	}
@@ -188,70 +237,165 @@ static void sccp_threadpool_thread_end(void *p)
 	sccp_threadpool_thread_t *tp_thread = (sccp_threadpool_thread_t *) p;
 	sccp_threadpool_thread_t *res = NULL;
 	sccp_threadpool_t *tp_p = tp_thread->tp_p;
+	int idx;
+
+	pbx_rwlock_wrlock(&tp_p->workers_lock);									// only still there when cancelled
+	for (idx = 0; idx < tp_p->num_workers; idx++) {
+		if (tp_p->workers[idx] == tp_thread) {
+			tp_p->workers[idx] = tp_p->workers[--tp_p->num_workers];
+			break;
+		}
+	}
+	pbx_rwlock_unlock(&tp_p->workers_lock);
 
 	SCCP_LIST_LOCK(&(tp_p->threads));
 	res = SCCP_LIST_REMOVE(&(tp_p->threads), tp_thread, list);
+	tp_p->retired_executed += tp_thread->executed;
+	tp_p->retired_stolen += tp_thread->stolen;
+	for (idx = 0; idx < THREADPOOL_LATENCY_BUCKETS; idx++) {
+		tp_p->retired_latency[idx] += tp_thread->latency[idx];
+	}
+	pbx_cond_signal(&(tp_p->exit));
 	SCCP_LIST_UNLOCK(&(tp_p->threads));
 
-	pbx_cond_signal(&(tp_p->exit));
 	if (res) {
+		SCCP_LIST_HEAD_DESTROY(&res->jobs);
 		sccp_free(res);
 	}
 }
 
+/* take the oldest job from our own queue */
+static sccp_threadpool_job_t *sccp_threadpool_jobqueue_pop(sccp_threadpool_thread_t * tp_thread)
+{
+	sccp_threadpool_job_t *job = NULL;
+
+	if (SCCP_LIST_GETSIZE(&tp_thread->jobs)) {
+		SCCP_LIST_LOCK(&tp_thread->jobs);
+		job = SCCP_LIST_REMOVE_HEAD(&tp_thread->jobs, list);
+		SCCP_LIST_UNLOCK(&tp_thread->jobs);
+		if (job && !job->affinity) {
+			(void) ATOMIC_DECR(&tp_thread->tp_p->stealable, 1, &tp_thread->tp_p->lock);
+		}
+	}
+	return job;
+}
+
+/* take the most recently added job without affinity from another thread's queue */
+static sccp_threadpool_job_t *sccp_threadpool_jobqueue_steal(sccp_threadpool_thread_t * tp_thread)
+{
+	sccp_threadpool_t *tp_p = tp_thread->tp_p;
+	sccp_threadpool_job_t *job = NULL;
+	int idx, start;
+
+	if (tp_p->stealable <= 0) {
+		return NULL;
+	}
+	pbx_rwlock_rdlock(&tp_p->workers_lock);
+	start = (int) (tp_p->next_worker % (unsigned int) tp_p->num_workers);
+	for (idx = 0; idx < tp_p->num_workers && !job; idx++) {
+		sccp_threadpool_thread_t *victim = tp_p->workers[(start + idx) % tp_p->num_workers];
+		if (victim == tp_thread || SCCP_LIST_GETSIZE(&victim->jobs) == 0) {
+			continue;
+		}
+		SCCP_LIST_LOCK(&victim->jobs);
+		for (job = SCCP_LIST_LAST(&victim->jobs); job && job->affinity; job = job->list.prev);
+		if (job) {
+			SCCP_LIST_REMOVE(&victim->jobs, job, list);
+		}
+		SCCP_LIST_UNLOCK(&victim->jobs);
+	}
+	pbx_rwlock_unlock(&tp_p->workers_lock);
+	if (job) {
+		(void) ATOMIC_DECR(&tp_p->stealable, 1, &tp_p->lock);
+		tp_thread->stolen++;
+	}
+	return job;
+}
+
+static void sccp_threadpool_job_recycle(sccp_threadpool_t * tp_p, sccp_threadpool_job_t * job)
+{
+	SCCP_LIST_LOCK(&tp_p->freejobs);
+	if (SCCP_LIST_GETSIZE(&tp_p->freejobs) < THREADPOOL_JOB_CACHE_SIZE) {
+		SCCP_LIST_INSERT_HEAD(&tp_p->freejobs, job, list);
+		job = NULL;
+	}
+	SCCP_LIST_UNLOCK(&tp_p->freejobs);
+	if (job) {
+		sccp_free(job);
+	}
+}
+
+static inline int sccp_threadpool_latency_bucket(int64_t usec)
+{
+	int bucket = 0;
+
+	while (usec > 1 && bucket < THREADPOOL_LATENCY_BUCKETS - 1) {
+		usec >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
 /* What each individual thread is doing */
 void sccp_threadpool_thread_do(void *p)
 {
 	sccp_threadpool_thread_t *tp_thread = (sccp_threadpool_thread_t *) p;
 	sccp_threadpool_t *tp_p = tp_thread->tp_p;
 	void *thread = (void *) pthread_self();
+	sccp_threadpool_job_t *job = NULL;
 
 	pthread_cleanup_push(sccp_threadpool_thread_end, tp_thread);
 
-	int jobs = 0, threads = 0;
-
 	sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_3 "Starting Threadpool JobQueue:%p\n", thread);
 	while (1) {
 		pthread_testcancel();
-		jobs = SCCP_LIST_GETSIZE(&tp_p->jobs);
-		threads = SCCP_LIST_GETSIZE(&tp_p->threads);
-
-		sccp_log((DEBUGCAT_THPOOL)) (VERBOSE_PREFIX_3 "(sccp_threadpool_thread_do) num_jobs: %d, thread: %p, num_threads: %d\n", jobs, thread, threads);
 
 		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-		SCCP_LIST_LOCK(&(tp_p->jobs));									/* LOCK */
-		while (SCCP_LIST_GETSIZE(&tp_p->jobs) == 0 && !tp_thread->die) {
-			sccp_log((DEBUGCAT_THPOOL)) (VERBOSE_PREFIX_3 "(sccp_threadpool_thread_do) Thread %p Waiting for New Work Condition\n", thread);
-			pbx_cond_wait(&(tp_p->work), &(tp_p->jobs.lock));
-		}
-		if (tp_thread->die && SCCP_LIST_GETSIZE(&tp_p->jobs) == 0) {
-			sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_3 "JobQueue Die. Exiting thread %p...\n", thread);
-			SCCP_LIST_UNLOCK(&(tp_p->jobs));
-			break;
-		}
-		sccp_log((DEBUGCAT_THPOOL)) (VERBOSE_PREFIX_3 "(sccp_threadpool_thread_do) Let's work. num_jobs: %d, thread: %p, num_threads: %d\n", jobs, thread, threads);
-		{
-			/* Read job from queue and execute it */
-			void *(*func_buff) (void *arg) = NULL;
-			void *arg_buff = NULL;
-			sccp_threadpool_job_t *job;
-
-			if ((job = SCCP_LIST_REMOVE_HEAD(&(tp_p->jobs), list))) {
-				func_buff = job->function;
-				arg_buff = job->arg;
+		if (!(job = sccp_threadpool_jobqueue_pop(tp_thread)) && !(job = sccp_threadpool_jobqueue_steal(tp_thread))) {
+			if (tp_thread->die) {
+				/* recheck under the workers write lock, nobody can be queueing to us anymore once we are out of the workers */
+				pbx_rwlock_wrlock(&tp_p->workers_lock);
+				int remaining = SCCP_LIST_GETSIZE(&tp_thread->jobs);
+				for (int idx = 0; !remaining && idx < tp_p->num_workers; idx++) {
+					if (tp_p->workers[idx] == tp_thread) {
+						tp_p->workers[idx] = tp_p->workers[--tp_p->num_workers];	// never moves a permanent thread, they are in front
+						break;
+					}
+				}
+				pbx_rwlock_unlock(&tp_p->workers_lock);
+				if (!remaining) {
+					sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_3 "JobQueue Die. Exiting thread %p...\n", thread);
+					break;
+				}
+				pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+				continue;
 			}
-			SCCP_LIST_UNLOCK(&(tp_p->jobs));
-
-			sccp_log((DEBUGCAT_THPOOL)) (VERBOSE_PREFIX_3 "(sccp_threadpool_thread_do) executing %p in thread: %p\n", job, thread);
-			if (job) {
-				func_buff(arg_buff);								/* run function */
-				sccp_free(job);									/* DEALLOC job */
+			/* nothing to do, wait for new work (or for the resize interval to pass) */
+			struct timespec ts = { time(0) + THREADPOOL_RESIZE_INTERVAL, 0 };
+			int res = 0;
+			pbx_mutex_lock(&tp_p->lock);
+			tp_thread->idle = TRUE;
+			(void) ATOMIC_INCR(&tp_p->num_idle, 1, &tp_p->lock);
+			while (SCCP_LIST_GETSIZE(&tp_thread->jobs) == 0 && tp_p->stealable <= 0 && !tp_thread->die && res != ETIMEDOUT) {
+				sccp_log((DEBUGCAT_THPOOL)) (VERBOSE_PREFIX_3 "(sccp_threadpool_thread_do) Thread %p Waiting for New Work Condition\n", thread);
+				res = pbx_cond_timedwait(&(tp_p->work), &(tp_p->lock), &ts);
 			}
-			// check number of threads in threadpool
-			if ((time(0) - tp_p->last_size_check) > THREADPOOL_RESIZE_INTERVAL) {
+			(void) ATOMIC_DECR(&tp_p->num_idle, 1, &tp_p->lock);
+			tp_thread->idle = FALSE;
+			pbx_mutex_unlock(&tp_p->lock);
+			if (res == ETIMEDOUT) {
 				sccp_threadpool_check_size(tp_p);						/* Check Resizing */
 			}
+			pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+			continue;
 		}
+		(void) ATOMIC_DECR(&tp_p->queued, 1, &tp_p->lock);
+		tp_thread->latency[sccp_threadpool_latency_bucket(ast_tvdiff_us(pbx_tvnow(), job->queued))]++;
+
+		sccp_log((DEBUGCAT_THPOOL)) (VERBOSE_PREFIX_3 "(sccp_threadpool_thread_do) executing %p in thread: %p\n", job, thread);
+		job->function(job->arg);									/* run function */
+		tp_thread->executed++;
+		sccp_threadpool_job_recycle(tp_p, job);								/* recycle job */
 		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
 	}
 	sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_3 "JobQueue Exiting Thread...\n");
@@ -261,12 +405,25 @@ void sccp_threadpool_thread_do(void *p)
 
 /* Add work to the thread pool */
 int sccp_threadpool_add_work(sccp_threadpool_t * tp_p, void *(*function_p) (void *), void *arg_p)
+{
+	return sccp_threadpool_add_work_affinity(tp_p, function_p, arg_p, NULL);
+}
+
+/* Add work to the thread pool, jobs with the same affinity key are run in order by the same thread */
+int sccp_threadpool_add_work_affinity(sccp_threadpool_t * tp_p, void *(*function_p) (void *), void *arg_p, const char *affinity)
 {
 	// prevent new work while shutting down
 	if (!tp_p->sccp_threadpool_shuttingdown) {
-		sccp_threadpool_job_t *newJob;
+		sccp_threadpool_job_t *newJob = NULL;
 
-		if (!(newJob = sccp_calloc(sizeof *newJob, 1))) {
+		SCCP_LIST_LOCK(&tp_p->freejobs);
+		if ((newJob = SCCP_LIST_REMOVE_HEAD(&tp_p->freejobs, list))) {
+			tp_p->jobs_recycled++;
+		} else {
+			tp_p->jobs_allocated++;
+		}
+		SCCP_LIST_UNLOCK(&tp_p->freejobs);
+		if (!newJob && !(newJob = sccp_calloc(sizeof *newJob, 1))) {
         		pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
 			exit(1);
 		}
@@ -274,6 +431,14 @@ int sccp_threadpool_add_work(sccp_threadpool_t * tp_p, void *(*function_p) (void
 		/* add function and argument */
 		newJob->function = function_p;
 		newJob->arg = arg_p;
+		newJob->affinity = 0;
+		if (!sccp_strlen_zero(affinity)) {
+			uint32_t hash = 2166136261U;							/* FNV-1a, never 0 for a non empty key */
+			for (const char *c = affinity; *c; c++) {
+				hash = (hash ^ (unsigned char) *c) * 16777619U;
+			}
+			newJob->affinity = hash | 1;
+		}
 
 		/* add job to queue */
 		sccp_threadpool_jobqueue_add(tp_p, newJob);
@@ -290,24 +455,26 @@ boolean_t sccp_threadpool_destroy(sccp_threadpool_t * tp_p)
 		return FALSE;
 	}
 	sccp_threadpool_thread_t *tp_thread = NULL;
+	sccp_threadpool_job_t *job = NULL;
 
-	sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_2 "Destroying Threadpool %p with %d jobs\n", tp_p, SCCP_LIST_GETSIZE(&tp_p->jobs));
+	sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_2 "Destroying Threadpool %p with %d jobs\n", tp_p, tp_p->queued);
 
 	// After this point, no new jobs can be added
-	SCCP_LIST_LOCK(&(tp_p->jobs));
+	pbx_rwlock_wrlock(&tp_p->workers_lock);
 	tp_p->sccp_threadpool_shuttingdown = 1;
-	SCCP_LIST_UNLOCK(&(tp_p->jobs));
+	pbx_rwlock_unlock(&tp_p->workers_lock);
 
 	// shutdown is a kind of work too
 	SCCP_LIST_LOCK(&(tp_p->threads));
 	SCCP_LIST_TRAVERSE(&(tp_p->threads), tp_thread, list) {
 		tp_thread->die = TRUE;
-		pbx_cond_broadcast(&(tp_p->work));
 	}
 	SCCP_LIST_UNLOCK(&(tp_p->threads));
 
 	// wake up jobs untill jobqueue is empty, before shutting down, to make sure all jobs have been processed
+	pbx_mutex_lock(&tp_p->lock);
 	pbx_cond_broadcast(&(tp_p->work));
+	pbx_mutex_unlock(&tp_p->lock);
 
 	// wait for all threads to exit
 	if (SCCP_LIST_GETSIZE(&tp_p->threads) != 0) {
@@ -322,7 +489,9 @@ boolean_t sccp_threadpool_destroy(sccp_threadpool_t * tp_p)
 			ts.tv_sec = tp.tv_sec;
 			ts.tv_nsec = tp.tv_usec * 1000;
 			ts.tv_sec += 1;										// wait max 2 second
+			pbx_mutex_lock(&tp_p->lock);
 			pbx_cond_broadcast(&(tp_p->work));
+			pbx_mutex_unlock(&tp_p->lock);
 			pbx_cond_timedwait(&tp_p->exit, &(tp_p->threads.lock), &ts);
 		}
 
@@ -339,10 +508,16 @@ boolean_t sccp_threadpool_destroy(sccp_threadpool_t * tp_p)
 	}
 
 	/* Dealloc */
+	while ((job = SCCP_LIST_REMOVE_HEAD(&tp_p->freejobs, list))) {
+		sccp_free(job);
+	}
 	pbx_cond_destroy(&(tp_p->work));									/* Remove Condition */
 	pbx_cond_destroy(&(tp_p->exit));									/* Remove Condition */
-	SCCP_LIST_HEAD_DESTROY(&(tp_p->jobs));
+	pbx_mutex_destroy(&tp_p->lock);
+	pbx_rwlock_destroy(&tp_p->workers_lock);
+	SCCP_LIST_HEAD_DESTROY(&(tp_p->freejobs));
 	SCCP_LIST_HEAD_DESTROY(&(tp_p->threads));
+	sccp_free(tp_p->workers);
 	sccp_free(tp_p);
 	tp_p = NULL;												/* DEALLOC thread pool */
 	sccp_log((DEBUGCAT_CORE)) (VERBOSE_PREFIX_3 "Threadpool Ended\n");
@@ -359,35 +534,153 @@ int __PURE__ sccp_threadpool_thread_count(sccp_threadpool_t * tp_p)
 /* Add job to queue */
 void sccp_threadpool_jobqueue_add(sccp_threadpool_t * tp_p, sccp_threadpool_job_t * newjob_p)
 {
+	sccp_threadpool_thread_t *tp_thread = NULL;
+	int queued = 0;
+
 	if (!tp_p || !newjob_p) {
 		pbx_log(LOG_ERROR, "(sccp_threadpool_jobqueue_add) no tp_p or no work pointer\n");
 		sccp_free(newjob_p);
 		return;
 	}
 
-	sccp_log((DEBUGCAT_THPOOL)) (VERBOSE_PREFIX_3 "(sccp_threadpool_jobqueue_add) tp_p: %p, jobCount: %d\n", tp_p, SCCP_LIST_GETSIZE(&tp_p->jobs));
-	SCCP_LIST_LOCK(&(tp_p->jobs));
-	if (tp_p->sccp_threadpool_shuttingdown) {
+	sccp_log((DEBUGCAT_THPOOL)) (VERBOSE_PREFIX_3 "(sccp_threadpool_jobqueue_add) tp_p: %p, jobCount: %d\n", tp_p, tp_p->queued);
+	newjob_p->queued = pbx_tvnow();
+	pbx_rwlock_rdlock(&tp_p->workers_lock);
+	if (tp_p->sccp_threadpool_shuttingdown || !tp_p->num_workers) {
+		pbx_rwlock_unlock(&tp_p->workers_lock);
 		pbx_log(LOG_ERROR, "(sccp_threadpool_jobqueue_add) shutting down. skipping work\n");
-		SCCP_LIST_UNLOCK(&(tp_p->jobs));
 		sccp_free(newjob_p);
 		return;
 	}
-	SCCP_LIST_INSERT_TAIL(&(tp_p->jobs), newjob_p, list);
-	SCCP_LIST_UNLOCK(&(tp_p->jobs));
+	if (newjob_p->affinity) {
+		tp_thread = tp_p->workers[newjob_p->affinity % (uint32_t) tp_p->num_permanent];
+	} else {
+		/* round robin, skipping threads that are about to exit */
+		for (int tries = 0; tries < tp_p->num_workers; tries++) {
+			tp_thread = tp_p->workers[ATOMIC_INCR(&tp_p->next_worker, 1, &tp_p->lock) % (unsigned int) tp_p->num_workers];
+			if (!tp_thread->die) {
+				break;
+			}
+		}
+	}
+	SCCP_LIST_LOCK(&tp_thread->jobs);
+	SCCP_LIST_INSERT_TAIL(&tp_thread->jobs, newjob_p, list);
+	SCCP_LIST_UNLOCK(&tp_thread->jobs);
+	pbx_rwlock_unlock(&tp_p->workers_lock);
 
-	if ((int)SCCP_LIST_GETSIZE(&tp_p->jobs) > tp_p->job_high_water_mark) {
-		tp_p->job_high_water_mark = SCCP_LIST_GETSIZE(&tp_p->jobs);
+	if (!newjob_p->affinity) {
+		(void) ATOMIC_INCR(&tp_p->stealable, 1, &tp_p->lock);
+	}
+	queued = ATOMIC_INCR(&tp_p->queued, 1, &tp_p->lock) + 1;
+	if (queued > tp_p->job_high_water_mark) {
+		tp_p->job_high_water_mark = queued;
+	}
+
+	/* wake up an idle thread, the owner in case of affinity, as nobody else is allowed to pick that job up */
+	if (ATOMIC_FETCH(&tp_p->num_idle, &tp_p->lock)) {
+		pbx_mutex_lock(&tp_p->lock);
+		if (newjob_p->affinity) {
+			pbx_cond_broadcast(&(tp_p->work));
+		} else {
+			pbx_cond_signal(&(tp_p->work));
+		}
+		pbx_mutex_unlock(&tp_p->lock);
+	}
+	if (queued > (int) SCCP_LIST_GETSIZE(&tp_p->threads) * 2) {
+		sccp_threadpool_check_size(tp_p);								/* Check Resizing */
 	}
-	pbx_cond_signal(&(tp_p->work));
 }
 
 int sccp_threadpool_jobqueue_count(sccp_threadpool_t * tp_p)
 {
-	sccp_log((DEBUGCAT_THPOOL)) (VERBOSE_PREFIX_3 "(sccp_threadpool_jobqueue_count) tp_p: %p, jobCount: %d\n", tp_p, SCCP_LIST_GETSIZE(&tp_p->jobs));
-	return SCCP_LIST_GETSIZE(&tp_p->jobs);
+	sccp_log((DEBUGCAT_THPOOL)) (VERBOSE_PREFIX_3 "(sccp_threadpool_jobqueue_count) tp_p: %p, jobCount: %d\n", tp_p, tp_p->queued);
+	return tp_p->queued;
+}
+
+/* =================== STATISTICS ===================== */
+
+/* upper bound (usec) of the latency bucket holding the requested percentile */
+static unsigned long sccp_threadpool_latency_percentile(const unsigned long latency[THREADPOOL_LATENCY_BUCKETS], unsigned long total, int percentile)
+{
+	unsigned long seen = 0;
+
+	if (!total) {
+		return 0;
+	}
+	for (int bucket = 0; bucket < THREADPOOL_LATENCY_BUCKETS; bucket++) {
+		seen += latency[bucket];
+		if (seen * 100 >= total * percentile) {
+			return (2UL << bucket) - 1;
+		}
+	}
+	return (2UL << (THREADPOOL_LATENCY_BUCKETS - 1)) - 1;
 }
 
+int sccp_show_threadpool(int fd, sccp_cli_totals_t *totals, struct mansession *s, const struct message *m, int argc, char *argv[])
+{
+	sccp_threadpool_t *tp_p = GLOB(general_threadpool);
+	sccp_threadpool_thread_t *tp_thread = NULL;
+	unsigned long latency[THREADPOOL_LATENCY_BUCKETS] = {0};
+	unsigned long executed = 0, stolen = 0;
+	int local_line_total = 0;
+	int idx = 0, bucket = 0;
+
+	if (!tp_p) {
+		CLI_AMI_RETURN_ERROR(fd, s, m, "Threadpool not running %s\n", "");		/* explicit return */
+	}
+
+	SCCP_LIST_LOCK(&tp_p->threads);
+	executed = tp_p->retired_executed;
+	stolen = tp_p->retired_stolen;
+	memcpy(latency, tp_p->retired_latency, sizeof(latency));
+	pbx_rwlock_rdlock(&tp_p->workers_lock);
+#define CLI_AMI_TABLE_NAME ThreadpoolThreads
+#define CLI_AMI_TABLE_PER_ENTRY_NAME Thread
+#define CLI_AMI_TABLE_ITERATOR for(idx = 0; idx < tp_p->num_workers; idx++)
+#define CLI_AMI_TABLE_BEFORE_ITERATION 											\
+		tp_thread = tp_p->workers[idx];										\
+		executed += tp_thread->executed;									\
+		stolen += tp_thread->stolen;										\
+		for (bucket = 0; bucket < THREADPOOL_LATENCY_BUCKETS; bucket++) {					\
+			latency[bucket] += tp_thread->latency[bucket];							\
+		}
+#define CLI_AMI_TABLE_FIELDS 												\
+	CLI_AMI_TABLE_FIELD(Id,			"-3",		d,	3,	idx)					\
+	CLI_AMI_TABLE_FIELD(Thread,		"-15",		p,	15,	(void *) tp_thread->thread)		\
+	CLI_AMI_TABLE_FIELD(Permanent,		"-9.9",		s,	9,	idx < tp_p->num_permanent ? "yes" : "no")	\
+	CLI_AMI_TABLE_FIELD(State,		"-7.7",		s,	7,	tp_thread->die ? "exiting" : (tp_thread->idle ? "idle" : "busy"))	\
+	CLI_AMI_TABLE_FIELD(Depth,		"-5",		d,	5,	(int) SCCP_LIST_GETSIZE(&tp_thread->jobs))	\
+	CLI_AMI_TABLE_FIELD(Executed,		"-10",		lu,	10,	tp_thread->executed)			\
+	CLI_AMI_TABLE_FIELD(Stolen,		"-10",		lu,	10,	tp_thread->stolen)
+#include "sccp_cli_table.h"
+	local_line_total++;
+	pbx_rwlock_unlock(&tp_p->workers_lock);
+	SCCP_LIST_UNLOCK(&tp_p->threads);
+
+	int once;
+#define CLI_AMI_TABLE_NAME ThreadpoolTotals
+#define CLI_AMI_TABLE_PER_ENTRY_NAME Total
+#define CLI_AMI_TABLE_ITERATOR for(once=0;once<1;once++)
+#define CLI_AMI_TABLE_FIELDS 												\
+	CLI_AMI_TABLE_FIELD(Threads,		"-7",		d,	7,	sccp_threadpool_thread_count(tp_p))	\
+	CLI_AMI_TABLE_FIELD(Queued,		"-6",		d,	6,	tp_p->queued)				\
+	CLI_AMI_TABLE_FIELD(HighWater,		"-9",		d,	9,	tp_p->job_high_water_mark)		\
+	CLI_AMI_TABLE_FIELD(Executed,		"-10",		lu,	10,	executed)				\
+	CLI_AMI_TABLE_FIELD(Stolen,		"-8",		lu,	8,	stolen)					\
+	CLI_AMI_TABLE_FIELD(JobsAlloc,		"-9",		lu,	9,	tp_p->jobs_allocated)			\
+	CLI_AMI_TABLE_FIELD(JobsReuse,		"-9",		lu,	9,	tp_p->jobs_recycled)			\
+	CLI_AMI_TABLE_FIELD(P50us,		"-8",		lu,	8,	sccp_threadpool_latency_percentile(latency, executed, 50))	\
+	CLI_AMI_TABLE_FIELD(P90us,		"-8",		lu,	8,	sccp_threadpool_latency_percentile(latency, executed, 90))	\
+	CLI_AMI_TABLE_FIELD(P99us,		"-8",		lu,	8,	sccp_threadpool_latency_percentile(latency, executed, 99))
+#include "sccp_cli_table.h"
+	local_line_total++;
+
+	if (s) {
+		totals->lines = local_line_total;
+		totals->tables = 2;
+	}
+	return RESULT_SUCCESS;
+}
 
 #if CS_TEST_FRAMEWORK
 #include <asterisk/test.h>
@@ -485,16 +778,96 @@ AST_TEST_DEFINE(sccp_threadpool_work)
 	return AST_TEST_PASS;
 }
 
+#define NUM_AFFINITY_KEYS 4
+#define NUM_AFFINITY_WORK 200
+struct affinity_test {
+	int key;
+	int seq;
+	int *last_seq;
+	volatile int *out_of_order;
+};
+
+static void *sccp_threadpool_affinity_test_thread(void *data)
+{
+	struct affinity_test *work = data;
+
+	if (rand() % 4 == 0) {
+		usleep(rand() % 100);										/* give other threads a chance to overtake */
+	}
+	if (work->last_seq[work->key] != work->seq - 1) {
+		(*work->out_of_order)++;
+	}
+	work->last_seq[work->key] = work->seq;
+	return 0;
+}
+
+AST_TEST_DEFINE(sccp_threadpool_affinity)
+{
+	switch(cmd) {
+		case TEST_INIT:
+			info->name = "affinity";
+			info->category = test_category;
+			info->summary = "chan-sccp-b threadpool affinity ordering and work stealing";
+			info->description = "jobs sharing an affinity key have to run in order, other jobs may be stolen by idle threads";
+			return AST_TEST_NOT_RUN;
+	        case TEST_EXECUTE:
+	        	break;
+	}
+	sccp_threadpool_t *test_threadpool = NULL;
+	struct affinity_test work[NUM_AFFINITY_KEYS][NUM_AFFINITY_WORK];
+	int last_seq[NUM_AFFINITY_KEYS];
+	volatile int out_of_order = 0;
+	char key[16];
+	int loop, idx, loopcount = 0;
+
+	pbx_test_status_update(test, "Create Test threadpool\n");
+	test_threadpool = sccp_threadpool_init(THREADPOOL_MIN_SIZE);
+	pbx_test_validate(test, NULL != test_threadpool);
+
+	for (idx = 0; idx < NUM_AFFINITY_KEYS; idx++) {
+		last_seq[idx] = -1;
+	}
+	pbx_test_status_update(test, "Adding %d ordered jobs for %d keys, mixed with unordered work\n", NUM_AFFINITY_WORK, NUM_AFFINITY_KEYS);
+	for (loop = 0; loop < NUM_AFFINITY_WORK; loop++) {
+		for (idx = 0; idx < NUM_AFFINITY_KEYS; idx++) {
+			work[idx][loop] = (struct affinity_test) {idx, loop, last_seq, &out_of_order};
+			snprintf(key, sizeof(key), "SEP%012d", idx);
+			pbx_test_validate(test, sccp_threadpool_add_work_affinity(test_threadpool, sccp_threadpool_affinity_test_thread, &work[idx][loop], key) > 0);
+		}
+		if (loop % 10 == 0) {
+			pbx_test_validate(test, sccp_threadpool_add_work(test_threadpool, (void *) sccp_cli_threadpool_test_thread, test) > 0);
+		}
+	}
+	while (sccp_threadpool_jobqueue_count(test_threadpool) > 0 && loopcount++ < 20) {
+		pbx_test_status_update(test, "Job Queue: %d, Threads: %d\n", sccp_threadpool_jobqueue_count(test_threadpool), sccp_threadpool_thread_count(test_threadpool));
+		sleep(1);
+	}
+	pbx_test_validate(test, sccp_threadpool_jobqueue_count(test_threadpool) == 0);
+	usleep(100000);												/* let the last jobs finish */
+
+	pbx_test_status_update(test, "Out of order: %d\n", out_of_order);
+	pbx_test_validate(test, out_of_order == 0);
+	for (idx = 0; idx < NUM_AFFINITY_KEYS; idx++) {
+		pbx_test_validate(test, last_seq[idx] == NUM_AFFINITY_WORK - 1);
+	}
+
+	pbx_test_status_update(test, "Destroy Test threadpool\n");
+	sccp_threadpool_destroy(test_threadpool);
+	return AST_TEST_PASS;
+}
+
 static void __attribute__((constructor)) sccp_register_tests(void)
 {
         AST_TEST_REGISTER(sccp_threadpool_create_destroy);
         AST_TEST_REGISTER(sccp_threadpool_work);
+        AST_TEST_REGISTER(sccp_threadpool_affinity);
 }
 
 static void __attribute__((destructor)) sccp_unregister_tests(void)
 {
         AST_TEST_UNREGISTER(sccp_threadpool_create_destroy);
         AST_TEST_UNREGISTER(sccp_threadpool_work);
+        AST_TEST_UNREGISTER(sccp_threadpool_affinity);
 }
 #endif
 
@@ -11,6 +11,11 @@
 #pragma once
 //#include "config.h"
 //#include "common.h"
+#include "sccp_cli.h"
+
+/* forward declarations */
+struct mansession;
+struct message;
 
 __BEGIN_C_EXTERN__
 /* Description:         Library providing a threading pool where you can add work on the fly. The number
@@ -34,16 +39,20 @@ __BEGIN_C_EXTERN__
 
 /*                       _______________________________________________________        
  *                      /                                                       \
- *                      |   JOB QUEUE        | job1 | job2 | job3 | job4 | ..   |
- *                      |                                                       |
- *                      |   threadpool      | thread1 | thread2 | ..            |
+ *                      |   thread1   | job1 | job4 | ..                        |
+ *                      |   thread2   | job2 | job5 | ..       <-- steal --     |
+ *                      |   thread3   | job3 | ..                               |
  *                      \_______________________________________________________/
  *      
- * Description:         Jobs are added to the job queue. Once a thread in the pool
- *                      is idle, it is assigned with the first job from the queue(and
- *                      erased from the queue). It's each thread's job to read from 
- *                      the queue serially(using lock) and executing each job
- *                      until the queue is empty.
+ * Description:         Each thread in the pool owns a job queue. New jobs are spread
+ *                      over the threads round robin, each thread runs the jobs on its
+ *                      own queue in order. A thread that runs out of work steals the
+ *                      most recently added job from another thread's queue.
+ *
+ *                      Jobs added with an affinity key always end up on the same
+ *                      (permanent) thread for that key and are never stolen, so jobs
+ *                      sharing a key (i.e. events for one device) run one after the
+ *                      other, in the order they were added.
  * 
  */
 /* ================================= STRUCTURES ================================================ */
@@ -54,6 +63,8 @@ typedef struct sccp_threadpool_job sccp_threadpool_job_t;
 struct sccp_threadpool_job {
 	void *(*function) (void *arg);										/*!< function pointer         */
 	void *arg;												/*!< function's argument      */
+	uint32_t affinity;											/*!< affinity hash (0 = none) */
+	struct timeval queued;											/*!< time the job was added   */
 	SCCP_LIST_ENTRY (sccp_threadpool_job_t) list;
 };
 
@@ -102,6 +113,19 @@ SCCP_API void SCCP_CALL sccp_threadpool_thread_do(void *p);
  */
 SCCP_API int sccp_threadpool_add_work(sccp_threadpool_t * SCCP_CALL  tp_p, void *(*function_p) (void *), void *arg_p);
 
+/*!
+ * \brief Add work to the job queue, keeping jobs with the same affinity key in order
+ * 
+ * Jobs with the same affinity key (i.e. a device id) are executed one after the other, in the order they were added.
+ * 
+ * \param tp_p threadpool to which the work will be added to
+ * \param function_p callback function to add as work
+ * \param arg_p argument to the above function
+ * \param affinity affinity key (NULL or empty means no affinity, same as sccp_threadpool_add_work)
+ * \return int
+ */
+SCCP_API int SCCP_CALL sccp_threadpool_add_work_affinity(sccp_threadpool_t * tp_p, void *(*function_p) (void *), void *arg_p, const char *affinity);
+
 /*!
  * \brief Destroy the threadpool
  * 
@@ -146,5 +170,8 @@ SCCP_API void SCCP_CALL sccp_threadpool_jobqueue_add(sccp_threadpool_t * tp_p, s
  * \param tp_p pointer to threadpool
  */
 SCCP_API int SCCP_CALL sccp_threadpool_jobqueue_count(sccp_threadpool_t * tp_p);
+
+/* ------------------------- Statistics ---------------------------------- */
+SCCP_API int SCCP_CALL sccp_show_threadpool(int fd, sccp_cli_totals_t *totals, struct mansession *s, const struct message *m, int argc, char *argv[]);
 __END_C_EXTERN__
 // kate: indent-width 8; replace-tabs off; indent-mode cstyle; auto-insert-doxygen on; line-numbers on; tab-indents on; keep-extra-spaces off; auto-brackets off;
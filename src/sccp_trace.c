@@ -0,0 +1,517 @@
+/*!
+ * \file        sccp_trace.c
+ * \brief       SCCP Binary Trace Ring
+ * \note        This program is free software and may be modified and distributed under the terms of the GNU Public License.
+ *              See the LICENSE file at the top of the source tree.
+ */
+
+/*!
+ * \section sccp_trace   Binary Trace Ring
+ *
+ * sccp_log formats its message and hands it to the pbx logger synchronously, which changes the timing of the code being debugged
+ * enough to make races disappear under load. The trace ring records the same kind of information as fixed size binary records
+ * instead (timestamp, category, object, event and three arguments), which costs a clock read and a couple of stores.
+ *
+ * Every thread writes to its own ring of SCCP_TRACE_RING_SIZE records, so recording never takes a lock. Readers (the cli and the
+ * dump) copy the rings while they are being written: each record carries its sequence number, which the writer clears before and
+ * sets after updating the record, a copy is only used when the sequence number was the expected one before and after the copy.
+ *
+ * Which categories are traced is set independently of the debug categories, using the 'trace' option in sccp.conf or 'sccp trace'.
+ * 'sccp show trace' shows the most recent records, 'sccp trace dump <file>' writes all of them to a file, which can be decoded
+ * offline using tools/sccp_trace_decode.py. The file header contains the event, category and message names, so the decoder does
+ * not have to be kept in sync with the source.
+ *
+ * Rings are allocated on first use by a thread and stay allocated when the thread exits (so its last records can still be
+ * dumped), the next new thread takes such a ring over. They are all released in sccp_trace_destroy, once no writer is still using
+ * the ring it found through its thread key (writers are counted in trace_writers before they check trace_running).
+ */
+
+#include "config.h"
+#include "common.h"
+#include "sccp_trace.h"
+#include "sccp_protocol.h"
+#include "sccp_utils.h"
+#include "sccp_atomic.h"
+#include <asterisk/cli.h>
+#include <pthread.h>
+#include <time.h>
+
+SCCP_FILE_VERSION(__FILE__, "");
+
+#define SCCP_TRACE_RING_MASK (SCCP_TRACE_RING_SIZE - 1)
+#define SCCP_TRACE_SHOW_DEFAULT 100
+#define SCCP_TRACE_STOP_WAIT 500										/* times 10ms, wait for writers in sccp_trace_destroy */
+
+typedef struct sccp_trace_ring sccp_trace_ring_t;
+struct sccp_trace_ring {
+	sccp_trace_record_t records[SCCP_TRACE_RING_SIZE];
+	volatile uint32_t head;											/*!< number of records written, only updated by the owner */
+	uint32_t tid;
+	boolean_t owned;											/*!< FALSE once the thread has exited, the ring can be taken over */
+	sccp_trace_ring_t *next;
+};
+
+static pthread_key_t trace_ring_key;
+static volatile int trace_running = 0;
+static volatile int trace_writers = 0;										/* threads inside __sccp_trace, which may hold a ring */
+AST_MUTEX_DEFINE_STATIC(trace_lock);										/* protects trace_rings and the owned flags */
+static sccp_trace_ring_t *trace_rings = NULL;
+static volatile uint64_t trace_cleared = 0;									/* records older than this are not shown/dumped */
+
+static const char *const trace_event_names[] = {
+	[SCCP_TRACE_NONE] = "none",
+	[SCCP_TRACE_MSG_RX] = "msg_rx",
+	[SCCP_TRACE_MSG_TX] = "msg_tx",
+	[SCCP_TRACE_DEVICE_REGSTATE] = "device_regstate",
+	[SCCP_TRACE_CHANNEL_STATE] = "channel_state",
+	[SCCP_TRACE_REF_ALLOC] = "ref_alloc",
+	[SCCP_TRACE_REF_RETAIN] = "ref_retain",
+	[SCCP_TRACE_REF_RELEASE] = "ref_release",
+	[SCCP_TRACE_REF_ERROR] = "ref_error",
+};
+
+static inline uint64_t trace_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/* thread exit: keep the records, hand the ring to the next thread that needs one */
+static void trace_ring_destructor(void *data)
+{
+	sccp_trace_ring_t *ring = (sccp_trace_ring_t *) data;
+	sccp_trace_ring_t *cur = NULL;
+
+	if (!ring) {
+		return;
+	}
+	pbx_mutex_lock(&trace_lock);
+	for (cur = trace_rings; cur; cur = cur->next) {
+		if (cur == ring) {										/* not released by sccp_trace_destroy in the meantime */
+			ring->owned = FALSE;
+			break;
+		}
+	}
+	pbx_mutex_unlock(&trace_lock);
+}
+
+static sccp_trace_ring_t *trace_ring_get(void)
+{
+	sccp_trace_ring_t *ring = NULL;
+
+	if (!trace_running) {
+		return NULL;
+	}
+	if ((ring = (sccp_trace_ring_t *) pthread_getspecific(trace_ring_key))) {
+		return ring;
+	}
+	pbx_mutex_lock(&trace_lock);
+	if (!trace_running) {
+		pbx_mutex_unlock(&trace_lock);
+		return NULL;
+	}
+	for (ring = trace_rings; ring && ring->owned; ring = ring->next) {
+		/* find a ring left behind by an exited thread */
+	}
+	if (!ring) {
+		if (!(ring = (sccp_trace_ring_t *) sccp_calloc(1, sizeof(sccp_trace_ring_t)))) {
+			pbx_mutex_unlock(&trace_lock);
+			return NULL;
+		}
+		ring->next = trace_rings;
+		trace_rings = ring;
+	}
+	ring->owned = TRUE;
+	ring->tid = ast_get_tid();
+	pthread_setspecific(trace_ring_key, ring);
+	pbx_mutex_unlock(&trace_lock);
+	return ring;
+}
+
+void sccp_trace_init(void)
+{
+	pbx_mutex_lock(&trace_lock);
+	if (!trace_running) {
+		if (pthread_key_create(&trace_ring_key, trace_ring_destructor) == 0) {
+			trace_running = 1;
+		} else {
+			pbx_log(LOG_WARNING, "SCCP: (sccp_trace_init) could not create thread key, tracing disabled\n");
+		}
+	}
+	pbx_mutex_unlock(&trace_lock);
+}
+
+void sccp_trace_destroy(void)
+{
+	sccp_trace_ring_t *ring = NULL;
+	int loopcount = 0;
+	int writers = 0;
+
+	pbx_mutex_lock(&trace_lock);
+	if (!trace_running) {
+		pbx_mutex_unlock(&trace_lock);
+		return;
+	}
+	trace_running = 0;
+	pbx_mutex_unlock(&trace_lock);										/* writers may need trace_lock to get their ring */
+	__sync_synchronize();											/* __sccp_trace increments trace_writers before checking trace_running */
+	while ((writers = ATOMIC_FETCH(&trace_writers, &trace_lock)) && SCCP_TRACE_STOP_WAIT > loopcount++) {
+		usleep(10000);
+	}
+
+	pbx_mutex_lock(&trace_lock);
+	pthread_key_delete(trace_ring_key);
+	if (writers) {
+		pbx_log(LOG_WARNING, "SCCP: (sccp_trace_destroy) %d threads still writing trace records, leaking the trace rings\n", writers);
+	}
+	while ((ring = trace_rings)) {
+		trace_rings = ring->next;
+		if (!writers) {
+			sccp_free(ring);
+		}
+	}
+	pbx_mutex_unlock(&trace_lock);
+}
+
+/*!
+ * \brief Add a record to the calling thread's ring (use the sccp_trace macro, which checks the trace categories first)
+ */
+void __sccp_trace(uint32_t category, sccp_trace_event_t event, uint64_t object, uint32_t arg0, uint32_t arg1, uint32_t arg2)
+{
+	sccp_trace_ring_t *ring = NULL;
+	sccp_trace_record_t *record = NULL;
+	uint32_t head;
+
+	if (!trace_running) {
+		return;
+	}
+	ATOMIC_INCR(&trace_writers, 1, &trace_lock);								/* before checking trace_running again, see sccp_trace_destroy */
+	if (!(ring = trace_ring_get())) {
+		ATOMIC_DECR(&trace_writers, 1, &trace_lock);
+		return;
+	}
+	head = ring->head;
+	record = &ring->records[head & SCCP_TRACE_RING_MASK];
+	record->seq = 0;
+	__sync_synchronize();											/* invalidate the slot before overwriting it */
+	record->timestamp = trace_now();
+	record->object = object;
+	record->tid = ring->tid;
+	record->category = category;
+	record->event = (uint16_t) event;
+	record->reserved = 0;
+	record->arg[0] = arg0;
+	record->arg[1] = arg1;
+	record->arg[2] = arg2;
+	record->reserved2 = 0;
+	__sync_synchronize();											/* publish the contents before the sequence number */
+	record->seq = head + 1;
+	ring->head = head + 1;
+	ATOMIC_DECR(&trace_writers, 1, &trace_lock);
+}
+
+const char *sccp_trace_event2str(sccp_trace_event_t event)
+{
+	if ((uint32_t) event < ARRAY_LEN(trace_event_names) && trace_event_names[event]) {
+		return trace_event_names[event];
+	}
+	return "unknown";
+}
+
+/*!
+ * \brief Forget the records written up to now
+ * \note the rings are owned by their threads, clearing only moves the point from which records are shown and dumped
+ */
+void sccp_trace_clear(void)
+{
+	trace_cleared = trace_now();
+}
+
+static int trace_record_cmp(const void *a, const void *b)
+{
+	const sccp_trace_record_t *rec_a = (const sccp_trace_record_t *) a;
+	const sccp_trace_record_t *rec_b = (const sccp_trace_record_t *) b;
+
+	if (rec_a->timestamp != rec_b->timestamp) {
+		return rec_a->timestamp < rec_b->timestamp ? -1 : 1;
+	}
+	return rec_a->tid < rec_b->tid ? -1 : (rec_a->tid > rec_b->tid);
+}
+
+/* consistent copy of all rings, oldest record first, the caller frees the result */
+static sccp_trace_record_t *trace_snapshot(uint32_t *count)
+{
+	sccp_trace_record_t *records = NULL;
+	sccp_trace_ring_t *ring = NULL;
+	uint32_t numrings = 0, num = 0;
+	uint64_t cleared = trace_cleared;
+
+	*count = 0;
+	pbx_mutex_lock(&trace_lock);
+	for (ring = trace_rings; ring; ring = ring->next) {
+		numrings++;
+	}
+	if (!numrings || !(records = (sccp_trace_record_t *) sccp_malloc(numrings * SCCP_TRACE_RING_SIZE * sizeof(sccp_trace_record_t)))) {
+		pbx_mutex_unlock(&trace_lock);
+		return NULL;
+	}
+	for (ring = trace_rings; ring; ring = ring->next) {
+		uint32_t head = ring->head;
+		uint32_t pos = head > SCCP_TRACE_RING_SIZE ? head - SCCP_TRACE_RING_SIZE : 0;
+
+		__sync_synchronize();
+		for (; pos < head; pos++) {
+			const sccp_trace_record_t *record = &ring->records[pos & SCCP_TRACE_RING_MASK];
+			if (record->seq != pos + 1) {
+				continue;									/* being overwritten */
+			}
+			__sync_synchronize();
+			records[num] = *record;
+			__sync_synchronize();
+			if (record->seq != pos + 1 || records[num].timestamp < cleared) {
+				continue;									/* overwritten while copying */
+			}
+			num++;
+		}
+	}
+	pbx_mutex_unlock(&trace_lock);
+
+	qsort(records, num, sizeof(sccp_trace_record_t), trace_record_cmp);
+	*count = num;
+	return records;
+}
+
+static const char *trace_category2str(uint32_t category)
+{
+	uint i;
+
+	for (i = 0; i < ARRAY_LEN(sccp_debug_categories); i++) {
+		if (sccp_debug_categories[i].category == category) {
+			return sccp_debug_categories[i].key;
+		}
+	}
+	for (i = 0; i < ARRAY_LEN(sccp_debug_categories); i++) {
+		if (sccp_debug_categories[i].key && sccp_debug_categories[i].category && (sccp_debug_categories[i].category & category) == sccp_debug_categories[i].category) {
+			return sccp_debug_categories[i].key;
+		}
+	}
+	return "";
+}
+
+static void trace_record_details(const sccp_trace_record_t *record, char *buf, size_t buflen)
+{
+	switch (record->event) {
+		case SCCP_TRACE_MSG_RX:
+		case SCCP_TRACE_MSG_TX:
+			snprintf(buf, buflen, "%s (0x%04X) len:%u", msgtype2str(record->arg[0]), record->arg[0], record->arg[1]);
+			break;
+		case SCCP_TRACE_DEVICE_REGSTATE:
+			snprintf(buf, buflen, "%s <- %s", record->arg[0] < SKINNY_REGISTRATIONSTATE_SENTINEL ? skinny_registrationstate2str(record->arg[0]) : "?", record->arg[1] < SKINNY_REGISTRATIONSTATE_SENTINEL ? skinny_registrationstate2str(record->arg[1]) : "?");
+			break;
+		case SCCP_TRACE_CHANNEL_STATE:
+			snprintf(buf, buflen, "%s <- %s", record->arg[0] < SCCP_CHANNELSTATE_SENTINEL ? sccp_channelstate2str(record->arg[0]) : "?", record->arg[1] < SCCP_CHANNELSTATE_SENTINEL ? sccp_channelstate2str(record->arg[1]) : "?");
+			break;
+		case SCCP_TRACE_REF_ALLOC:
+		case SCCP_TRACE_REF_RETAIN:
+		case SCCP_TRACE_REF_RELEASE:
+			snprintf(buf, buflen, "type:%u refcount:%u line:%u", record->arg[0], record->arg[1], record->arg[2]);
+			break;
+		case SCCP_TRACE_REF_ERROR:
+			snprintf(buf, buflen, "delta:%d line:%u", (int32_t) record->arg[0], record->arg[2]);
+			break;
+		default:
+			snprintf(buf, buflen, "%u %u %u", record->arg[0], record->arg[1], record->arg[2]);
+			break;
+	}
+}
+
+/*!
+ * \brief Write all trace records to filename (see tools/sccp_trace_decode.py for the format)
+ * \return number of records written or -1 on failure
+ */
+int sccp_trace_dump(const char *filename)
+{
+	sccp_trace_record_t *records = NULL;
+	uint32_t num = 0, i, nummsgs = 0;
+	FILE *f = NULL;
+	int res = -1;
+
+	if (!filename || !(f = fopen(filename, "w"))) {
+		pbx_log(LOG_WARNING, "SCCP: (sccp_trace_dump) could not open '%s' for writing\n", filename ? filename : "");
+		return -1;
+	}
+	records = trace_snapshot(&num);
+
+	for (i = 0; i <= SCCP_MESSAGE_HIGH_BOUNDARY; i++) {
+		nummsgs += sccp_messagetypes[i].text ? 1 : 0;
+	}
+	for (i = SPCP_MESSAGE_LOW_BOUNDARY; i <= SPCP_MESSAGE_HIGH_BOUNDARY; i++) {
+		nummsgs += spcp_messagetypes[i - SPCP_MESSAGE_OFFSET].text ? 1 : 0;
+	}
+
+	/* header: magic, version, record size and the number of entries in each section */
+	uint32_t header[6] = { SCCP_TRACE_FILE_VERSION, sizeof(sccp_trace_record_t), ARRAY_LEN(trace_event_names), ARRAY_LEN(sccp_debug_categories), nummsgs, num };
+	fwrite(SCCP_TRACE_FILE_MAGIC, 1, 8, f);
+	fwrite(header, sizeof(header), 1, f);
+	for (i = 0; i < ARRAY_LEN(trace_event_names); i++) {
+		const char *name = trace_event_names[i] ? trace_event_names[i] : "";
+		fwrite(name, 1, strlen(name) + 1, f);
+	}
+	for (i = 0; i < ARRAY_LEN(sccp_debug_categories); i++) {
+		uint32_t category = sccp_debug_categories[i].category;
+		const char *key = sccp_debug_categories[i].key ? sccp_debug_categories[i].key : "";
+		fwrite(&category, sizeof(category), 1, f);
+		fwrite(key, 1, strlen(key) + 1, f);
+	}
+	for (i = 0; i <= SPCP_MESSAGE_HIGH_BOUNDARY; i = (i == SCCP_MESSAGE_HIGH_BOUNDARY ? SPCP_MESSAGE_LOW_BOUNDARY : i + 1)) {
+		const char *text = i <= SCCP_MESSAGE_HIGH_BOUNDARY ? sccp_messagetypes[i].text : spcp_messagetypes[i - SPCP_MESSAGE_OFFSET].text;
+		if (text) {
+			fwrite(&i, sizeof(i), 1, f);
+			fwrite(text, 1, strlen(text) + 1, f);
+		}
+	}
+	if (num && fwrite(records, sizeof(sccp_trace_record_t), num, f) != num) {
+		pbx_log(LOG_WARNING, "SCCP: (sccp_trace_dump) writing '%s' failed: %s\n", filename, strerror(errno));
+	} else {
+		res = (int) num;
+	}
+	if (fclose(f)) {
+		res = -1;
+	}
+	if (records) {
+		sccp_free(records);
+	}
+	return res;
+}
+
+/*!
+ * \brief Show the most recent trace records
+ */
+int sccp_show_trace(int fd, sccp_cli_totals_t *totals, struct mansession *s, const struct message *m, int argc, char *argv[])
+{
+	int local_line_total = 0;
+	sccp_trace_record_t *records = NULL;
+	uint32_t num = 0, first = 0, idx = 0, maxrecords = SCCP_TRACE_SHOW_DEFAULT;
+	char timebuf[32], detail[80];
+
+	if (argc == 4 && !sccp_strlen_zero(argv[3])) {
+		maxrecords = (uint32_t) sccp_atoi(argv[3], strlen(argv[3]));
+	}
+	records = trace_snapshot(&num);
+	first = num > maxrecords ? num - maxrecords : 0;
+
+#define CLI_AMI_TABLE_NAME Trace
+#define CLI_AMI_TABLE_PER_ENTRY_NAME Record
+#define CLI_AMI_TABLE_ITERATOR for(idx = first; idx < num; idx++)
+#define CLI_AMI_TABLE_BEFORE_ITERATION 											\
+		{													\
+			time_t secs = (time_t) (records[idx].timestamp / 1000000000ULL);				\
+			struct tm tm;											\
+			localtime_r(&secs, &tm);									\
+			strftime(timebuf, sizeof(timebuf), "%H:%M:%S", &tm);						\
+			snprintf(timebuf + strlen(timebuf), sizeof(timebuf) - strlen(timebuf), ".%06u", (unsigned) (records[idx].timestamp % 1000000000ULL / 1000));	\
+			trace_record_details(&records[idx], detail, sizeof(detail));					\
+		}
+#define CLI_AMI_TABLE_FIELDS 												\
+	CLI_AMI_TABLE_FIELD(Time,		"-15.15",	s,	15,	timebuf)				\
+	CLI_AMI_TABLE_FIELD(Thread,		"-7",		u,	7,	records[idx].tid)			\
+	CLI_AMI_TABLE_FIELD(Category,		"-10.10",	s,	10,	trace_category2str(records[idx].category))	\
+	CLI_AMI_TABLE_FIELD(Event,		"-15.15",	s,	15,	sccp_trace_event2str(records[idx].event))	\
+	CLI_AMI_TABLE_FIELD(Object,		"-18",		llx,	18,	(unsigned long long) records[idx].object)	\
+	CLI_AMI_TABLE_FIELD(Details,		"-60.60",	s,	60,	detail)
+#include "sccp_cli_table.h"
+	local_line_total++;
+
+	if (records) {
+		sccp_free(records);
+	}
+	if (s) {
+		totals->lines = local_line_total;
+		totals->tables = 1;
+	}
+	return RESULT_SUCCESS;
+}
+
+#if CS_TEST_FRAMEWORK
+#include <asterisk/test.h>
+#define TRACE_BENCH_RECORDS 1000000
+AST_TEST_DEFINE(sccp_trace_ring_test)
+{
+	sccp_trace_record_t *records = NULL;
+	sccp_trace_ring_t *ring = NULL;
+	int32_t trace = GLOB(trace);
+	uint32_t num = 0, found = 0, i;
+	uint32_t head;
+	struct timeval start;
+	int64_t trace_us;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "ring";
+		info->category = "/channels/chan_sccp/trace/";
+		info->summary = "chan-sccp-b trace ring test";
+		info->description = "chan-sccp-b trace ring wrap around, snapshot and cost per record";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	if (!(ring = trace_ring_get())) {
+		pbx_test_status_update(test, "Tracing is not running, skipping\n");
+		return AST_TEST_PASS;
+	}
+	GLOB(trace) = DEBUGCAT_NEWCODE;
+	sccp_trace(DEBUGCAT_HIGH, SCCP_TRACE_MSG_RX, ring, 0, 0, 0);						/* not traced */
+	head = ring->head;
+	for (i = 0; i < SCCP_TRACE_RING_SIZE + 10; i++) {
+		sccp_trace(DEBUGCAT_NEWCODE, SCCP_TRACE_CHANNEL_STATE, ring, i, i + 1, 0xC0FFEE);
+	}
+	pbx_test_validate(test, ring->head == head + SCCP_TRACE_RING_SIZE + 10);
+
+	records = trace_snapshot(&num);
+	pbx_test_validate(test, records != NULL);
+	for (i = 0; i < num; i++) {
+		if (i && records[i].timestamp < records[i - 1].timestamp) {
+			pbx_test_status_update(test, "records are not ordered\n");
+			found = 0;
+			break;
+		}
+		if (records[i].object == (uintptr_t) ring && records[i].arg[2] == 0xC0FFEE) {
+			pbx_test_validate(test, records[i].event == SCCP_TRACE_CHANNEL_STATE && records[i].arg[1] == records[i].arg[0] + 1);
+			found++;
+		}
+	}
+	sccp_free(records);
+	pbx_test_status_update(test, "%u of %d records in the snapshot\n", found, SCCP_TRACE_RING_SIZE);
+	pbx_test_validate(test, found == SCCP_TRACE_RING_SIZE);
+
+	start = pbx_tvnow();
+	for (i = 0; i < TRACE_BENCH_RECORDS; i++) {
+		sccp_trace(DEBUGCAT_NEWCODE, SCCP_TRACE_REF_RETAIN, ring, 1, i, __LINE__);
+	}
+	trace_us = ast_tvdiff_us(pbx_tvnow(), start);
+	pbx_test_status_update(test, "%d records in %.3f ms, %.1f nsec per record\n", TRACE_BENCH_RECORDS, (double) trace_us / 1000, (double) trace_us * 1000 / TRACE_BENCH_RECORDS);
+
+	sccp_trace_clear();
+	records = trace_snapshot(&num);
+	pbx_test_validate(test, num == 0);
+	if (records) {
+		sccp_free(records);
+	}
+	GLOB(trace) = trace;
+	return AST_TEST_PASS;
+}
+
+static void __attribute__((constructor)) sccp_register_tests(void)
+{
+	AST_TEST_REGISTER(sccp_trace_ring_test);
+}
+
+static void __attribute__((destructor)) sccp_unregister_tests(void)
+{
+	AST_TEST_UNREGISTER(sccp_trace_ring_test);
+}
+#endif
+// kate: indent-width 8; replace-tabs off; indent-mode cstyle; auto-insert-doxygen on; line-numbers on; tab-indents on; keep-extra-spaces off; auto-brackets off;
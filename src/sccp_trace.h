@@ -0,0 +1,68 @@
+/*!
+ * \file        sccp_trace.h
+ * \brief       SCCP Binary Trace Ring Header
+ * \note        This program is free software and may be modified and distributed under the terms of the GNU Public License.
+ *              See the LICENSE file at the top of the source tree.
+ */
+#pragma once
+
+#include "sccp_cli.h"
+
+/* forward declarations */
+struct mansession;
+struct message;
+
+__BEGIN_C_EXTERN__
+#define SCCP_TRACE_RING_SIZE 1024										/*!< records per thread (power of two) */
+#define SCCP_TRACE_FILE_MAGIC "SCCPTRC1"									/*!< first 8 bytes of a dump file, see tools/sccp_trace_decode.py */
+#define SCCP_TRACE_FILE_VERSION 1
+
+/*!
+ * \brief Trace Events
+ * \note Only ever append, the numbers end up in dump files (the names are stored in the file header as well)
+ */
+typedef enum {
+	/* *INDENT-OFF* */
+	SCCP_TRACE_NONE = 0,
+	SCCP_TRACE_MSG_RX,											/*!< object: session, arg: messageId, length */
+	SCCP_TRACE_MSG_TX,											/*!< object: session, arg: messageId, length */
+	SCCP_TRACE_DEVICE_REGSTATE,										/*!< object: device, arg: new state, old state */
+	SCCP_TRACE_CHANNEL_STATE,										/*!< object: callid, arg: new state, previous state */
+	SCCP_TRACE_REF_ALLOC,											/*!< object: refcounted object, arg: type, refcount, line */
+	SCCP_TRACE_REF_RETAIN,											/*!< object: refcounted object, arg: type, refcount, line */
+	SCCP_TRACE_REF_RELEASE,											/*!< object: refcounted object, arg: type, refcount, line */
+	SCCP_TRACE_REF_ERROR,											/*!< object: pointer, arg: delta, 0, line */
+	SCCP_TRACE_EVENT_SENTINEL,
+	/* *INDENT-ON* */
+} sccp_trace_event_t;
+
+/*!
+ * \brief Trace Record (48 bytes, stored and dumped as is)
+ */
+typedef struct sccp_trace_record {
+	uint64_t timestamp;											/*!< nanoseconds since the epoch */
+	uint64_t object;											/*!< pointer or id of the object the event is about */
+	uint32_t seq;												/*!< position in the ring + 1, 0 while being written */
+	uint32_t tid;												/*!< thread (lwp) id */
+	uint32_t category;											/*!< sccp_debug_category_t */
+	uint16_t event;												/*!< sccp_trace_event_t */
+	uint16_t reserved;
+	uint32_t arg[3];
+	uint32_t reserved2;											/*!< keeps the size explicit (no padding written to dump files) */
+} sccp_trace_record_t;
+
+/*!
+ * \brief add a record to the calling thread's trace ring, when tracing of (one of the) category(ies) is enabled
+ * \note the arguments are only evaluated when the category is being traced, like sccp_log
+ */
+#define sccp_trace(_cat, _event, _object, _arg0, _arg1, _arg2) if ((sccp_globals->trace & (_cat))) __sccp_trace((_cat), (_event), (uint64_t) (uintptr_t) (_object), (_arg0), (_arg1), (_arg2))
+
+SCCP_API void SCCP_CALL sccp_trace_init(void);
+SCCP_API void SCCP_CALL sccp_trace_destroy(void);
+SCCP_API void SCCP_CALL __sccp_trace(uint32_t category, sccp_trace_event_t event, uint64_t object, uint32_t arg0, uint32_t arg1, uint32_t arg2);
+SCCP_API const char * SCCP_CALL sccp_trace_event2str(sccp_trace_event_t event);
+SCCP_API void SCCP_CALL sccp_trace_clear(void);
+SCCP_API int SCCP_CALL sccp_trace_dump(const char *filename);
+SCCP_API int SCCP_CALL sccp_show_trace(int fd, sccp_cli_totals_t *totals, struct mansession *s, const struct message *m, int argc, char *argv[]);
+__END_C_EXTERN__
+// kate: indent-width 8; replace-tabs off; indent-mode cstyle; auto-insert-doxygen on; line-numbers on; tab-indents on; keep-extra-spaces off; auto-brackets off;
@@ -799,6 +799,9 @@ void sccp_free_ha(struct sccp_ha *ha)
 	while (ha) {
 		hal = ha;
 		ha = ha->next;
+		if (hal->trie) {
+			sccp_free(hal->trie);
+		}
 		sccp_free(hal);
 	}
 }
@@ -883,7 +886,7 @@ int sccp_apply_ha(const struct sccp_ha *ha, const struct sockaddr_storage *addr)
 }
 
 /*!
- * \brief Apply a set of rules to a given IP address
+ * \brief Apply a set of rules to a given IP address, by walking the list
  *
  * \details
  * The list of host access rules is traversed, beginning with the
@@ -892,13 +895,9 @@ int sccp_apply_ha(const struct sccp_ha *ha, const struct sockaddr_storage *addr)
  * address matches multiple rules that the last one matched will be
  * the one whose sense will be returned.
  *
- * \param ha The head of the list of host access rules to follow
- * \param addr An sockaddr_storage whose address is considered when matching rules
- * \param defaultValue int value
- * \retval AST_SENSE_ALLOW The IP address passes our ACL
- * \retval AST_SENSE_DENY The IP address fails our ACL
+ * \note reference implementation for the compiled trie, used when the list could not be compiled
  */
-int sccp_apply_ha_default(const struct sccp_ha *ha, const struct sockaddr_storage *addr, int defaultValue)
+static int sccp_apply_ha_linear(const struct sccp_ha *ha, const struct sockaddr_storage *addr, int defaultValue)
 {
 	/* Start optimistic */
 	int res = defaultValue;
@@ -910,7 +909,7 @@ int sccp_apply_ha_default(const struct sccp_ha *ha, const struct sockaddr_storag
 		struct sockaddr_storage mapped_addr;
 		const struct sockaddr_storage *addr_to_use;
 
-		if (sccp_netsock_is_IPv4(&ha->netaddr)) {
+		if (sccp_netsock_is_IPv4(&current_ha->netaddr)) {
 			if (sccp_netsock_is_IPv6(addr)) {
 				if (sccp_netsock_is_mapped_IPv4(addr)) {
 					if (!sccp_netsock_ipv4_mapped(addr, &mapped_addr)) {
@@ -953,6 +952,200 @@ int sccp_apply_ha_default(const struct sccp_ha *ha, const struct sockaddr_storag
 	return res;
 }
 
+/*!
+ * \brief Compiled Host Access Rule Trie Node
+ *
+ * Children are indexes into sccp_ha_trie->nodes, 0 meaning none (a root node is never a child).
+ */
+typedef struct sccp_ha_trie_node {
+	uint32_t child[2];
+	int32_t rule;												/*!< highest (=last) rule index ending at this prefix, -1 when none */
+	int sense;
+} sccp_ha_trie_node_t;
+
+/*!
+ * \brief Compiled Host Access Rule List
+ *
+ * Binary prefix trie per address family, built once at config load time by sccp_compile_ha. Every rule is stored at the
+ * node of its network prefix, tagged with its position in the list. A lookup walks the address bits from the root and
+ * keeps the highest rule index it passes, which is exactly the last matching rule of the linear walk.
+ */
+struct sccp_ha_trie {
+	uint32_t size;
+	sccp_ha_trie_node_t nodes[];										/*!< nodes[0]: IPv4 root, nodes[1]: IPv6 root */
+};
+
+#define SCCP_HA_TRIE_ROOT_IPV4 0
+#define SCCP_HA_TRIE_ROOT_IPV6 1
+#define SCCP_HA_BIT(_bytes, _bit) (((_bytes)[(_bit) >> 3] >> (7 - ((_bit) & 7))) & 1)
+
+/*!
+ * \brief Get the prefix length of a netmask, -1 when the mask is not contiguous (e.g. 255.0.255.0)
+ */
+static int sccp_ha_prefixlen(const uint8_t *mask, int bytes)
+{
+	int bit;
+	int len = 0;
+
+	while (len < bytes * 8 && SCCP_HA_BIT(mask, len)) {
+		len++;
+	}
+	for (bit = len; bit < bytes * 8; bit++) {
+		if (SCCP_HA_BIT(mask, bit)) {
+			return -1;
+		}
+	}
+	return len;
+}
+
+/*!
+ * \brief Get the address bytes, length (in bytes) and trie root a host access rule or address uses
+ * \note IPv4-mapped IPv6 addresses are handled by the IPv4 rules, just like in sccp_apply_ha_linear
+ */
+static const uint8_t *sccp_ha_addrbytes(const struct sockaddr_storage *addr, int *bytes, uint32_t *root)
+{
+	if (addr->ss_family == AF_INET) {
+		*bytes = 4;
+		*root = SCCP_HA_TRIE_ROOT_IPV4;
+		return (const uint8_t *) &((const struct sockaddr_in *) addr)->sin_addr;
+	}
+	if (addr->ss_family == AF_INET6) {
+		const uint8_t *addr6 = ((const struct sockaddr_in6 *) addr)->sin6_addr.s6_addr;
+
+		if (IN6_IS_ADDR_V4MAPPED(&((const struct sockaddr_in6 *) addr)->sin6_addr)) {
+			*bytes = 4;
+			*root = SCCP_HA_TRIE_ROOT_IPV4;
+			return addr6 + 12;
+		}
+		*bytes = 16;
+		*root = SCCP_HA_TRIE_ROOT_IPV6;
+		return addr6;
+	}
+	return NULL;
+}
+
+/*!
+ * \brief Compile a list of host access rules into a prefix trie, replacing the linear walk in sccp_apply_ha_default
+ *
+ * \param ha The head of the list of host access rules, the compiled form is attached to it
+ * \retval TRUE compiled
+ * \retval FALSE list cannot be compiled (non-contiguous netmask), rules will be applied by walking the list
+ *
+ * \note to be called before the list is published (config load), the list should not be appended to afterwards
+ */
+boolean_t sccp_compile_ha(struct sccp_ha *ha)
+{
+	const struct sccp_ha *current_ha;
+	const uint8_t *mask;
+	struct sccp_ha_trie *trie;
+	uint32_t size = 2;
+	uint32_t used = 2;
+	int32_t rule = 0;
+
+	if (!ha) {
+		return FALSE;
+	}
+	if (ha->trie) {
+		sccp_free(ha->trie);
+		ha->trie = NULL;										/* stale, also when the list cannot be compiled */
+	}
+	for (current_ha = ha; current_ha; current_ha = current_ha->next) {
+		int bytes = 0;
+		uint32_t root = 0;
+		int len;
+
+		if (current_ha->netaddr.ss_family != current_ha->netmask.ss_family || (current_ha->netaddr.ss_family == AF_INET6 && sccp_netsock_is_mapped_IPv4(&current_ha->netaddr))) {
+			return FALSE;
+		}
+		mask = sccp_ha_addrbytes(&current_ha->netmask, &bytes, &root);
+		if (!mask || (len = sccp_ha_prefixlen(mask, bytes)) < 0) {
+			sccp_log(DEBUGCAT_HIGH) (VERBOSE_PREFIX_2 "SCCP: (sccp_compile_ha) netmask %s cannot be compiled, using linear acl evaluation\n", sccp_netsock_stringify_addr(&current_ha->netmask));
+			return FALSE;
+		}
+		size += len;
+	}
+
+	if (!(trie = (struct sccp_ha_trie *) sccp_calloc(sizeof(struct sccp_ha_trie) + size * sizeof(sccp_ha_trie_node_t), 1))) {
+		pbx_log(LOG_ERROR, SS_Memory_Allocation_Error, "SCCP");
+		return FALSE;
+	}
+	trie->size = size;
+	trie->nodes[SCCP_HA_TRIE_ROOT_IPV4].rule = -1;
+	trie->nodes[SCCP_HA_TRIE_ROOT_IPV6].rule = -1;
+
+	for (current_ha = ha; current_ha; current_ha = current_ha->next, rule++) {
+		int bytes = 0;
+		uint32_t idx = 0;
+		const uint8_t *addr = sccp_ha_addrbytes(&current_ha->netaddr, &bytes, &idx);
+		int len = sccp_ha_prefixlen(sccp_ha_addrbytes(&current_ha->netmask, &bytes, &idx), bytes);
+		int bit;
+
+		for (bit = 0; bit < len; bit++) {
+			uint32_t *child = &trie->nodes[idx].child[SCCP_HA_BIT(addr, bit)];
+
+			if (!*child) {
+				*child = used;
+				trie->nodes[used++].rule = -1;
+			}
+			idx = *child;
+		}
+		trie->nodes[idx].rule = rule;								/* later rules override earlier ones */
+		trie->nodes[idx].sense = current_ha->sense;
+	}
+	ha->trie = trie;
+	sccp_log(DEBUGCAT_HIGH) (VERBOSE_PREFIX_2 "SCCP: (sccp_compile_ha) compiled %d rules into %d trie nodes\n", rule, used);
+	return TRUE;
+}
+
+static int sccp_apply_ha_trie(const struct sccp_ha_trie *trie, const struct sockaddr_storage *addr, int defaultValue)
+{
+	int res = defaultValue;
+	int32_t best = -1;
+	int bytes = 0;
+	uint32_t idx = 0;
+	int bit = 0;
+	const uint8_t *bits = sccp_ha_addrbytes(addr, &bytes, &idx);
+
+	if (!bits) {
+		return res;
+	}
+	do {
+		const sccp_ha_trie_node_t *node = &trie->nodes[idx];
+
+		if (node->rule > best) {
+			best = node->rule;
+			res = node->sense;
+		}
+		if (bit == bytes * 8) {
+			break;
+		}
+		idx = node->child[SCCP_HA_BIT(bits, bit)];
+		bit++;
+	} while (idx);
+	return res;
+}
+
+/*!
+ * \brief Apply a set of rules to a given IP address
+ *
+ * \details
+ * If an IP address matches multiple rules, the last one matched will be the one whose sense will be returned. Uses the
+ * compiled form when the list has been passed through sccp_compile_ha.
+ *
+ * \param ha The head of the list of host access rules to follow
+ * \param addr An sockaddr_storage whose address is considered when matching rules
+ * \param defaultValue int value
+ * \retval AST_SENSE_ALLOW The IP address passes our ACL
+ * \retval AST_SENSE_DENY The IP address fails our ACL
+ */
+int sccp_apply_ha_default(const struct sccp_ha *ha, const struct sockaddr_storage *addr, int defaultValue)
+{
+	if (ha && ha->trie) {
+		return sccp_apply_ha_trie(ha->trie, addr, defaultValue);
+	}
+	return sccp_apply_ha_linear(ha, addr, defaultValue);
+}
+
 /*!
  * \brief
  * Parse an IPv4 or IPv6 address string.
@@ -1207,6 +1400,10 @@ struct sccp_ha *sccp_append_ha(const char *sense, const char *stuff, struct sccp
 
 	ha->next = NULL;
 	if (prev) {
+		if (ret->trie) {									/* list changed, compiled form is stale */
+			sccp_free(ret->trie);
+			ret->trie = NULL;
+		}
 		prev->next = ha;
 	} else {
 		ret = ha;
@@ -1433,6 +1630,151 @@ AST_TEST_DEFINE(chan_sccp_acl_invalid_tests)
 	return res;
 }
 
+/* random address from a few overlapping networks, so that random rules actually match */
+static void sccp_acl_test_random_addr(struct sockaddr_storage *sas, int family)
+{
+	static const uint8_t prefix4[][2] = { {10, 0}, {10, 1}, {172, 16}, {192, 168} };
+	static const uint8_t prefix6[][4] = { {0xfe, 0x80, 0, 0}, {0x20, 0x01, 0x0d, 0xb8} };
+	uint8_t *bytes;
+	int len;
+	int i = 0;
+
+	memset(sas, 0, sizeof(*sas));
+	if (family == AF_INET) {
+		sas->ss_family = AF_INET;
+		bytes = (uint8_t *) &((struct sockaddr_in *) sas)->sin_addr;
+		len = 4;
+		memcpy(bytes, prefix4[sccp_random() % ARRAY_LEN(prefix4)], 2);
+		i = 2;
+	} else {
+		sas->ss_family = AF_INET6;
+		bytes = ((struct sockaddr_in6 *) sas)->sin6_addr.s6_addr;
+		len = 16;
+		memcpy(bytes, prefix6[sccp_random() % ARRAY_LEN(prefix6)], 4);
+		i = 4;
+	}
+	for (; i < len; i++) {
+		bytes[i] = (sccp_random() % 4) ? sccp_random() % 3 : sccp_random() & 0xff;
+	}
+	if (family == AF_INET6 && !(sccp_random() % 4)) {					/* IPv4-mapped IPv6 address */
+		struct sockaddr_storage sas4;
+
+		sccp_acl_test_random_addr(&sas4, AF_INET);
+		memset(bytes, 0, 10);
+		bytes[10] = bytes[11] = 0xff;
+		memcpy(bytes + 12, &((struct sockaddr_in *) &sas4)->sin_addr, 4);
+	}
+}
+
+AST_TEST_DEFINE(chan_sccp_acl_compiled_tests)
+{
+	struct sccp_ha *ha = NULL;
+	enum ast_test_result_state res = AST_TEST_PASS;
+	int mismatches = 0;
+	int lookups = 0;
+	int list, rule, lookup;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "compiled";
+		info->category = "/channels/chan_sccp/acl/";
+		info->summary = "Compiled ACL unit test";
+		info->description = "Compare the compiled acl trie with the linear rule walk, using random rules and addresses";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	pbx_test_status_update(test, "Executing compiled acl tests...\n");
+	for (list = 0; list < 200; list++) {
+		int nrules = 1 + sccp_random() % 24;
+
+		for (rule = 0; rule < nrules; rule++) {
+			struct sockaddr_storage sas;
+			char stuff[INET6_ADDRSTRLEN + 5];
+			int error = 0;
+			int family = (sccp_random() % 3) ? AF_INET : AF_INET6;
+
+			do {
+				sccp_acl_test_random_addr(&sas, family);
+			} while (sccp_netsock_is_mapped_IPv4(&sas));
+			snprintf(stuff, sizeof(stuff), "%s/%d", sccp_netsock_stringify_addr(&sas), (int) (sccp_random() % (family == AF_INET ? 33 : 129)));
+			ha = sccp_append_ha((sccp_random() % 2) ? "permit" : "deny", stuff, ha, &error);
+			pbx_test_validate_cleanup(test, error == 0, res, cleanup);
+		}
+		pbx_test_validate_cleanup(test, sccp_compile_ha(ha) && ha->trie, res, cleanup);
+
+		for (lookup = 0; lookup < 500; lookup++) {
+			struct sockaddr_storage sas;
+
+			sccp_acl_test_random_addr(&sas, (sccp_random() % 2) ? AF_INET : AF_INET6);
+			if (sccp_apply_ha_default(ha, &sas, AST_SENSE_ALLOW) != sccp_apply_ha_linear(ha, &sas, AST_SENSE_ALLOW) || sccp_apply_ha_default(ha, &sas, AST_SENSE_DENY) != sccp_apply_ha_linear(ha, &sas, AST_SENSE_DENY)) {
+				if (!mismatches++) {
+					struct ast_str *buf = pbx_str_alloca(DEFAULT_PBX_STR_BUFFERSIZE);
+
+					sccp_print_ha(buf, DEFAULT_PBX_STR_BUFFERSIZE, ha);
+					pbx_test_status_update(test, "mismatch for %s on %s\n", sccp_netsock_stringify_addr(&sas), pbx_str_buffer(buf));
+				}
+			}
+			lookups++;
+		}
+		sccp_free_ha(ha);
+		ha = NULL;
+	}
+	pbx_test_status_update(test, "%d mismatches in %d lookups\n", mismatches, lookups);
+	pbx_test_validate_cleanup(test, mismatches == 0, res, cleanup);
+
+	pbx_test_status_update(test, "appending to a compiled list drops the compiled form\n");
+	{
+		struct sockaddr_storage sas;
+		int error = 0;
+
+		ha = sccp_append_ha("deny", "0.0.0.0/0.0.0.0", ha, &error);
+		ha = sccp_append_ha("permit", "10.0.0.0/8", ha, &error);
+		pbx_test_validate_cleanup(test, error == 0, res, cleanup);
+		pbx_test_validate_cleanup(test, sccp_compile_ha(ha) && ha->trie, res, cleanup);
+		ha = sccp_append_ha("deny", "10.1.0.0/16", ha, &error);
+		pbx_test_validate_cleanup(test, error == 0 && !ha->trie, res, cleanup);
+		sccp_sockaddr_storage_parse(&sas, "10.1.15.1", PARSE_PORT_FORBID);
+		pbx_test_validate_cleanup(test, sccp_apply_ha(ha, &sas) == AST_SENSE_DENY, res, cleanup);
+		pbx_test_validate_cleanup(test, sccp_compile_ha(ha) && ha->trie, res, cleanup);
+		pbx_test_validate_cleanup(test, sccp_apply_ha(ha, &sas) == AST_SENSE_DENY, res, cleanup);
+		sccp_sockaddr_storage_parse(&sas, "10.2.15.1", PARSE_PORT_FORBID);
+		pbx_test_validate_cleanup(test, sccp_apply_ha(ha, &sas) == AST_SENSE_ALLOW, res, cleanup);
+
+		pbx_test_status_update(test, "a recompile that fails drops the previous compiled form\n");
+		sccp_sockaddr_storage_parse(&ha->next->next->netmask, "255.255.0.255", PARSE_PORT_FORBID);	/* 10.1.0.0/255.255.0.255: non-contiguous */
+		pbx_test_validate_cleanup(test, !sccp_compile_ha(ha) && !ha->trie, res, cleanup);
+		sccp_sockaddr_storage_parse(&sas, "10.1.15.0", PARSE_PORT_FORBID);
+		pbx_test_validate_cleanup(test, sccp_apply_ha(ha, &sas) == AST_SENSE_DENY, res, cleanup);
+		sccp_sockaddr_storage_parse(&sas, "10.1.15.1", PARSE_PORT_FORBID);
+		pbx_test_validate_cleanup(test, sccp_apply_ha(ha, &sas) == AST_SENSE_ALLOW, res, cleanup);
+		sccp_free_ha(ha);
+		ha = NULL;
+	}
+
+	pbx_test_status_update(test, "non-contiguous netmask falls back to the linear walk\n");
+	{
+		struct sockaddr_storage sas;
+		int error = 0;
+
+		ha = sccp_append_ha("deny", "0.0.0.0/0.0.0.0", ha, &error);
+		ha = sccp_append_ha("permit", "10.0.15.0/255.0.255.0", ha, &error);
+		pbx_test_validate_cleanup(test, error == 0, res, cleanup);
+		pbx_test_validate_cleanup(test, !sccp_compile_ha(ha) && !ha->trie, res, cleanup);
+		sccp_sockaddr_storage_parse(&sas, "10.1.15.1", PARSE_PORT_FORBID);
+		pbx_test_validate_cleanup(test, sccp_apply_ha(ha, &sas) == AST_SENSE_ALLOW, res, cleanup);
+		sccp_sockaddr_storage_parse(&sas, "10.1.16.1", PARSE_PORT_FORBID);
+		pbx_test_validate_cleanup(test, sccp_apply_ha(ha, &sas) == AST_SENSE_DENY, res, cleanup);
+	}
+
+cleanup:
+	if (ha) {
+		sccp_free_ha(ha);
+	}
+	return res;
+}
+
 AST_TEST_DEFINE(chan_sccp_reduce_codec_set)
 {
 	switch (cmd) {
@@ -1824,8 +2166,46 @@ long int sccp_random(void)
 }
 
 #if HAVE_ICONV
+/*
+ * Most strings sent to the phones are plain ASCII, which is valid Latin1 as is, those are copied without going through
+ * iconv at all. The remaining strings are converted using an iconv descriptor owned by the calling thread, so
+ * conversions no longer serialize on a single handle. The global handle (and its lock) is only used as fallback when a
+ * thread could not get its own descriptor.
+ */
+typedef struct sccp_iconv_handle sccp_iconv_handle_t;
+struct sccp_iconv_handle {
+	iconv_t cd;
+	sccp_iconv_handle_t *prev;
+	sccp_iconv_handle_t *next;
+};
+
 static iconv_t __sccp_iconv = (iconv_t) -1;
-static sccp_mutex_t __iconv_lock;
+static sccp_mutex_t __iconv_lock;										/* protects __sccp_iconv and __iconv_handles */
+static pthread_key_t __iconv_key;
+static boolean_t __iconv_key_created = FALSE;
+static sccp_iconv_handle_t *__iconv_handles = NULL;
+
+/* thread exit: close the descriptor of this thread */
+static void __iconv_handle_destructor(void *data)
+{
+	sccp_iconv_handle_t *handle = (sccp_iconv_handle_t *) data;
+
+	if (!handle) {
+		return;
+	}
+	pbx_mutex_lock(&__iconv_lock);
+	if (handle->prev) {
+		handle->prev->next = handle->next;
+	} else {
+		__iconv_handles = handle->next;
+	}
+	if (handle->next) {
+		handle->next->prev = handle->prev;
+	}
+	pbx_mutex_unlock(&__iconv_lock);
+	iconv_close(handle->cd);
+	sccp_free(handle);
+}
 
 static void __attribute__((constructor)) __start_iconv(void)
 {
@@ -1834,42 +2214,259 @@ static void __attribute__((constructor)) __start_iconv(void)
 		pbx_log(LOG_ERROR, "SCCP:conversion from 'UTF-8' to 'ISO8859-1' not available.\n");
 	}
 	pbx_mutex_init_notracking(&__iconv_lock);
+	if (pthread_key_create(&__iconv_key, __iconv_handle_destructor) == 0) {
+		__iconv_key_created = TRUE;
+	}
 }
 
 static void __attribute__((destructor)) __stop_iconv(void)
 {
-	if (__sccp_iconv) {
-		pbx_mutex_destroy(&__iconv_lock);
+	sccp_iconv_handle_t *handle = NULL;
+
+	if (__iconv_key_created) {
+		pthread_key_delete(__iconv_key);								/* threads still running will not call the destructor anymore */
+		__iconv_key_created = FALSE;
+	}
+	while ((handle = __iconv_handles)) {
+		__iconv_handles = handle->next;
+		iconv_close(handle->cd);
+		sccp_free(handle);
+	}
+	if (__sccp_iconv != (iconv_t) -1) {
 		iconv_close(__sccp_iconv);
+		__sccp_iconv = (iconv_t) -1;
+	}
+	pbx_mutex_destroy(&__iconv_lock);
+}
+
+/* descriptor of the calling thread, opened on first use, NULL when the thread has to use the shared one */
+static sccp_iconv_handle_t *__iconv_handle_get(void)
+{
+	sccp_iconv_handle_t *handle = NULL;
+
+	if (!__iconv_key_created) {
+		return NULL;
+	}
+	if ((handle = (sccp_iconv_handle_t *) pthread_getspecific(__iconv_key))) {
+		return handle;
+	}
+	if (!(handle = (sccp_iconv_handle_t *) sccp_calloc(1, sizeof(sccp_iconv_handle_t)))) {
+		return NULL;
+	}
+	if ((handle->cd = iconv_open("ISO8859-1", "UTF-8")) == (iconv_t) -1) {
+		sccp_free(handle);
+		return NULL;
+	}
+	pbx_mutex_lock(&__iconv_lock);
+	handle->next = __iconv_handles;
+	if (__iconv_handles) {
+		__iconv_handles->prev = handle;
+	}
+	__iconv_handles = handle;
+	pbx_mutex_unlock(&__iconv_lock);
+	pthread_setspecific(__iconv_key, handle);
+	return handle;
+}
+
+/* TRUE when str[0..len) only contains 7-bit characters, checks a word at a time */
+static inline boolean_t __utf8_isAscii(const char *str, size_t len)
+{
+	const uint64_t highbits = 0x8080808080808080ULL;
+	uint64_t word;
+
+	while (len >= sizeof(word)) {
+		memcpy(&word, str, sizeof(word));								/* unaligned load, compiles to a single mov */
+		if (word & highbits) {
+			return FALSE;
+		}
+		str += sizeof(word);
+		len -= sizeof(word);
+	}
+	while (len--) {
+		if ((unsigned char) *str++ & 0x80) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+static void __iconv_convert(iconv_t cd, ICONV_CONST char *utf8str, size_t incount, char *buf, size_t outcount)
+{
+	iconv(cd, NULL, NULL, NULL, NULL);									/* reset, in case the previous call stopped halfway a sequence */
+	if (iconv(cd, &utf8str, &incount, &buf, &outcount) == (size_t) -1) {
+		if (errno == E2BIG) {
+			pbx_log(LOG_WARNING, "SCCP: Iconv: output buffer too small.\n");
+		} else if (errno == EILSEQ) {
+			pbx_log(LOG_WARNING,  "SCCP: Iconv: illegal character.\n");
+		} else if (errno == EINVAL) {
+			pbx_log(LOG_WARNING,  "SCCP: Iconv: incomplete character sequence.\n");
+		} else {
+			pbx_log(LOG_WARNING,  "SCCP: Iconv: error %d: %s.\n", errno, strerror(errno));
+		}
+	}
+	if (outcount) {
+		*buf = '\0';
 	}
 }
 
 gcc_inline boolean_t sccp_utils_convUtf8toLatin1(ICONV_CONST char *utf8str, char *buf, size_t len) 
 {
+	sccp_iconv_handle_t *handle = NULL;
+
 	if (__sccp_iconv == (iconv_t) -1) {
 		// fallback to plain string copy
 		sccp_copy_string(buf, utf8str, len);
 		return TRUE;
 	}
-	size_t incount, outcount = len;
-	incount = sccp_strlen(utf8str);
-	if (incount) {
-		pbx_mutex_lock(&__iconv_lock);
-		if (iconv(__sccp_iconv, &utf8str, &incount, &buf, &outcount) == (size_t) -1) {
-			if (errno == E2BIG) {
-				pbx_log(LOG_WARNING, "SCCP: Iconv: output buffer too small.\n");
-			} else if (errno == EILSEQ) {
-				pbx_log(LOG_WARNING,  "SCCP: Iconv: illegal character.\n");
-			} else if (errno == EINVAL) {
-				pbx_log(LOG_WARNING,  "SCCP: Iconv: incomplete character sequence.\n");
-			} else {
-				pbx_log(LOG_WARNING,  "SCCP: Iconv: error %d: %s.\n", errno, strerror(errno));
-}
+	size_t incount = sccp_strlen(utf8str);
+	if (!len) {
+		return TRUE;
+	}
+	if (!incount) {
+		*buf = '\0';
+		return TRUE;
+	}
+	if (__utf8_isAscii(utf8str, incount)) {
+		if (incount > len) {
+			pbx_log(LOG_WARNING, "SCCP: Iconv: output buffer too small.\n");
+			incount = len;
+		}
+		memcpy(buf, utf8str, incount);
+		if (incount < len) {
+			buf[incount] = '\0';
 		}
+		return TRUE;
+	}
+	if ((handle = __iconv_handle_get())) {
+		__iconv_convert(handle->cd, utf8str, incount, buf, len);
+	} else {
+		pbx_mutex_lock(&__iconv_lock);
+		__iconv_convert(__sccp_iconv, utf8str, incount, buf, len);
 		pbx_mutex_unlock(&__iconv_lock);
 	}
 	return TRUE;
 }
+
+#if CS_TEST_FRAMEWORK
+AST_TEST_DEFINE(chan_sccp_conv_utf8_latin1)
+{
+	static const struct {
+		const char *utf8;
+		const char *latin1;
+	} cases[] = {
+		{"", ""},
+		{"1234567", "1234567"},										/* shorter than a word */
+		{"12345678", "12345678"},									/* exactly a word */
+		{"123456789abcdefgh", "123456789abcdefgh"},							/* two words + tail */
+		{"\xc3\xa9", "\xe9"},										/* é at the start */
+		{"caf\xc3\xa9", "caf\xe9"},									/* é in the tail */
+		{"1234567\xc3\xa9", "1234567\xe9"},								/* sequence straddling the first word */
+		{"12345678901234\xc3\xbc", "12345678901234\xfc"},						/* ü in the second word */
+		{"\xc2\xa0\xc3\xbf", "\xa0\xff"},								/* first and last Latin1 code point above ASCII */
+		{"Bj\xc3\xb6rk Gu\xc3\xb0mundsd\xc3\xb3ttir", "Bj\xf6rk Gu\xf0mundsd\xf3ttir"},
+		{"abc\xc3", "abc"},										/* truncated sequence: stops before it */
+		{"12\xe2\x82\xac", "12"},									/* € is not in Latin1: stops before it */
+	};
+	char buf[64];
+	uint i, pos;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "convUtf8toLatin1";
+		info->category = "/channels/chan_sccp/utils/";
+		info->summary = "convUtf8toLatin1 unit test";
+		info->description = "UTF-8 to Latin1 conversion, ASCII fast path and multibyte sequences";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+	if (__sccp_iconv == (iconv_t) -1) {
+		pbx_test_status_update(test, "iconv UTF-8 -> ISO8859-1 not available, skipping\n");
+		return AST_TEST_PASS;
+	}
+
+	for (i = 0; i < ARRAY_LEN(cases); i++) {
+		memset(buf, 'x', sizeof(buf));
+		sccp_utils_convUtf8toLatin1((ICONV_CONST char *) cases[i].utf8, buf, sizeof(buf));
+		if (strcmp(buf, cases[i].latin1)) {
+			pbx_test_status_update(test, "case %d: unexpected conversion result\n", i);
+			return AST_TEST_FAIL;
+		}
+	}
+
+	pbx_test_status_update(test, "Moving a multibyte character over every word position...\n");
+	for (pos = 0; pos < 24; pos++) {
+		char utf8[32], latin1[32];
+		memset(utf8, 'a', pos);
+		memcpy(utf8 + pos, "\xc3\xa4z", 4);
+		memset(latin1, 'a', pos);
+		memcpy(latin1 + pos, "\xe4z", 3);
+		memset(buf, 'x', sizeof(buf));
+		sccp_utils_convUtf8toLatin1(utf8, buf, sizeof(buf));
+		pbx_test_validate(test, !strcmp(buf, latin1));
+	}
+
+	pbx_test_status_update(test, "Converting into a buffer that is too small...\n");
+	memset(buf, 'x', sizeof(buf));
+	sccp_utils_convUtf8toLatin1((ICONV_CONST char *) "0123456789", buf, 4);
+	pbx_test_validate(test, !memcmp(buf, "0123", 4) && buf[4] == 'x');
+	memset(buf, 'x', sizeof(buf));
+	sccp_utils_convUtf8toLatin1((ICONV_CONST char *) "\xc3\xa9\xc3\xa9\xc3\xa9", buf, 2);
+	pbx_test_validate(test, !memcmp(buf, "\xe9\xe9", 2) && buf[2] == 'x');
+	return AST_TEST_PASS;
+}
+
+#define CONV_BENCH_ROUNDS 200000
+AST_TEST_DEFINE(chan_sccp_conv_utf8_latin1_bench)
+{
+	static const char *const ascii = "Reception Desk 2nd Floor - Ext 4711";
+	static const char *const latin1 = "R\xc3\xa9" "ception B\xc3\xbc" "ro 2. Stock - Ext 4711";
+	sccp_iconv_handle_t *handle = NULL;
+	struct timeval start;
+	int64_t fast_us, ascii_iconv_us, latin1_us;
+	char buf[64];
+	uint i;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "convUtf8toLatin1Bench";
+		info->category = "/channels/chan_sccp/utils/";
+		info->summary = "convUtf8toLatin1 benchmark";
+		info->description = "Throughput of the ASCII fast path and the per-thread iconv conversion";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+	if (__sccp_iconv == (iconv_t) -1 || !(handle = __iconv_handle_get())) {
+		pbx_test_status_update(test, "iconv UTF-8 -> ISO8859-1 not available, skipping\n");
+		return AST_TEST_PASS;
+	}
+
+	start = pbx_tvnow();
+	for (i = 0; i < CONV_BENCH_ROUNDS; i++) {
+		sccp_utils_convUtf8toLatin1((ICONV_CONST char *) ascii, buf, sizeof(buf));
+	}
+	fast_us = ast_tvdiff_us(pbx_tvnow(), start);
+
+	start = pbx_tvnow();
+	for (i = 0; i < CONV_BENCH_ROUNDS; i++) {
+		__iconv_convert(handle->cd, (ICONV_CONST char *) ascii, strlen(ascii), buf, sizeof(buf));
+	}
+	ascii_iconv_us = ast_tvdiff_us(pbx_tvnow(), start);
+
+	start = pbx_tvnow();
+	for (i = 0; i < CONV_BENCH_ROUNDS; i++) {
+		sccp_utils_convUtf8toLatin1((ICONV_CONST char *) latin1, buf, sizeof(buf));
+	}
+	latin1_us = ast_tvdiff_us(pbx_tvnow(), start);
+
+	pbx_test_status_update(test, "ascii fast path : %.3f ms, %.1f Mstrings/s\n", (double) fast_us / 1000, (double) CONV_BENCH_ROUNDS / (fast_us ? fast_us : 1));
+	pbx_test_status_update(test, "ascii via iconv : %.3f ms, %.1f Mstrings/s\n", (double) ascii_iconv_us / 1000, (double) CONV_BENCH_ROUNDS / (ascii_iconv_us ? ascii_iconv_us : 1));
+	pbx_test_status_update(test, "latin1 via iconv: %.3f ms, %.1f Mstrings/s\n", (double) latin1_us / 1000, (double) CONV_BENCH_ROUNDS / (latin1_us ? latin1_us : 1));
+	pbx_test_validate(test, !strcmp(buf, "R\xe9" "ception B\xfc" "ro 2. Stock - Ext 4711"));
+	return AST_TEST_PASS;
+}
+#endif
 #endif
 
 gcc_inline boolean_t sccp_always_false(void)
@@ -1888,16 +2485,26 @@ static void __attribute__((constructor)) sccp_register_tests(void)
 {
 	AST_TEST_REGISTER(chan_sccp_acl_tests);
 	AST_TEST_REGISTER(chan_sccp_acl_invalid_tests);
+	AST_TEST_REGISTER(chan_sccp_acl_compiled_tests);
 	AST_TEST_REGISTER(chan_sccp_reduce_codec_set);
 	AST_TEST_REGISTER(chan_sccp_combine_codec_sets);
+#if HAVE_ICONV
+	AST_TEST_REGISTER(chan_sccp_conv_utf8_latin1);
+	AST_TEST_REGISTER(chan_sccp_conv_utf8_latin1_bench);
+#endif
 }
 
 static void __attribute__((destructor)) sccp_unregister_tests(void)
 {
 	AST_TEST_UNREGISTER(chan_sccp_acl_tests);
 	AST_TEST_UNREGISTER(chan_sccp_acl_invalid_tests);
+	AST_TEST_UNREGISTER(chan_sccp_acl_compiled_tests);
 	AST_TEST_UNREGISTER(chan_sccp_reduce_codec_set);
 	AST_TEST_UNREGISTER(chan_sccp_combine_codec_sets);
+#if HAVE_ICONV
+	AST_TEST_UNREGISTER(chan_sccp_conv_utf8_latin1);
+	AST_TEST_UNREGISTER(chan_sccp_conv_utf8_latin1_bench);
+#endif
 }
 #endif
 
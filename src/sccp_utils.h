@@ -113,6 +113,7 @@ SCCP_API int __PURE__ SCCP_CALL sccp_strIsNumeric(const char *s);
 SCCP_API void SCCP_CALL sccp_free_ha(struct sccp_ha *ha);
 SCCP_API int SCCP_CALL sccp_apply_ha(const struct sccp_ha *ha, const struct sockaddr_storage *addr);
 SCCP_API int SCCP_CALL sccp_apply_ha_default(const struct sccp_ha *ha, const struct sockaddr_storage *addr, int defaultValue);
+SCCP_API boolean_t SCCP_CALL sccp_compile_ha(struct sccp_ha *ha);
 
 SCCP_API int SCCP_CALL sccp_sockaddr_split_hostport(char *str, char **host, char **port, int flags);
 SCCP_API int SCCP_CALL sccp_sockaddr_storage_parse(struct sockaddr_storage *addr, const char *str, int flags);
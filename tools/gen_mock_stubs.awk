@@ -0,0 +1,66 @@
+#
+# gen_mock_stubs.awk
+#
+# creates "pbx_impl/mock/mock_stubs.c" from the linker output of a probe link of sccp_mock_bench
+# invoked using -->  $(LINK) ... -Wl,--unresolved-symbols=report-all 2>&1 | awk -f gen_mock_stubs.awk > mock_stubs.c
+#
+# Every asterisk core function libsccp references, but which pbx_impl/mock/mock_runtime.c does not provide, gets a
+# stub that names the function and aborts. The runner then links on a plain system without the asterisk binary, and
+# reaching an unshimmed function fails loudly instead of jumping to address zero.
+# Variables (ast_config_AST_*, option_debug, ...) can not be stubbed this way, they are defined in mock_runtime.c.
+#
+# tested with gawk, mawk, and nawk.
+#
+
+BEGIN {
+	count = 0
+}
+
+# GNU ld / gold: "undefined reference to `symbol'" or "undefined reference to 'symbol'"
+/undefined reference to / {
+	symbol = $0
+	sub(/.*undefined reference to [`']/, "", symbol)
+	sub(/'.*/, "", symbol)
+	add_symbol(symbol)
+	next
+}
+
+# lld: "undefined symbol: symbol"
+/undefined symbol: / {
+	symbol = $0
+	sub(/.*undefined symbol: /, "", symbol)
+	sub(/[ \t].*/, "", symbol)
+	add_symbol(symbol)
+	next
+}
+
+function add_symbol(symbol)
+{
+	if (symbol !~ /^[A-Za-z_][A-Za-z0-9_]*$/ || (symbol in seen)) {
+		return
+	}
+	seen[symbol] = 1
+	symbols[count++] = symbol
+}
+
+END {
+	print "/* generated by tools/gen_mock_stubs.awk, do not edit */"
+	print "#include <stdio.h>"
+	print "#include <stdlib.h>"
+	print ""
+	print "void sccp_mock_unresolved(const char *symbol);"
+	print ""
+	print "void sccp_mock_unresolved(const char *symbol)"
+	print "{"
+	print "\tfprintf(stderr, \"sccp_mock_bench: '%s' is not provided by the mock pbx runtime\\n\", symbol);"
+	print "\tabort();"
+	print "}"
+	for (i = 0; i < count; i++) {
+		print ""
+		print "void " symbols[i] "(void);"
+		print "void " symbols[i] "(void)"
+		print "{"
+		print "\tsccp_mock_unresolved(\"" symbols[i] "\");"
+		print "}"
+	}
+}
@@ -48,6 +48,20 @@ function my_strtonum(str,        ret, n, i, k, c)
     return ret
 }
 
+#
+# Case-insensitive (strcasecmp order) comparison of two enum entries, ties are broken by their position in the enum
+# so that duplicate strings keep their original order (str2val returns the first one, like the linear search did)
+#
+function entry_less(a, b,        ka, kb)
+{
+    ka = tolower(Entry_text[a]) ""
+    kb = tolower(Entry_text[b]) ""
+    if (ka != kb) {
+        return ka < kb
+    }
+    return a < b
+}
+
 BEGIN {
 	out_header_file = "sccp_enum.h"
 	out_source_file = "sccp_enum.c"
@@ -82,6 +96,34 @@ BEGIN {
 	
 	print "static const char ERROR_2FMT[] = \"SCCP: Error during lookup of '%d' in %s2str\\n\";" > out_source_file
 	print "static const char LOOKUPERROR_FMT[] = \"SCCP: LOOKUP ERROR, %s_str2val('%s') not found\\n\";" > out_source_file
+	print "" > out_source_file
+	print "/* str2val lookup tables, sorted case-insensitive (strcasecmp order) */" > out_source_file
+	print "typedef struct sccp_enum_lookup {" > out_source_file
+	print "\tconst char *const str;" > out_source_file
+	print "\tconst uint32_t value;" > out_source_file
+	print "} sccp_enum_lookup_t;" > out_source_file
+	print "" > out_source_file
+	print "/* binary search returning the first matching entry, NULL is looked up as an empty string (like sccp_strcaseequals) */" > out_source_file
+	print "static const sccp_enum_lookup_t *sccp_enum_lookup(const sccp_enum_lookup_t *table, uint32_t size, const char *lookup_str) {" > out_source_file
+	print "\tuint32_t lo = 0, hi = size, mid;" > out_source_file
+	print "\tif (!lookup_str) {" > out_source_file
+	print "\t\tlookup_str = \"\";" > out_source_file
+	print "\t}" > out_source_file
+	print "\twhile (lo < hi) {" > out_source_file
+	print "\t\tmid = lo + (hi - lo) / 2;" > out_source_file
+	print "\t\tif (strcasecmp(table[mid].str, lookup_str) < 0) {" > out_source_file
+	print "\t\t\tlo = mid + 1;" > out_source_file
+	print "\t\t} else {" > out_source_file
+	print "\t\t\thi = mid;" > out_source_file
+	print "\t\t}" > out_source_file
+	print "\t}" > out_source_file
+	print "\tif (lo < size && !strcasecmp(table[lo].str, lookup_str)) {" > out_source_file
+	print "\t\treturn &table[lo];" > out_source_file
+	print "\t}" > out_source_file
+	print "\treturn NULL;" > out_source_file
+	print "}" > out_source_file
+
+	test_body = ""
 
 	enum_name = ""
 	Comment = ""
@@ -341,21 +383,37 @@ codeSkip == 1			{ next }
 			} else {
 				totlen = 0
 				for ( i = 0; i < e; i++) {
-					totlen += length(Entry_text[e]) + 1
+					totlen += length(Entry_text[i]) + 1
 				}
+				# values, parallel to the map, so bits do not have to start at 1<<0 or be contiguous
+				print "static const uint32_t " namespace "_" enum_name "_values[] = {" > out_source_file
+				for ( i = 0; i < e; ++i) {
+					if (Entry_ifdef[i] != "") {
+						print "#ifdef " Entry_ifdef[i] > out_source_file
+						ifdef = 1
+					} else {
+						print "\t" Entry_id[i] "," > out_source_file
+					}
+					if (ifdef && Entry_ifdef[i] == "") {
+						print "#endif" > out_source_file
+						ifdef = 0
+					}
+				}
+				print "};" > out_source_file
 				print "const char * " namespace "_" enum_name "2str(int " namespace "_" enum_name "_int_value) {" > out_source_file
 				print "\tstatic char res[" totlen " + 1] = \"\";" >out_source_file
 				print "\tint pos = 0;" >out_source_file
 				if (Entry_val[0] == 0) {
 					print "\tif (" namespace "_" enum_name "_int_value == 0) {" > out_source_file
-					print "\t\tsnprintf(res, " totlen ", \"%s\", " namespace "_" enum_name "_map[0]);" >out_source_file
+					print "\t\tsnprintf(res, sizeof(res), \"%s\", " namespace "_" enum_name "_map[0]);" >out_source_file
 					print "\t\treturn res;" > out_source_file
 					print "\t}" > out_source_file
 				}
 				print "\tuint32_t i;" >out_source_file
-				print "\tfor (i = 0; i < ARRAY_LEN(" namespace "_" enum_name "_map) - 1; i++) {" >out_source_file
-				print "\t\tif (("namespace "_" enum_name "_int_value & (1 << i)) == (1 << i)) {" >out_source_file
-				print "\t\t\tpos += snprintf(res + pos, " totlen ", \"%s%s\", pos ? \",\" : \"\", " namespace "_" enum_name "_map[i + 1]);" >out_source_file
+				print "\tres[0] = '\\0';" >out_source_file
+				print "\tfor (i = 0; i < ARRAY_LEN(" namespace "_" enum_name "_values); i++) {" >out_source_file
+				print "\t\tif (" namespace "_" enum_name "_values[i] && ((uint32_t) " namespace "_" enum_name "_int_value & " namespace "_" enum_name "_values[i]) == " namespace "_" enum_name "_values[i]) {" >out_source_file
+				print "\t\t\tpos += snprintf(res + pos, sizeof(res) - pos, \"%s%s\", pos ? \",\" : \"\", " namespace "_" enum_name "_map[i]);" >out_source_file
 				print "\t\t}" >out_source_file
 				print "\t}" >out_source_file
 				print "\tif (!strlen(res)) {" >out_source_file
@@ -377,26 +435,39 @@ codeSkip == 1			{ next }
 		}
 		print "}\n" > out_source_file
 		
-		# sccp_channelstate_t sccp_channelstate_str2val(const char *lookup_str) {
-		print namespace "_" enum_name "_t " namespace "_" enum_name "_str2val(const char *lookup_str) {" > out_source_file
-		if (sparse == 0) {
-			print "\tuint32_t idx;" > out_source_file
-			print "\tfor (idx = 0; idx < ARRAY_LEN(" namespace "_" enum_name "_map); idx++) {" > out_source_file
-			print "\t\tif (sccp_strcaseequals(" namespace "_" enum_name "_map[idx], lookup_str)) {" > out_source_file
-			if (bitfield == 0) {
-				print "\t\t\treturn ("namespace "_" enum_name "_t) idx;" > out_source_file
-			} else {
-				print "\t\t\treturn ("namespace "_" enum_name "_t) (1 << idx);" > out_source_file
+		# static const sccp_enum_lookup_t sccp_channelstate_lookup[] = {
+		n = 0
+		for ( i = 0; i < e; ++i) {
+			if (Entry_ifdef[i] == "") {					# skip the #ifdef markers, they guard the next entry
+				sorted[n++] = i
 			}
-			print "\t\t}" > out_source_file
-			print "\t}" > out_source_file
-		} else {
-			for ( i = 0; i < e; ++i) {
-				print "\tif (sccp_strcaseequals(" namespace "_" enum_name "_map[" i "], lookup_str)) {" > out_source_file
-				print "\t\treturn " Entry_id[i] ";" > out_source_file
-				print "\t}" > out_source_file
+		}
+		for ( i = 1; i < n; ++i) {						# insertion sort, enums are small
+			k = sorted[i]
+			for (j = i - 1; j >= 0 && entry_less(k, sorted[j]); j--) {
+				sorted[j + 1] = sorted[j]
+			}
+			sorted[j + 1] = k
+		}
+		print "static const sccp_enum_lookup_t " namespace "_" enum_name "_lookup[] = {" > out_source_file
+		for ( i = 0; i < n; ++i) {
+			k = sorted[i]
+			if (k > 0 && Entry_ifdef[k - 1] != "") {
+				print "#ifdef " Entry_ifdef[k - 1] > out_source_file
+			}
+			print "\t{\"" Entry_text[k] "\", " Entry_id[k] "}," > out_source_file
+			if (k > 0 && Entry_ifdef[k - 1] != "") {
+				print "#endif" > out_source_file
 			}
 		}
+		print "};\n" > out_source_file
+
+		# sccp_channelstate_t sccp_channelstate_str2val(const char *lookup_str) {
+		print namespace "_" enum_name "_t " namespace "_" enum_name "_str2val(const char *lookup_str) {" > out_source_file
+		print "\tconst sccp_enum_lookup_t *entry = sccp_enum_lookup(" namespace "_" enum_name "_lookup, ARRAY_LEN(" namespace "_" enum_name "_lookup), lookup_str);" > out_source_file
+		print "\tif (entry) {" > out_source_file
+		print "\t\treturn (" namespace "_" enum_name "_t) entry->value;" > out_source_file
+		print "\t}" > out_source_file
 		print "\tpbx_log(LOG_ERROR, LOOKUPERROR_FMT, __" namespace "_" enum_name "_str, lookup_str);" > out_source_file
 		print "\treturn "toupper(namespace) "_" toupper(enum_name) "_SENTINEL;" > out_source_file
 		print "}\n" > out_source_file
@@ -424,6 +495,18 @@ codeSkip == 1			{ next }
 		print "}" > out_source_file
 		
 		print "/* = End ===" headerfooter >out_source_file
+
+		if (bitfield == 0) {
+			val2str_cast = "(" namespace "_" enum_name "_t)"
+		} else {
+			val2str_cast = "(int)"
+		}
+		test_body = test_body "\terrors += sccp_enum_test_table(test, __" namespace "_" enum_name "_str, " namespace "_" enum_name "_lookup, ARRAY_LEN(" namespace "_" enum_name "_lookup));\n"
+		test_body = test_body "\tfor (idx = 0; idx < ARRAY_LEN(" namespace "_" enum_name "_lookup); idx++) {\n"
+		test_body = test_body "\t\tentry = &" namespace "_" enum_name "_lookup[idx];\n"
+		test_body = test_body "\t\terrors += sccp_enum_test_roundtrip(test, __" namespace "_" enum_name "_str, entry->str, " namespace "_" enum_name "2str(" val2str_cast " entry->value), " namespace "_" enum_name "2str(" val2str_cast " " namespace "_" enum_name "_str2val(entry->str)), " namespace "_" enum_name "_exists(entry->value));\n"
+		test_body = test_body "\t\terrors += (" namespace "_" enum_name "_str2val(sccp_enum_test_toupper(entry->str, upper, sizeof(upper))) != " namespace "_" enum_name "_str2val(entry->str));\n"
+		test_body = test_body "\t}\n"
         }
         # reset values
         Comment = ""
@@ -434,6 +517,72 @@ codeSkip == 1			{ next }
 }
 
 END {
+	#
+	# gen str2val/val2str round-trip unit test
+	#
+	print "\n#if CS_TEST_FRAMEWORK" > out_source_file
+	print "#include <asterisk/test.h>" > out_source_file
+	print "/* check that a lookup table is strictly sorted the way sccp_enum_lookup expects (duplicates allowed) */" > out_source_file
+	print "static int sccp_enum_test_table(struct ast_test *test, const char *enum_name, const sccp_enum_lookup_t *table, uint32_t size) {" > out_source_file
+	print "\tuint32_t idx;" > out_source_file
+	print "\tfor (idx = 1; idx < size; idx++) {" > out_source_file
+	print "\t\tif (strcasecmp(table[idx - 1].str, table[idx].str) > 0) {" > out_source_file
+	print "\t\t\tpbx_test_status_update(test, \"%s: lookup table not sorted at '%s' > '%s'\\n\", enum_name, table[idx - 1].str, table[idx].str);" > out_source_file
+	print "\t\t\treturn 1;" > out_source_file
+	print "\t\t}" > out_source_file
+	print "\t}" > out_source_file
+	print "\treturn 0;" > out_source_file
+	print "}\n" > out_source_file
+	print "/* str -> val -> str and val -> str have to give back the original string (duplicate strings return the first value) */" > out_source_file
+	print "static int sccp_enum_test_roundtrip(struct ast_test *test, const char *enum_name, const char *str, const char *val2str, const char *str2val2str, int exists) {" > out_source_file
+	print "\tif (!exists || strcasecmp(str, val2str) || strcasecmp(str, str2val2str)) {" > out_source_file
+	print "\t\tpbx_test_status_update(test, \"%s: round-trip of '%s' failed, val2str:'%s', val2str(str2val):'%s', exists:%d\\n\", enum_name, str, val2str, str2val2str, exists);" > out_source_file
+	print "\t\treturn 1;" > out_source_file
+	print "\t}" > out_source_file
+	print "\treturn 0;" > out_source_file
+	print "}\n" > out_source_file
+	print "static const char *sccp_enum_test_toupper(const char *str, char *buf, size_t len) {" > out_source_file
+	print "\tsize_t pos;" > out_source_file
+	print "\tfor (pos = 0; str[pos] && pos < len - 1; pos++) {" > out_source_file
+	print "\t\tbuf[pos] = toupper((unsigned char) str[pos]);" > out_source_file
+	print "\t}" > out_source_file
+	print "\tbuf[pos] = '\\0';" > out_source_file
+	print "\treturn buf;" > out_source_file
+	print "}\n" > out_source_file
+	print "AST_TEST_DEFINE(sccp_enum_roundtrip)" > out_source_file
+	print "{" > out_source_file
+	print "\tconst sccp_enum_lookup_t *entry = NULL;" > out_source_file
+	print "\tchar upper[256];" > out_source_file
+	print "\tuint32_t idx;" > out_source_file
+	print "\tint errors = 0;" > out_source_file
+	print "" > out_source_file
+	print "\tswitch (cmd) {" > out_source_file
+	print "\t\tcase TEST_INIT:" > out_source_file
+	print "\t\t\tinfo->name = \"roundtrip\";" > out_source_file
+	print "\t\t\tinfo->category = \"/channels/chan_sccp/enum/\";" > out_source_file
+	print "\t\t\tinfo->summary = \"chan-sccp-b enum str2val/val2str round-trip\";" > out_source_file
+	print "\t\t\tinfo->description = \"Generated by gen_sccp_enum.awk: every value of every strenum in sccp_enum.in is looked up by string and converted back\";" > out_source_file
+	print "\t\t\treturn AST_TEST_NOT_RUN;" > out_source_file
+	print "\t\tcase TEST_EXECUTE:" > out_source_file
+	print "\t\t\tbreak;" > out_source_file
+	print "\t}" > out_source_file
+	print "" > out_source_file
+	printf "%s", test_body > out_source_file
+	print "" > out_source_file
+	print "\tpbx_test_status_update(test, \"%d round-trip errors\\n\", errors);" > out_source_file
+	print "\tpbx_test_validate(test, errors == 0);" > out_source_file
+	print "\treturn AST_TEST_PASS;" > out_source_file
+	print "}\n" > out_source_file
+	print "static void __attribute__((constructor)) sccp_register_tests(void)" > out_source_file
+	print "{" > out_source_file
+	print "\tAST_TEST_REGISTER(sccp_enum_roundtrip);" > out_source_file
+	print "}\n" > out_source_file
+	print "static void __attribute__((destructor)) sccp_unregister_tests(void)" > out_source_file
+	print "{" > out_source_file
+	print "\tAST_TEST_UNREGISTER(sccp_enum_roundtrip);" > out_source_file
+	print "}" > out_source_file
+	print "#endif" > out_source_file
+
 	# add guard
 	print "__END_C_EXTERN__" >out_header_file 
 	close (out_header_file)
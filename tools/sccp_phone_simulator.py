@@ -0,0 +1,823 @@
+#! /usr/bin/env python3
+'''
+Synthetic SCCP (skinny) phone simulator and load generator for chan-sccp
+
+Registers a number of virtual phones against a chan-sccp instance (or the stub
+pbx), keeps them alive and runs scripted call / softkey / busy lamp field
+scenarios between them, then reports the registration rate, request/response
+latency percentiles and errors. No real phones are needed; every simulated
+phone is one tcp connection from this process (single threaded, non-blocking).
+
+Usage: sccp_phone_simulator.py [options]        (see --help)
+
+Typical run over loopback:
+    sccp_phone_simulator.py --devices 50 --print-config  >> /etc/asterisk/sccp.conf
+    sccp_phone_simulator.py --devices 50 --print-dialplan >> /etc/asterisk/extensions.conf
+    asterisk -rx "sccp reload" ; asterisk -rx "dialplan reload"
+    sccp_phone_simulator.py --devices 50 --rate 20 --scenario calls,blf --duration 60
+
+Or against the stub pbx, without asterisk (phones register anonymously on the
+hotline, there is no dialplan behind the calls):
+    src/sccp_mock_bench -L 0 &
+    sccp_phone_simulator.py --devices 50 --rate 20 --duration 60
+
+Scenarios (comma separated, registration and keepalives always run):
+    idle        only register and keep the sessions alive
+    calls       even numbered phones call the next phone (offhook, keypad digits + '#',
+                onhook), the callee answers by going offhook
+    softkeys    like calls, but using the NewCall / Answer / Hold / Resume / EndCall softkeys
+    blf         request the feature status of every (blf) speeddial button and count
+                the status updates that come in
+
+The message ids and layouts follow src/sccp_protocol.h; message names and device
+types are read from src/sccp_protocol.h and src/sccp_enum.in when available.
+
+This program is free software, distributed under the terms of
+the GNU General Public License Version 2.
+'''
+
+import argparse
+import errno
+import heapq
+import json
+import math
+import os
+import random
+import re
+import selectors
+import socket
+import struct
+import sys
+import time
+
+# sccp_mid_t (src/sccp_protocol.h)
+KeepAliveMessage = 0x0000
+RegisterMessage = 0x0001
+KeypadButtonMessage = 0x0003
+OffHookMessage = 0x0006
+OnHookMessage = 0x0007
+SpeedDialStatReqMessage = 0x000A
+LineStatReqMessage = 0x000B
+TimeDateReqMessage = 0x000D
+ButtonTemplateReqMessage = 0x000E
+CapabilitiesResMessage = 0x0010
+OpenReceiveChannelAck = 0x0022
+SoftKeySetReqMessage = 0x0025
+SoftKeyEventMessage = 0x0026
+UnregisterMessage = 0x0027
+SoftKeyTemplateReqMessage = 0x0028
+RegisterAvailableLinesMessage = 0x002D
+FeatureStatReqMessage = 0x0034
+RegisterAckMessage = 0x0081
+StartMediaTransmission = 0x008A
+SpeedDialStatMessage = 0x0091
+LineStatMessage = 0x0092
+DefineTimeDate = 0x0094
+ButtonTemplateMessage = 0x0097
+CapabilitiesReqMessage = 0x009B
+RegisterRejectMessage = 0x009D
+Reset = 0x009F
+KeepAliveAckMessage = 0x0100
+OpenReceiveChannel = 0x0105
+SoftKeyTemplateResMessage = 0x0108
+SoftKeySetResMessage = 0x0109
+CallStateMessage = 0x0111
+UnregisterAckMessage = 0x0118
+FeatureStatMessage = 0x011F
+FeatureStatDynamicMessage = 0x0146
+LineStatDynamicMessage = 0x0147
+SpeedDialStatDynamicMessage = 0x0149
+
+# skinny_callstate_t (src/sccp_enum.in)
+CALLSTATE_OFFHOOK = 1
+CALLSTATE_ONHOOK = 2
+CALLSTATE_RINGOUT = 3
+CALLSTATE_RINGIN = 4
+CALLSTATE_CONNECTED = 5
+CALLSTATE_BUSY = 6
+CALLSTATE_CONGESTION = 7
+CALLSTATE_HOLD = 8
+CALLSTATE_PROCEED = 12
+CALLSTATE_INVALIDNUMBER = 14
+CALLSTATE_FAILED = (CALLSTATE_BUSY, CALLSTATE_CONGESTION, CALLSTATE_INVALIDNUMBER)
+
+# skinny_buttontype_t (src/sccp_enum.in)
+BUTTONTYPE_SPEEDDIAL = 0x02
+BUTTONTYPE_LINE = 0x09
+BUTTONTYPE_BLFSPEEDDIAL = 0x15
+
+# softkey events are the position in softkeysmap + 1 (src/sccp_softkeys.c)
+SOFTKEY_NEWCALL = 2
+SOFTKEY_HOLD = 3
+SOFTKEY_ENDCALL = 9
+SOFTKEY_RESUME = 10
+SOFTKEY_ANSWER = 11
+
+# skinny_codec_t (src/sccp_codec.h)
+CODECS = (0x0004, 0x0002, 0x000C)                       # ulaw, alaw, g729a
+
+StationMaxDeviceNameSize = 16
+HEADER = struct.Struct("<III")                          # length, lel_protocolVer, lel_messageId
+U32 = struct.Struct("<I")
+
+SRCDIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), os.pardir, "src")
+
+
+def load_message_names(srcdir):
+    '''message id -> name, from the sccp_mid_t enum in sccp_protocol.h'''
+    names = {}
+    try:
+        with open(os.path.join(srcdir, "sccp_protocol.h")) as f:
+            text = f.read()
+    except IOError:
+        return names
+    start = text.find("SCCP_MESSAGE_LOW_BOUNDARY")
+    end = text.find("} sccp_mid_t;")
+    for name, value in re.findall(r"^\s*(\w+)\s*=\s*(0x[0-9A-Fa-f]+)\s*,", text[start:end], re.M):
+        names.setdefault(int(value, 16), name)
+    return names
+
+
+def load_device_types(srcdir):
+    '''model name ("7962") and enum name -> skinny_devicetype_t value, from sccp_enum.in'''
+    types = {}
+    try:
+        with open(os.path.join(srcdir, "sccp_enum.in")) as f:
+            text = f.read()
+    except IOError:
+        return types
+    start = text.find("strenum devicetype")
+    end = text.find("\n}", start)
+    for enumname, value, text_ in re.findall(r"^\s*(SKINNY_DEVICETYPE_\w+)\s*,?\s*,?=(\d+)\s*,\s*\"([^\"]*)\"", text[start:end], re.M):
+        value = int(value, 10)
+        types[enumname] = value
+        types[enumname.replace("SKINNY_DEVICETYPE_", "").lower()] = value
+        model = text_.split()[-1] if text_ else ""
+        if any(c.isdigit() for c in model):
+            types.setdefault(model.lower(), value)
+    return types
+
+
+def device_type(name, types):
+    if name.isdigit() and name.lower() not in types:
+        return int(name)
+    value = types.get(name.lower())
+    if value is None:
+        value = types.get("cisco" + name.lower())
+    if value is None:
+        raise ValueError("unknown device type '%s' (use the number or the model, e.g. 7962)" % name)
+    return value
+
+
+def cstr(data):
+    return data.split(b"\0", 1)[0].decode("latin-1", "replace")
+
+
+def padded(text, size):
+    data = text.encode("latin-1")[:size - 1]
+    return data + b"\0" * (size - len(data))
+
+
+class Stats(object):
+    '''counters and latency samples shared by all simulated phones'''
+
+    def __init__(self):
+        self.start = time.time()
+        self.counters = {}
+        self.errors = {}
+        self.latency = {}
+        self.rx = {}
+        self.tx = {}
+        self.first_register = None
+        self.last_registered = None
+
+    def count(self, name, amount=1):
+        self.counters[name] = self.counters.get(name, 0) + amount
+
+    def error(self, name):
+        self.errors[name] = self.errors.get(name, 0) + 1
+
+    def sample(self, name, seconds):
+        self.latency.setdefault(name, []).append(seconds * 1000.0)
+
+    @staticmethod
+    def percentile(samples, pct):
+        if not samples:
+            return 0.0
+        rank = max(0, min(len(samples) - 1, int(math.ceil(pct / 100.0 * len(samples))) - 1))
+        return samples[rank]
+
+    def registration_rate(self):
+        registered = self.counters.get("registered", 0)
+        if not registered or self.first_register is None:
+            return 0.0
+        elapsed = max(self.last_registered - self.first_register, 1e-6)
+        return registered / elapsed
+
+    def report(self, names):
+        elapsed = time.time() - self.start
+        out = []
+        out.append("Run time           : %.1f s" % elapsed)
+        out.append("Registrations      : %d ok, %d rejected, %.1f registrations/s" % (self.counters.get("registered", 0), self.counters.get("rejected", 0), self.registration_rate()))
+        for key in sorted(self.counters):
+            out.append("  %-17s: %d" % (key, self.counters[key]))
+        out.append("Messages           : %d sent, %d received" % (sum(self.tx.values()), sum(self.rx.values())))
+        out.append("")
+        out.append("%-20s %8s %9s %9s %9s %9s %9s" % ("Latency (ms)", "Count", "p50", "p90", "p99", "p99.9", "max"))
+        for key in sorted(self.latency):
+            samples = sorted(self.latency[key])
+            out.append("%-20s %8d %9.2f %9.2f %9.2f %9.2f %9.2f" % (key, len(samples), self.percentile(samples, 50), self.percentile(samples, 90), self.percentile(samples, 99), self.percentile(samples, 99.9), samples[-1]))
+        out.append("")
+        if self.errors:
+            out.append("Errors:")
+            for key in sorted(self.errors):
+                out.append("  %-40s: %d" % (key, self.errors[key]))
+        else:
+            out.append("Errors: none")
+        out.append("")
+        out.append("%-40s %10s %10s" % ("Message", "Sent", "Received"))
+        for mid in sorted(set(self.tx) | set(self.rx)):
+            out.append("%-40s %10d %10d" % ("%s (0x%04X)" % (names.get(mid, "Unknown"), mid), self.tx.get(mid, 0), self.rx.get(mid, 0)))
+        return "\n".join(out)
+
+    def as_dict(self):
+        latency = {}
+        for key, samples in self.latency.items():
+            samples = sorted(samples)
+            latency[key] = {"count": len(samples), "p50": self.percentile(samples, 50), "p90": self.percentile(samples, 90), "p99": self.percentile(samples, 99), "p999": self.percentile(samples, 99.9), "max": samples[-1]}
+        return {"runtime": time.time() - self.start, "registration_rate": self.registration_rate(), "counters": self.counters, "errors": self.errors, "latency_ms": latency, "sent": dict(("0x%04X" % k, v) for k, v in self.tx.items()), "received": dict(("0x%04X" % k, v) for k, v in self.rx.items())}
+
+
+class Phone(object):
+    '''One simulated phone / skinny session'''
+
+    def __init__(self, sim, index, name, devicetype, protocol, extension, partner):
+        self.sim = sim
+        self.index = index
+        self.name = name
+        self.devicetype = devicetype
+        self.protocol = protocol
+        self.inuseprotocol = protocol
+        self.extension = extension
+        self.partner = partner
+        self.sock = None
+        self.rxbuf = b""
+        self.txbuf = b""
+        self.state = "idle"
+        self.waiting = []
+        self.buttons = []
+        self.lines = []
+        self.features = []
+        self.keepalive = sim.args.keepalive
+        self.register_sent = None
+        self.calls = {}
+        self.active_call = None
+
+    # transport
+    def connect(self):
+        self.sock = socket.socket(self.sim.family, socket.SOCK_STREAM)
+        self.sock.setblocking(False)
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.state = "connecting"
+        self.connect_started = time.time()
+        err = self.sock.connect_ex(self.sim.address)
+        if err not in (0, errno.EINPROGRESS, errno.EWOULDBLOCK):
+            self.fail("connect: %s" % os.strerror(err))
+            return
+        self.sim.selector.register(self.sock, selectors.EVENT_WRITE, self)
+
+    def on_writable(self):
+        if self.state == "connecting":
+            err = self.sock.getsockopt(socket.SOL_SOCKET, socket.SO_ERROR)
+            if err:
+                self.fail("connect: %s" % os.strerror(err))
+                return
+            self.sim.stats.sample("connect", time.time() - self.connect_started)
+            self.state = "registering"
+            self.register()
+        self.flush()
+
+    def on_readable(self):
+        try:
+            data = self.sock.recv(65536)
+        except (BlockingIOError, InterruptedError):
+            return
+        except OSError as e:
+            self.fail("recv: %s" % e.strerror)
+            return
+        if not data:
+            self.fail("connection closed by server" if self.state != "closing" else None)
+            return
+        self.rxbuf += data
+        while len(self.rxbuf) >= HEADER.size:
+            length, _version, mid = HEADER.unpack_from(self.rxbuf, 0)
+            if length < 4 or length > 65536:
+                self.fail("invalid packet length %d" % length)
+                return
+            total = length + 8
+            if len(self.rxbuf) < total:
+                break
+            payload = self.rxbuf[HEADER.size:total]
+            self.rxbuf = self.rxbuf[total:]
+            self.sim.stats.rx[mid] = self.sim.stats.rx.get(mid, 0) + 1
+            self.dispatch(mid, payload)
+            if self.sock is None:
+                return
+
+    def send(self, mid, payload=b"", expect=None, label=None):
+        if self.sock is None:
+            return
+        version = self.protocol if self.protocol >= 17 else 0
+        self.txbuf += HEADER.pack(len(payload) + 4, version, mid) + payload
+        self.sim.stats.tx[mid] = self.sim.stats.tx.get(mid, 0) + 1
+        if expect:
+            self.waiting.append((label, expect, time.time()))
+        self.flush()
+
+    def flush(self):
+        if self.sock is None or self.state == "connecting":
+            return
+        try:
+            while self.txbuf:
+                sent = self.sock.send(self.txbuf)
+                self.txbuf = self.txbuf[sent:]
+        except (BlockingIOError, InterruptedError):
+            pass
+        except OSError as e:
+            self.fail("send: %s" % e.strerror)
+            return
+        self.sim.selector.modify(self.sock, selectors.EVENT_READ | (selectors.EVENT_WRITE if self.txbuf else 0), self)
+
+    def close(self):
+        if self.sock is not None:
+            self.sim.selector.unregister(self.sock)
+            self.sock.close()
+            self.sock = None
+
+    def fail(self, reason):
+        if reason:
+            self.sim.stats.error(reason)
+            self.sim.log(1, "%s: %s" % (self.name, reason))
+        if self.state in ("registering", "connecting"):
+            self.sim.stats.count("register failed")
+        self.state = "failed" if reason else "closed"
+        self.close()
+
+    def check_timeouts(self, now):
+        for entry in [w for w in self.waiting if now - w[2] > self.sim.args.timeout]:
+            self.waiting.remove(entry)
+            self.sim.stats.error("timeout: %s" % entry[0])
+            if self.state == "registering":
+                self.fail("registration stalled waiting for %s" % entry[0])
+                return
+
+    def answered(self, mid):
+        for entry in self.waiting:
+            if mid in entry[1]:
+                self.waiting.remove(entry)
+                self.sim.stats.sample(entry[0], time.time() - entry[2])
+                return True
+        return False
+
+    # registration
+    def register(self):
+        ip = socket.inet_aton("127.0.0.1") if self.sim.family == socket.AF_INET else b"\0" * 4
+        ipv6 = socket.inet_pton(socket.AF_INET6, "::1") if self.sim.family == socket.AF_INET6 else b"\0" * 16
+        features = bytes((self.protocol, 0x00, 0x72 if self.protocol >= 15 else 0x60, 0x85))
+        mac = self.name[-12:].encode("ascii")
+        payload = padded(self.name, StationMaxDeviceNameSize) + struct.pack("<II", 0, 1)    # StationIdentifier
+        payload += ip + struct.pack("<III", self.devicetype, 5, 0) + features
+        payload += struct.pack("<II", 0, 0) + mac.ljust(12, b"\0")
+        payload += struct.pack("<II", 1, 6) + ipv6 + struct.pack("<I", 0)
+        payload += padded("SCCP%d.sim" % self.protocol, 32) + b"\0" * 48
+        self.register_sent = time.time()
+        if self.sim.stats.first_register is None:
+            self.sim.stats.first_register = self.register_sent
+        self.send(RegisterMessage, payload, (RegisterAckMessage, RegisterRejectMessage), "register ack")
+
+    def registered(self):
+        now = time.time()
+        self.state = "registered"
+        self.sim.stats.count("registered")
+        self.sim.stats.last_registered = now
+        self.sim.stats.sample("registration", now - self.register_sent)
+        self.sim.log(2, "%s: registered, protocol %d, lines %s, features %s" % (self.name, self.inuseprotocol, self.lines, self.features))
+        self.sim.schedule(self.keepalive, self.send_keepalive)
+        self.sim.phone_registered(self)
+
+    def send_keepalive(self):
+        if self.state not in ("registered",):
+            return
+        self.send(KeepAliveMessage, b"", (KeepAliveAckMessage,), "keepalive")
+        self.sim.schedule(self.keepalive, self.send_keepalive)
+
+    def unregister(self):
+        if self.state == "registered":
+            self.state = "closing"
+            self.send(UnregisterMessage, struct.pack("<I", 0), (UnregisterAckMessage,), "unregister")
+        elif self.sock is not None:
+            self.close()
+
+    # message handlers
+    def dispatch(self, mid, payload):
+        self.answered(mid)
+        handler = HANDLERS.get(mid)
+        if handler:
+            handler(self, payload)
+        elif self.sim.args.verbose >= 3:
+            self.sim.log(3, "%s: << %s" % (self.name, self.sim.names.get(mid, "0x%04X" % mid)))
+
+    def on_register_ack(self, payload):
+        keepalive, = U32.unpack_from(payload, 0)
+        if not self.sim.args.keepalive and keepalive:
+            self.keepalive = keepalive
+        if len(payload) > 16 and payload[16]:
+            self.inuseprotocol = payload[16]
+
+    def on_register_reject(self, payload):
+        self.sim.stats.count("rejected")
+        self.fail("register rejected: %s" % cstr(payload[:32]))
+
+    def on_capabilities_req(self, payload):
+        caps = b"".join(struct.pack("<II", codec, 20) + b"\0" * 8 for codec in CODECS)
+        self.send(CapabilitiesResMessage, struct.pack("<I", len(CODECS)) + caps)
+        self.buttons = []
+        self.send(ButtonTemplateReqMessage, struct.pack("<I", 0), (ButtonTemplateMessage,), "button template")
+
+    def on_button_template(self, payload):
+        offset, count, total = struct.unpack_from("<III", payload, 0)
+        for i in range(count):
+            if 12 + i * 2 + 1 < len(payload):
+                self.buttons.append((payload[12 + i * 2], payload[12 + i * 2 + 1]))
+        if offset + count < total:
+            self.waiting.append(("button template", (ButtonTemplateMessage,), time.time()))
+            return
+        self.lines = [instance for instance, kind in self.buttons if kind == BUTTONTYPE_LINE]
+        self.features = [(instance, kind) for instance, kind in self.buttons if kind in (BUTTONTYPE_BLFSPEEDDIAL, BUTTONTYPE_SPEEDDIAL)]
+        self.send(SoftKeyTemplateReqMessage, b"", (SoftKeyTemplateResMessage,), "softkey template")
+
+    def on_softkey_template(self, payload):
+        self.send(SoftKeySetReqMessage, b"", (SoftKeySetResMessage,), "softkey set")
+
+    def on_softkey_set(self, payload):
+        if self.state != "registering":
+            return
+        for line in self.lines:
+            self.send(LineStatReqMessage, struct.pack("<I", line), (LineStatMessage, LineStatDynamicMessage), "line stat")
+        self.send(RegisterAvailableLinesMessage, struct.pack("<I", len(self.lines)))
+        self.send(TimeDateReqMessage, b"", (DefineTimeDate,), "time date")
+
+    def on_define_time_date(self, payload):
+        if self.state == "registering":
+            self.registered()
+
+    def on_reset(self, payload):
+        self.sim.stats.count("reset by server")
+        self.fail("reset by server")
+
+    def on_unregister_ack(self, payload):
+        self.sim.stats.count("unregistered")
+        self.state = "closed"
+        self.close()
+
+    def on_open_receive_channel(self, payload):
+        conference, passthru = struct.unpack_from("<II", payload, 0)
+        callref, = U32.unpack_from(payload, 24) if len(payload) >= 28 else (conference,)
+        port = 20000 + (self.index * 2) % 40000
+        if self.inuseprotocol >= 17:
+            ack = struct.pack("<II", 0, 0) + socket.inet_aton("127.0.0.1") + b"\0" * 12 + struct.pack("<III", port, passthru, callref)
+        else:
+            ack = struct.pack("<I", 0) + socket.inet_aton("127.0.0.1") + struct.pack("<III", port, passthru, callref)
+        self.sim.stats.count("media channels")
+        self.send(OpenReceiveChannelAck, ack)
+
+    def on_feature_stat(self, payload):
+        self.sim.stats.count("blf updates")
+
+    def on_call_state(self, payload):
+        state, line, callref = struct.unpack_from("<III", payload, 0)
+        call = self.calls.get(callref)
+        if call is None and self.active_call is not None and self.active_call.get("callref") is None and state == CALLSTATE_OFFHOOK:
+            call = self.active_call
+            call["callref"] = callref
+            call["line"] = line
+            self.calls[callref] = call
+        if call is None:
+            if state == CALLSTATE_RINGIN:
+                call = {"callref": callref, "line": line, "outbound": False, "started": time.time(), "state": state}
+                self.calls[callref] = call
+                self.sim.stats.count("calls received")
+                self.sim.schedule(self.sim.args.answer_delay, lambda: self.answer(call))
+            return
+        previous = call.get("state")
+        call["state"] = state
+        if state == CALLSTATE_OFFHOOK and call["outbound"] and previous is None:
+            self.dial(call)
+        elif state == CALLSTATE_CONNECTED and previous != CALLSTATE_CONNECTED:
+            if previous == CALLSTATE_HOLD:
+                return
+            if call["outbound"]:
+                self.sim.stats.sample("call setup", time.time() - call["started"])
+                self.sim.stats.count("calls connected")
+                self.sim.schedule(self.sim.args.hold_time * random.uniform(0.8, 1.2), lambda: self.hangup_or_hold(call))
+        elif state in CALLSTATE_FAILED and call["outbound"] and not call.get("failed"):
+            call["failed"] = True
+            self.sim.stats.error("call failed: state %d" % state)
+            self.hangup(call)
+        elif state == CALLSTATE_ONHOOK:
+            self.calls.pop(callref, None)
+            if call is self.active_call:
+                self.active_call = None
+                self.schedule_call()
+
+    # scenarios
+    def start_scenarios(self):
+        scenarios = self.sim.scenarios
+        if "blf" in scenarios:
+            for instance, kind in self.features:
+                if kind == BUTTONTYPE_BLFSPEEDDIAL or self.inuseprotocol >= 15:
+                    self.send(FeatureStatReqMessage, struct.pack("<II", instance, 1), (FeatureStatDynamicMessage, FeatureStatMessage, SpeedDialStatMessage, SpeedDialStatDynamicMessage), "feature stat")
+                else:
+                    self.send(SpeedDialStatReqMessage, struct.pack("<I", instance), (SpeedDialStatMessage, SpeedDialStatDynamicMessage), "speeddial stat")
+        if ("calls" in scenarios or "softkeys" in scenarios) and self.partner is not None and self.lines:
+            self.schedule_call(first=True)
+
+    def schedule_call(self, first=False):
+        if self.partner is None or self.state != "registered" or self.sim.stopping:
+            return
+        delay = random.uniform(0, self.sim.args.call_interval) if first else self.sim.args.call_interval * random.uniform(0.5, 1.5)
+        self.sim.schedule(delay, self.place_call)
+
+    def softkeys(self):
+        return "softkeys" in self.sim.scenarios and ("calls" not in self.sim.scenarios or self.index % 4 >= 2)
+
+    def place_call(self):
+        if self.state != "registered" or self.active_call is not None or self.sim.stopping:
+            return
+        line = self.lines[0]
+        self.active_call = {"callref": None, "line": line, "outbound": True, "started": time.time(), "state": None, "softkeys": self.softkeys()}
+        self.sim.stats.count("calls placed")
+        if self.active_call["softkeys"]:
+            self.send(SoftKeyEventMessage, struct.pack("<III", SOFTKEY_NEWCALL, line, 0), (CallStateMessage,), "newcall softkey")
+        else:
+            self.send(OffHookMessage, struct.pack("<II", line, 0), (CallStateMessage,), "offhook")
+        self.sim.schedule(self.sim.args.timeout, lambda call=self.active_call: self.call_timeout(call))
+
+    def dial(self, call):
+        for digit in self.partner.extension + "#":
+            button = {"*": 0x0E, "#": 0x0F}.get(digit)
+            button = int(digit) if button is None else button
+            self.send(KeypadButtonMessage, struct.pack("<IIIII", button, call["line"], call["callref"], 0, 0))
+        self.waiting.append(("dial", (CallStateMessage,), time.time()))
+
+    def answer(self, call):
+        if call.get("state") != CALLSTATE_RINGIN or self.state != "registered":
+            return
+        if self.softkeys():
+            self.send(SoftKeyEventMessage, struct.pack("<III", SOFTKEY_ANSWER, call["line"], call["callref"]), (CallStateMessage,), "answer softkey")
+        else:
+            self.send(OffHookMessage, struct.pack("<II", call["line"], call["callref"]), (CallStateMessage,), "answer")
+
+    def hangup_or_hold(self, call):
+        if call.get("softkeys") and not call.get("held") and call.get("state") == CALLSTATE_CONNECTED:
+            call["held"] = True
+            self.send(SoftKeyEventMessage, struct.pack("<III", SOFTKEY_HOLD, call["line"], call["callref"]), (CallStateMessage,), "hold softkey")
+            self.sim.schedule(1.0, lambda: self.resume(call))
+            return
+        self.hangup(call)
+
+    def resume(self, call):
+        if call.get("state") == CALLSTATE_HOLD:
+            self.send(SoftKeyEventMessage, struct.pack("<III", SOFTKEY_RESUME, call["line"], call["callref"]), (CallStateMessage,), "resume softkey")
+        self.sim.schedule(1.0, lambda: self.hangup(call))
+
+    def hangup(self, call):
+        if self.state not in ("registered", "closing") or call.get("hungup") or call.get("callref") is None:
+            return
+        call["hungup"] = True
+        if call.get("softkeys"):
+            self.send(SoftKeyEventMessage, struct.pack("<III", SOFTKEY_ENDCALL, call["line"], call["callref"]), (CallStateMessage,), "endcall softkey")
+        else:
+            self.send(OnHookMessage, struct.pack("<II", call["line"], call["callref"]), (CallStateMessage,), "onhook")
+
+    def call_timeout(self, call):
+        if call is self.active_call and call.get("state") != CALLSTATE_CONNECTED and not call.get("hungup") and not call.get("failed"):
+            self.sim.stats.error("call setup timeout")
+            if call.get("callref") is None:
+                self.active_call = None
+                self.send(OnHookMessage, struct.pack("<II", call["line"], 0))
+                self.schedule_call()
+            else:
+                self.hangup(call)
+
+
+HANDLERS = {
+    RegisterAckMessage: Phone.on_register_ack,
+    RegisterRejectMessage: Phone.on_register_reject,
+    CapabilitiesReqMessage: Phone.on_capabilities_req,
+    ButtonTemplateMessage: Phone.on_button_template,
+    SoftKeyTemplateResMessage: Phone.on_softkey_template,
+    SoftKeySetResMessage: Phone.on_softkey_set,
+    DefineTimeDate: Phone.on_define_time_date,
+    Reset: Phone.on_reset,
+    UnregisterAckMessage: Phone.on_unregister_ack,
+    OpenReceiveChannel: Phone.on_open_receive_channel,
+    CallStateMessage: Phone.on_call_state,
+    FeatureStatDynamicMessage: Phone.on_feature_stat,
+    FeatureStatMessage: Phone.on_feature_stat,
+}
+
+
+class Simulator(object):
+    def __init__(self, args):
+        self.args = args
+        self.stats = Stats()
+        self.selector = selectors.DefaultSelector()
+        self.timers = []
+        self.timer_seq = 0
+        self.stopping = False
+        self.names = load_message_names(args.srcdir)
+        info = socket.getaddrinfo(args.host, args.port, 0, socket.SOCK_STREAM)[0]
+        self.family, self.address = info[0], info[4]
+        self.scenarios = set(args.scenario.split(","))
+        self.phones = make_phones(self, args)
+
+    def log(self, level, text):
+        if self.args.verbose >= level:
+            sys.stderr.write("%.3f %s\n" % (time.time() - self.stats.start, text))
+
+    def schedule(self, delay, callback):
+        self.timer_seq += 1
+        heapq.heappush(self.timers, (time.time() + delay, self.timer_seq, callback))
+
+    def phone_registered(self, phone):
+        if self.args.scenario_delay:
+            self.schedule(self.args.scenario_delay, phone.start_scenarios)
+        else:
+            phone.start_scenarios()
+
+    def progress(self):
+        states = {}
+        for phone in self.phones:
+            states[phone.state] = states.get(phone.state, 0) + 1
+        self.log(0, "%s | calls placed %d, connected %d | errors %d" % (", ".join("%s %d" % item for item in sorted(states.items())), self.stats.counters.get("calls placed", 0), self.stats.counters.get("calls connected", 0), sum(self.stats.errors.values())))
+        if not self.stopping:
+            self.schedule(self.args.report_interval, self.progress)
+
+    def stop(self):
+        self.stopping = True
+        for phone in self.phones:
+            for call in list(phone.calls.values()):
+                phone.hangup(call)
+        self.schedule(1.0, self.unregister_all)
+
+    def unregister_all(self):
+        for phone in self.phones:
+            phone.unregister()
+        self.deadline = time.time() + self.args.timeout
+
+    def run(self):
+        self.deadline = None
+        interval = 1.0 / self.args.rate if self.args.rate > 0 else 0
+        for i, phone in enumerate(self.phones):
+            self.schedule(i * interval, phone.connect)
+        if self.args.report_interval:
+            self.schedule(self.args.report_interval, self.progress)
+        self.schedule(len(self.phones) * interval + self.args.duration, self.stop)
+        last_check = time.time()
+        try:
+            while True:
+                now = time.time()
+                if self.deadline is not None and (now > self.deadline or all(p.sock is None for p in self.phones)):
+                    break
+                timeout = 0.1
+                if self.timers:
+                    timeout = max(0, min(timeout, self.timers[0][0] - now))
+                for key, events in self.selector.select(timeout):
+                    phone = key.data
+                    if events & selectors.EVENT_READ and phone.sock is not None:
+                        phone.on_readable()
+                    if events & selectors.EVENT_WRITE and phone.sock is not None:
+                        phone.on_writable()
+                now = time.time()
+                while self.timers and self.timers[0][0] <= now:
+                    _when, _seq, callback = heapq.heappop(self.timers)
+                    callback()
+                if now - last_check >= 0.5:
+                    last_check = now
+                    for phone in self.phones:
+                        if phone.sock is not None:
+                            phone.check_timeouts(now)
+        except KeyboardInterrupt:
+            self.log(0, "interrupted")
+        for phone in self.phones:
+            phone.close()
+
+
+def make_phones(sim, args):
+    types = load_device_types(args.srcdir)
+    devicetypes = [device_type(t, types) for t in args.type.split(",")]
+    protocols = [int(p) for p in args.protocol.split(",")]
+    phones = []
+    for i in range(args.devices):
+        name = "%s%012X" % (args.prefix, args.mac + i)
+        phones.append(Phone(sim, i, name, devicetypes[i % len(devicetypes)], protocols[i % len(protocols)], str(args.first_extension + i), None))
+    for i in range(0, len(phones) - 1, 2):
+        phones[i].partner = phones[i + 1]
+    return phones
+
+
+def print_config(args):
+    '''sccp.conf device and line sections for the simulated phones'''
+    types = load_device_types(args.srcdir)
+    typenames = args.type.split(",")
+    for i in range(args.devices):
+        name = "%s%012X" % (args.prefix, args.mac + i)
+        extension = args.first_extension + i
+        partner = extension + 1 if i % 2 == 0 else extension - 1
+        typename = typenames[i % len(typenames)]
+        device_type(typename, types)
+        print("[%s]" % name)
+        print("type = device")
+        print("devicetype = %s" % typename)
+        print("description = Simulated phone %d" % i)
+        print("button = line, %d, default" % extension)
+        if i + 1 < args.devices or i % 2:
+            print("button = speeddial, Sim %d, %d, %d@%s" % (partner, partner, partner, args.context))
+        print("deny = 0.0.0.0/0.0.0.0")
+        print("permit = 127.0.0.0/255.0.0.0")
+        print("")
+        print("[%d]" % extension)
+        print("type = line")
+        print("id = %d" % extension)
+        print("label = Sim %d" % extension)
+        print("cid_num = %d" % extension)
+        print("cid_name = Sim %d" % extension)
+        print("context = %s" % args.context)
+        print("incominglimit = 2")
+        print("")
+
+
+def print_dialplan(args):
+    '''extensions.conf context routing the simulated extensions (with hints for blf)'''
+    print("[%s]" % args.context)
+    for i in range(args.devices):
+        extension = args.first_extension + i
+        print("exten => %d,hint,SCCP/%d" % (extension, extension))
+        print("exten => %d,1,Dial(SCCP/%d,30)" % (extension, extension))
+        print(" same => n,Hangup()")
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description="Synthetic SCCP phone simulator and load generator for chan-sccp", formatter_class=argparse.ArgumentDefaultsHelpFormatter)
+    parser.add_argument("--host", default="127.0.0.1", help="chan-sccp (or stub pbx: sccp_mock_bench -L) address")
+    parser.add_argument("--port", type=int, default=2000, help="sccp port")
+    parser.add_argument("--devices", type=int, default=10, help="number of simulated phones")
+    parser.add_argument("--type", default="7962", help="device type(s), model or number, comma separated list is used round robin")
+    parser.add_argument("--protocol", default="17", help="skinny protocol version(s) announced at registration, comma separated list is used round robin")
+    parser.add_argument("--prefix", default="SEP", help="device name prefix")
+    parser.add_argument("--mac", type=lambda v: int(v, 16), default=0x5CC900000000, help="mac address (hex) of the first phone")
+    parser.add_argument("--first-extension", type=int, default=9000, help="line / extension of the first phone")
+    parser.add_argument("--rate", type=float, default=10.0, help="new registrations per second (0: all at once)")
+    parser.add_argument("--duration", type=float, default=30.0, help="seconds to run after the last phone started registering")
+    parser.add_argument("--scenario", default="idle", help="idle, calls, softkeys, blf (comma separated)")
+    parser.add_argument("--scenario-delay", type=float, default=1.0, help="seconds between registration and starting the scenarios")
+    parser.add_argument("--call-interval", type=float, default=10.0, help="average seconds between calls per calling phone")
+    parser.add_argument("--hold-time", type=float, default=5.0, help="average call duration in seconds")
+    parser.add_argument("--answer-delay", type=float, default=0.5, help="seconds a called phone rings before answering")
+    parser.add_argument("--keepalive", type=int, default=0, help="keepalive interval in seconds (0: use the interval from the RegisterAck)")
+    parser.add_argument("--timeout", type=float, default=10.0, help="seconds to wait for a response before counting an error")
+    parser.add_argument("--report-interval", type=float, default=5.0, help="seconds between progress lines (0: off)")
+    parser.add_argument("--json", metavar="FILE", help="also write the results as json to FILE")
+    parser.add_argument("--context", default="sccp-sim", help="dialplan context for --print-config / --print-dialplan")
+    parser.add_argument("--print-config", action="store_true", help="print sccp.conf sections for the simulated phones and exit")
+    parser.add_argument("--print-dialplan", action="store_true", help="print an extensions.conf context for the simulated phones and exit")
+    parser.add_argument("--srcdir", default=SRCDIR, help=argparse.SUPPRESS)
+    parser.add_argument("--seed", type=int, help="random seed (reproducible call timing)")
+    parser.add_argument("-v", "--verbose", action="count", default=0)
+    args = parser.parse_args(argv[1:])
+
+    if args.seed is not None:
+        random.seed(args.seed)
+    try:
+        if args.print_config:
+            print_config(args)
+            return 0
+        if args.print_dialplan:
+            print_dialplan(args)
+            return 0
+        sim = Simulator(args)
+    except (ValueError, socket.gaierror) as e:
+        sys.stderr.write("%s\n" % e)
+        return 2
+
+    sim.run()
+    print(sim.stats.report(sim.names))
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(sim.stats.as_dict(), f, indent=2, sort_keys=True)
+    return 1 if sim.stats.counters.get("registered", 0) < args.devices else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
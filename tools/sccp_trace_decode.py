@@ -0,0 +1,130 @@
+#! /usr/bin/env python
+'''
+Decode a chan-sccp binary trace dump ('sccp trace dump <filename>')
+
+Usage: sccp_trace_decode.py <filename> [--category <key>] [--event <name>] [--object <hex>]
+
+This program is free software, distributed under the terms of
+the GNU General Public License Version 2.
+
+File layout (little/native endian, as written by sccp_trace_dump in src/sccp_trace.c):
+    char     magic[8]            "SCCPTRC1"
+    uint32   version, record_size, num_events, num_categories, num_messages, num_records
+    num_events     x  char name[]                 (NUL terminated, index = event number)
+    num_categories x  uint32 category, char key[]
+    num_messages   x  uint32 messageid, char text[]
+    num_records    x  record (record_size bytes)
+record:
+    uint64 timestamp (ns), uint64 object, uint32 seq, uint32 tid, uint32 category,
+    uint16 event, uint16 reserved, uint32 arg[3], uint32 reserved2
+'''
+
+import struct
+import sys
+import time
+
+MAGIC = b"SCCPTRC1"
+HEADER = struct.Struct("=6I")
+RECORD = struct.Struct("=QQIIIHH3II")
+
+
+class TraceFile(object):
+    def __init__(self, data):
+        if data[:8] != MAGIC:
+            raise ValueError("not an sccp trace dump (bad magic)")
+        (self.version, self.record_size, num_events, num_categories,
+         num_messages, num_records) = HEADER.unpack_from(data, 8)
+        if self.version != 1:
+            raise ValueError("unsupported trace dump version %d" % self.version)
+        if self.record_size < RECORD.size:
+            raise ValueError("record size %d too small" % self.record_size)
+        self.offset = 8 + HEADER.size
+        self.data = data
+        self.events = [self._string() for _ in range(num_events)]
+        self.categories = []
+        for _ in range(num_categories):
+            value = self._uint32()
+            self.categories.append((value, self._string()))
+        self.messages = {}
+        for _ in range(num_messages):
+            value = self._uint32()
+            self.messages[value] = self._string()
+        self.num_records = num_records
+
+    def _uint32(self):
+        (value,) = struct.unpack_from("=I", self.data, self.offset)
+        self.offset += 4
+        return value
+
+    def _string(self):
+        end = self.data.index(b"\0", self.offset)
+        value = self.data[self.offset:end].decode("ascii", "replace")
+        self.offset = end + 1
+        return value
+
+    def category2str(self, category):
+        for value, key in self.categories:
+            if value == category:
+                return key
+        for value, key in self.categories:
+            if value and (value & category) == value:
+                return key
+        return "%x" % category
+
+    def event2str(self, event):
+        if event < len(self.events) and self.events[event]:
+            return self.events[event]
+        return "unknown(%d)" % event
+
+    def records(self):
+        offset = self.offset
+        for _ in range(self.num_records):
+            if offset + self.record_size > len(self.data):
+                sys.stderr.write("truncated dump, stopping\n")
+                return
+            yield RECORD.unpack_from(self.data, offset)
+            offset += self.record_size
+
+    def details(self, event, args):
+        name = self.event2str(event)
+        if name in ("msg_rx", "msg_tx"):
+            return "%s (0x%04X) len:%d" % (self.messages.get(args[0], "unknown"), args[0], args[1])
+        if name in ("device_regstate", "channel_state"):
+            return "%d <- %d" % (args[0], args[1])
+        if name in ("ref_alloc", "ref_retain", "ref_release"):
+            return "type:%d refcount:%d line:%d" % (args[0], args[1], args[2])
+        if name == "ref_error":
+            return "delta:%d line:%d" % (struct.unpack("=i", struct.pack("=I", args[0]))[0], args[2])
+        return "%d %d %d" % tuple(args)
+
+
+def main(argv):
+    if len(argv) < 2:
+        sys.stderr.write(__doc__)
+        return 1
+    filters = {}
+    i = 2
+    while i + 1 < len(argv):
+        filters[argv[i].lstrip("-")] = argv[i + 1]
+        i += 2
+
+    with open(argv[1], "rb") as f:
+        trace = TraceFile(f.read())
+
+    for (timestamp, obj, _seq, tid, category, event, _reserved, a0, a1, a2, _reserved2) in trace.records():
+        catname = trace.category2str(category)
+        evname = trace.event2str(event)
+        if "category" in filters and filters["category"] != catname:
+            continue
+        if "event" in filters and filters["event"] != evname:
+            continue
+        if "object" in filters and int(filters["object"], 16) != obj:
+            continue
+        secs = timestamp // 1000000000
+        stamp = time.strftime("%Y-%m-%d %H:%M:%S", time.localtime(secs))
+        print("%s.%09d %-7d %-10s %-15s 0x%-16x %s" % (stamp, timestamp % 1000000000, tid, catname, evname, obj, trace.details(event, (a0, a1, a2))))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))